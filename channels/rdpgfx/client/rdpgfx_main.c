@@ -38,6 +38,7 @@
 #include <winpr/collections.h>
 
 #include <freerdp/addin.h>
+#include <freerdp/cache/persistent.h>
 #include <freerdp/channels/log.h>
 
 #include "rdpgfx_common.h"
@@ -141,6 +142,157 @@ static UINT rdpgfx_send_caps_advertise_pdu(RDPGFX_CHANNEL_CALLBACK* callback)
 	return error;
 }
 
+/**
+ * Function description
+ *
+ * @return the persistent cache store, or NULL if persistence is disabled
+ */
+static rdpPersistentCache* rdpgfx_open_persistent_cache(RDPGFX_PLUGIN* gfx)
+{
+	size_t length;
+	char* filename = NULL;
+	rdpSettings* settings = gfx->settings;
+
+	/* capability negotiation enables persistence, only a cache file is an opt-in */
+	if (!settings->BitmapCachePersistEnabled || !settings->BitmapCachePersistFile)
+		return NULL;
+
+	if (!gfx->persistent)
+		gfx->persistent = persistent_cache_new();
+
+	if (!gfx->persistent || persistent_cache_is_open(gfx->persistent))
+		return gfx->persistent;
+
+	/* the bitmap cache holds a lock on its own file, use a sibling file */
+	length = strlen(settings->BitmapCachePersistFile) + 5;
+	filename = (char*) malloc(length);
+
+	if (filename)
+		sprintf_s(filename, length, "%s.gfx", settings->BitmapCachePersistFile);
+
+	if (filename)
+		persistent_cache_open(gfx->persistent, filename, settings->BitmapCachePersistMaxSize);
+
+	free(filename);
+	return gfx->persistent;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_send_cache_import_offer_pdu(RDPGFX_CHANNEL_CALLBACK* callback)
+{
+	UINT error;
+	wStream* s;
+	UINT32 index;
+	UINT32 count = 0;
+	const UINT64* keys;
+	RDPGFX_HEADER header;
+	PERSISTENT_CACHE_ENTRY entry;
+	BITMAP_CACHE_V2_CELL_INFO cellInfo;
+	RDPGFX_CACHE_IMPORT_OFFER_PDU pdu;
+	RDPGFX_CACHE_ENTRY_METADATA* cacheEntries;
+	RDPGFX_PLUGIN* gfx = (RDPGFX_PLUGIN*) callback->plugin;
+	RdpgfxClientContext* context = (RdpgfxClientContext*) gfx->iface.pInterface;
+	rdpPersistentCache* persistent = rdpgfx_open_persistent_cache(gfx);
+	gfx->CacheImportOfferCount = 0;
+
+	if (!persistent_cache_is_open(persistent))
+		return CHANNEL_RC_OK;
+
+	/* slot 0 is never used by an import reply */
+	cellInfo.numEntries = MIN(RDPGFX_CACHE_ENTRY_MAX_COUNT, gfx->MaxCacheSlot - 1);
+	cellInfo.persistent = TRUE;
+	persistent_cache_snapshot_keys(persistent, &cellInfo, 1);
+	keys = persistent_cache_get_snapshot(persistent, 0, &count);
+
+	if (count < 1)
+		return CHANNEL_RC_OK;
+
+	cacheEntries = (RDPGFX_CACHE_ENTRY_METADATA*) calloc(count,
+	               sizeof(RDPGFX_CACHE_ENTRY_METADATA));
+
+	if (!cacheEntries)
+	{
+		WLog_ERR(TAG, "calloc failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	pdu.cacheEntries = cacheEntries;
+	pdu.cacheEntriesCount = (UINT16) count;
+
+	/* walk from the least recently used key so the store keeps its order */
+	for (index = count; index > 0; index--)
+	{
+		if (!persistent_cache_read_entry(persistent, keys[index - 1], &entry))
+			break;
+
+		cacheEntries[index - 1].cacheKey = entry.key64;
+		cacheEntries[index - 1].bitmapLength = entry.size;
+	}
+
+	if (index > 0)
+	{
+		WLog_ERR(TAG, "persistent cache changed while building the offer");
+		free(cacheEntries);
+		return CHANNEL_RC_OK;
+	}
+
+	header.flags = 0;
+	header.cmdId = RDPGFX_CMDID_CACHEIMPORTOFFER;
+	header.pduLength = RDPGFX_HEADER_SIZE + 2 + (pdu.cacheEntriesCount * 12);
+	WLog_DBG(TAG, "SendCacheImportOfferPdu: cacheEntriesCount: %d",
+	         pdu.cacheEntriesCount);
+	s = Stream_New(NULL, header.pduLength);
+
+	if (!s)
+	{
+		WLog_ERR(TAG, "Stream_New failed!");
+		free(cacheEntries);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if ((error = rdpgfx_write_header(s, &header)))
+	{
+		WLog_ERR(TAG, "rdpgfx_write_header failed with error %u!", error);
+		Stream_Free(s, TRUE);
+		free(cacheEntries);
+		return error;
+	}
+
+	/* RDPGFX_CACHE_IMPORT_OFFER_PDU */
+	Stream_Write_UINT16(s, pdu.cacheEntriesCount); /* cacheEntriesCount (2 bytes) */
+
+	for (index = 0; index < pdu.cacheEntriesCount; index++)
+	{
+		Stream_Write_UINT64(s, cacheEntries[index].cacheKey); /* cacheKey (8 bytes) */
+		Stream_Write_UINT32(s, cacheEntries[index].bitmapLength); /* bitmapLength (4 bytes) */
+	}
+
+	Stream_SealLength(s);
+	error = callback->channel->Write(callback->channel, (UINT32) Stream_Length(s),
+	                                 Stream_Buffer(s), NULL);
+	Stream_Free(s, TRUE);
+
+	if (!error)
+	{
+		gfx->CacheImportOfferCount = pdu.cacheEntriesCount;
+
+		if (context)
+		{
+			IFCALLRET(context->CacheImportOffer, error, context, &pdu);
+
+			if (error)
+				WLog_ERR(TAG, "context->CacheImportOffer failed with error %u", error);
+		}
+	}
+
+	free(cacheEntries);
+	return error;
+}
+
 /**
  * Function description
  *
@@ -165,7 +317,7 @@ static UINT rdpgfx_recv_caps_confirm_pdu(RDPGFX_CHANNEL_CALLBACK* callback,
 	Stream_Read_UINT32(s, capsSet.flags); /* capsData (4 bytes) */
 	WLog_DBG(TAG, "RecvCapsConfirmPdu: version: 0x%04X flags: 0x%04X",
 	         capsSet.version, capsSet.flags);
-	return CHANNEL_RC_OK;
+	return rdpgfx_send_cache_import_offer_pdu(callback);
 }
 
 /**
@@ -306,6 +458,9 @@ static UINT rdpgfx_recv_evict_cache_entry_pdu(RDPGFX_CHANNEL_CALLBACK* callback,
 	Stream_Read_UINT16(s, pdu.cacheSlot); /* cacheSlot (2 bytes) */
 	WLog_DBG(TAG, "RecvEvictCacheEntryPdu: cacheSlot: %d", pdu.cacheSlot);
 
+	if (pdu.cacheSlot < gfx->MaxCacheSlot)
+		gfx->CacheSlotKeys[pdu.cacheSlot] = 0;
+
 	if (context)
 	{
 		IFCALLRET(context->EvictCacheEntry, error, context, &pdu);
@@ -317,6 +472,60 @@ static UINT rdpgfx_recv_evict_cache_entry_pdu(RDPGFX_CHANNEL_CALLBACK* callback,
 	return error;
 }
 
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_load_cache_import_reply(RDPGFX_PLUGIN* gfx,
+        const RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu)
+{
+	UINT16 index;
+	UINT16 cacheSlot;
+	UINT32 count = 0;
+	const UINT64* keys;
+	PERSISTENT_CACHE_ENTRY entry;
+	RdpgfxClientContext* context = (RdpgfxClientContext*) gfx->iface.pInterface;
+	UINT error = CHANNEL_RC_OK;
+
+	if (pdu->importedEntriesCount > gfx->CacheImportOfferCount)
+	{
+		WLog_ERR(TAG, "import reply for %d entries, only %d were offered",
+		         pdu->importedEntriesCount, gfx->CacheImportOfferCount);
+		return ERROR_INVALID_DATA;
+	}
+
+	keys = persistent_cache_get_snapshot(gfx->persistent, 0, &count);
+
+	if (!context || !context->CacheImportEntry || (count < pdu->importedEntriesCount))
+		return CHANNEL_RC_OK;
+
+	/* reply entries map one to one onto the offered keys, slot 0 is not imported */
+	for (index = 0; index < pdu->importedEntriesCount; index++)
+	{
+		cacheSlot = pdu->cacheSlots[index];
+
+		if ((cacheSlot == 0) || (cacheSlot >= gfx->MaxCacheSlot))
+			continue;
+
+		if (!persistent_cache_read_entry(gfx->persistent, keys[index], &entry))
+		{
+			WLog_WARN(TAG, "persistent cache entry for slot %d is gone", cacheSlot);
+			continue;
+		}
+
+		if ((error = context->CacheImportEntry(context, cacheSlot, &entry)))
+		{
+			WLog_ERR(TAG, "context->CacheImportEntry failed with error %u", error);
+			return error;
+		}
+
+		gfx->CacheSlotKeys[cacheSlot] = entry.key64;
+	}
+
+	return error;
+}
+
 /**
  * Function description
  *
@@ -361,6 +570,13 @@ static UINT rdpgfx_recv_cache_import_reply_pdu(RDPGFX_CHANNEL_CALLBACK* callback
 	WLog_DBG(TAG, "RecvCacheImportReplyPdu: importedEntriesCount: %d",
 	         pdu.importedEntriesCount);
 
+	if ((error = rdpgfx_load_cache_import_reply(gfx, &pdu)))
+	{
+		WLog_ERR(TAG, "rdpgfx_load_cache_import_reply failed with error %u", error);
+		free(pdu.cacheSlots);
+		return error;
+	}
+
 	if (context)
 	{
 		IFCALLRET(context->CacheImportReply, error, context, &pdu);
@@ -857,6 +1073,33 @@ static UINT rdpgfx_recv_surface_to_surface_pdu(RDPGFX_CHANNEL_CALLBACK*
 	return error;
 }
 
+/**
+ * Writes a freshly cached bitmap through to the persistent store.
+ */
+static void rdpgfx_save_cache_entry(RDPGFX_PLUGIN* gfx, UINT16 cacheSlot, UINT64 cacheKey)
+{
+	PERSISTENT_CACHE_ENTRY entry;
+	RdpgfxClientContext* context = (RdpgfxClientContext*) gfx->iface.pInterface;
+
+	if (cacheSlot >= gfx->MaxCacheSlot)
+		return;
+
+	gfx->CacheSlotKeys[cacheSlot] = cacheKey;
+
+	if (!persistent_cache_is_open(gfx->persistent) || !context->ExportCacheEntry)
+		return;
+
+	ZeroMemory(&entry, sizeof(entry));
+
+	if (context->ExportCacheEntry(context, cacheSlot, &entry) != CHANNEL_RC_OK)
+		return;
+
+	entry.key64 = cacheKey;
+	entry.cellId = 0;
+	/* entries larger than the biggest size class are silently skipped */
+	persistent_cache_write_entry(gfx->persistent, &entry);
+}
+
 /**
  * Function description
  *
@@ -899,6 +1142,8 @@ static UINT rdpgfx_recv_surface_to_cache_pdu(RDPGFX_CHANNEL_CALLBACK* callback,
 
 		if (error)
 			WLog_ERR(TAG, "context->SurfaceToCache failed with error %u", error);
+		else
+			rdpgfx_save_cache_entry(gfx, pdu.cacheSlot, pdu.cacheKey);
 	}
 
 	return error;
@@ -1321,6 +1566,8 @@ static UINT rdpgfx_on_close(IWTSVirtualChannelCallback* pChannelCallback)
 
 			gfx->CacheSlots[index] = NULL;
 		}
+
+		gfx->CacheSlotKeys[index] = 0;
 	}
 
 	return CHANNEL_RC_OK;
@@ -1463,8 +1710,11 @@ static UINT rdpgfx_plugin_terminated(IWTSPlugin* pPlugin)
 
 			gfx->CacheSlots[index] = NULL;
 		}
+
+		gfx->CacheSlotKeys[index] = 0;
 	}
 
+	persistent_cache_free(gfx->persistent);
 	free(context);
 	free(gfx);
 	return CHANNEL_RC_OK;
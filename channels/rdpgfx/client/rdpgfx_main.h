@@ -77,6 +77,10 @@ struct _RDPGFX_PLUGIN
 
 	UINT16 MaxCacheSlot;
 	void* CacheSlots[25600];
+	UINT64 CacheSlotKeys[25600];
+
+	rdpPersistentCache* persistent;
+	UINT16 CacheImportOfferCount;
 	rdpContext* rdpcontext;
 };
 typedef struct _RDPGFX_PLUGIN RDPGFX_PLUGIN;
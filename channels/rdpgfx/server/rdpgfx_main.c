@@ -101,12 +101,12 @@ static UINT rdpgfx_server_packet_send(RdpgfxServerContext* context, wStream* s)
 	/* Allocate new stream with enough capacity. Additional overhead is
 	 * descriptor (1 bytes) + segmentCount (2 bytes) + uncompressedSize (4 bytes)
 	 * + segmentCount * size (4 bytes) */
-	fs = Stream_New(NULL, SrcSize + 7
-	                + (SrcSize / ZGFX_SEGMENTED_MAXSIZE + 1) * 4);
+	fs = StreamPool_Take(context->priv->SendPool, SrcSize + 7
+	                     + (SrcSize / ZGFX_SEGMENTED_MAXSIZE + 1) * 4);
 
 	if (!fs)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
+		WLog_ERR(TAG, "StreamPool_Take failed!");
 		error = CHANNEL_RC_NO_MEMORY;
 		goto out;
 	}
@@ -136,8 +136,11 @@ static UINT rdpgfx_server_packet_send(RdpgfxServerContext* context, wStream* s)
 
 	error = CHANNEL_RC_OK;
 out:
-	Stream_Free(fs, TRUE);
-	Stream_Free(s, TRUE);
+
+	if (fs)
+		Stream_Release(fs);
+
+	Stream_Release(s);
 	return error;
 }
 
@@ -153,29 +156,28 @@ out:
  *
  * @return new stream
  */
-static wStream* rdpgfx_server_single_packet_new(UINT16 cmdId, UINT32 dataLen)
+static wStream* rdpgfx_server_single_packet_new(RdpgfxServerContext* context,
+        UINT16 cmdId, UINT32 dataLen)
 {
 	UINT error;
 	wStream* s;
 	UINT32 pduLength = rdpgfx_pdu_length(dataLen);
-	s = Stream_New(NULL, pduLength);
+	s = StreamPool_Take(context->priv->SendPool, pduLength);
 
 	if (!s)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		goto error;
+		WLog_ERR(TAG, "StreamPool_Take failed!");
+		return NULL;
 	}
 
 	if ((error = rdpgfx_server_packet_init_header(s, cmdId, pduLength)))
 	{
 		WLog_ERR(TAG, "Failed to init header with error %u!", error);
-		goto error;
+		Stream_Release(s);
+		return NULL;
 	}
 
 	return s;
-error:
-	Stream_Free(s, TRUE);
-	return NULL;
 }
 
 /**
@@ -194,6 +196,49 @@ static INLINE UINT rdpgfx_server_single_packet_send(
 	return rdpgfx_server_packet_send(context, s);
 }
 
+static UINT32 rdpgfx_server_cache_key_hash(void* key)
+{
+	UINT64 key64 = *((UINT64*) key);
+	return (UINT32)(key64 ^ (key64 >> 32));
+}
+
+static BOOL rdpgfx_server_cache_key_compare(void* key1, void* key2)
+{
+	return (*((UINT64*) key1) == *((UINT64*) key2)) ? TRUE : FALSE;
+}
+
+/**
+ * Records which cache key the client holds in a cache slot.
+ * A key of 0 marks the slot as free. The caller holds cacheLock.
+ */
+static void rdpgfx_server_cache_set_slot(RdpgfxServerPrivate* priv,
+        UINT16 cacheSlot, UINT64 cacheKey)
+{
+	UINT64* slotKey;
+	const ULONG_PTR value = ((ULONG_PTR) cacheSlot) + 1;
+
+	if (cacheSlot >= RDPGFX_SERVER_MAX_CACHE_SLOTS)
+		return;
+
+	slotKey = &priv->CacheSlotKeys[cacheSlot];
+
+	if (*slotKey && ((ULONG_PTR) HashTable_GetItemValue(priv->CacheIndex, slotKey) == value))
+		HashTable_Remove(priv->CacheIndex, slotKey);
+
+	*slotKey = cacheKey;
+
+	if (cacheKey && !HashTable_Contains(priv->CacheIndex, slotKey))
+		HashTable_Add(priv->CacheIndex, slotKey, (void*) value);
+}
+
+static void rdpgfx_server_cache_reset(RdpgfxServerPrivate* priv)
+{
+	EnterCriticalSection(&priv->cacheLock);
+	HashTable_Clear(priv->CacheIndex);
+	ZeroMemory(priv->CacheSlotKeys, sizeof(priv->CacheSlotKeys));
+	LeaveCriticalSection(&priv->cacheLock);
+}
+
 /**
  * Function description
  *
@@ -203,7 +248,7 @@ static UINT rdpgfx_send_caps_confirm_pdu(RdpgfxServerContext* context,
         RDPGFX_CAPS_CONFIRM_PDU* capsConfirm)
 {
 	RDPGFX_CAPSET* capsSet = capsConfirm->capsSet;
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_CAPSCONFIRM, RDPGFX_CAPSET_SIZE);
 
 	if (!s)
@@ -215,6 +260,8 @@ static UINT rdpgfx_send_caps_confirm_pdu(RdpgfxServerContext* context,
 	Stream_Write_UINT32(s, capsSet->version); /* version (4 bytes) */
 	Stream_Write_UINT32(s, 4); /* capsDataLength (4 bytes) */
 	Stream_Write_UINT32(s, capsSet->flags); /* capsData (4 bytes) */
+	context->priv->MaxCacheSlots = (capsSet->flags & (RDPGFX_CAPS_FLAG_THINCLIENT |
+	                                RDPGFX_CAPS_FLAG_SMALL_CACHE)) ? 4096 : RDPGFX_SERVER_MAX_CACHE_SLOTS;
 	return rdpgfx_server_single_packet_send(context, s);
 }
 
@@ -238,7 +285,7 @@ static UINT rdpgfx_send_reset_graphics_pdu(RdpgfxServerContext* context,
 		return ERROR_INVALID_DATA;
 	}
 
-	s = rdpgfx_server_single_packet_new(
+	s = rdpgfx_server_single_packet_new(context,
 	        RDPGFX_CMDID_RESETGRAPHICS,
 	        RDPGFX_RESET_GRAPHICS_PDU_SIZE - RDPGFX_HEADER_SIZE);
 
@@ -275,7 +322,7 @@ static UINT rdpgfx_send_reset_graphics_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_evict_cache_entry_pdu(RdpgfxServerContext* context,
         RDPGFX_EVICT_CACHE_ENTRY_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_EVICTCACHEENTRY, 2);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_EVICTCACHEENTRY, 2);
 
 	if (!s)
 	{
@@ -284,6 +331,9 @@ static UINT rdpgfx_send_evict_cache_entry_pdu(RdpgfxServerContext* context,
 	}
 
 	Stream_Write_UINT16(s, pdu->cacheSlot); /* cacheSlot (2 bytes) */
+	EnterCriticalSection(&context->priv->cacheLock);
+	rdpgfx_server_cache_set_slot(context->priv, pdu->cacheSlot, 0);
+	LeaveCriticalSection(&context->priv->cacheLock);
 	return rdpgfx_server_single_packet_send(context, s);
 }
 
@@ -296,7 +346,7 @@ static UINT rdpgfx_send_cache_import_reply_pdu(RdpgfxServerContext* context,
         RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu)
 {
 	UINT16 index;
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_CACHEIMPORTREPLY,
 	                 2 + 2 * pdu->importedEntriesCount);
 
@@ -325,7 +375,7 @@ static UINT rdpgfx_send_cache_import_reply_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_create_surface_pdu(RdpgfxServerContext* context,
         RDPGFX_CREATE_SURFACE_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_CREATESURFACE, 7);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_CREATESURFACE, 7);
 
 	if (!s)
 	{
@@ -348,7 +398,7 @@ static UINT rdpgfx_send_create_surface_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_delete_surface_pdu(RdpgfxServerContext* context,
         RDPGFX_DELETE_SURFACE_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_DELETESURFACE, 2);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_DELETESURFACE, 2);
 
 	if (!s)
 	{
@@ -381,7 +431,7 @@ static INLINE void rdpgfx_write_end_frame_pdu(wStream* s,
 static UINT rdpgfx_send_start_frame_pdu(RdpgfxServerContext* context,
                                         RDPGFX_START_FRAME_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_STARTFRAME,
 	                 RDPGFX_START_FRAME_PDU_SIZE);
 
@@ -403,7 +453,7 @@ static UINT rdpgfx_send_start_frame_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_end_frame_pdu(RdpgfxServerContext* context,
                                       RDPGFX_END_FRAME_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_ENDFRAME,
 	                 RDPGFX_END_FRAME_PDU_SIZE);
 
@@ -679,7 +729,7 @@ static UINT rdpgfx_send_surface_command(RdpgfxServerContext* context,
 {
 	UINT error = CHANNEL_RC_OK;
 	wStream* s;
-	s = rdpgfx_server_single_packet_new(
+	s = rdpgfx_server_single_packet_new(context,
 	        rdpgfx_surface_command_cmdid(cmd),
 	        rdpgfx_estimate_surface_command(cmd));
 
@@ -699,7 +749,7 @@ static UINT rdpgfx_send_surface_command(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -731,11 +781,11 @@ static UINT rdpgfx_send_surface_frame_command(RdpgfxServerContext* context,
 		size += rdpgfx_pdu_length(RDPGFX_END_FRAME_PDU_SIZE);
 	}
 
-	s = Stream_New(NULL, size);
+	s = StreamPool_Take(context->priv->SendPool, size);
 
 	if (!s)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
+		WLog_ERR(TAG, "StreamPool_Take failed!");
 		return CHANNEL_RC_NO_MEMORY;
 	}
 
@@ -797,7 +847,7 @@ static UINT rdpgfx_send_surface_frame_command(RdpgfxServerContext* context,
 
 	return rdpgfx_server_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -810,7 +860,7 @@ static UINT rdpgfx_send_delete_encoding_context_pdu(RdpgfxServerContext*
         context,
         RDPGFX_DELETE_ENCODING_CONTEXT_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_DELETEENCODINGCONTEXT, 6);
 
 	if (!s)
@@ -835,7 +885,7 @@ static UINT rdpgfx_send_solid_fill_pdu(RdpgfxServerContext* context,
 	UINT error = CHANNEL_RC_OK;
 	UINT16 index;
 	RECTANGLE_16* fillRect;
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_SOLIDFILL,
 	                 8 + 8 * pdu->fillRectCount);
 
@@ -869,7 +919,7 @@ static UINT rdpgfx_send_solid_fill_pdu(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -884,7 +934,7 @@ static UINT rdpgfx_send_surface_to_surface_pdu(RdpgfxServerContext* context,
 	UINT error = CHANNEL_RC_OK;
 	UINT16 index;
 	RDPGFX_POINT16* destPt;
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_SURFACETOSURFACE,
 	                 14 + 4 * pdu->destPtsCount);
 
@@ -919,7 +969,7 @@ static UINT rdpgfx_send_surface_to_surface_pdu(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -932,7 +982,7 @@ static UINT rdpgfx_send_surface_to_cache_pdu(RdpgfxServerContext* context,
         RDPGFX_SURFACE_TO_CACHE_PDU* pdu)
 {
 	UINT error = CHANNEL_RC_OK;
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_SURFACETOCACHE, 20);
 
 	if (!s)
@@ -952,9 +1002,12 @@ static UINT rdpgfx_send_surface_to_cache_pdu(RdpgfxServerContext* context,
 		goto error;
 	}
 
+	EnterCriticalSection(&context->priv->cacheLock);
+	rdpgfx_server_cache_set_slot(context->priv, pdu->cacheSlot, pdu->cacheKey);
+	LeaveCriticalSection(&context->priv->cacheLock);
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -969,7 +1022,7 @@ static UINT rdpgfx_send_cache_to_surface_pdu(RdpgfxServerContext* context,
 	UINT error = CHANNEL_RC_OK;
 	UINT16 index;
 	RDPGFX_POINT16* destPt;
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_CACHETOSURFACE,
 	                 6 + 4 * pdu->destPtsCount);
 
@@ -996,7 +1049,7 @@ static UINT rdpgfx_send_cache_to_surface_pdu(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -1008,7 +1061,7 @@ error:
 static UINT rdpgfx_send_map_surface_to_output_pdu(RdpgfxServerContext* context,
         RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_MAPSURFACETOOUTPUT, 12);
 
 	if (!s)
@@ -1032,7 +1085,7 @@ static UINT rdpgfx_send_map_surface_to_output_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_map_surface_to_window_pdu(RdpgfxServerContext* context,
         RDPGFX_MAP_SURFACE_TO_WINDOW_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(
+	wStream* s = rdpgfx_server_single_packet_new(context,
 	                 RDPGFX_CMDID_MAPSURFACETOWINDOW, 18);
 
 	if (!s)
@@ -1082,6 +1135,54 @@ static UINT rdpgfx_recv_frame_acknowledge_pdu(RdpgfxServerContext* context,
 	return error;
 }
 
+/**
+ * Accepts the offered persistent cache entries into consecutive cache slots,
+ * records them in the cache index and sends the matching import reply.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_server_import_cache_entries(RdpgfxServerContext* context,
+        const RDPGFX_CACHE_IMPORT_OFFER_PDU* offer)
+{
+	UINT16 index;
+	UINT16 cacheSlot;
+	UINT error = CHANNEL_RC_OK;
+	RDPGFX_CACHE_IMPORT_REPLY_PDU reply;
+	RdpgfxServerPrivate* priv = context->priv;
+	reply.importedEntriesCount = MIN(offer->cacheEntriesCount, RDPGFX_CACHE_ENTRY_MAX_COUNT);
+	reply.cacheSlots = (UINT16*) calloc(reply.importedEntriesCount, sizeof(UINT16));
+
+	if (!reply.cacheSlots)
+	{
+		WLog_ERR(TAG, "calloc failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	rdpgfx_server_cache_reset(priv);
+	EnterCriticalSection(&priv->cacheLock);
+
+	/* slot 0 tells the client that an entry was not imported */
+	for (index = 0; index < reply.importedEntriesCount; index++)
+	{
+		cacheSlot = index + 1;
+
+		if (cacheSlot >= priv->MaxCacheSlots)
+			break;
+
+		rdpgfx_server_cache_set_slot(priv, cacheSlot, offer->cacheEntries[index].cacheKey);
+		reply.cacheSlots[index] = cacheSlot;
+	}
+
+	LeaveCriticalSection(&priv->cacheLock);
+	IFCALLRET(context->CacheImportReply, error, context, &reply);
+
+	if (error)
+		WLog_ERR(TAG, "context->CacheImportReply failed with error %u", error);
+
+	free(reply.cacheSlots);
+	return error;
+}
+
 /**
  * Function description
  *
@@ -1104,7 +1205,8 @@ static UINT rdpgfx_recv_cache_import_offer_pdu(RdpgfxServerContext* context,
 	/* cacheEntriesCount (2 bytes) */
 	Stream_Read_UINT16(s, pdu.cacheEntriesCount);
 
-	if (pdu.cacheEntriesCount <= 0)
+	if ((pdu.cacheEntriesCount <= 0) ||
+	    (pdu.cacheEntriesCount > RDPGFX_CACHE_ENTRY_MAX_COUNT))
 	{
 		/* According to the latest spec, capsSetCount <= 3 */
 		WLog_ERR(TAG, "Invalid cacheEntriesCount: %u", pdu.cacheEntriesCount);
@@ -1142,6 +1244,9 @@ static UINT rdpgfx_recv_cache_import_offer_pdu(RdpgfxServerContext* context,
 		if (error)
 			WLog_ERR(TAG, "context->CacheImportOffer failed with error %u",
 			         error);
+		else if ((error = rdpgfx_server_import_cache_entries(context, &pdu)))
+			WLog_ERR(TAG, "rdpgfx_server_import_cache_entries failed with error %u",
+			         error);
 	}
 
 	free(pdu.cacheEntries);
@@ -1497,6 +1602,7 @@ static BOOL rdpgfx_server_close(RdpgfxServerContext* context)
 	priv->channelEvent = NULL;
 	priv->isOpened = FALSE;
 	priv->isReady = FALSE;
+	rdpgfx_server_cache_reset(priv);
 	return TRUE;
 }
 
@@ -1554,10 +1660,42 @@ RdpgfxServerContext* rdpgfx_server_context_new(HANDLE vcm)
 		goto out_free_priv;
 	}
 
+	priv->SendPool = StreamPool_New(TRUE, 4096);
+
+	if (!priv->SendPool)
+	{
+		WLog_ERR(TAG, "StreamPool_New failed!");
+		goto out_free_stream;
+	}
+
+	priv->CacheIndex = HashTable_New(FALSE);
+
+	if (!priv->CacheIndex)
+	{
+		WLog_ERR(TAG, "HashTable_New failed!");
+		goto out_free_pool;
+	}
+
+	priv->CacheIndex->hash = rdpgfx_server_cache_key_hash;
+	priv->CacheIndex->keyCompare = rdpgfx_server_cache_key_compare;
+
+	if (!InitializeCriticalSectionAndSpinCount(&priv->cacheLock, 4000))
+	{
+		WLog_ERR(TAG, "InitializeCriticalSectionAndSpinCount failed!");
+		goto out_free_index;
+	}
+
 	priv->isOpened = FALSE;
 	priv->isReady = FALSE;
 	priv->ownThread = TRUE;
+	priv->MaxCacheSlots = RDPGFX_SERVER_MAX_CACHE_SLOTS;
 	return (RdpgfxServerContext*) context;
+out_free_index:
+	HashTable_Free(priv->CacheIndex);
+out_free_pool:
+	StreamPool_Free(priv->SendPool);
+out_free_stream:
+	Stream_Free(priv->input_stream, TRUE);
 out_free_priv:
 	free(context->priv);
 out_free:
@@ -1570,7 +1708,12 @@ void rdpgfx_server_context_free(RdpgfxServerContext* context)
 	rdpgfx_server_close(context);
 
 	if (context->priv)
+	{
 		Stream_Free(context->priv->input_stream, TRUE);
+		HashTable_Free(context->priv->CacheIndex);
+		StreamPool_Free(context->priv->SendPool);
+		DeleteCriticalSection(&context->priv->cacheLock);
+	}
 
 	free(context->priv);
 	free(context);
@@ -1581,6 +1724,48 @@ HANDLE rdpgfx_server_get_event_handle(RdpgfxServerContext* context)
 	return context->priv->channelEvent;
 }
 
+/**
+ * Looks up the cache slot in which the client holds a bitmap with the given
+ * cache key, either imported from its persistent cache or cached earlier in
+ * this session.
+ *
+ * @return TRUE if the key is cached
+ */
+BOOL rdpgfx_server_cache_lookup(RdpgfxServerContext* context, UINT64 cacheKey,
+                                UINT16* cacheSlot)
+{
+	ULONG_PTR value;
+	RdpgfxServerPrivate* priv;
+
+	if (!context || !context->priv || !cacheKey)
+		return FALSE;
+
+	priv = context->priv;
+	EnterCriticalSection(&priv->cacheLock);
+	value = (ULONG_PTR) HashTable_GetItemValue(priv->CacheIndex, &cacheKey);
+	LeaveCriticalSection(&priv->cacheLock);
+
+	if (!value)
+		return FALSE;
+
+	if (cacheSlot)
+		*cacheSlot = (UINT16)(value - 1);
+
+	return TRUE;
+}
+
+/**
+ * Returns the number of cache slots the client supports, as announced by
+ * the confirmed capability set. Valid cache slots are 1 to the result - 1.
+ */
+UINT16 rdpgfx_server_cache_max_slots(RdpgfxServerContext* context)
+{
+	if (!context || !context->priv)
+		return 0;
+
+	return context->priv->MaxCacheSlots;
+}
+
 /*
  * Handle rpdgfx messages - server side
  *
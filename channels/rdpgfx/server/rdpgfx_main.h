@@ -20,9 +20,14 @@
 #ifndef FREERDP_CHANNEL_RDPGFX_SERVER_MAIN_H
 #define FREERDP_CHANNEL_RDPGFX_SERVER_MAIN_H
 
+#include <winpr/synch.h>
+#include <winpr/collections.h>
+
 #include <freerdp/server/rdpgfx.h>
 #include <freerdp/codec/zgfx.h>
 
+#define RDPGFX_SERVER_MAX_CACHE_SLOTS	25600
+
 struct _rdpgfx_server_private
 {
 	ZGFX_CONTEXT* zgfx;
@@ -33,8 +38,14 @@ struct _rdpgfx_server_private
 	void* rdpgfx_channel;
 	DWORD SessionId;
 	wStream* input_stream;
+	wStreamPool* SendPool;
 	BOOL isOpened;
 	BOOL isReady;
+
+	UINT16 MaxCacheSlots;
+	CRITICAL_SECTION cacheLock;
+	wHashTable* CacheIndex;
+	UINT64 CacheSlotKeys[RDPGFX_SERVER_MAX_CACHE_SLOTS];
 };
 
 #endif /* FREERDP_CHANNEL_RDPGFX_SERVER_MAIN_H */
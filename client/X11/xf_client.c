@@ -49,6 +49,10 @@
 #include <X11/extensions/Xinerama.h>
 #endif
 
+#ifdef WITH_XPRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+
 #ifdef WITH_XI
 #include <X11/extensions/XInput2.h>
 #endif
@@ -285,9 +289,196 @@ static BOOL xf_desktop_resize(rdpContext* context)
 	return TRUE;
 }
 
+static BOOL xf_present_frame(void* context, const RECTANGLE_16* rects,
+                             UINT32 count)
+{
+	UINT32 i;
+	xfContext* xfc = (xfContext*) context;
+	rdpSettings* settings = xfc->context.settings;
+	/* the primary buffer must not change while it is copied out */
+	EnterCriticalSection(&xfc->presentLock);
+	xf_lock_x11(xfc, FALSE);
+
+	for (i = 0; i < count; i++)
+	{
+		const int x = rects[i].left;
+		const int y = rects[i].top;
+		const int w = rects[i].right - rects[i].left;
+		const int h = rects[i].bottom - rects[i].top;
+
+		if (settings->SoftwareGdi)
+			XPutImage(xfc->display, xfc->primary, xfc->gc, xfc->image,
+			          x, y, x, y, w, h);
+
+		xf_draw_screen(xfc, x, y, w, h);
+	}
+
+	XFlush(xfc->display);
+	xf_unlock_x11(xfc, FALSE);
+	LeaveCriticalSection(&xfc->presentLock);
+	return TRUE;
+}
+
+static void xf_present_add_damage(xfContext* xfc, INT32 x, INT32 y,
+                                  INT32 w, INT32 h)
+{
+	RECTANGLE_16 rect;
+	rdpGdi* gdi = xfc->context.gdi;
+
+	if (x < 0)
+	{
+		w += x;
+		x = 0;
+	}
+
+	if (y < 0)
+	{
+		h += y;
+		y = 0;
+	}
+
+	if ((w <= 0) || (h <= 0))
+		return;
+
+	rect.left = x;
+	rect.top = y;
+	rect.right = MIN(x + w, gdi->width);
+	rect.bottom = MIN(y + h, gdi->height);
+
+	if ((rect.left < rect.right) && (rect.top < rect.bottom))
+		present_scheduler_add_damage(xfc->present, &rect);
+}
+
+/**
+ * With frame pacing enabled EndPaint only records the damage, the
+ * client thread blits it at the next display refresh.
+ */
+static BOOL xf_present_end_paint(xfContext* xfc, HGDI_WND hwnd)
+{
+	int i;
+
+	if (xfc->complex_regions)
+	{
+		for (i = 0; i < hwnd->ninvalid; i++)
+			xf_present_add_damage(xfc, hwnd->cinvalid[i].x, hwnd->cinvalid[i].y,
+			                      hwnd->cinvalid[i].w, hwnd->cinvalid[i].h);
+	}
+	else if (!hwnd->invalid->null)
+	{
+		xf_present_add_damage(xfc, hwnd->invalid->x, hwnd->invalid->y,
+		                      hwnd->invalid->w, hwnd->invalid->h);
+	}
+
+	present_scheduler_end_frame(xfc->present);
+	return TRUE;
+}
+
+static DWORD xf_present_get_timeout(xfContext* xfc, DWORD timeout)
+{
+	DWORD presentTimeout;
+
+	if (!xfc->present)
+		return timeout;
+
+	presentTimeout = present_scheduler_get_timeout(xfc->present);
+	return MIN(timeout, presentTimeout);
+}
+
+static BOOL xf_present_check(xfContext* xfc)
+{
+	if (!xfc->present)
+		return TRUE;
+
+#ifdef WITH_XPRESENT
+
+	/* ask for a notification at the next vblank, the frame is presented
+	 * when it arrives */
+	if (xfc->xpresentAvailable && !xfc->presentNotifyPending &&
+	    present_scheduler_is_pending(xfc->present))
+	{
+		xf_lock_x11(xfc, FALSE);
+		XPresentNotifyMSC(xfc->display, xfc->window->handle, ++xfc->presentSerial,
+		                  0, 1, 0);
+		XFlush(xfc->display);
+		xf_unlock_x11(xfc, FALSE);
+		xfc->presentNotifyPending = TRUE;
+	}
+
+#endif
+	return present_scheduler_check(xfc->present);
+}
+
+BOOL xf_present_handle_event(xfContext* xfc, XEvent* event)
+{
+#ifdef WITH_XPRESENT
+
+	if (!xfc->present || !xfc->xpresentAvailable)
+		return FALSE;
+
+	if ((event->type != GenericEvent) ||
+	    (event->xcookie.extension != xfc->XPresentOpcode))
+		return FALSE;
+
+	if (event->xcookie.evtype == PresentCompleteNotify)
+	{
+		xfc->presentNotifyPending = FALSE;
+		present_scheduler_vblank(xfc->present);
+	}
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+static BOOL xf_present_init(xfContext* xfc)
+{
+	rdpSettings* settings = xfc->context.settings;
+
+	if (!settings->FramePacing || xfc->remote_app)
+		return TRUE;
+
+	if (!InitializeCriticalSectionAndSpinCount(&xfc->presentLock, 4000))
+		return FALSE;
+
+	xfc->present = present_scheduler_new(settings->FramePacingRate,
+	                                     xf_present_frame, xfc);
+
+	if (!xfc->present)
+	{
+		DeleteCriticalSection(&xfc->presentLock);
+		return FALSE;
+	}
+
+#ifdef WITH_XPRESENT
+
+	/* vblank notifications are delivered with the X11 events, they can
+	 * only drive presentation if those are handled by the client thread */
+	if (xfc->xpresentAvailable && !settings->AsyncInput)
+	{
+		XPresentSelectInput(xfc->display, xfc->window->handle,
+		                    PresentCompleteNotifyMask);
+		present_scheduler_set_vsync(xfc->present, TRUE);
+	}
+	else
+		xfc->xpresentAvailable = FALSE;
+
+#endif
+	return TRUE;
+}
+
+/**
+ * With frame pacing the client thread copies the primary buffer out, the
+ * painting in between BeginPaint and EndPaint holds it off.
+ */
 static BOOL xf_sw_begin_paint(rdpContext* context)
 {
+	xfContext* xfc = (xfContext*) context;
 	rdpGdi* gdi = context->gdi;
+
+	if (xfc->present)
+		EnterCriticalSection(&xfc->presentLock);
+
 	gdi->primary->hdc->hwnd->invalid->null = TRUE;
 	gdi->primary->hdc->hwnd->ninvalid = 0;
 	return TRUE;
@@ -311,6 +502,13 @@ static BOOL xf_sw_end_paint(rdpContext* context)
 
 	if (!xfc->remote_app)
 	{
+		if (xfc->present)
+		{
+			xf_present_end_paint(xfc, gdi->primary->hdc->hwnd);
+			LeaveCriticalSection(&xfc->presentLock);
+			return TRUE;
+		}
+
 		if (!xfc->complex_regions)
 		{
 			if (gdi->primary->hdc->hwnd->invalid->null)
@@ -363,7 +561,12 @@ static BOOL xf_sw_desktop_resize(rdpContext* context)
 	xfContext* xfc = (xfContext*) context;
 	rdpSettings* settings = context->settings;
 	BOOL ret = FALSE;
+
+	if (xfc->present)
+		EnterCriticalSection(&xfc->presentLock);
+
 	xf_lock_x11(xfc, TRUE);
+	present_scheduler_reset(xfc->present);
 
 	if (!gdi_resize(gdi, settings->DesktopWidth, settings->DesktopHeight))
 		goto out;
@@ -384,6 +587,10 @@ static BOOL xf_sw_desktop_resize(rdpContext* context)
 	ret = xf_desktop_resize(context);
 out:
 	xf_unlock_x11(xfc, TRUE);
+
+	if (xfc->present)
+		LeaveCriticalSection(&xfc->presentLock);
+
 	return ret;
 }
 
@@ -403,6 +610,9 @@ static BOOL xf_hw_end_paint(rdpContext* context)
 
 	if (!xfc->remote_app)
 	{
+		if (xfc->present)
+			return xf_present_end_paint(xfc, xfc->hdc->hwnd);
+
 		if (!xfc->complex_regions)
 		{
 			if (xfc->hdc->hwnd->invalid->null)
@@ -466,6 +676,7 @@ static BOOL xf_hw_desktop_resize(rdpContext* context)
 	rdpSettings* settings = context->settings;
 	BOOL ret = FALSE;
 	xf_lock_x11(xfc, TRUE);
+	present_scheduler_reset(xfc->present);
 
 	if (!gdi_resize(gdi, settings->DesktopWidth, settings->DesktopHeight))
 		goto out;
@@ -933,6 +1144,18 @@ static void xf_check_extensions(xfContext* context)
 		}
 	}
 #endif
+#ifdef WITH_XPRESENT
+	{
+		int xpresent_event_base;
+		int xpresent_error_base;
+
+		if (XPresentQueryExtension(context->display, &context->XPresentOpcode,
+		                           &xpresent_event_base, &xpresent_error_base))
+		{
+			context->xpresentAvailable = TRUE;
+		}
+	}
+#endif
 }
 
 #ifdef WITH_XI
@@ -1275,6 +1498,9 @@ static BOOL xf_post_connect(freerdp* instance)
 		update->DesktopResize = xf_hw_desktop_resize;
 	}
 
+	if (!xf_present_init(xfc))
+		return FALSE;
+
 	pointer_cache_register_callbacks(update);
 	update->PlaySound = xf_play_sound;
 	update->SetKeyboardIndicators = xf_keyboard_set_indicators;
@@ -1299,6 +1525,13 @@ static void xf_post_disconnect(freerdp* instance)
 
 	context = instance->context;
 	xfc = (xfContext*) context;
+	if (xfc->present)
+	{
+		present_scheduler_free(xfc->present);
+		xfc->present = NULL;
+		DeleteCriticalSection(&xfc->presentLock);
+	}
+
 	gdi_free(instance);
 
 	if (xfc->clipboard)
@@ -1538,7 +1771,11 @@ static void* xf_client_thread(void* param)
 			nCount += tmp;
 		}
 
-		waitStatus = WaitForMultipleObjects(nCount, handles, FALSE, 100);
+		if (xfc->present && (nCount < 64))
+			handles[nCount++] = present_scheduler_get_event_handle(xfc->present);
+
+		waitStatus = WaitForMultipleObjects(nCount, handles, FALSE,
+		                                    xf_present_get_timeout(xfc, 100));
 
 		if (!settings->AsyncTransport)
 		{
@@ -1560,6 +1797,12 @@ static void* xf_client_thread(void* param)
 				break;
 			}
 		}
+
+		if (!xf_present_check(xfc))
+		{
+			WLog_ERR(TAG, "Failed to present frame");
+			break;
+		}
 	}
 
 	if (settings->AsyncInput)
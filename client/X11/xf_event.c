@@ -979,6 +979,9 @@ BOOL xf_event_process(freerdp* instance, XEvent* event)
 		DEBUG_X11("%s Event(%d): wnd=0x%04X", X11_EVENT_STRINGS[event->type],
 		          event->type, (UINT32) event->xany.window);
 
+	if (xf_present_handle_event(xfc, event))
+		return TRUE;
+
 	switch (event->type)
 	{
 		case Expose:
@@ -38,6 +38,7 @@ typedef struct xf_context xfContext;
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/codec/h264.h>
 #include <freerdp/codec/progressive.h>
+#include <freerdp/client/present.h>
 #include <freerdp/codec/region.h>
 
 struct xf_FullscreenMonitors
@@ -225,6 +226,16 @@ struct xf_context
 	BOOL xkbAvailable;
 	BOOL xrenderAvailable;
 
+	/* Frame pacing */
+	rdpPresentScheduler* present;
+	CRITICAL_SECTION presentLock;
+#ifdef WITH_XPRESENT
+	BOOL xpresentAvailable;
+	int XPresentOpcode;
+	UINT32 presentSerial;
+	BOOL presentNotifyPending;
+#endif
+
 	/* value to be sent over wire for each logical client mouse button */
 	int button_map[NUM_BUTTONS_MAPPED];
 };
@@ -282,6 +293,7 @@ void xf_lock_x11(xfContext* xfc, BOOL display);
 void xf_unlock_x11(xfContext* xfc, BOOL display);
 
 BOOL xf_picture_transform_required(xfContext* xfc);
+BOOL xf_present_handle_event(xfContext* xfc, XEvent* event);
 void xf_draw_screen(xfContext* xfc, int x, int y, int w, int h);
 
 FREERDP_API DWORD xf_exit_code_from_disconnect_reason(DWORD reason);
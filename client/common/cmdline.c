@@ -70,6 +70,7 @@ static COMMAND_LINE_ARGUMENT_A args[] =
 	{ "t", COMMAND_LINE_VALUE_REQUIRED, "<title>", NULL, NULL, -1, "title", "Window title" },
 	{ "decorations", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Window decorations" },
 	{ "smart-sizing", COMMAND_LINE_VALUE_OPTIONAL, "<width>x<height>", NULL, NULL, -1, NULL, "Scale remote desktop to window size" },
+	{ "frame-pacing", COMMAND_LINE_VALUE_OPTIONAL, "<refresh rate>", NULL, NULL, -1, NULL, "Coalesce screen updates to the display refresh rate" },
 	{ "a", COMMAND_LINE_VALUE_REQUIRED, NULL, NULL, NULL, -1, "addin", "Addin" },
 	{ "vc", COMMAND_LINE_VALUE_REQUIRED, NULL, NULL, NULL, -1, NULL, "Static virtual channel" },
 	{ "dvc", COMMAND_LINE_VALUE_REQUIRED, NULL, NULL, NULL, -1, NULL, "Dynamic virtual channel" },
@@ -137,6 +138,9 @@ static COMMAND_LINE_ARGUMENT_A args[] =
 	{ "sec-nla", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "nla protocol security" },
 	{ "sec-ext", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "nla extended protocol security" },
 	{ "tls-ciphers", COMMAND_LINE_VALUE_REQUIRED, "<netmon|ma|ciphers>", NULL, NULL, -1, NULL, "Allowed TLS ciphers" },
+	{ "kernel-tls", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Offload TLS 1.2 record encryption to the kernel" },
+	{ "tls-resume", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "TLS session resumption" },
+	{ "tls-session-cache", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "Persist TLS sessions for resumption in file" },
 	{ "cert-name", COMMAND_LINE_VALUE_REQUIRED, "<name>", NULL, NULL, -1, NULL, "certificate name" },
 	{ "cert-ignore", COMMAND_LINE_VALUE_FLAG, NULL, NULL, NULL, -1, NULL, "ignore certificate" },
 	{ "cert-tofu", COMMAND_LINE_VALUE_FLAG, NULL, NULL, NULL, -1, NULL, "Automatically accept certificate on first connect" },
@@ -152,8 +156,13 @@ static COMMAND_LINE_ARGUMENT_A args[] =
 	{ "mouse-motion", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "mouse-motion" },
 	{ "parent-window", COMMAND_LINE_VALUE_REQUIRED, "<window id>", NULL, NULL, -1, NULL, "Parent window id" },
 	{ "bitmap-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Enable bitmap cache" },
+	{ "persist-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Enable persistent bitmap cache" },
+	{ "persist-cache-file", COMMAND_LINE_VALUE_REQUIRED, "<filename>", NULL, NULL, -1, NULL, "Persistent bitmap cache file (default: per-host file in the configuration directory)" },
+	{ "persist-cache-size", COMMAND_LINE_VALUE_REQUIRED, "<size>", NULL, NULL, -1, NULL, "Persistent bitmap cache size budget in bytes" },
+	{ "bitmap-cache-memory", COMMAND_LINE_VALUE_REQUIRED, "<size>", NULL, NULL, -1, NULL, "Bitmap cache memory budget in bytes (0: unlimited)" },
 	{ "offscreen-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Enable offscreen bitmap cache" },
 	{ "glyph-cache", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Glyph cache (EXPERIMENTAL)" },
+	{ "glyph-cache-memory", COMMAND_LINE_VALUE_REQUIRED, "<size>", NULL, NULL, -1, NULL, "Glyph cache memory budget in bytes (0: unlimited)" },
 	{ "codec-cache", COMMAND_LINE_VALUE_REQUIRED, "<rfx|nsc|jpeg>", NULL, NULL, -1, NULL, "bitmap codec cache" },
 	{ "fast-path", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Enable fast-path input/output" },
 	{ "max-fast-path-size", COMMAND_LINE_VALUE_OPTIONAL, "<size>", NULL, NULL, -1, NULL, "specify maximum fast-path update size" },
@@ -1642,6 +1651,13 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 				free(str);
 			}
 		}
+		CommandLineSwitchCase(arg, "frame-pacing")
+		{
+			settings->FramePacing = TRUE;
+
+			if (arg->Value)
+				settings->FramePacingRate = atoi(arg->Value);
+		}
 		CommandLineSwitchCase(arg, "bpp")
 		{
 			settings->ColorDepth = atoi(arg->Value);
@@ -2221,6 +2237,21 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 					return COMMAND_LINE_ERROR_MEMORY;
 			}
 		}
+		CommandLineSwitchCase(arg, "kernel-tls")
+		{
+			settings->TlsKernelOffload = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "tls-resume")
+		{
+			settings->TlsSessionResumption = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "tls-session-cache")
+		{
+			free(settings->TlsSessionCacheFile);
+
+			if (!(settings->TlsSessionCacheFile = _strdup(arg->Value)))
+				return COMMAND_LINE_ERROR_MEMORY;
+		}
 		CommandLineSwitchCase(arg, "cert-name")
 		{
 			free(settings->CertificateName);
@@ -2268,6 +2299,35 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 		{
 			settings->BitmapCacheEnabled = arg->Value ? TRUE : FALSE;
 		}
+		CommandLineSwitchCase(arg, "persist-cache")
+		{
+			UINT32 i;
+			settings->BitmapCachePersistEnabled = arg->Value ? TRUE : FALSE;
+
+			for (i = 0; i < settings->BitmapCacheV2NumCells; i++)
+				settings->BitmapCacheV2CellInfo[i].persistent = settings->BitmapCachePersistEnabled;
+		}
+		CommandLineSwitchCase(arg, "persist-cache-file")
+		{
+			UINT32 i;
+			free(settings->BitmapCachePersistFile);
+
+			if (!(settings->BitmapCachePersistFile = _strdup(arg->Value)))
+				return COMMAND_LINE_ERROR_MEMORY;
+
+			settings->BitmapCachePersistEnabled = TRUE;
+
+			for (i = 0; i < settings->BitmapCacheV2NumCells; i++)
+				settings->BitmapCacheV2CellInfo[i].persistent = TRUE;
+		}
+		CommandLineSwitchCase(arg, "persist-cache-size")
+		{
+			settings->BitmapCachePersistMaxSize = atoi(arg->Value);
+		}
+		CommandLineSwitchCase(arg, "bitmap-cache-memory")
+		{
+			settings->BitmapCacheMaxMemory = atoi(arg->Value);
+		}
 		CommandLineSwitchCase(arg, "offscreen-cache")
 		{
 			settings->OffscreenSupportLevel = arg->Value ? TRUE : FALSE;
@@ -2277,6 +2337,10 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 			settings->GlyphSupportLevel = arg->Value ? GLYPH_SUPPORT_FULL :
 			                              GLYPH_SUPPORT_NONE;
 		}
+		CommandLineSwitchCase(arg, "glyph-cache-memory")
+		{
+			settings->GlyphCacheMaxMemory = atoi(arg->Value);
+		}
 		CommandLineSwitchCase(arg, "codec-cache")
 		{
 			settings->BitmapCacheV3Enabled = TRUE;
@@ -0,0 +1,335 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Frame Presentation Scheduler
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+#include <freerdp/codec/region.h>
+#include <freerdp/client/present.h>
+
+#define TAG CLIENT_TAG("common.present")
+
+/**
+ * Decoded frames are not put on screen right away. Their damage is
+ * accumulated and flushed once per display refresh, so a burst of
+ * frames arriving within one refresh interval costs a single blit and
+ * only the most recent content is shown. Frames are acknowledged to the
+ * server when they are decoded, dropping them here does not stall the
+ * server's flow control.
+ *
+ * Refresh boundaries are derived from the last known vblank (or the
+ * scheduler creation time) and the refresh interval. With vsync enabled
+ * the caller reports vblanks through present_scheduler_vblank() and the
+ * timer only serves as a fallback should notifications stop arriving.
+ */
+
+struct rdp_present_scheduler
+{
+	CRITICAL_SECTION lock;
+	HANDLE event;
+
+	UINT64 interval; /* microseconds */
+	UINT64 phase;
+	UINT64 lastPresent;
+	BOOL vsync;
+
+	REGION16 damage;
+	REGION16 presenting;
+	BOOL framePending;
+
+	pcPresentFrame Present;
+	void* context;
+
+	PRESENT_STATISTICS stats;
+};
+
+static UINT64 present_scheduler_now(void)
+{
+	return GetTickCount64() * 1000;
+}
+
+static UINT64 present_scheduler_next_deadline(rdpPresentScheduler* scheduler)
+{
+	UINT64 intervals;
+	UINT64 deadline;
+
+	if (scheduler->lastPresent < scheduler->phase)
+		return scheduler->phase;
+
+	intervals = (scheduler->lastPresent - scheduler->phase) / scheduler->interval;
+	deadline = scheduler->phase + (intervals + 1) * scheduler->interval;
+
+	/* a missed vblank notification must not stall presentation forever */
+	if (scheduler->vsync)
+		deadline += scheduler->interval;
+
+	return deadline;
+}
+
+rdpPresentScheduler* present_scheduler_new(UINT32 refreshRate,
+        pcPresentFrame present, void* context)
+{
+	rdpPresentScheduler* scheduler;
+
+	if (!present)
+		return NULL;
+
+	if (!refreshRate)
+		refreshRate = PRESENT_DEFAULT_REFRESH_RATE;
+
+	scheduler = (rdpPresentScheduler*) calloc(1, sizeof(rdpPresentScheduler));
+
+	if (!scheduler)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&scheduler->lock, 4000))
+	{
+		free(scheduler);
+		return NULL;
+	}
+
+	scheduler->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!scheduler->event)
+	{
+		DeleteCriticalSection(&scheduler->lock);
+		free(scheduler);
+		return NULL;
+	}
+
+	scheduler->interval = 1000000 / refreshRate;
+	scheduler->phase = present_scheduler_now();
+	scheduler->Present = present;
+	scheduler->context = context;
+	region16_init(&scheduler->damage);
+	region16_init(&scheduler->presenting);
+	return scheduler;
+}
+
+void present_scheduler_free(rdpPresentScheduler* scheduler)
+{
+	if (!scheduler)
+		return;
+
+	WLog_DBG(TAG, "frames completed: %lu presented: %lu dropped: %lu",
+	         (unsigned long) scheduler->stats.framesCompleted,
+	         (unsigned long) scheduler->stats.framesPresented,
+	         (unsigned long) scheduler->stats.framesDropped);
+	region16_uninit(&scheduler->damage);
+	region16_uninit(&scheduler->presenting);
+	CloseHandle(scheduler->event);
+	DeleteCriticalSection(&scheduler->lock);
+	free(scheduler);
+}
+
+BOOL present_scheduler_add_damage(rdpPresentScheduler* scheduler,
+                                  const RECTANGLE_16* rect)
+{
+	BOOL rc;
+
+	if (!scheduler || !rect)
+		return FALSE;
+
+	if (rectangle_is_empty(rect))
+		return TRUE;
+
+	EnterCriticalSection(&scheduler->lock);
+	rc = region16_union_rect(&scheduler->damage, &scheduler->damage, rect);
+	LeaveCriticalSection(&scheduler->lock);
+	return rc;
+}
+
+/**
+ * Marks the damage added so far as a complete frame. A frame that is
+ * still waiting for its refresh slot is superseded by this one.
+ */
+void present_scheduler_end_frame(rdpPresentScheduler* scheduler)
+{
+	if (!scheduler)
+		return;
+
+	EnterCriticalSection(&scheduler->lock);
+
+	if (region16_is_empty(&scheduler->damage))
+	{
+		LeaveCriticalSection(&scheduler->lock);
+		return;
+	}
+
+	scheduler->stats.framesCompleted++;
+
+	if (scheduler->framePending)
+		scheduler->stats.framesDropped++;
+
+	scheduler->framePending = TRUE;
+	LeaveCriticalSection(&scheduler->lock);
+	SetEvent(scheduler->event);
+}
+
+void present_scheduler_reset(rdpPresentScheduler* scheduler)
+{
+	if (!scheduler)
+		return;
+
+	EnterCriticalSection(&scheduler->lock);
+	region16_clear(&scheduler->damage);
+	scheduler->framePending = FALSE;
+	LeaveCriticalSection(&scheduler->lock);
+}
+
+/**
+ * The event is signalled whenever a new frame completes and stays so
+ * until the next present_scheduler_check(). The owner of the event loop
+ * should wait at most present_scheduler_get_timeout() before checking.
+ */
+HANDLE present_scheduler_get_event_handle(rdpPresentScheduler* scheduler)
+{
+	if (!scheduler)
+		return NULL;
+
+	return scheduler->event;
+}
+
+BOOL present_scheduler_is_pending(rdpPresentScheduler* scheduler)
+{
+	BOOL pending;
+
+	if (!scheduler)
+		return FALSE;
+
+	EnterCriticalSection(&scheduler->lock);
+	pending = scheduler->framePending;
+	LeaveCriticalSection(&scheduler->lock);
+	return pending;
+}
+
+DWORD present_scheduler_get_timeout(rdpPresentScheduler* scheduler)
+{
+	UINT64 now;
+	UINT64 deadline;
+	DWORD timeout = INFINITE;
+
+	if (!scheduler)
+		return timeout;
+
+	EnterCriticalSection(&scheduler->lock);
+
+	if (scheduler->framePending)
+	{
+		now = present_scheduler_now();
+		deadline = present_scheduler_next_deadline(scheduler);
+
+		if (deadline <= now)
+			timeout = 0;
+		else
+			timeout = (DWORD)((deadline - now + 999) / 1000);
+	}
+
+	LeaveCriticalSection(&scheduler->lock);
+	return timeout;
+}
+
+static BOOL present_scheduler_flush(rdpPresentScheduler* scheduler, BOOL force)
+{
+	UINT32 count;
+	UINT64 now;
+	const RECTANGLE_16* rects;
+	EnterCriticalSection(&scheduler->lock);
+	ResetEvent(scheduler->event);
+	now = present_scheduler_now();
+
+	if (force)
+		scheduler->phase = now;
+
+	if (!scheduler->framePending ||
+	    (!force && (now < present_scheduler_next_deadline(scheduler))))
+	{
+		LeaveCriticalSection(&scheduler->lock);
+		return TRUE;
+	}
+
+	if (!region16_copy(&scheduler->presenting, &scheduler->damage))
+	{
+		LeaveCriticalSection(&scheduler->lock);
+		return FALSE;
+	}
+
+	region16_clear(&scheduler->damage);
+	scheduler->framePending = FALSE;
+	scheduler->lastPresent = now;
+	scheduler->stats.framesPresented++;
+	LeaveCriticalSection(&scheduler->lock);
+	rects = region16_rects(&scheduler->presenting, &count);
+	return scheduler->Present(scheduler->context, rects, count);
+}
+
+/**
+ * Presents the pending frame if its refresh slot has been reached.
+ * Only one thread may present, usually the one running the event loop.
+ */
+BOOL present_scheduler_check(rdpPresentScheduler* scheduler)
+{
+	if (!scheduler)
+		return FALSE;
+
+	return present_scheduler_flush(scheduler, FALSE);
+}
+
+void present_scheduler_set_vsync(rdpPresentScheduler* scheduler, BOOL vsync)
+{
+	if (!scheduler)
+		return;
+
+	EnterCriticalSection(&scheduler->lock);
+	scheduler->vsync = vsync;
+	LeaveCriticalSection(&scheduler->lock);
+}
+
+/**
+ * Reports a vertical blank of the target display. The refresh phase is
+ * realigned and a pending frame is presented immediately.
+ */
+BOOL present_scheduler_vblank(rdpPresentScheduler* scheduler)
+{
+	if (!scheduler)
+		return FALSE;
+
+	return present_scheduler_flush(scheduler, TRUE);
+}
+
+void present_scheduler_get_statistics(rdpPresentScheduler* scheduler,
+                                      PRESENT_STATISTICS* statistics)
+{
+	if (!statistics)
+		return;
+
+	if (!scheduler)
+	{
+		ZeroMemory(statistics, sizeof(PRESENT_STATISTICS));
+		return;
+	}
+
+	EnterCriticalSection(&scheduler->lock);
+	*statistics = scheduler->stats;
+	LeaveCriticalSection(&scheduler->lock);
+}
@@ -0,0 +1,124 @@
+
+#include <stdio.h>
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include <freerdp/client/present.h>
+
+/* 10 Hz keeps the test robust against coarse timers */
+#define TEST_REFRESH_RATE	10
+
+typedef struct
+{
+	UINT32 calls;
+	UINT32 rects;
+	RECTANGLE_16 last;
+} TEST_PRESENT;
+
+static BOOL test_present(void* context, const RECTANGLE_16* rects, UINT32 count)
+{
+	TEST_PRESENT* test = (TEST_PRESENT*) context;
+	test->calls++;
+	test->rects = count;
+
+	if (count)
+		test->last = rects[count - 1];
+
+	return TRUE;
+}
+
+static void test_frame(rdpPresentScheduler* scheduler, UINT16 left, UINT16 top)
+{
+	RECTANGLE_16 rect;
+	rect.left = left;
+	rect.top = top;
+	rect.right = left + 16;
+	rect.bottom = top + 16;
+	present_scheduler_add_damage(scheduler, &rect);
+	present_scheduler_end_frame(scheduler);
+}
+
+int TestClientPresent(int argc, char* argv[])
+{
+	int rc = -1;
+	DWORD timeout;
+	TEST_PRESENT test = { 0 };
+	PRESENT_STATISTICS stats;
+	rdpPresentScheduler* scheduler;
+	scheduler = present_scheduler_new(TEST_REFRESH_RATE, test_present, &test);
+
+	if (!scheduler)
+		return -1;
+
+	if (present_scheduler_get_timeout(scheduler) != INFINITE)
+		goto fail;
+
+	/* the first frame after an idle period is presented right away */
+	test_frame(scheduler, 0, 0);
+
+	if (WaitForSingleObject(present_scheduler_get_event_handle(scheduler), 0) != WAIT_OBJECT_0)
+		goto fail;
+
+	if (!present_scheduler_check(scheduler) || (test.calls != 1))
+	{
+		fprintf(stderr, "idle frame was not presented\n");
+		goto fail;
+	}
+
+	/* a burst within the same refresh interval is coalesced */
+	test_frame(scheduler, 32, 0);
+	test_frame(scheduler, 64, 0);
+	test_frame(scheduler, 96, 0);
+
+	if (!present_scheduler_check(scheduler) || (test.calls != 1))
+	{
+		fprintf(stderr, "frame presented before its refresh slot\n");
+		goto fail;
+	}
+
+	timeout = present_scheduler_get_timeout(scheduler);
+
+	if ((timeout == INFINITE) || (timeout > 1000 / TEST_REFRESH_RATE))
+		goto fail;
+
+	Sleep(timeout);
+
+	if (!present_scheduler_check(scheduler) || (test.calls != 2) || (test.rects != 3))
+	{
+		fprintf(stderr, "coalesced frame was not presented\n");
+		goto fail;
+	}
+
+	if ((test.last.left != 96) || (test.last.right != 112))
+		goto fail;
+
+	/* a vblank presents immediately */
+	test_frame(scheduler, 0, 32);
+
+	if (!present_scheduler_vblank(scheduler) || (test.calls != 3))
+		goto fail;
+
+	/* a reset discards pending damage */
+	test_frame(scheduler, 0, 64);
+	present_scheduler_reset(scheduler);
+
+	if (present_scheduler_is_pending(scheduler) ||
+	    (present_scheduler_get_timeout(scheduler) != INFINITE))
+		goto fail;
+
+	present_scheduler_get_statistics(scheduler, &stats);
+
+	if ((stats.framesCompleted != 6) || (stats.framesPresented != 3) ||
+	    (stats.framesDropped != 2))
+	{
+		fprintf(stderr, "unexpected statistics: completed %u presented %u dropped %u\n",
+		        (UINT32) stats.framesCompleted, (UINT32) stats.framesPresented,
+		        (UINT32) stats.framesDropped);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	present_scheduler_free(scheduler);
+	return rc;
+}
@@ -0,0 +1,48 @@
+# - Find XPRESENT
+# Find the XPRESENT libraries
+#
+#  This module defines the following variables:
+#     XPRESENT_FOUND        - true if XPRESENT_INCLUDE_DIR & XPRESENT_LIBRARY are found
+#     XPRESENT_LIBRARIES    - Set when XPRESENT_LIBRARY is found
+#     XPRESENT_INCLUDE_DIRS - Set when XPRESENT_INCLUDE_DIR is found
+#
+#     XPRESENT_INCLUDE_DIR  - where to find Xpresent.h, etc.
+#     XPRESENT_LIBRARY      - the XPRESENT library
+#
+
+#=============================================================================
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#=============================================================================
+
+find_path(XPRESENT_INCLUDE_DIR NAMES X11/extensions/Xpresent.h
+          PATH_SUFFIXES X11/extensions
+          PATHS /opt/X11/include
+          DOC "The Xpresent include directory"
+)
+
+find_library(XPRESENT_LIBRARY NAMES Xpresent
+          PATHS /opt/X11/lib
+          DOC "The Xpresent library"
+)
+
+include(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(Xpresent DEFAULT_MSG XPRESENT_LIBRARY XPRESENT_INCLUDE_DIR)
+
+if(XPRESENT_FOUND)
+  set( XPRESENT_LIBRARIES ${XPRESENT_LIBRARY} )
+  set( XPRESENT_INCLUDE_DIRS ${XPRESENT_INCLUDE_DIR} )
+endif()
+
+mark_as_advanced(XPRESENT_INCLUDE_DIR XPRESENT_LIBRARY)
+
@@ -25,6 +25,9 @@
 #include <freerdp/update.h>
 #include <freerdp/freerdp.h>
 
+#include <freerdp/cache/persistent.h>
+#include <freerdp/cache/budget.h>
+
 #include <winpr/stream.h>
 
 typedef struct _BITMAP_V2_CELL BITMAP_V2_CELL;
@@ -36,6 +39,8 @@ struct _BITMAP_V2_CELL
 {
 	UINT32 number;
 	rdpBitmap** entries;
+	UINT64* keys;
+	UINT32 budgetBase;
 };
 
 struct rdp_bitmap_cache
@@ -56,6 +61,9 @@ struct rdp_bitmap_cache
 	rdpUpdate* update;
 	rdpContext* context;
 	rdpSettings* settings;
+	rdpPersistentCache* persistent;
+	UINT32 persistentGeneration;
+	rdpCacheBudget* budget;
 };
 
 #ifdef __cplusplus
@@ -67,6 +75,9 @@ FREERDP_API void bitmap_cache_register_callbacks(rdpUpdate* update);
 FREERDP_API rdpBitmapCache* bitmap_cache_new(rdpSettings* settings);
 FREERDP_API void bitmap_cache_free(rdpBitmapCache* bitmap_cache);
 
+FREERDP_API void bitmap_cache_get_statistics(rdpBitmapCache* bitmap_cache,
+        CACHE_STATISTICS* statistics);
+
 #ifdef __cplusplus
 }
 #endif
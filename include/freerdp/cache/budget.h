@@ -0,0 +1,64 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Cache Memory Budget
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CACHE_BUDGET_H
+#define FREERDP_CACHE_BUDGET_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+
+typedef struct _CACHE_STATISTICS CACHE_STATISTICS;
+typedef struct rdp_cache_budget rdpCacheBudget;
+
+struct _CACHE_STATISTICS
+{
+	UINT64 hits;
+	UINT64 misses;
+	UINT64 evictions;
+	UINT64 usedBytes;
+	UINT64 peakBytes;
+	UINT64 maxBytes;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A budget tracks the memory held by the entries of a cache, numbered
+ * 0 to count - 1, and keeps the evictable ones in least recently used
+ * order. A maxBytes of 0 disables eviction.
+ */
+FREERDP_API rdpCacheBudget* cache_budget_new(UINT32 count, UINT64 maxBytes);
+FREERDP_API void cache_budget_free(rdpCacheBudget* budget);
+
+FREERDP_API void cache_budget_charge(rdpCacheBudget* budget, UINT32 entry,
+                                     UINT32 bytes, BOOL evictable);
+FREERDP_API void cache_budget_release(rdpCacheBudget* budget, UINT32 entry);
+FREERDP_API void cache_budget_hit(rdpCacheBudget* budget, UINT32 entry);
+FREERDP_API void cache_budget_miss(rdpCacheBudget* budget);
+FREERDP_API BOOL cache_budget_reclaim(rdpCacheBudget* budget, UINT32 bytes,
+                                      UINT32* entry);
+
+FREERDP_API void cache_budget_get_statistics(rdpCacheBudget* budget,
+        CACHE_STATISTICS* statistics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_CACHE_BUDGET_H */
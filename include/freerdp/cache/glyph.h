@@ -27,18 +27,39 @@
 #include <winpr/wlog.h>
 #include <winpr/stream.h>
 
+typedef struct _GLYPH_CACHE_CELL GLYPH_CACHE_CELL;
 typedef struct _GLYPH_CACHE GLYPH_CACHE;
 typedef struct _FRAGMENT_CACHE_ENTRY FRAGMENT_CACHE_ENTRY;
 typedef struct _FRAGMENT_CACHE FRAGMENT_CACHE;
 typedef struct rdp_glyph_cache rdpGlyphCache;
 
 #include <freerdp/cache/cache.h>
+#include <freerdp/cache/budget.h>
+
+/**
+ * Glyph bitmaps are kept in one atlas per cache id, with a fixed stride
+ * of maxCellSize bytes. Graphics objects (entries) are created on first
+ * use and evicted again when the cache exceeds its memory budget.
+ */
+struct _GLYPH_CACHE_CELL
+{
+	INT32 x;
+	INT32 y;
+	UINT32 cx;
+	UINT32 cy;
+	UINT32 cb;
+	BYTE* overflow;
+	BOOL valid;
+};
 
 struct _GLYPH_CACHE
 {
 	UINT32 number;
 	UINT32 maxCellSize;
 	rdpGlyph** entries;
+	GLYPH_CACHE_CELL* cells;
+	BYTE* atlas;
+	UINT32 budgetBase;
 };
 
 struct _FRAGMENT_CACHE_ENTRY
@@ -60,6 +81,7 @@ struct rdp_glyph_cache
 	wLog* log;
 	rdpContext* context;
 	rdpSettings* settings;
+	rdpCacheBudget* budget;
 };
 
 #ifdef __cplusplus
@@ -71,6 +93,9 @@ FREERDP_API void glyph_cache_register_callbacks(rdpUpdate* update);
 FREERDP_API rdpGlyphCache* glyph_cache_new(rdpSettings* settings);
 FREERDP_API void glyph_cache_free(rdpGlyphCache* glyph);
 
+FREERDP_API void glyph_cache_get_statistics(rdpGlyphCache* glyph,
+        CACHE_STATISTICS* statistics);
+
 #ifdef __cplusplus
 }
 #endif
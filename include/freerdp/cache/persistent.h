@@ -0,0 +1,76 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Bitmap Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_PERSISTENT_CACHE_H
+#define FREERDP_PERSISTENT_CACHE_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+#include <freerdp/settings.h>
+
+#define PERSISTENT_CACHE_MAX_CELLS		5
+
+typedef struct _PERSISTENT_CACHE_ENTRY PERSISTENT_CACHE_ENTRY;
+typedef struct rdp_persistent_cache rdpPersistentCache;
+
+/**
+ * A single cached bitmap, identified by its 64-bit persistent key.
+ * On read, data points into the memory-mapped cache file and stays
+ * valid until the next write to the same cache.
+ */
+struct _PERSISTENT_CACHE_ENTRY
+{
+	UINT64 key64;
+	UINT32 cellId;
+	UINT32 width;
+	UINT32 height;
+	UINT32 format;
+	UINT32 size;
+	BYTE* data;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FREERDP_API BOOL persistent_cache_open(rdpPersistentCache* persistent,
+                                       const char* filename, UINT32 maxSize);
+FREERDP_API void persistent_cache_close(rdpPersistentCache* persistent);
+FREERDP_API BOOL persistent_cache_is_open(rdpPersistentCache* persistent);
+
+FREERDP_API BOOL persistent_cache_read_entry(rdpPersistentCache* persistent,
+        UINT64 key64, PERSISTENT_CACHE_ENTRY* entry);
+FREERDP_API BOOL persistent_cache_write_entry(rdpPersistentCache* persistent,
+        const PERSISTENT_CACHE_ENTRY* entry);
+
+FREERDP_API UINT32 persistent_cache_snapshot_keys(rdpPersistentCache* persistent,
+        const BITMAP_CACHE_V2_CELL_INFO* cellInfo, UINT32 numCells);
+FREERDP_API const UINT64* persistent_cache_get_snapshot(rdpPersistentCache* persistent,
+        UINT32 cellId, UINT32* count);
+FREERDP_API UINT32 persistent_cache_get_generation(rdpPersistentCache* persistent);
+
+FREERDP_API char* persistent_cache_get_default_path(rdpSettings* settings,
+        const char* prefix);
+
+FREERDP_API rdpPersistentCache* persistent_cache_new(void);
+FREERDP_API void persistent_cache_free(rdpPersistentCache* persistent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_PERSISTENT_CACHE_H */
@@ -305,6 +305,9 @@ struct _RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU
 typedef struct _RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU
 		RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU;
 
+/* cache entries a Cache Import Offer may list [MS-RDPEGFX] 2.2.2.16 */
+#define RDPGFX_CACHE_ENTRY_MAX_COUNT		5462
+
 struct _RDPGFX_CACHE_ENTRY_METADATA
 {
 	UINT64 cacheKey;
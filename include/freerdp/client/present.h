@@ -0,0 +1,70 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Frame Presentation Scheduler
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_PRESENT_H
+#define FREERDP_CLIENT_PRESENT_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+
+#define PRESENT_DEFAULT_REFRESH_RATE	60
+
+typedef struct rdp_present_scheduler rdpPresentScheduler;
+typedef struct _PRESENT_STATISTICS PRESENT_STATISTICS;
+
+/**
+ * Called with the damage accumulated since the last presentation,
+ * without any scheduler lock held.
+ */
+typedef BOOL (*pcPresentFrame)(void* context, const RECTANGLE_16* rects, UINT32 count);
+
+struct _PRESENT_STATISTICS
+{
+	UINT64 framesCompleted;
+	UINT64 framesPresented;
+	UINT64 framesDropped;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FREERDP_API rdpPresentScheduler* present_scheduler_new(UINT32 refreshRate,
+        pcPresentFrame present, void* context);
+FREERDP_API void present_scheduler_free(rdpPresentScheduler* scheduler);
+
+FREERDP_API BOOL present_scheduler_add_damage(rdpPresentScheduler* scheduler,
+        const RECTANGLE_16* rect);
+FREERDP_API void present_scheduler_end_frame(rdpPresentScheduler* scheduler);
+FREERDP_API void present_scheduler_reset(rdpPresentScheduler* scheduler);
+
+FREERDP_API HANDLE present_scheduler_get_event_handle(rdpPresentScheduler* scheduler);
+FREERDP_API BOOL present_scheduler_is_pending(rdpPresentScheduler* scheduler);
+FREERDP_API DWORD present_scheduler_get_timeout(rdpPresentScheduler* scheduler);
+FREERDP_API BOOL present_scheduler_check(rdpPresentScheduler* scheduler);
+
+FREERDP_API void present_scheduler_set_vsync(rdpPresentScheduler* scheduler, BOOL vsync);
+FREERDP_API BOOL present_scheduler_vblank(rdpPresentScheduler* scheduler);
+
+FREERDP_API void present_scheduler_get_statistics(rdpPresentScheduler* scheduler,
+        PRESENT_STATISTICS* statistics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_CLIENT_PRESENT_H */
@@ -23,6 +23,7 @@
 #define FREERDP_CHANNEL_CLIENT_RDPGFX_H
 
 #include <freerdp/channels/rdpgfx.h>
+#include <freerdp/cache/persistent.h>
 
 /**
  * Client Interface
@@ -76,6 +77,11 @@ typedef void* (*pcRdpgfxGetCacheSlotData)(RdpgfxClientContext* context,
 
 typedef UINT(*pcRdpgfxUpdateSurfaces)(RdpgfxClientContext* context);
 
+typedef UINT(*pcRdpgfxCacheImportEntry)(RdpgfxClientContext* context,
+                                        UINT16 cacheSlot, const PERSISTENT_CACHE_ENTRY* importCacheEntry);
+typedef UINT(*pcRdpgfxExportCacheEntry)(RdpgfxClientContext* context,
+                                        UINT16 cacheSlot, PERSISTENT_CACHE_ENTRY* exportCacheEntry);
+
 struct _rdpgfx_client_context
 {
 	void* handle;
@@ -105,6 +111,9 @@ struct _rdpgfx_client_context
 	pcRdpgfxGetCacheSlotData GetCacheSlotData;
 
 	pcRdpgfxUpdateSurfaces UpdateSurfaces;
+
+	pcRdpgfxCacheImportEntry CacheImportEntry;
+	pcRdpgfxExportCacheEntry ExportCacheEntry;
 };
 
 #endif /* FREERDP_CHANNEL_CLIENT_RDPGFX_H */
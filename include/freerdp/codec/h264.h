@@ -71,6 +71,10 @@ struct _H264_CONTEXT
 	UINT32 iYUV444Stride[3];
 	BYTE* pYUV444Data[3];
 
+	/* size of the 4:2:0 input planes a compressor keeps between frames */
+	UINT32 iYUVEncodeWidth;
+	UINT32 iYUVEncodeHeight;
+
 	UINT32 numSystemData;
 	void* pSystemData;
 	H264_CONTEXT_SUBSYSTEM* subsystem;
@@ -85,6 +89,12 @@ FREERDP_API INT32 avc420_compress(H264_CONTEXT* h264, BYTE* pSrcData,
 				  UINT32 nSrcWidth, UINT32 nSrcHeight,
 				  BYTE** ppDstData, UINT32* pDstSize);
 
+FREERDP_API INT32 avc420_compress_region(H264_CONTEXT* h264, BYTE* pSrcData,
+				  DWORD SrcFormat, UINT32 nSrcStep,
+				  UINT32 nSrcWidth, UINT32 nSrcHeight,
+				  const RECTANGLE_16* regionRects, UINT32 numRegionRects,
+				  BYTE** ppDstData, UINT32* pDstSize);
+
 FREERDP_API INT32 avc420_decompress(H264_CONTEXT* h264, BYTE* pSrcData,
 				    UINT32 SrcSize, BYTE* pDstData,
 				    DWORD DstFormat, UINT32 nDstStep,
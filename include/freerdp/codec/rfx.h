@@ -33,6 +33,7 @@ typedef struct _RFX_CONTEXT RFX_CONTEXT;
 #include <freerdp/constants.h>
 #include <freerdp/codec/region.h>
 
+#include <winpr/pool.h>
 #include <winpr/stream.h>
 
 #ifdef __cplusplus
@@ -198,6 +199,8 @@ FREERDP_API BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width,
                                    UINT32 height);
 
 FREERDP_API RFX_CONTEXT* rfx_context_new(BOOL encoder);
+FREERDP_API RFX_CONTEXT* rfx_context_new_ex(BOOL encoder,
+        PTP_CALLBACK_ENVIRON pcbe);
 FREERDP_API void rfx_context_free(RFX_CONTEXT* context);
 
 #ifdef __cplusplus
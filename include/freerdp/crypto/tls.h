@@ -64,6 +64,7 @@
 #define TLS_ALERT_DESCRIPTION_UNSUPPORTED_EXTENSION	110
 
 typedef struct rdp_tls rdpTls;
+typedef struct _TLS_SESSION_STATISTICS TLS_SESSION_STATISTICS;
 
 struct rdp_tls
 {
@@ -84,6 +85,16 @@ struct rdp_tls
 	BOOL isGatewayTransport;
 };
 
+/* process wide, ClientOffered counts handshakes a cached session was offered in */
+struct _TLS_SESSION_STATISTICS
+{
+	UINT64 ClientHandshakes;
+	UINT64 ClientOffered;
+	UINT64 ClientResumed;
+	UINT64 ServerHandshakes;
+	UINT64 ServerResumed;
+};
+
 #ifdef __cplusplus
  extern "C" {
 #endif
@@ -106,6 +117,8 @@ FREERDP_API void tls_print_certificate_name_mismatch_error(
 
 FREERDP_API BOOL tls_print_error(char* func, SSL* connection, int value);
 
+FREERDP_API void tls_get_session_statistics(TLS_SESSION_STATISTICS* statistics);
+
 FREERDP_API rdpTls* tls_new(rdpSettings* settings);
 FREERDP_API void tls_free(rdpTls* tls);
 
@@ -22,6 +22,18 @@
 
 #include <freerdp/api.h>
 
+/* sent uncompressed, then one entry per bulk compression type */
+#define METRICS_COMPRESSION_LEVELS	5
+
+struct _METRICS_COMPRESSION_LEVEL
+{
+	UINT64 Packets;
+	UINT64 UncompressedBytes;
+	UINT64 CompressedBytes;
+	UINT64 CompressionTime; /* microseconds */
+};
+typedef struct _METRICS_COMPRESSION_LEVEL METRICS_COMPRESSION_LEVEL;
+
 struct rdp_metrics
 {
 	rdpContext* context;
@@ -29,6 +41,8 @@ struct rdp_metrics
 	UINT64 TotalCompressedBytes;
 	UINT64 TotalUncompressedBytes;
 	double TotalCompressionRatio;
+
+	METRICS_COMPRESSION_LEVEL CompressionLevels[METRICS_COMPRESSION_LEVELS];
 };
 
 #ifdef __cplusplus
@@ -36,6 +50,8 @@ struct rdp_metrics
 #endif
 
 FREERDP_API double metrics_write_bytes(rdpMetrics* metrics, UINT32 UncompressedBytes, UINT32 CompressedBytes);
+FREERDP_API void metrics_write_compression(rdpMetrics* metrics, UINT32 level,
+		UINT32 UncompressedBytes, UINT32 CompressedBytes, UINT64 CompressionTime);
 
 FREERDP_API rdpMetrics* metrics_new(rdpContext* context);
 FREERDP_API void metrics_free(rdpMetrics* metrics);
@@ -26,6 +26,7 @@
 #include <freerdp/input.h>
 #include <freerdp/update.h>
 #include <freerdp/autodetect.h>
+#include <freerdp/reactor.h>
 
 #include <winpr/sspi.h>
 
@@ -41,6 +42,9 @@ typedef BOOL (*psPeerCheckFileDescriptor)(freerdp_peer* peer);
 typedef BOOL (*psPeerIsWriteBlocked)(freerdp_peer* peer);
 typedef int (*psPeerDrainOutputBuffer)(freerdp_peer* peer);
 typedef BOOL (*psPeerHasMoreToRead)(freerdp_peer* peer);
+typedef size_t (*psPeerGetOutputQueueSize)(freerdp_peer* peer);
+typedef BOOL (*psPeerIsOutputQueueFull)(freerdp_peer* peer);
+typedef BOOL (*psPeerOutputQueueDrained)(freerdp_peer* peer);
 typedef BOOL (*psPeerClose)(freerdp_peer* peer);
 typedef void (*psPeerDisconnect)(freerdp_peer* peer);
 typedef BOOL (*psPeerCapabilities)(freerdp_peer* peer);
@@ -113,6 +117,10 @@ struct rdp_freerdp_peer
 	psPeerDrainOutputBuffer DrainOutputBuffer;
 	psPeerHasMoreToRead HasMoreToRead;
 	psPeerGetEventHandles GetEventHandles;
+
+	psPeerGetOutputQueueSize GetOutputQueueSize;
+	psPeerIsOutputQueueFull IsOutputQueueFull;
+	psPeerOutputQueueDrained OutputQueueDrained; /* called from CheckFileDescriptor */
 };
 
 #ifdef __cplusplus
@@ -125,6 +133,9 @@ FREERDP_API void freerdp_peer_context_free(freerdp_peer* client);
 FREERDP_API freerdp_peer* freerdp_peer_new(int sockfd);
 FREERDP_API void freerdp_peer_free(freerdp_peer* client);
 
+FREERDP_API rdpReactorSource* freerdp_peer_reactor_add(freerdp_peer* client,
+        rdpReactor* reactor, HANDLE hVirtualChannelManager, pReactorClose close);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,68 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Event Reactor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_REACTOR_H
+#define FREERDP_REACTOR_H
+
+#include <freerdp/api.h>
+#include <freerdp/types.h>
+
+typedef struct rdp_reactor rdpReactor;
+typedef struct rdp_reactor_source rdpReactorSource;
+
+/**
+ * Called on a reactor thread whenever one of the handles of a source is
+ * signaled. Calls for the same source never overlap. Returning FALSE
+ * removes the source.
+ */
+typedef BOOL (*pReactorDispatch)(void* context);
+
+/**
+ * Called on the reactor thread once a source has been removed, the
+ * context may be released here.
+ */
+typedef void (*pReactorClose)(void* context);
+
+/**
+ * Optional, called on the reactor thread after each dispatch to fetch the
+ * current handles of a source whose handle set changes over time. Stores
+ * at most count handles and returns how many, 0 removes the source.
+ */
+typedef DWORD (*pReactorGetHandles)(void* context, HANDLE* handles, DWORD count);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FREERDP_API rdpReactor* freerdp_reactor_new(DWORD threads);
+FREERDP_API void freerdp_reactor_free(rdpReactor* reactor);
+
+FREERDP_API rdpReactorSource* freerdp_reactor_add(rdpReactor* reactor,
+        const HANDLE* handles, DWORD count, pReactorDispatch dispatch,
+        pReactorClose close, void* context);
+FREERDP_API rdpReactorSource* freerdp_reactor_add_ex(rdpReactor* reactor,
+        const HANDLE* handles, DWORD count, pReactorDispatch dispatch,
+        pReactorGetHandles getHandles, pReactorClose close, void* context);
+FREERDP_API void freerdp_reactor_remove(rdpReactor* reactor, rdpReactorSource* source);
+
+FREERDP_API DWORD freerdp_reactor_get_source_count(rdpReactor* reactor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_REACTOR_H */
@@ -92,6 +92,9 @@ FREERDP_API RdpgfxServerContext* rdpgfx_server_context_new(HANDLE vcm);
 FREERDP_API void rdpgfx_server_context_free(RdpgfxServerContext* context);
 FREERDP_API HANDLE rdpgfx_server_get_event_handle(RdpgfxServerContext* context);
 FREERDP_API UINT rdpgfx_server_handle_messages(RdpgfxServerContext* context);
+FREERDP_API BOOL rdpgfx_server_cache_lookup(RdpgfxServerContext* context,
+        UINT64 cacheKey, UINT16* cacheSlot);
+FREERDP_API UINT16 rdpgfx_server_cache_max_slots(RdpgfxServerContext* context);
 
 #ifdef __cplusplus
 }
@@ -39,6 +39,7 @@
 #include <freerdp/codec/region.h>
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
 #include <winpr/synch.h>
 #include <winpr/collections.h>
 
@@ -48,10 +49,23 @@ typedef struct rdp_shadow_screen rdpShadowScreen;
 typedef struct rdp_shadow_surface rdpShadowSurface;
 typedef struct rdp_shadow_encoder rdpShadowEncoder;
 typedef struct rdp_shadow_capture rdpShadowCapture;
+typedef struct rdp_shadow_share rdpShadowShare;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
 
 typedef struct _RDP_SHADOW_ENTRY_POINTS RDP_SHADOW_ENTRY_POINTS;
+
+/**
+ * A block of the previous frame that reappears in the new one: rect is
+ * the destination, the source is rect shifted back by (dx, dy).
+ */
+struct _SHADOW_SURFACE_MOVE
+{
+	RECTANGLE_16 rect;
+	INT32 dx;
+	INT32 dy;
+};
+typedef struct _SHADOW_SURFACE_MOVE SHADOW_SURFACE_MOVE;
 typedef int (*pfnShadowSubsystemEntry)(RDP_SHADOW_ENTRY_POINTS* pEntryPoints);
 
 typedef rdpShadowSubsystem* (*pfnShadowSubsystemNew)(void);
@@ -129,6 +143,7 @@ struct rdp_shadow_server
 	rdpShadowSurface* surface;
 	rdpShadowSurface* lobby;
 	rdpShadowCapture* capture;
+	rdpShadowShare* share;
 	rdpShadowSubsystem* subsystem;
 
 	DWORD port;
@@ -145,6 +160,13 @@ struct rdp_shadow_server
 	UINT32 h264BitRate;
 	FLOAT h264FrameRate;
 	UINT32 h264QP;
+	BOOL h264Region;
+
+	/* worker threads shared by the encoders of all clients */
+	PTP_POOL encodePool;
+	TP_CALLBACK_ENVIRON encodeEnv;
+	UINT32 encodeThreads;
+	volatile LONG encodeJobs;
 
 	char* ipcSocket;
 	char* ConfigPath;
@@ -168,6 +190,10 @@ struct rdp_shadow_surface
 
 	CRITICAL_SECTION lock;
 	REGION16 invalidRegion;
+
+	/* content moved since the last frame, see shadow_capture_detect_move */
+	BOOL moved;
+	SHADOW_SURFACE_MOVE move;
 };
 
 struct _RDP_SHADOW_ENTRY_POINTS
@@ -320,6 +346,10 @@ FREERDP_API int shadow_capture_align_clip_rect(RECTANGLE_16* rect,
         RECTANGLE_16* clip);
 FREERDP_API int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth,
                                        int nHeight, BYTE* pData2, int nStep2, RECTANGLE_16* rect);
+FREERDP_API int shadow_capture_compare_region(BYTE* pData1, int nStep1, int nWidth,
+        int nHeight, BYTE* pData2, int nStep2, REGION16* region);
+FREERDP_API BOOL shadow_capture_detect_move(BYTE* pData1, int nStep1, int nWidth,
+        int nHeight, BYTE* pData2, int nStep2, SHADOW_SURFACE_MOVE* move);
 
 FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
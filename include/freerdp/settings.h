@@ -497,6 +497,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_Password					22
 #define FreeRDP_Domain						23
 #define FreeRDP_PasswordHash					24
+#define FreeRDP_OutputQueueLimit				27
 #define FreeRDP_RdpVersion					128
 #define FreeRDP_DesktopWidth					129
 #define FreeRDP_DesktopHeight					130
@@ -560,6 +561,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_ForceEncryptedCsPdu				719
 #define FreeRDP_HiDefRemoteApp					720
 #define FreeRDP_CompressionLevel				721
+#define FreeRDP_CompressionAdaptive				722
 #define FreeRDP_IPv6Enabled					768
 #define FreeRDP_ClientAddress					769
 #define FreeRDP_ClientDir					770
@@ -603,6 +605,9 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_AllowedTlsCiphers				1101
 #define FreeRDP_VmConnectMode					1102
 #define FreeRDP_NtlmSamFile					1103
+#define FreeRDP_TlsKernelOffload				1104
+#define FreeRDP_TlsSessionResumption				1105
+#define FreeRDP_TlsSessionCacheFile				1106
 #define FreeRDP_MstscCookieMode					1152
 #define FreeRDP_CookieMaxLength					1153
 #define FreeRDP_PreconnectionId					1154
@@ -659,6 +664,8 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_YPan						1553
 #define FreeRDP_SmartSizingWidth				1554
 #define FreeRDP_SmartSizingHeight				1555
+#define FreeRDP_FramePacing					1556
+#define FreeRDP_FramePacingRate					1557
 #define FreeRDP_SoftwareGdi					1601
 #define FreeRDP_LocalConnection					1602
 #define FreeRDP_AuthenticationOnly				1603
@@ -723,6 +730,9 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_BitmapCachePersistEnabled			2500
 #define FreeRDP_BitmapCacheV2NumCells				2501
 #define FreeRDP_BitmapCacheV2CellInfo				2502
+#define FreeRDP_BitmapCachePersistFile				2503
+#define FreeRDP_BitmapCachePersistMaxSize			2504
+#define FreeRDP_BitmapCacheMaxMemory				2505
 #define FreeRDP_ColorPointerFlag				2560
 #define FreeRDP_PointerCacheSize				2561
 #define FreeRDP_KeyboardLayout					2624
@@ -739,6 +749,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_GlyphSupportLevel				2752
 #define FreeRDP_GlyphCache					2753
 #define FreeRDP_FragCache					2754
+#define FreeRDP_GlyphCacheMaxMemory				2755
 #define FreeRDP_OffscreenSupportLevel				2816
 #define FreeRDP_OffscreenCacheSize				2817
 #define FreeRDP_OffscreenCacheEntries				2818
@@ -830,7 +841,8 @@ struct rdp_settings
 	ALIGN64 char* PasswordHash; /* 24 */
 	ALIGN64 BOOL WaitForOutputBufferFlush; /* 25 */
 	ALIGN64 UINT32 MaxTimeInCheckLoop; /* 26 */
-	UINT64 padding0064[64 - 27]; /* 27 */
+	ALIGN64 UINT32 OutputQueueLimit; /* 27 */
+	UINT64 padding0064[64 - 28]; /* 28 */
 	UINT64 padding0128[128 - 64]; /* 64 */
 
 	/**
@@ -942,7 +954,8 @@ struct rdp_settings
 	ALIGN64 BOOL ForceEncryptedCsPdu; /* 719 */
 	ALIGN64 BOOL HiDefRemoteApp; /* 720 */
 	ALIGN64 UINT32 CompressionLevel; /* 721 */
-	UINT64 padding0768[768 - 722]; /* 722 */
+	ALIGN64 BOOL CompressionAdaptive; /* 722 */
+	UINT64 padding0768[768 - 723]; /* 723 */
 
 	/* Client Info (Extra) */
 	ALIGN64 BOOL IPv6Enabled; /* 768 */
@@ -1008,7 +1021,10 @@ struct rdp_settings
 	ALIGN64 char* AllowedTlsCiphers; /* 1101 */
 	ALIGN64 BOOL VmConnectMode; /* 1102 */
 	ALIGN64 char* NtlmSamFile; /* 1103 */
-	UINT64 padding1152[1152 - 1104]; /* 1104 */
+	ALIGN64 BOOL TlsKernelOffload; /* 1104 */
+	ALIGN64 BOOL TlsSessionResumption; /* 1105 */
+	ALIGN64 char* TlsSessionCacheFile; /* 1106 */
+	UINT64 padding1152[1152 - 1107]; /* 1107 */
 
 	/* Connection Cookie */
 	ALIGN64 BOOL MstscCookieMode; /* 1152 */
@@ -1091,7 +1107,9 @@ struct rdp_settings
 	ALIGN64 int YPan; /* 1553 */
 	ALIGN64 UINT32 SmartSizingWidth; /* 1554 */
 	ALIGN64 UINT32 SmartSizingHeight; /* 1555 */
-	UINT64 padding1601[1601 - 1556]; /* 1556 */
+	ALIGN64 BOOL FramePacing; /* 1556 */
+	ALIGN64 UINT32 FramePacingRate; /* 1557 */
+	UINT64 padding1601[1601 - 1558]; /* 1558 */
 
 	/* Miscellaneous */
 	ALIGN64 BOOL SoftwareGdi; /* 1601 */
@@ -1207,7 +1225,10 @@ struct rdp_settings
 	ALIGN64 BOOL BitmapCachePersistEnabled; /* 2500 */
 	ALIGN64 UINT32 BitmapCacheV2NumCells; /* 2501 */
 	ALIGN64 BITMAP_CACHE_V2_CELL_INFO* BitmapCacheV2CellInfo; /* 2502 */
-	UINT64 padding2560[2560 - 2503]; /* 2503 */
+	ALIGN64 char* BitmapCachePersistFile; /* 2503 */
+	ALIGN64 UINT32 BitmapCachePersistMaxSize; /* 2504 */
+	ALIGN64 UINT32 BitmapCacheMaxMemory; /* 2505 */
+	UINT64 padding2560[2560 - 2506]; /* 2506 */
 
 	/* Pointer Capabilities */
 	ALIGN64 BOOL ColorPointerFlag; /* 2560 */
@@ -1236,7 +1257,8 @@ struct rdp_settings
 	ALIGN64 UINT32 GlyphSupportLevel; /* 2752 */
 	ALIGN64 GLYPH_CACHE_DEFINITION* GlyphCache; /* 2753 */
 	ALIGN64 GLYPH_CACHE_DEFINITION* FragCache; /* 2754 */
-	UINT64 padding2816[2816 - 2755]; /* 2755 */
+	ALIGN64 UINT32 GlyphCacheMaxMemory; /* 2755 */
+	UINT64 padding2816[2816 - 2756]; /* 2756 */
 
 	/* Offscreen Bitmap Cache */
 	ALIGN64 UINT32 OffscreenSupportLevel; /* 2816 */
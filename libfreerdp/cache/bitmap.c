@@ -32,16 +32,49 @@
 #include <freerdp/log.h>
 #include <freerdp/cache/bitmap.h>
 #include <freerdp/gdi/bitmap.h>
+#include <freerdp/codec/color.h>
 
 #include "../gdi/gdi.h"
 #include "../core/graphics.h"
+#include "../core/rdp.h"
 
 #define TAG FREERDP_TAG("cache.bitmap")
 
 static rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
 				   UINT32 index);
 static BOOL bitmap_cache_put(rdpBitmapCache* bitmap_cache, UINT32 id,
-			     UINT32 index, rdpBitmap* bitmap);
+			     UINT32 index, rdpBitmap* bitmap, UINT64 key64);
+
+/**
+ * Writes a bitmap to the persistent cache.
+ * @return the persistent key if the bitmap can be reloaded later, 0 otherwise
+ */
+static UINT64 bitmap_cache_persist(rdpBitmapCache* bitmapCache, UINT32 id,
+				   UINT32 key1, UINT32 key2, const rdpBitmap* bitmap)
+{
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpSettings* settings = bitmapCache->settings;
+
+	if (!bitmapCache->persistent || !bitmap->data)
+		return 0;
+
+	if ((id >= settings->BitmapCacheV2NumCells) ||
+	    !settings->BitmapCacheV2CellInfo[id].persistent)
+		return 0;
+
+	entry.key64 = (((UINT64) key2) << 32) | key1;
+	entry.cellId = id;
+	entry.width = bitmap->width;
+	entry.height = bitmap->height;
+	entry.format = bitmap->format;
+	entry.size = bitmap->length;
+	entry.data = bitmap->data;
+
+	if (!persistent_cache_write_entry(bitmapCache->persistent, &entry))
+		return 0;
+
+	return entry.key64;
+}
 
 static BOOL update_gdi_memblt(rdpContext* context,
 			      MEMBLT_ORDER* memblt)
@@ -104,7 +137,6 @@ static BOOL update_gdi_cache_bitmap(rdpContext* context,
 				    const CACHE_BITMAP_ORDER* cacheBitmap)
 {
 	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
 	rdpCache* cache = context->cache;
 	bitmap = Bitmap_Alloc(context);
 
@@ -130,12 +162,9 @@ static BOOL update_gdi_cache_bitmap(rdpContext* context,
 		return FALSE;
 	}
 
-	prevBitmap = bitmap_cache_get(cache->bitmap, cacheBitmap->cacheId,
-				      cacheBitmap->cacheIndex);
-	Bitmap_Free(context, prevBitmap);
 	return bitmap_cache_put(cache->bitmap, cacheBitmap->cacheId,
 				cacheBitmap->cacheIndex,
-				bitmap);
+				bitmap, 0);
 }
 
 static BOOL update_gdi_cache_bitmap_v2(rdpContext* context,
@@ -143,7 +172,7 @@ static BOOL update_gdi_cache_bitmap_v2(rdpContext* context,
 
 {
 	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
+	UINT64 key64 = 0;
 	rdpCache* cache = context->cache;
 	rdpSettings* settings = context->settings;
 	bitmap = Bitmap_Alloc(context);
@@ -173,25 +202,25 @@ static BOOL update_gdi_cache_bitmap_v2(rdpContext* context,
 		return FALSE;
 	}
 
-	prevBitmap = bitmap_cache_get(cache->bitmap, cacheBitmapV2->cacheId,
-				      cacheBitmapV2->cacheIndex);
-
 	if (!bitmap->New(context, bitmap))
 	{
 		Bitmap_Free(context, bitmap);
 		return FALSE;
 	}
 
-	Bitmap_Free(context, prevBitmap);
+	if (cacheBitmapV2->flags & CBR2_PERSISTENT_KEY_PRESENT)
+		key64 = bitmap_cache_persist(cache->bitmap, cacheBitmapV2->cacheId,
+					     cacheBitmapV2->key1, cacheBitmapV2->key2, bitmap);
+
 	return bitmap_cache_put(cache->bitmap, cacheBitmapV2->cacheId,
-				cacheBitmapV2->cacheIndex, bitmap);
+				cacheBitmapV2->cacheIndex, bitmap, key64);
 }
 
 static BOOL update_gdi_cache_bitmap_v3(rdpContext* context,
 				       CACHE_BITMAP_V3_ORDER* cacheBitmapV3)
 {
 	rdpBitmap* bitmap;
-	rdpBitmap* prevBitmap;
+	UINT64 key64;
 	BOOL compressed = TRUE;
 	rdpCache* cache = context->cache;
 	rdpSettings* settings = context->settings;
@@ -222,11 +251,155 @@ static BOOL update_gdi_cache_bitmap_v3(rdpContext* context,
 		return FALSE;
 	}
 
-	prevBitmap = bitmap_cache_get(cache->bitmap, cacheBitmapV3->cacheId,
-				      cacheBitmapV3->cacheIndex);
-	Bitmap_Free(context, prevBitmap);
+	key64 = bitmap_cache_persist(cache->bitmap, cacheBitmapV3->cacheId,
+				     cacheBitmapV3->key1, cacheBitmapV3->key2, bitmap);
 	return bitmap_cache_put(cache->bitmap, cacheBitmapV3->cacheId,
-				cacheBitmapV3->cacheIndex, bitmap);
+				cacheBitmapV3->cacheIndex, bitmap, key64);
+}
+
+static UINT32 bitmap_cache_entry_size(const rdpBitmap* bitmap)
+{
+	return sizeof(rdpBitmap) + bitmap->length;
+}
+
+static void bitmap_cache_drop(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index)
+{
+	BITMAP_V2_CELL* cell = &bitmapCache->cells[id];
+
+	if (!cell->entries[index])
+		return;
+
+	cache_budget_release(bitmapCache->budget, cell->budgetBase + index);
+	Bitmap_Free(bitmapCache->context, cell->entries[index]);
+	cell->entries[index] = NULL;
+}
+
+static void bitmap_cache_evict(rdpBitmapCache* bitmapCache, UINT32 entry)
+{
+	UINT32 id;
+
+	for (id = 0; id < bitmapCache->maxCells; id++)
+	{
+		BITMAP_V2_CELL* cell = &bitmapCache->cells[id];
+
+		if ((entry >= cell->budgetBase) && (entry <= cell->budgetBase + cell->number))
+		{
+			/* already released by the budget, the key allows reloading it */
+			Bitmap_Free(bitmapCache->context, cell->entries[entry - cell->budgetBase]);
+			cell->entries[entry - cell->budgetBase] = NULL;
+			return;
+		}
+	}
+}
+
+static void bitmap_cache_charge(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index)
+{
+	UINT32 victim;
+	BITMAP_V2_CELL* cell = &bitmapCache->cells[id];
+	const UINT32 size = bitmap_cache_entry_size(cell->entries[index]);
+
+	/* only bitmaps backed by the persistent cache can be dropped from memory */
+	while (cache_budget_reclaim(bitmapCache->budget, size, &victim))
+		bitmap_cache_evict(bitmapCache, victim);
+
+	cache_budget_charge(bitmapCache->budget, cell->budgetBase + index, size,
+			    cell->keys[index] ? TRUE : FALSE);
+}
+
+static void bitmap_cache_load_keys(rdpBitmapCache* bitmapCache)
+{
+	UINT32 i, j;
+	UINT32 count;
+	const UINT64* keys;
+
+	for (i = 0; i < bitmapCache->maxCells; i++)
+	{
+		BITMAP_V2_CELL* cell = &bitmapCache->cells[i];
+		keys = persistent_cache_get_snapshot(bitmapCache->persistent, i, &count);
+		ZeroMemory(cell->keys, (cell->number + 1) * sizeof(UINT64));
+
+		for (j = 0; keys && (j < count) && (j < cell->number); j++)
+			cell->keys[j] = keys[j];
+	}
+}
+
+static void bitmap_cache_sync_persistent(rdpBitmapCache* bitmapCache)
+{
+	UINT32 i, j;
+	UINT32 generation;
+
+	if (!bitmapCache->persistent)
+		return;
+
+	generation = persistent_cache_get_generation(bitmapCache->persistent);
+
+	if (generation == bitmapCache->persistentGeneration)
+		return;
+
+	/**
+	 * A new persistent key list was sent (reconnect): the server now
+	 * assumes the cells contain exactly the offered keys.
+	 */
+	for (i = 0; i < bitmapCache->maxCells; i++)
+	{
+		for (j = 0; j < bitmapCache->cells[i].number + 1; j++)
+			bitmap_cache_drop(bitmapCache, i, j);
+	}
+
+	bitmap_cache_load_keys(bitmapCache);
+	bitmapCache->persistentGeneration = generation;
+}
+
+static rdpBitmap* bitmap_cache_load_persistent(rdpBitmapCache* bitmapCache,
+					       UINT32 id, UINT32 index)
+{
+	rdpBitmap* bitmap;
+	PERSISTENT_CACHE_ENTRY entry;
+	rdpContext* context = bitmapCache->context;
+	const UINT64 key64 = bitmapCache->cells[id].keys[index];
+
+	if (!key64)
+		return NULL;
+
+	if (!persistent_cache_read_entry(bitmapCache->persistent, key64, &entry))
+	{
+		WLog_WARN(TAG, "persistent bitmap 0x%08X%08X missing from cache file",
+			  (UINT32)(key64 >> 32), (UINT32)(key64 & 0xFFFFFFFF));
+		bitmapCache->cells[id].keys[index] = 0;
+		return NULL;
+	}
+
+	if ((entry.size != entry.width * entry.height * GetBytesPerPixel(entry.format)) ||
+	    (entry.size == 0))
+		return NULL;
+
+	bitmap = Bitmap_Alloc(context);
+
+	if (!bitmap)
+		return NULL;
+
+	Bitmap_SetDimensions(bitmap, entry.width, entry.height);
+	bitmap->format = entry.format;
+	bitmap->length = entry.size;
+	bitmap->data = (BYTE*) _aligned_malloc(bitmap->length, 16);
+
+	if (!bitmap->data)
+	{
+		Bitmap_Free(context, bitmap);
+		return NULL;
+	}
+
+	CopyMemory(bitmap->data, entry.data, entry.size);
+
+	if (!bitmap->New(context, bitmap))
+	{
+		Bitmap_Free(context, bitmap);
+		return NULL;
+	}
+
+	bitmapCache->cells[id].entries[index] = bitmap;
+	bitmap_cache_charge(bitmapCache, id, index);
+	return bitmap;
 }
 
 rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
@@ -234,7 +407,7 @@ rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
 {
 	rdpBitmap* bitmap;
 
-	if (id > bitmapCache->maxCells)
+	if (id >= bitmapCache->maxCells)
 	{
 		WLog_ERR(TAG,  "get invalid bitmap cell id: %d", id);
 		return NULL;
@@ -250,16 +423,31 @@ rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id,
 		return NULL;
 	}
 
+	bitmap_cache_sync_persistent(bitmapCache);
 	bitmap = bitmapCache->cells[id].entries[index];
+
+	if (bitmap)
+	{
+		cache_budget_hit(bitmapCache->budget, bitmapCache->cells[id].budgetBase + index);
+		return bitmap;
+	}
+
+	cache_budget_miss(bitmapCache->budget);
+
+	/* persistent bitmaps are loaded on first use and after eviction */
+	if (bitmapCache->persistent)
+		bitmap = bitmap_cache_load_persistent(bitmapCache, id, index);
+
 	return bitmap;
 }
 
 BOOL bitmap_cache_put(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index,
-		      rdpBitmap* bitmap)
+		      rdpBitmap* bitmap, UINT64 key64)
 {
-	if (id > bitmapCache->maxCells)
+	if (id >= bitmapCache->maxCells)
 	{
 		WLog_ERR(TAG,  "put invalid bitmap cell id: %d", id);
+		Bitmap_Free(bitmapCache->context, bitmap);
 		return FALSE;
 	}
 
@@ -270,10 +458,18 @@ BOOL bitmap_cache_put(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index,
 	else if (index > bitmapCache->cells[id].number)
 	{
 		WLog_ERR(TAG,  "put invalid bitmap index %d in cell id: %d", index, id);
+		Bitmap_Free(bitmapCache->context, bitmap);
 		return FALSE;
 	}
 
+	bitmap_cache_sync_persistent(bitmapCache);
+	bitmap_cache_drop(bitmapCache, id, index);
 	bitmapCache->cells[id].entries[index] = bitmap;
+	bitmapCache->cells[id].keys[index] = key64;
+
+	if (bitmap)
+		bitmap_cache_charge(bitmapCache, id, index);
+
 	return TRUE;
 }
 
@@ -293,6 +489,7 @@ void bitmap_cache_register_callbacks(rdpUpdate* update)
 rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 {
 	int i;
+	UINT32 count = 0;
 	rdpBitmapCache* bitmapCache;
 	bitmapCache = (rdpBitmapCache*) calloc(1, sizeof(rdpBitmapCache));
 
@@ -303,6 +500,14 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 	bitmapCache->update = ((freerdp*) settings->instance)->update;
 	bitmapCache->context = bitmapCache->update->context;
 	bitmapCache->maxCells = settings->BitmapCacheV2NumCells;
+
+	if (settings->BitmapCachePersistEnabled && bitmapCache->context->rdp)
+	{
+		bitmapCache->persistent = bitmapCache->context->rdp->persistent;
+		bitmapCache->persistentGeneration = persistent_cache_get_generation(
+							    bitmapCache->persistent);
+	}
+
 	bitmapCache->cells = (BITMAP_V2_CELL*) calloc(bitmapCache->maxCells,
 			     sizeof(BITMAP_V2_CELL));
 
@@ -312,27 +517,48 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 	for (i = 0; i < (int) bitmapCache->maxCells; i++)
 	{
 		bitmapCache->cells[i].number = settings->BitmapCacheV2CellInfo[i].numEntries;
+		bitmapCache->cells[i].budgetBase = count;
+		count += bitmapCache->cells[i].number + 1;
 		/* allocate an extra entry for BITMAP_CACHE_WAITING_LIST_INDEX */
 		bitmapCache->cells[i].entries = (rdpBitmap**) calloc((
 						    bitmapCache->cells[i].number + 1), sizeof(rdpBitmap*));
+		bitmapCache->cells[i].keys = (UINT64*) calloc((
+						 bitmapCache->cells[i].number + 1), sizeof(UINT64));
 
-		if (!bitmapCache->cells[i].entries)
+		if (!bitmapCache->cells[i].entries || !bitmapCache->cells[i].keys)
 			goto fail;
 	}
 
+	bitmapCache->budget = cache_budget_new(count, settings->BitmapCacheMaxMemory);
+
+	if (!bitmapCache->budget)
+		goto fail;
+
+	if (bitmapCache->persistent)
+		bitmap_cache_load_keys(bitmapCache);
+
 	return bitmapCache;
 fail:
 
 	if (bitmapCache->cells)
 	{
 		for (i = 0; i < (int) bitmapCache->maxCells; i++)
+		{
 			free(bitmapCache->cells[i].entries);
+			free(bitmapCache->cells[i].keys);
+		}
 	}
 
+	free(bitmapCache->cells);
 	free(bitmapCache);
 	return NULL;
 }
 
+void bitmap_cache_get_statistics(rdpBitmapCache* bitmapCache, CACHE_STATISTICS* statistics)
+{
+	cache_budget_get_statistics(bitmapCache ? bitmapCache->budget : NULL, statistics);
+}
+
 void bitmap_cache_free(rdpBitmapCache* bitmapCache)
 {
 	int i, j;
@@ -349,6 +575,17 @@ void bitmap_cache_free(rdpBitmapCache* bitmapCache)
 			}
 
 			free(bitmapCache->cells[i].entries);
+			free(bitmapCache->cells[i].keys);
+		}
+
+		if (bitmapCache->budget)
+		{
+			CACHE_STATISTICS stats;
+			cache_budget_get_statistics(bitmapCache->budget, &stats);
+			WLog_DBG(TAG, "bitmap cache: %u hits, %u misses, %u evictions, peak %u bytes",
+				 (UINT32) stats.hits, (UINT32) stats.misses,
+				 (UINT32) stats.evictions, (UINT32) stats.peakBytes);
+			cache_budget_free(bitmapCache->budget);
 		}
 
 		free(bitmapCache->cells);
@@ -0,0 +1,219 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Cache Memory Budget
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+
+#include <freerdp/cache/budget.h>
+
+#define CACHE_BUDGET_NIL	0xFFFFFFFF
+
+typedef struct _CACHE_BUDGET_ENTRY CACHE_BUDGET_ENTRY;
+
+struct _CACHE_BUDGET_ENTRY
+{
+	UINT32 prev;
+	UINT32 next;
+	UINT32 bytes;
+	BOOL charged;
+	BOOL linked;
+};
+
+struct rdp_cache_budget
+{
+	UINT32 count;
+	CACHE_BUDGET_ENTRY* entries;
+
+	/* most recently used first */
+	UINT32 head;
+	UINT32 tail;
+
+	CACHE_STATISTICS stats;
+};
+
+static void cache_budget_unlink(rdpCacheBudget* budget, UINT32 entry)
+{
+	CACHE_BUDGET_ENTRY* e = &budget->entries[entry];
+
+	if (!e->linked)
+		return;
+
+	if (e->prev != CACHE_BUDGET_NIL)
+		budget->entries[e->prev].next = e->next;
+	else
+		budget->head = e->next;
+
+	if (e->next != CACHE_BUDGET_NIL)
+		budget->entries[e->next].prev = e->prev;
+	else
+		budget->tail = e->prev;
+
+	e->prev = e->next = CACHE_BUDGET_NIL;
+	e->linked = FALSE;
+}
+
+static void cache_budget_push_front(rdpCacheBudget* budget, UINT32 entry)
+{
+	CACHE_BUDGET_ENTRY* e = &budget->entries[entry];
+	e->prev = CACHE_BUDGET_NIL;
+	e->next = budget->head;
+
+	if (budget->head != CACHE_BUDGET_NIL)
+		budget->entries[budget->head].prev = entry;
+	else
+		budget->tail = entry;
+
+	budget->head = entry;
+	e->linked = TRUE;
+}
+
+rdpCacheBudget* cache_budget_new(UINT32 count, UINT64 maxBytes)
+{
+	UINT32 i;
+	rdpCacheBudget* budget = (rdpCacheBudget*) calloc(1, sizeof(rdpCacheBudget));
+
+	if (!budget)
+		return NULL;
+
+	budget->count = count;
+	budget->head = budget->tail = CACHE_BUDGET_NIL;
+	budget->stats.maxBytes = maxBytes;
+	budget->entries = (CACHE_BUDGET_ENTRY*) calloc(count + 1, sizeof(CACHE_BUDGET_ENTRY));
+
+	if (!budget->entries)
+	{
+		free(budget);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++)
+		budget->entries[i].prev = budget->entries[i].next = CACHE_BUDGET_NIL;
+
+	return budget;
+}
+
+void cache_budget_free(rdpCacheBudget* budget)
+{
+	if (!budget)
+		return;
+
+	free(budget->entries);
+	free(budget);
+}
+
+void cache_budget_charge(rdpCacheBudget* budget, UINT32 entry, UINT32 bytes,
+                         BOOL evictable)
+{
+	CACHE_BUDGET_ENTRY* e;
+
+	if (!budget || (entry >= budget->count))
+		return;
+
+	cache_budget_release(budget, entry);
+	e = &budget->entries[entry];
+	e->bytes = bytes;
+	e->charged = TRUE;
+	budget->stats.usedBytes += bytes;
+
+	if (budget->stats.usedBytes > budget->stats.peakBytes)
+		budget->stats.peakBytes = budget->stats.usedBytes;
+
+	if (evictable)
+		cache_budget_push_front(budget, entry);
+}
+
+void cache_budget_release(rdpCacheBudget* budget, UINT32 entry)
+{
+	CACHE_BUDGET_ENTRY* e;
+
+	if (!budget || (entry >= budget->count))
+		return;
+
+	e = &budget->entries[entry];
+
+	if (!e->charged)
+		return;
+
+	cache_budget_unlink(budget, entry);
+	budget->stats.usedBytes -= e->bytes;
+	e->bytes = 0;
+	e->charged = FALSE;
+}
+
+void cache_budget_hit(rdpCacheBudget* budget, UINT32 entry)
+{
+	if (!budget || (entry >= budget->count))
+		return;
+
+	budget->stats.hits++;
+
+	if (budget->entries[entry].linked && (budget->head != entry))
+	{
+		cache_budget_unlink(budget, entry);
+		cache_budget_push_front(budget, entry);
+	}
+}
+
+void cache_budget_miss(rdpCacheBudget* budget)
+{
+	if (budget)
+		budget->stats.misses++;
+}
+
+/**
+ * Picks the least recently used evictable entry if charging another
+ * bytes would exceed the budget. The entry is released from the budget,
+ * the caller is expected to free the object it stands for and call
+ * again until FALSE is returned.
+ */
+BOOL cache_budget_reclaim(rdpCacheBudget* budget, UINT32 bytes, UINT32* entry)
+{
+	UINT32 victim;
+
+	if (!budget || !entry || !budget->stats.maxBytes)
+		return FALSE;
+
+	if (budget->stats.usedBytes + bytes <= budget->stats.maxBytes)
+		return FALSE;
+
+	victim = budget->tail;
+
+	if (victim == CACHE_BUDGET_NIL)
+		return FALSE;
+
+	cache_budget_release(budget, victim);
+	budget->stats.evictions++;
+	*entry = victim;
+	return TRUE;
+}
+
+void cache_budget_get_statistics(rdpCacheBudget* budget, CACHE_STATISTICS* statistics)
+{
+	if (!statistics)
+		return;
+
+	if (!budget)
+	{
+		ZeroMemory(statistics, sizeof(CACHE_STATISTICS));
+		return;
+	}
+
+	*statistics = budget->stats;
+}
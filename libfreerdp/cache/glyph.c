@@ -36,7 +36,8 @@
 static rdpGlyph* glyph_cache_get(rdpGlyphCache* glyph_cache, UINT32 id,
                                  UINT32 index);
 static BOOL glyph_cache_put(rdpGlyphCache* glyph_cache, UINT32 id, UINT32 index,
-                            rdpGlyph* entry);
+                            INT32 x, INT32 y, UINT32 cx, UINT32 cy, UINT32 cb,
+                            const BYTE* aj);
 
 static const void* glyph_cache_fragment_get(rdpGlyphCache* glyph, UINT32 index,
         UINT32* count);
@@ -452,25 +453,12 @@ static BOOL update_gdi_fast_glyph(rdpContext* context,
 	if ((fastGlyph->cbData > 1) && (fastGlyph->glyphData.aj))
 	{
 		/* got option font that needs to go into cache */
-		rdpGlyph* glyph;
 		const GLYPH_DATA_V2* glyphData = &fastGlyph->glyphData;
 
-		if (!glyphData)
-			return FALSE;
-
-		glyph = Glyph_Alloc(context, glyphData->x, glyphData->y, glyphData->cx,
-		                    glyphData->cy,
-		                    glyphData->cb, glyphData->aj);
-
-		if (!glyph)
-			return FALSE;
-
 		if (!glyph_cache_put(cache->glyph, fastGlyph->cacheId, fastGlyph->data[0],
-		                     glyph))
-		{
-			glyph->Free(context, glyph);
+		                     glyphData->x, glyphData->y, glyphData->cx, glyphData->cy,
+		                     glyphData->cb, glyphData->aj))
 			return FALSE;
-		}
 	}
 
 	text_data[0] = fastGlyph->data[0];
@@ -510,25 +498,14 @@ static BOOL update_gdi_cache_glyph(rdpContext* context,
 	for (i = 0; i < cacheGlyph->cGlyphs; i++)
 	{
 		const GLYPH_DATA* glyph_data = &cacheGlyph->glyphData[i];
-		rdpGlyph* glyph;
 
 		if (!glyph_data)
 			return FALSE;
 
-		if (!(glyph = Glyph_Alloc(context, glyph_data->x,
-		                          glyph_data->y,
-		                          glyph_data->cx,
-		                          glyph_data->cy,
-		                          glyph_data->cb,
-		                          glyph_data->aj)))
-			return FALSE;
-
 		if (!glyph_cache_put(cache->glyph, cacheGlyph->cacheId, glyph_data->cacheIndex,
-		                     glyph))
-		{
-			glyph->Free(context, glyph);
+		                     glyph_data->x, glyph_data->y, glyph_data->cx, glyph_data->cy,
+		                     glyph_data->cb, glyph_data->aj))
 			return FALSE;
-		}
 	}
 
 	return TRUE;
@@ -548,35 +525,68 @@ static BOOL update_gdi_cache_glyph_v2(rdpContext* context,
 	for (i = 0; i < cacheGlyphV2->cGlyphs; i++)
 	{
 		const GLYPH_DATA_V2* glyphData = &cacheGlyphV2->glyphData[i];
-		rdpGlyph* glyph;
 
 		if (!glyphData)
 			return FALSE;
 
-		glyph = Glyph_Alloc(context, glyphData->x,
-		                    glyphData->y,
-		                    glyphData->cx,
-		                    glyphData->cy,
-		                    glyphData->cb,
-		                    glyphData->aj);
-
-		if (!glyph)
-			return FALSE;
-
 		if (!glyph_cache_put(cache->glyph, cacheGlyphV2->cacheId, glyphData->cacheIndex,
-		                     glyph))
-		{
-			glyph->Free(context, glyph);
+		                     glyphData->x, glyphData->y, glyphData->cx, glyphData->cy,
+		                     glyphData->cb, glyphData->aj))
 			return FALSE;
-		}
 	}
 
 	return TRUE;
 }
 
+static UINT32 glyph_cache_entry_size(const GLYPH_CACHE_CELL* cell)
+{
+	/* the glyph bitmap is kept as a copy plus an expanded 8bpp image */
+	return sizeof(rdpGlyph) + cell->cb + cell->cx * cell->cy;
+}
+
+static void glyph_cache_drop(rdpGlyphCache* glyphCache, UINT32 id, UINT32 index)
+{
+	GLYPH_CACHE* cache = &glyphCache->glyphCache[id];
+	rdpGlyph* glyph = cache->entries[index];
+
+	if (!glyph)
+		return;
+
+	cache_budget_release(glyphCache->budget, cache->budgetBase + index);
+	glyph->Free(glyphCache->context, glyph);
+	cache->entries[index] = NULL;
+}
+
+static void glyph_cache_evict(rdpGlyphCache* glyphCache, UINT32 entry)
+{
+	UINT32 id;
+
+	for (id = 0; id < 10; id++)
+	{
+		GLYPH_CACHE* cache = &glyphCache->glyphCache[id];
+
+		if ((entry >= cache->budgetBase) && (entry < cache->budgetBase + cache->number))
+		{
+			/* already released by the budget */
+			rdpGlyph* glyph = cache->entries[entry - cache->budgetBase];
+
+			if (glyph)
+				glyph->Free(glyphCache->context, glyph);
+
+			cache->entries[entry - cache->budgetBase] = NULL;
+			return;
+		}
+	}
+}
+
 rdpGlyph* glyph_cache_get(rdpGlyphCache* glyphCache, UINT32 id, UINT32 index)
 {
+	UINT32 size;
+	UINT32 victim;
 	rdpGlyph* glyph;
+	GLYPH_CACHE* cache;
+	GLYPH_CACHE_CELL* cell;
+	const BYTE* aj;
 	WLog_Print(glyphCache->log, WLOG_DEBUG, "GlyphCacheGet: id: %d index: %d", id,
 	           index);
 
@@ -586,24 +596,54 @@ rdpGlyph* glyph_cache_get(rdpGlyphCache* glyphCache, UINT32 id, UINT32 index)
 		return NULL;
 	}
 
-	if (index > glyphCache->glyphCache[id].number)
+	cache = &glyphCache->glyphCache[id];
+
+	if (index >= cache->number)
 	{
 		WLog_ERR(TAG, "index %d out of range for cache id: %d", index, id);
 		return NULL;
 	}
 
-	glyph = glyphCache->glyphCache[id].entries[index];
+	glyph = cache->entries[index];
 
-	if (!glyph)
+	if (glyph)
+	{
+		cache_budget_hit(glyphCache->budget, cache->budgetBase + index);
+		return glyph;
+	}
+
+	cache_budget_miss(glyphCache->budget);
+	cell = &cache->cells[index];
+
+	if (!cell->valid)
+	{
 		WLog_ERR(TAG, "no glyph found at cache index: %d in cache id: %d", index, id);
+		return NULL;
+	}
 
+	size = glyph_cache_entry_size(cell);
+
+	while (cache_budget_reclaim(glyphCache->budget, size, &victim))
+		glyph_cache_evict(glyphCache, victim);
+
+	aj = cell->overflow ? cell->overflow : &cache->atlas[index * cache->maxCellSize];
+	glyph = Glyph_Alloc(glyphCache->context, cell->x, cell->y, cell->cx, cell->cy,
+	                    cell->cb, aj);
+
+	if (!glyph)
+		return NULL;
+
+	cache->entries[index] = glyph;
+	cache_budget_charge(glyphCache->budget, cache->budgetBase + index, size, TRUE);
 	return glyph;
 }
 
 BOOL glyph_cache_put(rdpGlyphCache* glyphCache, UINT32 id, UINT32 index,
-                     rdpGlyph* glyph)
+                     INT32 x, INT32 y, UINT32 cx, UINT32 cy, UINT32 cb,
+                     const BYTE* aj)
 {
-	rdpGlyph* prevGlyph;
+	GLYPH_CACHE* cache;
+	GLYPH_CACHE_CELL* cell;
 
 	if (id > 9)
 	{
@@ -611,20 +651,44 @@ BOOL glyph_cache_put(rdpGlyphCache* glyphCache, UINT32 id, UINT32 index,
 		return FALSE;
 	}
 
-	if (index > glyphCache->glyphCache[id].number)
+	cache = &glyphCache->glyphCache[id];
+
+	if (index >= cache->number)
 	{
 		WLog_ERR(TAG, "invalid glyph cache index: %d in cache id: %d", index, id);
 		return FALSE;
 	}
 
+	if (!aj && (cb > 0))
+		return FALSE;
+
 	WLog_Print(glyphCache->log, WLOG_DEBUG, "GlyphCachePut: id: %d index: %d", id,
 	           index);
-	prevGlyph = glyphCache->glyphCache[id].entries[index];
+	glyph_cache_drop(glyphCache, id, index);
+	cell = &cache->cells[index];
+	free(cell->overflow);
+	cell->overflow = NULL;
+	cell->valid = FALSE;
+
+	/* servers should honour the announced cell size, keep oversized glyphs anyway */
+	if (cb > cache->maxCellSize)
+	{
+		cell->overflow = (BYTE*) malloc(cb);
 
-	if (prevGlyph)
-		prevGlyph->Free(glyphCache->context, prevGlyph);
+		if (!cell->overflow)
+			return FALSE;
 
-	glyphCache->glyphCache[id].entries[index] = glyph;
+		CopyMemory(cell->overflow, aj, cb);
+	}
+	else if (cb > 0)
+		CopyMemory(&cache->atlas[index * cache->maxCellSize], aj, cb);
+
+	cell->x = x;
+	cell->y = y;
+	cell->cx = cx;
+	cell->cy = cy;
+	cell->cb = cb;
+	cell->valid = TRUE;
 	return TRUE;
 }
 
@@ -689,6 +753,7 @@ void glyph_cache_register_callbacks(rdpUpdate* update)
 rdpGlyphCache* glyph_cache_new(rdpSettings* settings)
 {
 	int i;
+	UINT32 count = 0;
 	rdpGlyphCache* glyphCache;
 	glyphCache = (rdpGlyphCache*) calloc(1, sizeof(rdpGlyphCache));
 
@@ -702,16 +767,24 @@ rdpGlyphCache* glyph_cache_new(rdpSettings* settings)
 
 	for (i = 0; i < 10; i++)
 	{
-		glyphCache->glyphCache[i].number = settings->GlyphCache[i].cacheEntries;
-		glyphCache->glyphCache[i].maxCellSize =
-		    settings->GlyphCache[i].cacheMaximumCellSize;
-		glyphCache->glyphCache[i].entries = (rdpGlyph**) calloc(
-		                                        glyphCache->glyphCache[i].number, sizeof(rdpGlyph*));
-
-		if (!glyphCache->glyphCache[i].entries)
+		GLYPH_CACHE* cache = &glyphCache->glyphCache[i];
+		cache->number = settings->GlyphCache[i].cacheEntries;
+		cache->maxCellSize = settings->GlyphCache[i].cacheMaximumCellSize;
+		cache->budgetBase = count;
+		count += cache->number;
+		cache->entries = (rdpGlyph**) calloc(cache->number + 1, sizeof(rdpGlyph*));
+		cache->cells = (GLYPH_CACHE_CELL*) calloc(cache->number + 1, sizeof(GLYPH_CACHE_CELL));
+		cache->atlas = (BYTE*) calloc(cache->number + 1, cache->maxCellSize);
+
+		if (!cache->entries || !cache->cells || !cache->atlas)
 			goto fail;
 	}
 
+	glyphCache->budget = cache_budget_new(count, settings->GlyphCacheMaxMemory);
+
+	if (!glyphCache->budget)
+		goto fail;
+
 	glyphCache->fragCache.entries = calloc(256, sizeof(FRAGMENT_CACHE_ENTRY));
 
 	if (!glyphCache->fragCache.entries)
@@ -723,6 +796,11 @@ fail:
 	return NULL;
 }
 
+void glyph_cache_get_statistics(rdpGlyphCache* glyphCache, CACHE_STATISTICS* statistics)
+{
+	cache_budget_get_statistics(glyphCache ? glyphCache->budget : NULL, statistics);
+}
+
 void glyph_cache_free(rdpGlyphCache* glyphCache)
 {
 	if (glyphCache)
@@ -749,11 +827,33 @@ void glyph_cache_free(rdpGlyphCache* glyphCache)
 						glyph->Free(glyphCache->context, glyph);
 						entries[j] = NULL;
 					}
+
+					if (cache[i].cells)
+						free(cache[i].cells[j].overflow);
 				}
 
 				free(entries);
 				cache[i].entries = NULL;
 			}
+
+			for (i = 0; i < 10; i++)
+			{
+				free(cache[i].cells);
+				free(cache[i].atlas);
+				cache[i].cells = NULL;
+				cache[i].atlas = NULL;
+			}
+		}
+
+		if (glyphCache->budget)
+		{
+			CACHE_STATISTICS stats;
+			cache_budget_get_statistics(glyphCache->budget, &stats);
+			WLog_Print(glyphCache->log, WLOG_DEBUG,
+			           "glyph cache: %u hits, %u misses, %u evictions, peak %u bytes",
+			           (UINT32) stats.hits, (UINT32) stats.misses,
+			           (UINT32) stats.evictions, (UINT32) stats.peakBytes);
+			cache_budget_free(glyphCache->budget);
 		}
 
 		if (glyphCache->fragCache.entries)
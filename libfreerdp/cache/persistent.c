@@ -0,0 +1,851 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Bitmap Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/collections.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <freerdp/log.h>
+#include <freerdp/cache/persistent.h>
+
+#define TAG FREERDP_TAG("cache.persistent")
+
+/**
+ * The cache file is a fixed-size, memory-mapped file:
+ *
+ * | header | class 0 slots | class 1 slots | class 2 slots |
+ *
+ * Each size class holds fixed-size slots (slot header followed by pixel data)
+ * large enough for 16x16, 32x32 and 64x64 tiles at 32bpp respectively.
+ * The byte budget given to persistent_cache_open() is split evenly between
+ * the classes. Every slot carries a usage stamp taken from a monotonic clock
+ * stored in the file header, which is used to rebuild the LRU order on load.
+ */
+
+#define PERSISTENT_CACHE_SIGNATURE		"FRDPBMC"
+#define PERSISTENT_CACHE_VERSION		1
+#define PERSISTENT_CACHE_CLASS_COUNT		3
+#define PERSISTENT_CACHE_DEFAULT_SIZE		(32 * 1024 * 1024)
+#define PERSISTENT_CACHE_NIL			0xFFFFFFFF
+
+static const UINT32 PERSISTENT_CACHE_SLOT_SIZE[PERSISTENT_CACHE_CLASS_COUNT] =
+{
+	16 * 16 * 4,
+	32 * 32 * 4,
+	64 * 64 * 4
+};
+
+struct _PERSISTENT_CACHE_HEADER
+{
+	BYTE signature[8];
+	UINT32 version;
+	UINT32 classCount;
+	UINT32 slotSize[PERSISTENT_CACHE_CLASS_COUNT];
+	UINT32 slotCount[PERSISTENT_CACHE_CLASS_COUNT];
+	UINT64 clock;
+};
+typedef struct _PERSISTENT_CACHE_HEADER PERSISTENT_CACHE_HEADER;
+
+struct _PERSISTENT_CACHE_SLOT
+{
+	UINT64 key64;
+	UINT64 stamp; /* 0 means the slot is free */
+	UINT16 width;
+	UINT16 height;
+	UINT32 format;
+	UINT32 size;
+	UINT32 cellId;
+};
+typedef struct _PERSISTENT_CACHE_SLOT PERSISTENT_CACHE_SLOT;
+
+struct _PERSISTENT_CACHE_CLASS
+{
+	BYTE* slots;
+	UINT32 slotSize;
+	UINT32 stride;
+	UINT32 count;
+	UINT32 head; /* most recently used */
+	UINT32 tail; /* least recently used or free */
+	UINT32* prev;
+	UINT32* next;
+	BYTE* pinned; /* offered in the current persistent key list */
+};
+typedef struct _PERSISTENT_CACHE_CLASS PERSISTENT_CACHE_CLASS;
+
+struct rdp_persistent_cache
+{
+#ifdef _WIN32
+	HANDLE hFile;
+	HANDLE hMap;
+#else
+	int fd;
+#endif
+	BYTE* base;
+	size_t length;
+	PERSISTENT_CACHE_HEADER* header;
+	PERSISTENT_CACHE_CLASS classes[PERSISTENT_CACHE_CLASS_COUNT];
+	wHashTable* index;
+
+	UINT32 generation;
+	UINT32 snapshotCount[PERSISTENT_CACHE_MAX_CELLS];
+	UINT64* snapshot[PERSISTENT_CACHE_MAX_CELLS];
+};
+
+struct _PERSISTENT_CACHE_STAMP
+{
+	UINT64 stamp;
+	UINT64 key64;
+	UINT32 index;
+};
+typedef struct _PERSISTENT_CACHE_STAMP PERSISTENT_CACHE_STAMP;
+
+static UINT32 persistent_cache_key_hash(void* key)
+{
+	UINT64 key64 = *((UINT64*) key);
+	return (UINT32)(key64 ^ (key64 >> 32));
+}
+
+static BOOL persistent_cache_key_compare(void* key1, void* key2)
+{
+	return (*((UINT64*) key1) == *((UINT64*) key2)) ? TRUE : FALSE;
+}
+
+static int persistent_cache_stamp_compare(const void* a, const void* b)
+{
+	const PERSISTENT_CACHE_STAMP* sa = (const PERSISTENT_CACHE_STAMP*) a;
+	const PERSISTENT_CACHE_STAMP* sb = (const PERSISTENT_CACHE_STAMP*) b;
+
+	/* most recent first */
+	if (sa->stamp > sb->stamp)
+		return -1;
+
+	if (sa->stamp < sb->stamp)
+		return 1;
+
+	return 0;
+}
+
+static PERSISTENT_CACHE_SLOT* persistent_cache_slot(PERSISTENT_CACHE_CLASS* cls, UINT32 index)
+{
+	return (PERSISTENT_CACHE_SLOT*) &cls->slots[(size_t) index * cls->stride];
+}
+
+static void* persistent_cache_index_value(UINT32 classId, UINT32 index)
+{
+	/* offset by one so that slot 0 of class 0 is not a NULL value */
+	return (void*)(ULONG_PTR)((((ULONG_PTR) index) << 2) + classId + 1);
+}
+
+static void persistent_cache_lru_unlink(PERSISTENT_CACHE_CLASS* cls, UINT32 index)
+{
+	UINT32 prev = cls->prev[index];
+	UINT32 next = cls->next[index];
+
+	if (prev != PERSISTENT_CACHE_NIL)
+		cls->next[prev] = next;
+	else
+		cls->head = next;
+
+	if (next != PERSISTENT_CACHE_NIL)
+		cls->prev[next] = prev;
+	else
+		cls->tail = prev;
+
+	cls->prev[index] = cls->next[index] = PERSISTENT_CACHE_NIL;
+}
+
+static void persistent_cache_lru_push_front(PERSISTENT_CACHE_CLASS* cls, UINT32 index)
+{
+	cls->prev[index] = PERSISTENT_CACHE_NIL;
+	cls->next[index] = cls->head;
+
+	if (cls->head != PERSISTENT_CACHE_NIL)
+		cls->prev[cls->head] = index;
+	else
+		cls->tail = index;
+
+	cls->head = index;
+}
+
+static void persistent_cache_lru_push_back(PERSISTENT_CACHE_CLASS* cls, UINT32 index)
+{
+	cls->next[index] = PERSISTENT_CACHE_NIL;
+	cls->prev[index] = cls->tail;
+
+	if (cls->tail != PERSISTENT_CACHE_NIL)
+		cls->next[cls->tail] = index;
+	else
+		cls->head = index;
+
+	cls->tail = index;
+}
+
+static void persistent_cache_touch(rdpPersistentCache* persistent, PERSISTENT_CACHE_CLASS* cls,
+                                   UINT32 index)
+{
+	PERSISTENT_CACHE_SLOT* slot = persistent_cache_slot(cls, index);
+	slot->stamp = ++persistent->header->clock;
+
+	if (cls->head != index)
+	{
+		persistent_cache_lru_unlink(cls, index);
+		persistent_cache_lru_push_front(cls, index);
+	}
+}
+
+static BOOL persistent_cache_map(rdpPersistentCache* persistent, const char* filename,
+                                 size_t length)
+{
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	/* no sharing: a cache file is owned by a single session at a time */
+	persistent->hFile = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+	                                OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (persistent->hFile == INVALID_HANDLE_VALUE)
+	{
+		WLog_WARN(TAG, "unable to open persistent cache file %s", filename);
+		return FALSE;
+	}
+
+	if (!GetFileSizeEx(persistent->hFile, &size))
+		return FALSE;
+
+	if ((UINT64) size.QuadPart != length)
+	{
+		size.QuadPart = 0;
+
+		if (!SetFilePointerEx(persistent->hFile, size, NULL, FILE_BEGIN) ||
+		    !SetEndOfFile(persistent->hFile))
+			return FALSE;
+
+		size.QuadPart = length;
+
+		if (!SetFilePointerEx(persistent->hFile, size, NULL, FILE_BEGIN) ||
+		    !SetEndOfFile(persistent->hFile))
+			return FALSE;
+	}
+
+	persistent->hMap = CreateFileMappingA(persistent->hFile, NULL, PAGE_READWRITE, 0, 0, NULL);
+
+	if (!persistent->hMap)
+		return FALSE;
+
+	persistent->base = (BYTE*) MapViewOfFile(persistent->hMap, FILE_MAP_ALL_ACCESS, 0, 0, length);
+
+	if (!persistent->base)
+		return FALSE;
+
+#else
+	struct flock lock;
+	struct stat sb;
+	void* base;
+	persistent->fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+
+	if (persistent->fd < 0)
+	{
+		WLog_WARN(TAG, "unable to open persistent cache file %s", filename);
+		return FALSE;
+	}
+
+	ZeroMemory(&lock, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+
+	/* a cache file is owned by a single session at a time */
+	if (fcntl(persistent->fd, F_SETLK, &lock) < 0)
+	{
+		WLog_WARN(TAG, "persistent cache file %s is in use by another session", filename);
+		return FALSE;
+	}
+
+	if (fstat(persistent->fd, &sb) < 0)
+		return FALSE;
+
+	if ((size_t) sb.st_size != length)
+	{
+		/* truncating first guarantees a zero-filled file, i.e. all slots free */
+		if ((ftruncate(persistent->fd, 0) < 0) ||
+		    (ftruncate(persistent->fd, (off_t) length) < 0))
+			return FALSE;
+	}
+
+	base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, persistent->fd, 0);
+
+	if (base == MAP_FAILED)
+		return FALSE;
+
+	persistent->base = (BYTE*) base;
+#endif
+	persistent->length = length;
+	return TRUE;
+}
+
+static void persistent_cache_unmap(rdpPersistentCache* persistent)
+{
+#ifdef _WIN32
+
+	if (persistent->base)
+	{
+		FlushViewOfFile(persistent->base, 0);
+		UnmapViewOfFile(persistent->base);
+	}
+
+	if (persistent->hMap)
+		CloseHandle(persistent->hMap);
+
+	if (persistent->hFile && (persistent->hFile != INVALID_HANDLE_VALUE))
+		CloseHandle(persistent->hFile);
+
+	persistent->hMap = NULL;
+	persistent->hFile = NULL;
+#else
+
+	if (persistent->base)
+	{
+		msync(persistent->base, persistent->length, MS_ASYNC);
+		munmap(persistent->base, persistent->length);
+	}
+
+	if (persistent->fd >= 0)
+		close(persistent->fd);
+
+	persistent->fd = -1;
+#endif
+	persistent->base = NULL;
+	persistent->length = 0;
+}
+
+static BOOL persistent_cache_load_class(rdpPersistentCache* persistent, UINT32 classId)
+{
+	UINT32 index;
+	UINT32 used = 0;
+	PERSISTENT_CACHE_STAMP* stamps;
+	PERSISTENT_CACHE_CLASS* cls = &persistent->classes[classId];
+	cls->head = cls->tail = PERSISTENT_CACHE_NIL;
+	cls->prev = (UINT32*) calloc(cls->count, sizeof(UINT32));
+	cls->next = (UINT32*) calloc(cls->count, sizeof(UINT32));
+	cls->pinned = (BYTE*) calloc(cls->count, sizeof(BYTE));
+	stamps = (PERSISTENT_CACHE_STAMP*) calloc(cls->count, sizeof(PERSISTENT_CACHE_STAMP));
+
+	if (!cls->prev || !cls->next || !cls->pinned || !stamps)
+	{
+		free(stamps);
+		return FALSE;
+	}
+
+	for (index = 0; index < cls->count; index++)
+	{
+		PERSISTENT_CACHE_SLOT* slot = persistent_cache_slot(cls, index);
+
+		if (slot->stamp && ((slot->size > cls->slotSize) || (slot->cellId >= PERSISTENT_CACHE_MAX_CELLS)
+		                    || (slot->stamp > persistent->header->clock)))
+		{
+			WLog_WARN(TAG, "discarding corrupt persistent cache entry 0x%08X%08X",
+			          (UINT32)(slot->key64 >> 32), (UINT32)(slot->key64 & 0xFFFFFFFF));
+			slot->stamp = 0;
+		}
+
+		if (slot->stamp && HashTable_Contains(persistent->index, &slot->key64))
+			slot->stamp = 0;
+
+		if (slot->stamp)
+		{
+			if (HashTable_Add(persistent->index, &slot->key64,
+			                  persistent_cache_index_value(classId, index)) < 0)
+			{
+				free(stamps);
+				return FALSE;
+			}
+
+			used++;
+		}
+
+		stamps[index].stamp = slot->stamp;
+		stamps[index].index = index;
+	}
+
+	/* rebuild the LRU list, free slots end up at the tail */
+	qsort(stamps, cls->count, sizeof(PERSISTENT_CACHE_STAMP), persistent_cache_stamp_compare);
+
+	for (index = 0; index < cls->count; index++)
+		persistent_cache_lru_push_back(cls, stamps[index].index);
+
+	free(stamps);
+	WLog_DBG(TAG, "persistent cache class %u: %u/%u slots in use",
+	         classId, used, cls->count);
+	return TRUE;
+}
+
+BOOL persistent_cache_open(rdpPersistentCache* persistent, const char* filename, UINT32 maxSize)
+{
+	UINT32 i;
+	size_t length;
+	size_t offset;
+	BOOL valid;
+	PERSISTENT_CACHE_HEADER* header;
+	UINT32 slotCount[PERSISTENT_CACHE_CLASS_COUNT];
+
+	if (!persistent || !filename)
+		return FALSE;
+
+	persistent_cache_close(persistent);
+
+	if (!maxSize)
+		maxSize = PERSISTENT_CACHE_DEFAULT_SIZE;
+
+	length = sizeof(PERSISTENT_CACHE_HEADER);
+
+	for (i = 0; i < PERSISTENT_CACHE_CLASS_COUNT; i++)
+	{
+		UINT32 stride = sizeof(PERSISTENT_CACHE_SLOT) + PERSISTENT_CACHE_SLOT_SIZE[i];
+		slotCount[i] = (maxSize / PERSISTENT_CACHE_CLASS_COUNT) / stride;
+
+		if (slotCount[i] < 1)
+			slotCount[i] = 1;
+
+		length += (size_t) slotCount[i] * stride;
+	}
+
+	if (!persistent_cache_map(persistent, filename, length))
+		goto fail;
+
+	header = persistent->header = (PERSISTENT_CACHE_HEADER*) persistent->base;
+	valid = (memcmp(header->signature, PERSISTENT_CACHE_SIGNATURE,
+	                sizeof(PERSISTENT_CACHE_SIGNATURE)) == 0) &&
+	        (header->version == PERSISTENT_CACHE_VERSION) &&
+	        (header->classCount == PERSISTENT_CACHE_CLASS_COUNT);
+
+	for (i = 0; valid && (i < PERSISTENT_CACHE_CLASS_COUNT); i++)
+	{
+		if ((header->slotSize[i] != PERSISTENT_CACHE_SLOT_SIZE[i]) ||
+		    (header->slotCount[i] != slotCount[i]))
+			valid = FALSE;
+	}
+
+	if (!valid)
+	{
+		WLog_DBG(TAG, "initializing persistent cache file %s", filename);
+		ZeroMemory(header, sizeof(PERSISTENT_CACHE_HEADER));
+		CopyMemory(header->signature, PERSISTENT_CACHE_SIGNATURE,
+		           sizeof(PERSISTENT_CACHE_SIGNATURE));
+		header->version = PERSISTENT_CACHE_VERSION;
+		header->classCount = PERSISTENT_CACHE_CLASS_COUNT;
+
+		for (i = 0; i < PERSISTENT_CACHE_CLASS_COUNT; i++)
+		{
+			header->slotSize[i] = PERSISTENT_CACHE_SLOT_SIZE[i];
+			header->slotCount[i] = slotCount[i];
+		}
+	}
+
+	offset = sizeof(PERSISTENT_CACHE_HEADER);
+
+	for (i = 0; i < PERSISTENT_CACHE_CLASS_COUNT; i++)
+	{
+		PERSISTENT_CACHE_CLASS* cls = &persistent->classes[i];
+		cls->slots = &persistent->base[offset];
+		cls->slotSize = PERSISTENT_CACHE_SLOT_SIZE[i];
+		cls->stride = sizeof(PERSISTENT_CACHE_SLOT) + cls->slotSize;
+		cls->count = slotCount[i];
+		offset += (size_t) cls->count * cls->stride;
+
+		if (!valid)
+		{
+			UINT32 index;
+
+			/* only free used slots, untouched pages of a new file stay sparse */
+			for (index = 0; index < cls->count; index++)
+			{
+				PERSISTENT_CACHE_SLOT* slot = persistent_cache_slot(cls, index);
+
+				if (slot->stamp)
+					slot->stamp = 0;
+			}
+		}
+	}
+
+	persistent->index = HashTable_New(FALSE);
+
+	if (!persistent->index)
+		goto fail;
+
+	persistent->index->hash = persistent_cache_key_hash;
+	persistent->index->keyCompare = persistent_cache_key_compare;
+
+	for (i = 0; i < PERSISTENT_CACHE_CLASS_COUNT; i++)
+	{
+		if (!persistent_cache_load_class(persistent, i))
+			goto fail;
+	}
+
+	WLog_DBG(TAG, "opened persistent cache %s (%d entries)", filename,
+	         HashTable_Count(persistent->index));
+	return TRUE;
+fail:
+	persistent_cache_close(persistent);
+	return FALSE;
+}
+
+void persistent_cache_close(rdpPersistentCache* persistent)
+{
+	UINT32 i;
+
+	if (!persistent)
+		return;
+
+	HashTable_Free(persistent->index);
+	persistent->index = NULL;
+
+	for (i = 0; i < PERSISTENT_CACHE_CLASS_COUNT; i++)
+	{
+		free(persistent->classes[i].prev);
+		free(persistent->classes[i].next);
+		free(persistent->classes[i].pinned);
+		ZeroMemory(&persistent->classes[i], sizeof(PERSISTENT_CACHE_CLASS));
+	}
+
+	persistent_cache_unmap(persistent);
+	persistent->header = NULL;
+}
+
+BOOL persistent_cache_is_open(rdpPersistentCache* persistent)
+{
+	return (persistent && persistent->header) ? TRUE : FALSE;
+}
+
+static BOOL persistent_cache_find(rdpPersistentCache* persistent, UINT64 key64,
+                                  UINT32* classId, UINT32* index)
+{
+	ULONG_PTR value = (ULONG_PTR) HashTable_GetItemValue(persistent->index, &key64);
+
+	if (!value)
+		return FALSE;
+
+	value--;
+	*classId = (UINT32)(value & 3);
+	*index = (UINT32)(value >> 2);
+	return TRUE;
+}
+
+BOOL persistent_cache_read_entry(rdpPersistentCache* persistent, UINT64 key64,
+                                 PERSISTENT_CACHE_ENTRY* entry)
+{
+	UINT32 classId;
+	UINT32 index;
+	PERSISTENT_CACHE_CLASS* cls;
+	PERSISTENT_CACHE_SLOT* slot;
+
+	if (!persistent_cache_is_open(persistent) || !entry)
+		return FALSE;
+
+	if (!persistent_cache_find(persistent, key64, &classId, &index))
+		return FALSE;
+
+	cls = &persistent->classes[classId];
+	slot = persistent_cache_slot(cls, index);
+	persistent_cache_touch(persistent, cls, index);
+	entry->key64 = slot->key64;
+	entry->cellId = slot->cellId;
+	entry->width = slot->width;
+	entry->height = slot->height;
+	entry->format = slot->format;
+	entry->size = slot->size;
+	entry->data = ((BYTE*) slot) + sizeof(PERSISTENT_CACHE_SLOT);
+	return TRUE;
+}
+
+BOOL persistent_cache_write_entry(rdpPersistentCache* persistent,
+                                  const PERSISTENT_CACHE_ENTRY* entry)
+{
+	UINT32 classId;
+	UINT32 index;
+	PERSISTENT_CACHE_CLASS* cls;
+	PERSISTENT_CACHE_SLOT* slot;
+
+	if (!persistent_cache_is_open(persistent) || !entry || !entry->data)
+		return FALSE;
+
+	if ((entry->cellId >= PERSISTENT_CACHE_MAX_CELLS) ||
+	    (entry->width > 0xFFFF) || (entry->height > 0xFFFF))
+		return FALSE;
+
+	if (!persistent_cache_find(persistent, entry->key64, &classId, &index))
+	{
+		for (classId = 0; classId < PERSISTENT_CACHE_CLASS_COUNT; classId++)
+		{
+			if (entry->size <= persistent->classes[classId].slotSize)
+				break;
+		}
+
+		/* larger than any slot, not persisted */
+		if (classId >= PERSISTENT_CACHE_CLASS_COUNT)
+			return FALSE;
+
+		cls = &persistent->classes[classId];
+		index = cls->tail;
+
+		/* the server may still reference keys offered in this session */
+		while ((index != PERSISTENT_CACHE_NIL) && cls->pinned[index])
+			index = cls->prev[index];
+
+		if (index == PERSISTENT_CACHE_NIL)
+			return FALSE;
+
+		slot = persistent_cache_slot(cls, index);
+
+		if (slot->stamp)
+			HashTable_Remove(persistent->index, &slot->key64);
+
+		slot->stamp = 0;
+		slot->key64 = entry->key64;
+
+		if (HashTable_Add(persistent->index, &slot->key64,
+		                  persistent_cache_index_value(classId, index)) < 0)
+			return FALSE;
+	}
+
+	cls = &persistent->classes[classId];
+	slot = persistent_cache_slot(cls, index);
+
+	if ((entry->size > cls->slotSize) && cls->pinned[index])
+		return FALSE;
+
+	if (entry->size > cls->slotSize)
+	{
+		/* the bitmap grew beyond its slot, drop the stale copy */
+		HashTable_Remove(persistent->index, &slot->key64);
+		slot->stamp = 0;
+		persistent_cache_lru_unlink(cls, index);
+		persistent_cache_lru_push_back(cls, index);
+		return FALSE;
+	}
+
+	slot->width = (UINT16) entry->width;
+	slot->height = (UINT16) entry->height;
+	slot->format = entry->format;
+	slot->size = entry->size;
+	slot->cellId = entry->cellId;
+	CopyMemory(((BYTE*) slot) + sizeof(PERSISTENT_CACHE_SLOT), entry->data, entry->size);
+	persistent_cache_touch(persistent, cls, index);
+	return TRUE;
+}
+
+UINT32 persistent_cache_snapshot_keys(rdpPersistentCache* persistent,
+                                      const BITMAP_CACHE_V2_CELL_INFO* cellInfo, UINT32 numCells)
+{
+	UINT32 i;
+	UINT32 classId;
+	UINT32 total = 0;
+	UINT32 count[PERSISTENT_CACHE_MAX_CELLS] = { 0 };
+	PERSISTENT_CACHE_STAMP* stamps[PERSISTENT_CACHE_MAX_CELLS] = { 0 };
+
+	if (!persistent)
+		return 0;
+
+	persistent->generation++;
+
+	for (i = 0; i < PERSISTENT_CACHE_MAX_CELLS; i++)
+	{
+		free(persistent->snapshot[i]);
+		persistent->snapshot[i] = NULL;
+		persistent->snapshotCount[i] = 0;
+	}
+
+	if (!persistent_cache_is_open(persistent) || !cellInfo)
+		return 0;
+
+	/* the previous key list is superseded, only the new one is pinned */
+	for (classId = 0; classId < PERSISTENT_CACHE_CLASS_COUNT; classId++)
+		ZeroMemory(persistent->classes[classId].pinned, persistent->classes[classId].count);
+
+	if (numCells > PERSISTENT_CACHE_MAX_CELLS)
+		numCells = PERSISTENT_CACHE_MAX_CELLS;
+
+	for (i = 0; i < numCells; i++)
+	{
+		if (!cellInfo[i].persistent || !cellInfo[i].numEntries)
+			continue;
+
+		stamps[i] = (PERSISTENT_CACHE_STAMP*) calloc(HashTable_Count(persistent->index) + 1,
+		            sizeof(PERSISTENT_CACHE_STAMP));
+
+		if (!stamps[i])
+			goto out;
+	}
+
+	for (classId = 0; classId < PERSISTENT_CACHE_CLASS_COUNT; classId++)
+	{
+		UINT32 index;
+		PERSISTENT_CACHE_CLASS* cls = &persistent->classes[classId];
+
+		for (index = cls->head; index != PERSISTENT_CACHE_NIL; index = cls->next[index])
+		{
+			PERSISTENT_CACHE_SLOT* slot = persistent_cache_slot(cls, index);
+
+			if (!slot->stamp)
+				break;
+
+			if ((slot->cellId >= numCells) || !stamps[slot->cellId])
+				continue;
+
+			stamps[slot->cellId][count[slot->cellId]].stamp = slot->stamp;
+			stamps[slot->cellId][count[slot->cellId]].key64 = slot->key64;
+			count[slot->cellId]++;
+		}
+	}
+
+	for (i = 0; i < numCells; i++)
+	{
+		UINT32 index;
+
+		if (!stamps[i] || !count[i])
+			continue;
+
+		qsort(stamps[i], count[i], sizeof(PERSISTENT_CACHE_STAMP), persistent_cache_stamp_compare);
+
+		if (count[i] > cellInfo[i].numEntries)
+			count[i] = cellInfo[i].numEntries;
+
+		persistent->snapshot[i] = (UINT64*) calloc(count[i], sizeof(UINT64));
+
+		if (!persistent->snapshot[i])
+			goto out;
+
+		for (index = 0; index < count[i]; index++)
+		{
+			UINT32 pinClass;
+			UINT32 pinIndex;
+			persistent->snapshot[i][index] = stamps[i][index].key64;
+
+			if (persistent_cache_find(persistent, stamps[i][index].key64, &pinClass, &pinIndex))
+				persistent->classes[pinClass].pinned[pinIndex] = TRUE;
+		}
+
+		persistent->snapshotCount[i] = count[i];
+		total += count[i];
+	}
+
+out:
+
+	for (i = 0; i < PERSISTENT_CACHE_MAX_CELLS; i++)
+		free(stamps[i]);
+
+	return total;
+}
+
+const UINT64* persistent_cache_get_snapshot(rdpPersistentCache* persistent, UINT32 cellId,
+        UINT32* count)
+{
+	if (!persistent || (cellId >= PERSISTENT_CACHE_MAX_CELLS))
+	{
+		if (count)
+			*count = 0;
+
+		return NULL;
+	}
+
+	if (count)
+		*count = persistent->snapshotCount[cellId];
+
+	return persistent->snapshot[cellId];
+}
+
+UINT32 persistent_cache_get_generation(rdpPersistentCache* persistent)
+{
+	return persistent ? persistent->generation : 0;
+}
+
+char* persistent_cache_get_default_path(rdpSettings* settings, const char* prefix)
+{
+	size_t i;
+	char* path = NULL;
+	char* filename = NULL;
+	char name[MAX_PATH];
+
+	if (!settings || !prefix || !settings->ConfigPath || !settings->ServerHostname)
+		return NULL;
+
+	if (!(path = GetCombinedPath(settings->ConfigPath, "cache")))
+		return NULL;
+
+	if (!PathFileExistsA(path))
+	{
+		if (!PathMakePathA(path, 0))
+		{
+			WLog_ERR(TAG, "error creating directory '%s'", path);
+			free(path);
+			return NULL;
+		}
+	}
+
+	sprintf_s(name, sizeof(name), "%s-%s-%u.bmc", prefix, settings->ServerHostname,
+	          settings->ServerPort);
+
+	/* host names may contain characters that are not valid in file names (IPv6) */
+	for (i = 0; name[i]; i++)
+	{
+		if (name[i] == ':' || name[i] == '/' || name[i] == '\\')
+			name[i] = '_';
+	}
+
+	filename = GetCombinedPath(path, name);
+	free(path);
+	return filename;
+}
+
+rdpPersistentCache* persistent_cache_new(void)
+{
+	rdpPersistentCache* persistent;
+	persistent = (rdpPersistentCache*) calloc(1, sizeof(rdpPersistentCache));
+
+	if (!persistent)
+		return NULL;
+
+#ifndef _WIN32
+	persistent->fd = -1;
+#endif
+	return persistent;
+}
+
+void persistent_cache_free(rdpPersistentCache* persistent)
+{
+	UINT32 i;
+
+	if (!persistent)
+		return;
+
+	persistent_cache_close(persistent);
+
+	for (i = 0; i < PERSISTENT_CACHE_MAX_CELLS; i++)
+		free(persistent->snapshot[i]);
+
+	free(persistent);
+}
@@ -0,0 +1,64 @@
+
+#include <winpr/crt.h>
+
+#include <freerdp/cache/budget.h>
+
+int TestCacheBudget(int argc, char* argv[])
+{
+	UINT32 entry;
+	int rc = -1;
+	CACHE_STATISTICS stats;
+	rdpCacheBudget* budget = cache_budget_new(8, 300);
+
+	if (!budget)
+		return -1;
+
+	cache_budget_charge(budget, 0, 100, TRUE);
+	cache_budget_charge(budget, 1, 100, TRUE);
+	/* pinned entries count against the budget but are never evicted */
+	cache_budget_charge(budget, 2, 100, FALSE);
+	cache_budget_hit(budget, 0);
+	cache_budget_miss(budget);
+
+	if (!cache_budget_reclaim(budget, 100, &entry) || (entry != 1))
+	{
+		fprintf(stderr, "least recently used entry was not reclaimed first\n");
+		goto fail;
+	}
+
+	cache_budget_charge(budget, 3, 100, TRUE);
+
+	if (!cache_budget_reclaim(budget, 100, &entry) || (entry != 0))
+		goto fail;
+
+	if (!cache_budget_reclaim(budget, 200, &entry) || (entry != 3))
+		goto fail;
+
+	if (cache_budget_reclaim(budget, 300, &entry))
+	{
+		fprintf(stderr, "a pinned entry was reclaimed\n");
+		goto fail;
+	}
+
+	/* re-charging an entry replaces its previous size */
+	cache_budget_charge(budget, 2, 50, FALSE);
+	cache_budget_get_statistics(budget, &stats);
+
+	if ((stats.hits != 1) || (stats.misses != 1) || (stats.evictions != 3) ||
+	    (stats.usedBytes != 50) || (stats.peakBytes != 300) || (stats.maxBytes != 300))
+	{
+		fprintf(stderr, "unexpected cache statistics\n");
+		goto fail;
+	}
+
+	cache_budget_release(budget, 2);
+	cache_budget_get_statistics(budget, &stats);
+
+	if (stats.usedBytes != 0)
+		goto fail;
+
+	rc = 0;
+fail:
+	cache_budget_free(budget);
+	return rc;
+}
@@ -0,0 +1,172 @@
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/file.h>
+
+#include <freerdp/cache/persistent.h>
+
+#define TEST_TILE_SIZE		(16 * 16 * 4)
+
+/* enough room for four 16x16 tiles in the smallest size class */
+#define TEST_CACHE_SIZE		(3 * 4 * (32 + TEST_TILE_SIZE))
+
+static BOOL test_write(rdpPersistentCache* persistent, UINT64 key64)
+{
+	BYTE data[TEST_TILE_SIZE];
+	PERSISTENT_CACHE_ENTRY entry;
+	FillMemory(data, sizeof(data), (BYTE) key64);
+	entry.key64 = key64;
+	entry.cellId = 0;
+	entry.width = 16;
+	entry.height = 16;
+	entry.format = 0;
+	entry.size = sizeof(data);
+	entry.data = data;
+	return persistent_cache_write_entry(persistent, &entry);
+}
+
+static BOOL test_read(rdpPersistentCache* persistent, UINT64 key64)
+{
+	UINT32 i;
+	PERSISTENT_CACHE_ENTRY entry;
+
+	if (!persistent_cache_read_entry(persistent, key64, &entry))
+		return FALSE;
+
+	if ((entry.width != 16) || (entry.height != 16) || (entry.size != TEST_TILE_SIZE))
+		return FALSE;
+
+	for (i = 0; i < entry.size; i++)
+	{
+		if (entry.data[i] != (BYTE) key64)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+int TestPersistentCache(int argc, char* argv[])
+{
+	UINT32 i;
+	UINT32 count;
+	int rc = -1;
+	char* filename;
+	const UINT64* keys;
+	rdpPersistentCache* persistent;
+	BITMAP_CACHE_V2_CELL_INFO cellInfo = { 10, TRUE };
+	const UINT64 expected[] = { 0x1111222233334445, 0x1111222233334441,
+	                            0x1111222233334444, 0x1111222233334443
+	                          };
+	filename = GetKnownSubPath(KNOWN_PATH_TEMP, "TestPersistentCache.bmc");
+
+	if (!filename)
+		return -1;
+
+	DeleteFileA(filename);
+	persistent = persistent_cache_new();
+
+	if (!persistent)
+		goto fail;
+
+	if (!persistent_cache_open(persistent, filename, TEST_CACHE_SIZE))
+	{
+		fprintf(stderr, "failed to open %s\n", filename);
+		goto fail;
+	}
+
+	for (i = 1; i <= 4; i++)
+	{
+		if (!test_write(persistent, 0x1111222233334440 + i))
+			goto fail;
+	}
+
+	/* touch the first entry so the second one becomes the eviction candidate */
+	if (!test_read(persistent, 0x1111222233334441))
+		goto fail;
+
+	if (!test_write(persistent, 0x1111222233334445))
+		goto fail;
+
+	if (test_read(persistent, 0x1111222233334442))
+	{
+		fprintf(stderr, "least recently used entry was not evicted\n");
+		goto fail;
+	}
+
+	/* entries too large for any size class are not persisted */
+	{
+		PERSISTENT_CACHE_ENTRY entry = { 0x42, 0, 128, 128, 0, 128 * 128 * 4, (BYTE*) filename };
+
+		if (persistent_cache_write_entry(persistent, &entry))
+			goto fail;
+	}
+
+	persistent_cache_close(persistent);
+
+	if (!persistent_cache_open(persistent, filename, TEST_CACHE_SIZE))
+		goto fail;
+
+	if (persistent_cache_snapshot_keys(persistent, &cellInfo, 1) != 4)
+	{
+		fprintf(stderr, "unexpected number of keys after reopening the cache\n");
+		goto fail;
+	}
+
+	keys = persistent_cache_get_snapshot(persistent, 0, &count);
+
+	for (i = 0; i < count; i++)
+	{
+		if (keys[i] != expected[i])
+		{
+			fprintf(stderr, "key %u out of LRU order\n", i);
+			goto fail;
+		}
+
+		if (!test_read(persistent, keys[i]))
+			goto fail;
+	}
+
+	/* keys offered in the key list are never evicted */
+	if (test_write(persistent, 0x1111222233334446))
+	{
+		fprintf(stderr, "offered key was evicted\n");
+		goto fail;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (!test_read(persistent, keys[i]))
+			goto fail;
+	}
+
+	/* a smaller key list releases the keys it no longer offers */
+	cellInfo.numEntries = 2;
+
+	if (persistent_cache_snapshot_keys(persistent, &cellInfo, 1) != 2)
+		goto fail;
+
+	if (!test_write(persistent, 0x1111222233334446))
+		goto fail;
+
+	keys = persistent_cache_get_snapshot(persistent, 0, &count);
+
+	for (i = 0; i < count; i++)
+	{
+		if (!test_read(persistent, keys[i]))
+			goto fail;
+	}
+
+	/* a different budget changes the file geometry and discards the content */
+	if (!persistent_cache_open(persistent, filename, 2 * TEST_CACHE_SIZE))
+		goto fail;
+
+	if (test_read(persistent, expected[0]))
+		goto fail;
+
+	rc = 0;
+fail:
+	persistent_cache_free(persistent);
+	DeleteFileA(filename);
+	free(filename);
+	return rc;
+}
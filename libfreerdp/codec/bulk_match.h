@@ -0,0 +1,98 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Bulk Compression Match Helpers
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BULK_MATCH_H
+#define __BULK_MATCH_H
+
+#include <winpr/crt.h>
+#include <winpr/platform.h>
+
+#include <freerdp/types.h>
+
+/**
+ * Returns the length of the common prefix of p1 and p2, at most limit.
+ * Eight bytes are compared at a time, only the tail and the word holding
+ * the first difference are looked at byte by byte. The ranges may overlap,
+ * they are only read.
+ */
+static INLINE UINT32 bulk_match_length(const BYTE* p1, const BYTE* p2, UINT32 limit)
+{
+	UINT64 v1;
+	UINT64 v2;
+	UINT32 length = 0;
+
+	while ((length + 8) <= limit)
+	{
+		CopyMemory(&v1, &p1[length], 8);
+		CopyMemory(&v2, &p2[length], 8);
+
+		if (v1 != v2)
+		{
+#if defined(__GNUC__) && defined(__LITTLE_ENDIAN__)
+			return length + (__builtin_ctzll(v1 ^ v2) >> 3);
+#else
+			break;
+#endif
+		}
+
+		length += 8;
+	}
+
+	while ((length < limit) && (p1[length] == p2[length]))
+		length++;
+
+	return length;
+}
+
+/**
+ * Copies a match into the history with LZ semantics: the result is the
+ * same as copying byte by byte from the front, so a source overlapping
+ * the destination repeats the pattern between them. Longer overlapping
+ * copies are done in steps doubling with the length already written.
+ */
+static INLINE void bulk_copy_match(BYTE* dst, const BYTE* src, UINT32 length)
+{
+	UINT32 size;
+
+	if (length < 16)
+	{
+		while (length--)
+			*dst++ = *src++;
+
+		return;
+	}
+
+	if ((src >= dst) || ((UINT32) (dst - src) >= length))
+	{
+		MoveMemory(dst, src, length);
+		return;
+	}
+
+	while (length > 0)
+	{
+		size = (UINT32) (dst - src);
+
+		if (size > length)
+			size = length;
+
+		CopyMemory(dst, src, size);
+		dst += size;
+		length -= size;
+	}
+}
+
+#endif /* __BULK_MATCH_H */
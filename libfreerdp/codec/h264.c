@@ -28,6 +28,7 @@
 
 #include <freerdp/primitives.h>
 #include <freerdp/codec/h264.h>
+#include <freerdp/codec/color.h>
 #include <freerdp/log.h>
 
 #define TAG FREERDP_TAG("codec")
@@ -991,6 +992,11 @@ static int openh264_compress(H264_CONTEXT* h264, BYTE** ppDstData,
 		{
 #if (OPENH264_MAJOR == 1) && (OPENH264_MINOR <= 5)
 			sys->EncParamExt.sSpatialLayers[0].sSliceCfg.uiSliceMode = SM_AUTO_SLICE;
+#else
+			/* one slice per thread so that every thread has a part of each frame */
+			sys->EncParamExt.sSpatialLayers[0].sSliceArgument.uiSliceMode = SM_FIXEDSLCNUM_SLICE;
+			sys->EncParamExt.sSpatialLayers[0].sSliceArgument.uiSliceNum =
+			    h264->NumberOfThreads;
 #endif
 		}
 
@@ -1546,16 +1552,96 @@ INT32 avc420_decompress(H264_CONTEXT* h264, BYTE* pSrcData, UINT32 SrcSize,
 	return 1;
 }
 
-INT32 avc420_compress(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
-                      UINT32 nSrcStep, UINT32 nSrcWidth, UINT32 nSrcHeight,
-                      BYTE** ppDstData, UINT32* pDstSize)
+static void avc420_free_encode_planes(H264_CONTEXT* h264)
+{
+	UINT32 x;
+
+	for (x = 0; x < 3; x++)
+	{
+		free(h264->pYUVData[0][x]);
+		h264->pYUVData[0][x] = NULL;
+		h264->iStride[0][x] = 0;
+	}
+
+	h264->iYUVEncodeWidth = 0;
+	h264->iYUVEncodeHeight = 0;
+}
+
+/**
+ * The encoder input planes are kept between frames, so that only the
+ * changed parts of a frame need to be converted. Unchanged macroblocks
+ * then match the reference frame and are coded as skip blocks.
+ *
+ * @return 1 if the planes are new and must be filled completely, 0 if
+ * the previous content is still valid, -1 on failure
+ */
+static int avc420_ensure_encode_planes(H264_CONTEXT* h264, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 x;
+
+	if (h264->pYUVData[0][0] && (h264->iYUVEncodeWidth == nWidth) &&
+	    (h264->iYUVEncodeHeight == nHeight))
+		return 0;
+
+	avc420_free_encode_planes(h264);
+	h264->iStride[0][0] = nWidth;
+	h264->iStride[0][1] = nWidth / 2;
+	h264->iStride[0][2] = nWidth / 2;
+
+	for (x = 0; x < 3; x++)
+	{
+		if (!(h264->pYUVData[0][x] = (BYTE*) malloc(nWidth * nHeight)))
+		{
+			avc420_free_encode_planes(h264);
+			return -1;
+		}
+	}
+
+	h264->iYUVEncodeWidth = nWidth;
+	h264->iYUVEncodeHeight = nHeight;
+	return 1;
+}
+
+static BOOL avc420_convert_rect(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
+                                UINT32 nSrcStep, UINT32 nSrcWidth, UINT32 nSrcHeight,
+                                const RECTANGLE_16* rect)
 {
-	int status = -1;
 	prim_size_t roi;
-	int nWidth, nHeight;
+	BYTE* pYUVData[3];
+	UINT32* iStride = h264->iStride[0];
 	primitives_t* prims = primitives_get();
-	UINT32* iStride;
-	BYTE** pYUVData;
+	/* chroma is subsampled, keep the area on even coordinates */
+	const UINT32 left = rect->left & ~1;
+	const UINT32 top = rect->top & ~1;
+	const UINT32 right = MIN((rect->right + 1) & ~1, nSrcWidth);
+	const UINT32 bottom = MIN((rect->bottom + 1) & ~1, nSrcHeight);
+
+	if ((left >= right) || (top >= bottom))
+		return TRUE;
+
+	roi.width = right - left;
+	roi.height = bottom - top;
+	pYUVData[0] = &h264->pYUVData[0][0][(top * iStride[0]) + left];
+	pYUVData[1] = &h264->pYUVData[0][1][((top / 2) * iStride[1]) + (left / 2)];
+	pYUVData[2] = &h264->pYUVData[0][2][((top / 2) * iStride[2]) + (left / 2)];
+	return prims->RGBToYUV420_8u_P3AC4R(
+	           &pSrcData[(top * nSrcStep) + (left * GetBytesPerPixel(SrcFormat))],
+	           SrcFormat, nSrcStep, pYUVData, iStride, &roi) == PRIMITIVES_SUCCESS;
+}
+
+/**
+ * Encodes a frame of which only the given areas changed since the last
+ * call. The first frame and every frame after a size change are
+ * converted completely. Passing no rectangles converts the whole frame.
+ */
+INT32 avc420_compress_region(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
+                             UINT32 nSrcStep, UINT32 nSrcWidth, UINT32 nSrcHeight,
+                             const RECTANGLE_16* regionRects, UINT32 numRegionRects,
+                             BYTE** ppDstData, UINT32* pDstSize)
+{
+	int status;
+	UINT32 index;
+	RECTANGLE_16 frameRect;
 
 	if (!h264)
 		return -1;
@@ -1563,39 +1649,37 @@ INT32 avc420_compress(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
 	if (!h264->subsystem->Compress)
 		return -1;
 
-	iStride =  h264->iStride[0];
-	pYUVData = h264->pYUVData[0];
-	nWidth = (nSrcWidth + 1) & ~1;
-	nHeight = (nSrcHeight + 1) & ~1;
+	status = avc420_ensure_encode_planes(h264, (nSrcWidth + 1) & ~1, (nSrcHeight + 1) & ~1);
 
-	if (!(pYUVData[0] = (BYTE*) malloc(nWidth * nHeight)))
+	if (status < 0)
 		return -1;
 
-	iStride[0] = nWidth;
-
-	if (!(pYUVData[1] = (BYTE*) malloc(nWidth * nHeight)))
-		goto error_1;
+	if ((status > 0) || !regionRects || !numRegionRects)
+	{
+		frameRect.left = 0;
+		frameRect.top = 0;
+		frameRect.right = nSrcWidth;
+		frameRect.bottom = nSrcHeight;
+		regionRects = &frameRect;
+		numRegionRects = 1;
+	}
 
-	iStride[1] = nWidth / 2;
+	for (index = 0; index < numRegionRects; index++)
+	{
+		if (!avc420_convert_rect(h264, pSrcData, SrcFormat, nSrcStep, nSrcWidth, nSrcHeight,
+		                         &regionRects[index]))
+			return -1;
+	}
 
-	if (!(pYUVData[2] = (BYTE*) malloc(nWidth * nHeight)))
-		goto error_2;
+	return h264->subsystem->Compress(h264, ppDstData, pDstSize, 0);
+}
 
-	iStride[2] = nWidth / 2;
-	roi.width = nSrcWidth;
-	roi.height = nSrcHeight;
-	prims->RGBToYUV420_8u_P3AC4R(pSrcData, SrcFormat, nSrcStep, pYUVData, iStride,
-	                             &roi);
-	status = h264->subsystem->Compress(h264, ppDstData, pDstSize, 0);
-	free(pYUVData[2]);
-	pYUVData[2] = NULL;
-error_2:
-	free(pYUVData[1]);
-	pYUVData[1] = NULL;
-error_1:
-	free(pYUVData[0]);
-	pYUVData[0] = NULL;
-	return status;
+INT32 avc420_compress(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
+                      UINT32 nSrcStep, UINT32 nSrcWidth, UINT32 nSrcHeight,
+                      BYTE** ppDstData, UINT32* pDstSize)
+{
+	return avc420_compress_region(h264, pSrcData, SrcFormat, nSrcStep, nSrcWidth, nSrcHeight,
+	                              NULL, 0, ppDstData, pDstSize);
 }
 
 INT32 avc444_compress(H264_CONTEXT* h264, BYTE* pSrcData, DWORD SrcFormat,
@@ -1946,6 +2030,10 @@ void h264_context_free(H264_CONTEXT* h264)
 {
 	if (h264)
 	{
+		/* the input planes of a compressor are owned by the context */
+		if (h264->Compressor)
+			avc420_free_encode_planes(h264);
+
 		h264->subsystem->Uninit(h264);
 		free(h264->pYUV444Data[0]);
 		free(h264->pYUV444Data[1]);
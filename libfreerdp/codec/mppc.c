@@ -29,6 +29,8 @@
 #include <freerdp/log.h>
 #include <freerdp/codec/mppc.h>
 
+#include "bulk_match.h"
+
 #define TAG FREERDP_TAG("codec.mppc")
 
 #define MPPC_MATCH_INDEX(_sym1, _sym2, _sym3) \
@@ -72,29 +74,129 @@ const UINT32 MPPC_MATCH_TABLE[256] =
 
 //#define DEBUG_MPPC	1
 
+/**
+ * Decoding tables indexed by the top five bits of the bit buffer. Every
+ * literal and copy offset prefix is at most five bits long, the entry
+ * gives the prefix length, the number of value bits following it and the
+ * base added to the value. Entries below MPPC_COPY_OFFSET_INDEX are
+ * literals.
+ */
+
+#define MPPC_COPY_OFFSET_INDEX	0x18
+
+struct _MPPC_PREFIX
+{
+	BYTE PrefixBits;
+	BYTE ValueBits;
+	UINT16 Base;
+};
+typedef struct _MPPC_PREFIX MPPC_PREFIX;
+
+static const MPPC_PREFIX MPPC_RDP4_PREFIX[32] =
+{
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, /* 0 + 7 bits of literal */
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 },
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 },
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 },
+	{ 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 }, /* 10 + 7 bits of literal */
+	{ 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 },
+	{ 3, 13, 320 }, { 3, 13, 320 }, { 3, 13, 320 }, { 3, 13, 320 }, /* 110 + 13 bits of CopyOffset */
+	{ 4, 8, 64 }, { 4, 8, 64 }, /* 1110 + 8 bits of CopyOffset */
+	{ 4, 6, 0 }, { 4, 6, 0 } /* 1111 + 6 bits of CopyOffset */
+};
+
+static const MPPC_PREFIX MPPC_RDP5_PREFIX[32] =
+{
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, /* 0 + 7 bits of literal */
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 },
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 },
+	{ 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 }, { 1, 7, 0 },
+	{ 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 }, /* 10 + 7 bits of literal */
+	{ 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 }, { 2, 7, 0x80 },
+	{ 3, 16, 2368 }, { 3, 16, 2368 }, { 3, 16, 2368 }, { 3, 16, 2368 }, /* 110 + 16 bits of CopyOffset */
+	{ 4, 11, 320 }, { 4, 11, 320 }, /* 1110 + 11 bits of CopyOffset */
+	{ 5, 8, 64 }, /* 11110 + 8 bits of CopyOffset */
+	{ 5, 6, 0 } /* 11111 + 6 bits of CopyOffset */
+};
+
+/**
+ * The bit buffer is MSB first and holds at least 56 valid bits after a
+ * refill, enough for a copy offset and a length of match. Past the end of
+ * the input it is filled with zeros.
+ */
+
+#define MppcRefillBits() \
+	if ((SrcEnd - SrcPtr) >= 8) { \
+		bits |= (((UINT64) SrcPtr[0] << 56) | ((UINT64) SrcPtr[1] << 48) | \
+			((UINT64) SrcPtr[2] << 40) | ((UINT64) SrcPtr[3] << 32) | \
+			((UINT64) SrcPtr[4] << 24) | ((UINT64) SrcPtr[5] << 16) | \
+			((UINT64) SrcPtr[6] << 8) | ((UINT64) SrcPtr[7])) >> nbits; \
+		SrcPtr += (63 - nbits) >> 3; \
+		nbits |= 56; \
+	} else { \
+		while (nbits <= 56) { \
+			if (SrcPtr < SrcEnd) \
+				bits |= ((UINT64) *SrcPtr++) << (56 - nbits); \
+			nbits += 8; \
+		} \
+	}
+
+#define MppcPeekBits(_nbits) \
+	((UINT32) (bits >> (64 - (_nbits))))
+
+#define MppcShiftBits(_nbits) \
+	bits <<= (_nbits); \
+	nbits -= (_nbits); \
+	position += (_nbits)
+
+static INLINE UINT32 mppc_leading_ones(UINT64 bits)
+{
+#if defined(__GNUC__)
+	if (~bits == 0)
+		return 64;
+
+	return (UINT32) __builtin_clzll(~bits);
+#else
+	UINT32 count = 0;
+
+	while (bits & 0x8000000000000000ULL)
+	{
+		bits <<= 1;
+		count++;
+	}
+
+	return count;
+#endif
+}
+
 int mppc_decompress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32 flags)
 {
-	BYTE Literal;
+	UINT64 bits;
+	UINT32 nbits;
+	UINT32 length;
+	UINT32 position;
+	UINT32 PrefixIndex;
 	BYTE* SrcPtr;
+	BYTE* SrcEnd;
+	BYTE* CopyPtr;
 	UINT32 CopyOffset;
 	UINT32 LengthOfMatch;
-	UINT32 accumulator;
+	UINT32 LengthOfMatchBits;
+	UINT32 MaxLengthOfMatchBits;
 	BYTE* HistoryPtr;
-	UINT32 HistoryOffset;
 	BYTE* HistoryBuffer;
 	BYTE* HistoryBufferEnd;
 	UINT32 HistoryBufferSize;
+	UINT32 HistoryMask;
 	UINT32 CompressionLevel;
-	wBitStream* bs = mppc->bs;
+	const MPPC_PREFIX* PrefixTable;
+	const MPPC_PREFIX* Prefix;
 
 	HistoryBuffer = mppc->HistoryBuffer;
 	HistoryBufferSize = mppc->HistoryBufferSize;
 	HistoryBufferEnd = &HistoryBuffer[HistoryBufferSize - 1];
 	CompressionLevel = mppc->CompressionLevel;
 
-	BitStream_Attach(bs, pSrcData, SrcSize);
-	BitStream_Fetch(bs);
-
 	if (flags & PACKET_AT_FRONT)
 	{
 		mppc->HistoryOffset = 0;
@@ -109,7 +211,6 @@ int mppc_decompress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** p
 	}
 
 	HistoryPtr = mppc->HistoryPtr;
-	HistoryOffset = mppc->HistoryOffset;
 
 	if (!(flags & PACKET_COMPRESSED))
 	{
@@ -118,13 +219,29 @@ int mppc_decompress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** p
 		return 1;
 	}
 
-	while ((bs->length - bs->position) >= 8)
+	if (CompressionLevel) /* RDP5 */
+	{
+		PrefixTable = MPPC_RDP5_PREFIX;
+		HistoryMask = 0xFFFF;
+		MaxLengthOfMatchBits = 15;
+	}
+	else /* RDP4 */
 	{
-		accumulator = bs->accumulator;
+		PrefixTable = MPPC_RDP4_PREFIX;
+		HistoryMask = 0x1FFF;
+		MaxLengthOfMatchBits = 12;
+	}
 
-		/**
-		 * Literal Encoding
-		 */
+	bits = 0;
+	nbits = 0;
+	position = 0;
+	length = SrcSize * 8;
+	SrcPtr = pSrcData;
+	SrcEnd = &pSrcData[SrcSize];
+
+	while ((length - position) >= 8)
+	{
+		MppcRefillBits();
 
 		if (HistoryPtr > HistoryBufferEnd)
 		{
@@ -132,293 +249,49 @@ int mppc_decompress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** p
 			return -1004;
 		}
 
-		if ((accumulator & 0x80000000) == 0x00000000)
-		{
-			/**
-			 * Literal, less than 0x80
-			 * bit 0 followed by the lower 7 bits of the literal
-			 */
-
-			Literal = ((accumulator & 0x7F000000) >> 24);
-
-			*(HistoryPtr) = Literal;
-			HistoryPtr++;
-
-			BitStream_Shift(bs, 8);
-
-			continue;
-		}
-		else if ((accumulator & 0xC0000000) == 0x80000000)
-		{
-			/**
-			 * Literal, greater than 0x7F
-			 * bits 10 followed by the lower 7 bits of the literal
-			 */
-
-			Literal = ((accumulator & 0x3F800000) >> 23) + 0x80;
-
-			*(HistoryPtr) = Literal;
-			HistoryPtr++;
-
-			BitStream_Shift(bs, 9);
-
-			continue;
-		}
-
 		/**
-		 * CopyOffset Encoding
+		 * Literal or CopyOffset Encoding
 		 */
 
-		CopyOffset = 0;
+		PrefixIndex = MppcPeekBits(5);
+		Prefix = &PrefixTable[PrefixIndex];
+		MppcShiftBits(Prefix->PrefixBits);
 
-		if (CompressionLevel) /* RDP5 */
+		if (PrefixIndex < MPPC_COPY_OFFSET_INDEX)
 		{
-			if ((accumulator & 0xF8000000) == 0xF8000000)
-			{
-				/**
-				 * CopyOffset, range [0, 63]
-				 * bits 11111 + lower 6 bits of CopyOffset
-				 */
-
-				CopyOffset = ((accumulator >> 21) & 0x3F);
-				BitStream_Shift(bs, 11);
-			}
-			else if ((accumulator & 0xF8000000) == 0xF0000000)
-			{
-				/**
-				 * CopyOffset, range [64, 319]
-				 * bits 11110 + lower 8 bits of (CopyOffset - 64)
-				 */
-
-				CopyOffset = ((accumulator >> 19) & 0xFF) + 64;
-				BitStream_Shift(bs, 13);
-			}
-			else if ((accumulator & 0xF0000000) == 0xE0000000)
-			{
-				/**
-				 * CopyOffset, range [320, 2367]
-				 * bits 1110 + lower 11 bits of (CopyOffset - 320)
-				 */
-
-				CopyOffset = ((accumulator >> 17) & 0x7FF) + 320;
-				BitStream_Shift(bs, 15);
-			}
-			else if ((accumulator & 0xE0000000) == 0xC0000000)
-			{
-				/**
-				 * CopyOffset, range [2368, ]
-				 * bits 110 + lower 16 bits of (CopyOffset - 2368)
-				 */
-
-				CopyOffset = ((accumulator >> 13) & 0xFFFF) + 2368;
-				BitStream_Shift(bs, 19);
-			}
-			else
-			{
-				/* Invalid CopyOffset Encoding */
-				return -1001;
-			}
+			*HistoryPtr++ = (BYTE) (MppcPeekBits(7) + Prefix->Base);
+			MppcShiftBits(7);
+			continue;
 		}
-		else /* RDP4 */
-		{
-			if ((accumulator & 0xF0000000) == 0xF0000000)
-			{
-				/**
-				 * CopyOffset, range [0, 63]
-				 * bits 1111 + lower 6 bits of CopyOffset
-				 */
 
-				CopyOffset = ((accumulator >> 22) & 0x3F);
-				BitStream_Shift(bs, 10);
-			}
-			else if ((accumulator & 0xF0000000) == 0xE0000000)
-			{
-				/**
-				 * CopyOffset, range [64, 319]
-				 * bits 1110 + lower 8 bits of (CopyOffset - 64)
-				 */
-
-				CopyOffset = ((accumulator >> 20) & 0xFF) + 64;
-				BitStream_Shift(bs, 12);
-			}
-			else if ((accumulator & 0xE0000000) == 0xC0000000)
-			{
-				/**
-				 * CopyOffset, range [320, 8191]
-				 * bits 110 + lower 13 bits of (CopyOffset - 320)
-				 */
-
-				CopyOffset = ((accumulator >> 16) & 0x1FFF) + 320;
-				BitStream_Shift(bs, 16);
-			}
-			else
-			{
-				/* Invalid CopyOffset Encoding */
-				return -1002;
-			}
-		}
+		CopyOffset = MppcPeekBits(Prefix->ValueBits) + Prefix->Base;
+		MppcShiftBits(Prefix->ValueBits);
 
 		/**
 		 * LengthOfMatch Encoding
+		 *
+		 * n leading ones, a zero and n + 1 lower bits of LengthOfMatch,
+		 * or a single zero bit for a LengthOfMatch of 3
 		 */
 
-		LengthOfMatch = 0;
-		accumulator = bs->accumulator;
+		LengthOfMatchBits = mppc_leading_ones(bits) + 1;
 
-		if ((accumulator & 0x80000000) == 0x00000000)
+		if (LengthOfMatchBits == 1)
 		{
-			/**
-			 * LengthOfMatch [3]
-			 * bit 0 + 0 lower bits of LengthOfMatch
-			 */
-
 			LengthOfMatch = 3;
-			BitStream_Shift(bs, 1);
-		}
-		else if ((accumulator & 0xC0000000) == 0x80000000)
-		{
-			/**
-			 * LengthOfMatch [4, 7]
-			 * bits 10 + 2 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 28) & 0x0003) + 0x0004;
-			BitStream_Shift(bs, 4);
-		}
-		else if ((accumulator & 0xE0000000) == 0xC0000000)
-		{
-			/**
-			 * LengthOfMatch [8, 15]
-			 * bits 110 + 3 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 26) & 0x0007) + 0x0008;
-			BitStream_Shift(bs, 6);
-		}
-		else if ((accumulator & 0xF0000000) == 0xE0000000)
-		{
-			/**
-			 * LengthOfMatch [16, 31]
-			 * bits 1110 + 4 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 24) & 0x000F) + 0x0010;
-			BitStream_Shift(bs, 8);
-		}
-		else if ((accumulator & 0xF8000000) == 0xF0000000)
-		{
-			/**
-			 * LengthOfMatch [32, 63]
-			 * bits 11110 + 5 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 22) & 0x001F) + 0x0020;
-			BitStream_Shift(bs, 10);
-		}
-		else if ((accumulator & 0xFC000000) == 0xF8000000)
-		{
-			/**
-			 * LengthOfMatch [64, 127]
-			 * bits 111110 + 6 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 20) & 0x003F) + 0x0040;
-			BitStream_Shift(bs, 12);
-		}
-		else if ((accumulator & 0xFE000000) == 0xFC000000)
-		{
-			/**
-			 * LengthOfMatch [128, 255]
-			 * bits 1111110 + 7 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 18) & 0x007F) + 0x0080;
-			BitStream_Shift(bs, 14);
-		}
-		else if ((accumulator & 0xFF000000) == 0xFE000000)
-		{
-			/**
-			 * LengthOfMatch [256, 511]
-			 * bits 11111110 + 8 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 16) & 0x00FF) + 0x0100;
-			BitStream_Shift(bs, 16);
-		}
-		else if ((accumulator & 0xFF800000) == 0xFF000000)
-		{
-			/**
-			 * LengthOfMatch [512, 1023]
-			 * bits 111111110 + 9 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 14) & 0x01FF) + 0x0200;
-			BitStream_Shift(bs, 18);
-		}
-		else if ((accumulator & 0xFFC00000) == 0xFF800000)
-		{
-			/**
-			 * LengthOfMatch [1024, 2047]
-			 * bits 1111111110 + 10 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 12) & 0x03FF) + 0x0400;
-			BitStream_Shift(bs, 20);
-		}
-		else if ((accumulator & 0xFFE00000) == 0xFFC00000)
-		{
-			/**
-			 * LengthOfMatch [2048, 4095]
-			 * bits 11111111110 + 11 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 10) & 0x07FF) + 0x0800;
-			BitStream_Shift(bs, 22);
-		}
-		else if ((accumulator & 0xFFF00000) == 0xFFE00000)
-		{
-			/**
-			 * LengthOfMatch [4096, 8191]
-			 * bits 111111111110 + 12 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 8) & 0x0FFF) + 0x1000;
-			BitStream_Shift(bs, 24);
-		}
-		else if (((accumulator & 0xFFF80000) == 0xFFF00000) && CompressionLevel) /* RDP5 */
-		{
-			/**
-			 * LengthOfMatch [8192, 16383]
-			 * bits 1111111111110 + 13 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 6) & 0x1FFF) + 0x2000;
-			BitStream_Shift(bs, 26);
-		}
-		else if (((accumulator & 0xFFFC0000) == 0xFFF80000) && CompressionLevel) /* RDP5 */
-		{
-			/**
-			 * LengthOfMatch [16384, 32767]
-			 * bits 11111111111110 + 14 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 4) & 0x3FFF) + 0x4000;
-			BitStream_Shift(bs, 28);
-		}
-		else if (((accumulator & 0xFFFE0000) == 0xFFFC0000) && CompressionLevel) /* RDP5 */
-		{
-			/**
-			 * LengthOfMatch [32768, 65535]
-			 * bits 111111111111110 + 15 lower bits of LengthOfMatch
-			 */
-
-			LengthOfMatch = ((accumulator >> 2) & 0x7FFF) + 0x8000;
-			BitStream_Shift(bs, 30);
+			MppcShiftBits(1);
 		}
 		else
 		{
-			/* Invalid LengthOfMatch Encoding */
-			return -1003;
+			if (LengthOfMatchBits > MaxLengthOfMatchBits)
+			{
+				/* Invalid LengthOfMatch Encoding */
+				return -1003;
+			}
+
+			MppcShiftBits(LengthOfMatchBits);
+			LengthOfMatch = (1 << LengthOfMatchBits) + MppcPeekBits(LengthOfMatchBits);
+			MppcShiftBits(LengthOfMatchBits);
 		}
 
 #ifdef DEBUG_MPPC
@@ -431,11 +304,9 @@ int mppc_decompress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** p
 			return -1005;
 		}
 
-		SrcPtr = &HistoryBuffer[(HistoryPtr - HistoryBuffer - CopyOffset) & (CompressionLevel ? 0xFFFF : 0x1FFF)];
-
-		do {
-			*HistoryPtr++ = *SrcPtr++;
-		} while (--LengthOfMatch);
+		CopyPtr = &HistoryBuffer[(HistoryPtr - HistoryBuffer - CopyOffset) & HistoryMask];
+		bulk_copy_match(HistoryPtr, CopyPtr, LengthOfMatch);
+		HistoryPtr += LengthOfMatch;
 	}
 
 	*pDstSize = (UINT32) (HistoryPtr - mppc->HistoryPtr);
@@ -454,6 +325,8 @@ int mppc_compress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppD
 	UINT32 DstSize;
 	BYTE* pDstData;
 	UINT32 MatchIndex;
+	UINT32 MatchLimit;
+	UINT32 MatchLength;
 	UINT32 accumulator;
 	BOOL PacketFlushed;
 	BOOL PacketAtFront;
@@ -568,6 +441,28 @@ int mppc_compress(MPPC_CONTEXT* mppc, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppD
 			LengthOfMatch = 3;
 			MatchPtr += 2;
 
+			/**
+			 * The part of the match lying behind the write position can be
+			 * compared word-wise, the loop below finishes overlapping matches.
+			 */
+			if ((MatchPtr < HistoryPtr) && (pSrcPtr < pSrcEnd) && (MatchPtr <= mppc->HistoryPtr))
+			{
+				MatchLimit = pSrcEnd - pSrcPtr;
+
+				if (MatchLimit > (UINT32) (HistoryPtr - MatchPtr))
+					MatchLimit = HistoryPtr - MatchPtr;
+
+				if (MatchLimit > (UINT32) (mppc->HistoryPtr - MatchPtr + 1))
+					MatchLimit = mppc->HistoryPtr - MatchPtr + 1;
+
+				MatchLength = bulk_match_length(pSrcPtr, MatchPtr, MatchLimit);
+				CopyMemory(HistoryPtr, pSrcPtr, MatchLength);
+				HistoryPtr += MatchLength;
+				pSrcPtr += MatchLength;
+				MatchPtr += MatchLength;
+				LengthOfMatch += MatchLength;
+			}
+
 			while ((*pSrcPtr == *MatchPtr) && (pSrcPtr < pSrcEnd) && (MatchPtr <= mppc->HistoryPtr))
 			{
 				MatchPtr++;
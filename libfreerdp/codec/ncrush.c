@@ -28,6 +28,8 @@
 #include <freerdp/log.h>
 #include <freerdp/codec/ncrush.h>
 
+#include "bulk_match.h"
+
 #define TAG FREERDP_TAG("codec")
 
 UINT16 HuffTableLEC[8192] =
@@ -1727,20 +1729,21 @@ UINT32 LOMBaseLUT[30] =
 	0x2 /* 29 */
 };
 
+/**
+ * The bit buffer holds up to 63 bits and is refilled 32 bits at a time,
+ * the tail of the input is consumed byte by byte.
+ */
 #define NCrushFetchBits() \
-	if (nbits < 16) { \
-		if ((SrcPtr + 1) >= SrcEnd) { \
-			if (SrcPtr >= SrcEnd) { \
-				if (nbits < 0) \
-					return -1; \
-			} else { \
-				bits += *SrcPtr++ << nbits; \
+	if (nbits < 32) { \
+		if ((SrcPtr + 4) <= SrcEnd) { \
+			bits |= ((UINT64) *((UINT32*) SrcPtr)) << nbits; \
+			SrcPtr += 4; \
+			nbits += 32; \
+		} else { \
+			while ((SrcPtr < SrcEnd) && (nbits <= 56)) { \
+				bits |= ((UINT64) *SrcPtr++) << nbits; \
 				nbits += 8; \
 			} \
-		} else { \
-			bits += *((UINT16*) SrcPtr) << nbits; \
-			SrcPtr += 2; \
-			nbits += 16; \
 		} \
 	} \
 
@@ -1749,24 +1752,41 @@ UINT32 LOMBaseLUT[30] =
 	offset = 0; \
 	accumulator = 0
 
+/**
+ * Output is a sequence of little endian 16 bit words, the writer keeps up
+ * to 63 pending bits and stores them 32 bits at a time. NCrushWritePosition()
+ * is where a writer flushing every 16 bits would be, the overflow checks
+ * rely on it.
+ */
 #define NCrushWriteBits(_bits, _nbits) \
-	accumulator |= _bits << offset; \
+	accumulator |= ((UINT64) (_bits)) << offset; \
 	offset += _nbits; \
-	if (offset >= 16) { \
+	if (offset >= 32) { \
 		*DstPtr++ = accumulator & 0xFF; \
 		*DstPtr++ = (accumulator >> 8) & 0xFF; \
-		accumulator >>= 16; \
-		offset -= 16; \
+		*DstPtr++ = (accumulator >> 16) & 0xFF; \
+		*DstPtr++ = (accumulator >> 24) & 0xFF; \
+		accumulator >>= 32; \
+		offset -= 32; \
 	}
 
+#define NCrushWritePosition() \
+	(DstPtr + ((offset >> 4) << 1))
+
 #define NCrushWriteFinish() \
+	if (offset >= 16) { \
+		*DstPtr++ = accumulator & 0xFF; \
+		*DstPtr++ = (accumulator >> 8) & 0xFF; \
+		accumulator >>= 16; \
+		offset -= 16; \
+	} \
 	*DstPtr++ = accumulator & 0xFF; \
 	*DstPtr++ = (accumulator >> 8) & 0xFF
 
 int ncrush_decompress(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32 flags)
 {
 	UINT32 index;
-	UINT32 bits;
+	UINT64 bits;
 	UINT32 nbits;
 	BYTE* SrcPtr;
 	BYTE* SrcEnd;
@@ -1979,18 +1999,8 @@ int ncrush_decompress(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize, BY
 
 		if (CopyOffsetPtr >= HistoryBuffer)
 		{
-			while (CopyLength > 0)
-			{
-				*HistoryPtr++ = *CopyOffsetPtr++;
-				CopyLength--;
-			}
-
-			while (LengthOfMatch > CopyOffset)
-			{
-				index = ((index >= CopyOffset)) ? 0 : index;
-				*HistoryPtr++ = *(CopyOffsetPtr + index++);
-				LengthOfMatch--;
-			}
+			bulk_copy_match(HistoryPtr, CopyOffsetPtr, LengthOfMatch);
+			HistoryPtr += LengthOfMatch;
 		}
 		else
 		{
@@ -2060,20 +2070,10 @@ int ncrush_hash_table_add(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize
 
 int ncrush_find_match_length(BYTE* Ptr1, BYTE* Ptr2, BYTE* HistoryPtr)
 {
-	BYTE val1, val2;
-	BYTE* Ptr = Ptr1;
-
-	do
-	{
-		if (Ptr1 > HistoryPtr)
-			break;
-
-		val1 = *Ptr1++;
-		val2 = *Ptr2++;
-	}
-	while (val1 == val2);
+	if (Ptr1 > HistoryPtr)
+		return -1;
 
-	return Ptr1 - (Ptr + 1);
+	return (int) bulk_match_length(Ptr1, Ptr2, HistoryPtr - Ptr1);
 }
 
 int ncrush_find_best_match(NCRUSH_CONTEXT* ncrush, UINT16 HistoryOffset, UINT32* pMatchOffset)
@@ -2245,7 +2245,7 @@ int ncrush_compress(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize, BYTE
 	UINT32 offset;
 	UINT16 Mask;
 	UINT32 MaskedBits;
-	UINT32 accumulator;
+	UINT64 accumulator;
 	BYTE* SrcEndPtr;
 	BYTE* DstEndPtr;
 	BYTE* HistoryPtr;
@@ -2366,7 +2366,7 @@ int ncrush_compress(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize, BYTE
 			Literal = *SrcPtr++;
 			HistoryPtr++;
 
-			if ((DstPtr + 2) > DstEndPtr) /* PACKET_FLUSH #1 */
+			if ((NCrushWritePosition() + 2) > DstEndPtr) /* PACKET_FLUSH #1 */
 			{
 				ncrush_context_reset(ncrush, TRUE);
 				*pFlags = PACKET_FLUSHED;
@@ -2394,7 +2394,7 @@ int ncrush_compress(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize, BYTE
 			if (!MatchLength)
 				return -1007;
 
-			if ((DstPtr + 8) > DstEndPtr) /* PACKET_FLUSH #2 */
+			if ((NCrushWritePosition() + 8) > DstEndPtr) /* PACKET_FLUSH #2 */
 			{
 				ncrush_context_reset(ncrush, TRUE);
 				*pFlags = PACKET_FLUSHED;
@@ -2540,7 +2540,7 @@ int ncrush_compress(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize, BYTE
 
 	while (SrcPtr < SrcEndPtr)
 	{
-		if ((DstPtr + 2) > DstEndPtr) /* PACKET_FLUSH #3 */
+		if ((NCrushWritePosition() + 2) > DstEndPtr) /* PACKET_FLUSH #3 */
 		{
 			ncrush_context_reset(ncrush, TRUE);
 			*pFlags = PACKET_FLUSHED;
@@ -2564,7 +2564,7 @@ int ncrush_compress(NCRUSH_CONTEXT* ncrush, BYTE* pSrcData, UINT32 SrcSize, BYTE
 		NCrushWriteBits(CodeLEC, BitLength);
 	}
 
-	if ((DstPtr + 4) >= DstEndPtr) /* PACKET_FLUSH #4 */
+	if ((NCrushWritePosition() + 4) >= DstEndPtr) /* PACKET_FLUSH #4 */
 	{
 		ncrush_context_reset(ncrush, TRUE);
 		*pFlags = PACKET_FLUSHED;
@@ -203,6 +203,16 @@ static void rfx_encoder_tile_free(RFX_TILE* tile)
 }
 
 RFX_CONTEXT* rfx_context_new(BOOL encoder)
+{
+	return rfx_context_new_ex(encoder, NULL);
+}
+
+/**
+ * Like rfx_context_new(), but tile work is submitted to the given callback
+ * environment instead of a thread pool owned by the context. This lets
+ * several contexts share the threads of one pool.
+ */
+RFX_CONTEXT* rfx_context_new_ex(BOOL encoder, PTP_CALLBACK_ENVIRON pcbe)
 {
 	HKEY hKey;
 	LONG status;
@@ -312,20 +322,28 @@ RFX_CONTEXT* rfx_context_new(BOOL encoder)
 		/* from multiple threads. This call will initialize all function pointers correctly     */
 		/* before any decoding threads are started */
 		primitives_get();
-		priv->ThreadPool = CreateThreadpool(NULL);
 
-		if (!priv->ThreadPool)
-			goto error_threadPool;
+		if (pcbe)
+		{
+			CopyMemory(&priv->ThreadPoolEnv, pcbe, sizeof(TP_CALLBACK_ENVIRON));
+		}
+		else
+		{
+			priv->ThreadPool = CreateThreadpool(NULL);
+
+			if (!priv->ThreadPool)
+				goto error_threadPool;
 
-		InitializeThreadpoolEnvironment(&priv->ThreadPoolEnv);
-		SetThreadpoolCallbackPool(&priv->ThreadPoolEnv, priv->ThreadPool);
+			InitializeThreadpoolEnvironment(&priv->ThreadPoolEnv);
+			SetThreadpoolCallbackPool(&priv->ThreadPoolEnv, priv->ThreadPool);
 
-		if (priv->MinThreadCount)
-			if (!SetThreadpoolThreadMinimum(priv->ThreadPool, priv->MinThreadCount))
-				goto error_threadPool_minimum;
+			if (priv->MinThreadCount)
+				if (!SetThreadpoolThreadMinimum(priv->ThreadPool, priv->MinThreadCount))
+					goto error_threadPool_minimum;
 
-		if (priv->MaxThreadCount)
-			SetThreadpoolThreadMaximum(priv->ThreadPool, priv->MaxThreadCount);
+			if (priv->MaxThreadCount)
+				SetThreadpoolThreadMaximum(priv->ThreadPool, priv->MaxThreadCount);
+		}
 	}
 
 	/* initialize the default pixel format */
@@ -374,7 +392,10 @@ void rfx_context_free(RFX_CONTEXT* context)
 
 	if (priv->UseThreads)
 	{
-		CloseThreadpool(context->priv->ThreadPool);
+		/* a pool passed to rfx_context_new_ex() belongs to the caller */
+		if (priv->ThreadPool)
+			CloseThreadpool(priv->ThreadPool);
+
 		DestroyThreadpoolEnvironment(&context->priv->ThreadPoolEnv);
 		free(priv->workObjects);
 		free(priv->tileWorkParams);
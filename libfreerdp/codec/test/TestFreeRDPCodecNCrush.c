@@ -89,6 +89,57 @@ int test_NCrushDecompressBells()
 	return 1;
 }
 
+int test_NCrushRoundTrip()
+{
+	int rc = -1;
+	int status;
+	UINT32 index;
+	UINT32 Flags;
+	UINT32 SrcSize;
+	UINT32 DstSize;
+	BYTE* pDstData;
+	BYTE* pOutData;
+	UINT32 OutSize;
+	BYTE SrcBuffer[8192];
+	BYTE DstBuffer[8192];
+	NCRUSH_CONTEXT* compressor;
+	NCRUSH_CONTEXT* decompressor;
+	compressor = ncrush_context_new(TRUE);
+	decompressor = ncrush_context_new(FALSE);
+
+	if (!compressor || !decompressor)
+		goto fail;
+
+	/* long runs and repeats exercise word-wise match extension and move the window */
+	for (index = 0; index < 32; index++)
+	{
+		SrcSize = sizeof(SrcBuffer) - (index * 97);
+		FillMemory(SrcBuffer, SrcSize, (BYTE) index);
+		CopyMemory(&SrcBuffer[index * 100], TEST_BELLS_DATA, sizeof(TEST_BELLS_DATA) - 1);
+		CopyMemory(&SrcBuffer[SrcSize / 2], SrcBuffer, SrcSize / 2);
+		pDstData = DstBuffer;
+		DstSize = sizeof(DstBuffer);
+		status = ncrush_compress(compressor, SrcBuffer, SrcSize, &pDstData, &DstSize, &Flags);
+
+		if (status < 0)
+			goto fail;
+
+		status = ncrush_decompress(decompressor, pDstData, DstSize, &pOutData, &OutSize, Flags);
+
+		if ((status < 0) || (OutSize != SrcSize) || (memcmp(pOutData, SrcBuffer, SrcSize) != 0))
+		{
+			printf("NCrushRoundTrip: mismatch in packet %d\n", (int) index);
+			goto fail;
+		}
+	}
+
+	rc = 1;
+fail:
+	ncrush_context_free(compressor);
+	ncrush_context_free(decompressor);
+	return rc;
+}
+
 int TestFreeRDPCodecNCrush(int argc, char* argv[])
 {
 	if (test_NCrushCompressBells() < 0)
@@ -97,5 +148,8 @@ int TestFreeRDPCodecNCrush(int argc, char* argv[])
 	if (test_NCrushDecompressBells() < 0)
 		return -1;
 
+	if (test_NCrushRoundTrip() < 0)
+		return -1;
+
 	return 0;
 }
@@ -28,6 +28,8 @@
 #include <freerdp/log.h>
 #include <freerdp/codec/xcrush.h>
 
+#include "bulk_match.h"
+
 #define TAG FREERDP_TAG("codec")
 
 const char* xcrush_get_level_2_compression_flags_string(UINT32 flags)
@@ -322,8 +324,6 @@ int xcrush_insert_chunk(XCRUSH_CONTEXT* xcrush, XCRUSH_SIGNATURE* signature, UIN
 
 int xcrush_find_match_length(XCRUSH_CONTEXT* xcrush, UINT32 MatchOffset, UINT32 ChunkOffset, UINT32 HistoryOffset, UINT32 SrcSize, UINT32 MaxMatchLength, XCRUSH_MATCH_INFO* MatchInfo)
 {
-	UINT32 MatchSymbol;
-	UINT32 ChunkSymbol;
 	BYTE* ChunkBuffer;
 	BYTE* MatchBuffer;
 	BYTE* MatchStartPtr;
@@ -373,18 +373,10 @@ int xcrush_find_match_length(XCRUSH_CONTEXT* xcrush, UINT32 MatchOffset, UINT32
 		return 0;
 	}
 
-	while (1)
+	if (ForwardMatchPtr < HistoryBufferEnd)
 	{
-		MatchSymbol = *ForwardMatchPtr++;
-		ChunkSymbol = *ForwardChunkPtr++;
-
-		if (MatchSymbol != ChunkSymbol)
-			break;
-
-		if (ForwardMatchPtr > HistoryBufferEnd)
-			break;
-			
-		ForwardMatchLength++;
+		ForwardMatchLength = bulk_match_length(ForwardMatchPtr, ForwardChunkPtr,
+				HistoryBufferEnd - ForwardMatchPtr);
 	}
 
 	ReverseMatchPtr = MatchBuffer - 1;
@@ -840,6 +840,9 @@ BOOL freerdp_get_param_bool(rdpSettings* settings, int id)
 		case FreeRDP_HiDefRemoteApp:
 			return settings->HiDefRemoteApp;
 
+		case FreeRDP_CompressionAdaptive:
+			return settings->CompressionAdaptive;
+
 		case FreeRDP_IPv6Enabled:
 			return settings->IPv6Enabled;
 
@@ -906,6 +909,12 @@ BOOL freerdp_get_param_bool(rdpSettings* settings, int id)
 		case FreeRDP_VmConnectMode:
 			return settings->VmConnectMode;
 
+		case FreeRDP_TlsKernelOffload:
+			return settings->TlsKernelOffload;
+
+		case FreeRDP_TlsSessionResumption:
+			return settings->TlsSessionResumption;
+
 		case FreeRDP_MstscCookieMode:
 			return settings->MstscCookieMode;
 
@@ -936,6 +945,9 @@ BOOL freerdp_get_param_bool(rdpSettings* settings, int id)
 		case FreeRDP_SmartSizing:
 			return settings->SmartSizing;
 
+		case FreeRDP_FramePacing:
+			return settings->FramePacing;
+
 		case FreeRDP_MouseMotion:
 			return settings->MouseMotion;
 
@@ -1273,6 +1285,10 @@ int freerdp_set_param_bool(rdpSettings* settings, int id, BOOL param)
 			settings->HiDefRemoteApp = param;
 			break;
 
+		case FreeRDP_CompressionAdaptive:
+			settings->CompressionAdaptive = param;
+			break;
+
 		case FreeRDP_IPv6Enabled:
 			settings->IPv6Enabled = param;
 			break;
@@ -1361,6 +1377,14 @@ int freerdp_set_param_bool(rdpSettings* settings, int id, BOOL param)
 			settings->VmConnectMode = param;
 			break;
 
+		case FreeRDP_TlsKernelOffload:
+			settings->TlsKernelOffload = param;
+			break;
+
+		case FreeRDP_TlsSessionResumption:
+			settings->TlsSessionResumption = param;
+			break;
+
 		case FreeRDP_MstscCookieMode:
 			settings->MstscCookieMode = param;
 			break;
@@ -1401,6 +1425,10 @@ int freerdp_set_param_bool(rdpSettings* settings, int id, BOOL param)
 			settings->SmartSizing = param;
 			break;
 
+		case FreeRDP_FramePacing:
+			settings->FramePacing = param;
+			break;
+
 		case FreeRDP_MouseMotion:
 			settings->MouseMotion = param;
 			break;
@@ -1739,6 +1767,9 @@ UINT32 freerdp_get_param_uint32(rdpSettings* settings, int id)
 		case FreeRDP_ServerPort:
 			return settings->ServerPort;
 
+		case FreeRDP_OutputQueueLimit:
+			return settings->OutputQueueLimit;
+
 		case FreeRDP_RdpVersion:
 			return settings->RdpVersion;
 
@@ -1871,6 +1902,12 @@ UINT32 freerdp_get_param_uint32(rdpSettings* settings, int id)
 		case FreeRDP_BitmapCacheV2NumCells:
 			return settings->BitmapCacheV2NumCells;
 
+		case FreeRDP_BitmapCachePersistMaxSize:
+			return settings->BitmapCachePersistMaxSize;
+
+		case FreeRDP_BitmapCacheMaxMemory:
+			return settings->BitmapCacheMaxMemory;
+
 		case FreeRDP_PointerCacheSize:
 			return settings->PointerCacheSize;
 
@@ -1896,6 +1933,9 @@ UINT32 freerdp_get_param_uint32(rdpSettings* settings, int id)
 		case FreeRDP_GlyphSupportLevel:
 			return settings->GlyphSupportLevel;
 
+		case FreeRDP_GlyphCacheMaxMemory:
+			return settings->GlyphCacheMaxMemory;
+
 		case FreeRDP_OffscreenSupportLevel:
 			return settings->OffscreenSupportLevel;
 
@@ -1974,6 +2014,9 @@ UINT32 freerdp_get_param_uint32(rdpSettings* settings, int id)
 		case FreeRDP_SmartSizingHeight:
 			return settings->SmartSizingHeight;
 
+		case FreeRDP_FramePacingRate:
+			return settings->FramePacingRate;
+
 		default:
 			WLog_ERR(TAG,  "freerdp_get_param_uint32: unknown id: %d", id);
 			return 0;
@@ -1996,6 +2039,10 @@ int freerdp_set_param_uint32(rdpSettings* settings, int id, UINT32 param)
 			settings->ServerPort = param;
 			break;
 
+		case FreeRDP_OutputQueueLimit:
+			settings->OutputQueueLimit = param;
+			break;
+
 		case FreeRDP_RdpVersion:
 			settings->RdpVersion = param;
 			break;
@@ -2172,6 +2219,18 @@ int freerdp_set_param_uint32(rdpSettings* settings, int id, UINT32 param)
 			settings->BitmapCacheV2NumCells = param;
 			break;
 
+		case FreeRDP_BitmapCachePersistMaxSize:
+			settings->BitmapCachePersistMaxSize = param;
+			break;
+
+		case FreeRDP_BitmapCacheMaxMemory:
+			settings->BitmapCacheMaxMemory = param;
+			break;
+
+		case FreeRDP_FramePacingRate:
+			settings->FramePacingRate = param;
+			break;
+
 		case FreeRDP_PointerCacheSize:
 			settings->PointerCacheSize = param;
 			break;
@@ -2204,6 +2263,10 @@ int freerdp_set_param_uint32(rdpSettings* settings, int id, UINT32 param)
 			settings->GlyphSupportLevel = param;
 			break;
 
+		case FreeRDP_GlyphCacheMaxMemory:
+			settings->GlyphCacheMaxMemory = param;
+			break;
+
 		case FreeRDP_OffscreenSupportLevel:
 			settings->OffscreenSupportLevel = param;
 			break;
@@ -2404,6 +2467,9 @@ char* freerdp_get_param_string(rdpSettings* settings, int id)
 		case FreeRDP_NtlmSamFile:
 			return settings->NtlmSamFile;
 
+		case FreeRDP_TlsSessionCacheFile:
+			return settings->TlsSessionCacheFile;
+
 		case FreeRDP_PreconnectionBlob:
 			return settings->PreconnectionBlob;
 
@@ -2491,6 +2557,9 @@ char* freerdp_get_param_string(rdpSettings* settings, int id)
 		case FreeRDP_RemoteApplicationCmdLine:
 			return settings->RemoteApplicationCmdLine;
 
+		case FreeRDP_BitmapCachePersistFile:
+			return settings->BitmapCachePersistFile;
+
 		case FreeRDP_ImeFileName:
 			return settings->ImeFileName;
 
@@ -2588,6 +2657,10 @@ int freerdp_set_param_string(rdpSettings* settings, int id, const char* param)
 			tmp = &settings->NtlmSamFile;
 			break;
 
+		case FreeRDP_TlsSessionCacheFile:
+			tmp = &settings->TlsSessionCacheFile;
+			break;
+
 		case FreeRDP_PreconnectionBlob:
 			tmp = &settings->PreconnectionBlob;
 			break;
@@ -2704,6 +2777,10 @@ int freerdp_set_param_string(rdpSettings* settings, int id, const char* param)
 			tmp = &settings->RemoteApplicationCmdLine;
 			break;
 
+		case FreeRDP_BitmapCachePersistFile:
+			tmp = &settings->BitmapCachePersistFile;
+			break;
+
 		case FreeRDP_ImeFileName:
 			tmp = &settings->ImeFileName;
 			break;
@@ -21,8 +21,12 @@
 #include "config.h"
 #endif
 
+#include <freerdp/log.h>
+
 #include "activation.h"
 
+#define TAG FREERDP_TAG("core.activation")
+
 /*
 static const char* const CTRLACTION_STRINGS[] =
 {
@@ -178,33 +182,129 @@ void rdp_write_persistent_list_entry(wStream* s, UINT32 key1, UINT32 key2)
 	Stream_Write_UINT32(s, key2); /* key2 (4 bytes) */
 }
 
-void rdp_write_client_persistent_key_list_pdu(wStream* s, rdpSettings* settings)
+void rdp_write_client_persistent_key_list_pdu(wStream* s, const UINT32* numEntries,
+        const UINT32* totalEntries, BYTE flags)
 {
-	Stream_Write_UINT16(s, 0); /* numEntriesCache0 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache1 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache2 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache3 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* numEntriesCache4 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache0 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache1 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache2 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache3 (2 bytes) */
-	Stream_Write_UINT16(s, 0); /* totalEntriesCache4 (2 bytes) */
-	Stream_Write_UINT8(s, PERSIST_FIRST_PDU | PERSIST_LAST_PDU); /* bBitMask (1 byte) */
+	UINT32 index;
+
+	for (index = 0; index < PERSISTENT_CACHE_MAX_CELLS; index++)
+		Stream_Write_UINT16(s, numEntries[index]); /* numEntriesCacheX (2 bytes) */
+
+	for (index = 0; index < PERSISTENT_CACHE_MAX_CELLS; index++)
+		Stream_Write_UINT16(s, totalEntries[index]); /* totalEntriesCacheX (2 bytes) */
+
+	Stream_Write_UINT8(s, flags); /* bBitMask (1 byte) */
 	Stream_Write_UINT8(s, 0); /* pad1 (1 byte) */
 	Stream_Write_UINT16(s, 0); /* pad3 (2 bytes) */
-
 	/* entries */
 }
 
+static rdpPersistentCache* rdp_open_persistent_cache(rdpRdp* rdp)
+{
+	char* filename;
+	rdpSettings* settings = rdp->settings;
+
+	if (!rdp->persistent)
+		rdp->persistent = persistent_cache_new();
+
+	if (!rdp->persistent || persistent_cache_is_open(rdp->persistent))
+		return rdp->persistent;
+
+	/**
+	 * The server capability turns BitmapCachePersistEnabled on, only a cache
+	 * file configured by the user opts in to writing bitmaps to disk.
+	 * Otherwise the session continues with an empty key list.
+	 */
+	if (!settings->BitmapCachePersistEnabled || !settings->BitmapCachePersistFile)
+		return rdp->persistent;
+
+	filename = _strdup(settings->BitmapCachePersistFile);
+
+	if (filename)
+		persistent_cache_open(rdp->persistent, filename, settings->BitmapCachePersistMaxSize);
+
+	free(filename);
+	return rdp->persistent;
+}
+
 BOOL rdp_send_client_persistent_key_list_pdu(rdpRdp* rdp)
 {
 	wStream* s;
+	UINT32 index;
+	UINT32 totalKeys = 0;
+	BYTE flags = PERSIST_FIRST_PDU;
+	const UINT64* keys[PERSISTENT_CACHE_MAX_CELLS];
+	UINT32 totalEntries[PERSISTENT_CACHE_MAX_CELLS];
+	UINT32 sentEntries[PERSISTENT_CACHE_MAX_CELLS] = { 0 };
+	rdpSettings* settings = rdp->settings;
+	rdpPersistentCache* persistent = rdp_open_persistent_cache(rdp);
+	/* keys are offered most recently used first, up to each cell's capacity */
+	persistent_cache_snapshot_keys(persistent, settings->BitmapCacheV2CellInfo,
+	                               settings->BitmapCacheV2NumCells);
+
+	for (index = 0; index < PERSISTENT_CACHE_MAX_CELLS; index++)
+	{
+		keys[index] = persistent_cache_get_snapshot(persistent, index, &totalEntries[index]);
+		totalKeys += totalEntries[index];
+	}
 
-	s = rdp_data_pdu_init(rdp);
-	rdp_write_client_persistent_key_list_pdu(s, rdp->settings);
+	WLog_DBG(TAG, "sending %u persistent bitmap cache keys", totalKeys);
+
+	do
+	{
+		UINT32 budget = PERSIST_MAX_KEYS_PER_PDU;
+		UINT32 numEntries[PERSISTENT_CACHE_MAX_CELLS];
+
+		for (index = 0; index < PERSISTENT_CACHE_MAX_CELLS; index++)
+		{
+			numEntries[index] = totalEntries[index] - sentEntries[index];
 
-	return rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_BITMAP_CACHE_PERSISTENT_LIST, rdp->mcs->userId);
+			if (numEntries[index] > budget)
+				numEntries[index] = budget;
+
+			budget -= numEntries[index];
+			totalKeys -= numEntries[index];
+		}
+
+		if (!totalKeys)
+			flags |= PERSIST_LAST_PDU;
+
+		s = rdp_data_pdu_init(rdp);
+
+		if (!s)
+			return FALSE;
+
+		if (!Stream_EnsureRemainingCapacity(s, 24 + (PERSIST_MAX_KEYS_PER_PDU - budget) * 8))
+		{
+			Stream_Release(s);
+			return FALSE;
+		}
+
+		rdp_write_client_persistent_key_list_pdu(s, numEntries, totalEntries, flags);
+
+		for (index = 0; index < PERSISTENT_CACHE_MAX_CELLS; index++)
+		{
+			UINT32 i;
+
+			for (i = 0; i < numEntries[index]; i++)
+			{
+				UINT64 key64 = keys[index][sentEntries[index] + i];
+				rdp_write_persistent_list_entry(s, (UINT32)(key64 & 0xFFFFFFFF),
+				                                (UINT32)(key64 >> 32));
+			}
+
+			sentEntries[index] += numEntries[index];
+		}
+
+		if (!rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_BITMAP_CACHE_PERSISTENT_LIST,
+		                       rdp->mcs->userId))
+			return FALSE;
+
+		flags = 0;
+	}
+	while (totalKeys);
+
+	return TRUE;
 }
 
 BOOL rdp_recv_client_font_list_pdu(wStream* s)
@@ -21,12 +21,44 @@
 #include "config.h"
 #endif
 
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include <winpr/sysinfo.h>
+
 #include "bulk.h"
 
 #define TAG "com.freerdp.core"
 
 //#define WITH_BULK_DEBUG		1
 
+/* payloads at least this large are sampled before they are compressed */
+#define BULK_SAMPLE_MIN_SIZE		1024
+#define BULK_SAMPLE_COUNT		256
+/* 256 random bytes hit about 162 distinct values */
+#define BULK_SAMPLE_MAX_DISTINCT	144
+
+#define BULK_TYPE_MAX_FAILURES		4
+#define BULK_TYPE_SKIP_COUNT		32
+
+/* compressed payloads between two adaptive level decisions */
+#define BULK_ADAPT_INTERVAL		64
+/* a new level must save at least 10% of the cost */
+#define BULK_ADAPT_GAIN			0.9
+/* percentage of the time between decisions that may be spent compressing */
+#define BULK_CPU_BUDGET			50
+
+/* initial ratio and cost (microseconds per byte) estimates, indexed by level */
+static const BULK_LEVEL_ESTIMATE BULK_LEVEL_PRIORS[METRICS_COMPRESSION_LEVELS] =
+{
+	{ 1.00, 0.000 }, /* uncompressed */
+	{ 0.55, 0.010 }, /* MPPC 8K */
+	{ 0.50, 0.012 }, /* MPPC 64K */
+	{ 0.45, 0.015 }, /* NCrush */
+	{ 0.40, 0.030 } /* XCrush */
+};
+
 const char* bulk_get_compression_flags_string(UINT32 flags)
 {
 	flags &= BULK_COMPRESSION_FLAGS_MASK;
@@ -175,9 +207,245 @@ int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstD
 	return status;
 }
 
-int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
+static UINT64 bulk_time(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (UINT64)(count.QuadPart * 1000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((UINT64) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static INLINE UINT32 bulk_level_index(UINT32 type)
+{
+	return type + 1;
+}
+
+/**
+ * Codec output and other already compressed data is close to random, a
+ * strided sample of such a payload hits most byte values. Compressing it
+ * only burns CPU and wipes the compression history.
+ */
+static BOOL bulk_sample_compressible(const BYTE* pSrcData, UINT32 SrcSize)
+{
+	UINT32 index;
+	UINT32 step;
+	UINT32 distinct = 0;
+	BYTE seen[256];
+
+	if (SrcSize < BULK_SAMPLE_MIN_SIZE)
+		return TRUE;
+
+	ZeroMemory(seen, sizeof(seen));
+	step = SrcSize / BULK_SAMPLE_COUNT;
+
+	for (index = 0; index < BULK_SAMPLE_COUNT; index++)
+	{
+		const BYTE value = pSrcData[index * step];
+
+		if (!seen[value])
+		{
+			seen[value] = 1;
+			distinct++;
+		}
+	}
+
+	return (distinct <= BULK_SAMPLE_MAX_DISTINCT) ? TRUE : FALSE;
+}
+
+static BOOL bulk_skip_payload(rdpBulk* bulk, BYTE updateCode, const BYTE* pSrcData,
+                              UINT32 SrcSize)
+{
+	BULK_UPDATE_TYPE* type = &bulk->UpdateTypes[updateCode % BULK_UPDATE_TYPES];
+
+	if (type->Skip > 0)
+	{
+		type->Skip--;
+		return TRUE;
+	}
+
+	return !bulk_sample_compressible(pSrcData, SrcSize);
+}
+
+/**
+ * An update type whose payloads repeatedly do not shrink is sent as is
+ * for a while before compression is tried on it again.
+ */
+static void bulk_update_type(rdpBulk* bulk, BYTE updateCode, UINT32 UncompressedBytes,
+                             UINT32 CompressedBytes)
+{
+	BULK_UPDATE_TYPE* type = &bulk->UpdateTypes[updateCode % BULK_UPDATE_TYPES];
+
+	if (((UINT64) CompressedBytes * 16) < ((UINT64) UncompressedBytes * 15))
+	{
+		type->Failures = 0;
+		return;
+	}
+
+	if (++type->Failures >= BULK_TYPE_MAX_FAILURES)
+	{
+		type->Failures = 0;
+		type->Skip = BULK_TYPE_SKIP_COUNT;
+	}
+}
+
+static void bulk_update_estimate(rdpBulk* bulk, UINT32 level, UINT32 UncompressedBytes,
+                                 UINT32 CompressedBytes, UINT64 time)
+{
+	BULK_LEVEL_ESTIMATE* estimate = &bulk->Estimates[level];
+	double ratio = ((double) CompressedBytes) / ((double) UncompressedBytes);
+	double cost = ((double) time) / ((double) UncompressedBytes);
+	estimate->Ratio = (estimate->Ratio * 7.0 + ratio) / 8.0;
+	estimate->Cost = (estimate->Cost * 7.0 + cost) / 8.0;
+	bulk->AdaptTime += time;
+}
+
+/**
+ * Returns the time in microseconds it takes to send one byte, guessing the
+ * link class from the round trip time if no bandwidth has been measured.
+ * Returns a negative value if autodetect has not provided anything yet.
+ */
+static double bulk_link_cost(rdpBulk* bulk)
+{
+	UINT32 rtt;
+	UINT32 bandwidth; /* kbit/s */
+	rdpAutoDetect* autodetect = bulk->context->rdp->autodetect;
+
+	if (!autodetect)
+		return -1.0;
+
+	bandwidth = autodetect->netCharBandwidth;
+
+	if (!bandwidth)
+	{
+		rtt = autodetect->netCharAverageRTT;
+
+		if (!rtt)
+			return -1.0;
+
+		if (rtt <= 2)
+			bandwidth = 1000000;
+		else if (rtt <= 20)
+			bandwidth = 100000;
+		else
+			bandwidth = 10000;
+	}
+
+	return 8000.0 / bandwidth;
+}
+
+static void bulk_set_send_level(rdpBulk* bulk, UINT32 level)
+{
+	/* a compressor that was idle starts with a flushed packet so the peer resets its history */
+	switch (level)
+	{
+		case 1 + PACKET_COMPR_TYPE_8K:
+		case 1 + PACKET_COMPR_TYPE_64K:
+			mppc_set_compression_level(bulk->mppcSend, level - 1);
+			mppc_context_reset(bulk->mppcSend, TRUE);
+			break;
+
+		case 1 + PACKET_COMPR_TYPE_RDP6:
+			ncrush_context_reset(bulk->ncrushSend, TRUE);
+			break;
+
+		case 1 + PACKET_COMPR_TYPE_RDP61:
+			xcrush_context_reset(bulk->xcrushSend, TRUE);
+			break;
+
+		default:
+			break;
+	}
+
+	WLog_DBG(TAG, "bulk compression level %u -> %u", bulk->SendLevel, level);
+	bulk->SendLevel = level;
+}
+
+/**
+ * Picks the level that minimizes the time to compress and send a byte,
+ * from the estimates gathered so far and the link speed reported by
+ * autodetect. Above the CPU budget only levels cheaper than the current
+ * one are considered. A level is only changed for a clear gain since
+ * every change flushes the compression history.
+ */
+static void bulk_adapt(rdpBulk* bulk, UINT32 negotiated)
+{
+	UINT32 level;
+	UINT32 best;
+	double cost;
+	double bestCost;
+	double currentCost;
+	BOOL overBudget;
+	BULK_LEVEL_ESTIMATE* estimate;
+	UINT64 now = bulk_time();
+	double link = bulk_link_cost(bulk);
+	overBudget = ((bulk->AdaptTime * 100) > ((now - bulk->AdaptStart) * BULK_CPU_BUDGET));
+	bulk->AdaptPackets = 0;
+	bulk->AdaptStart = now;
+	bulk->AdaptTime = 0;
+
+	if (link < 0.0)
+		return;
+
+	estimate = &bulk->Estimates[bulk->SendLevel];
+	currentCost = estimate->Cost + estimate->Ratio * link;
+	best = bulk->SendLevel;
+	bestCost = overBudget ? -1.0 : currentCost * BULK_ADAPT_GAIN;
+
+	for (level = 0; level <= negotiated; level++)
+	{
+		if (level == bulk->SendLevel)
+			continue;
+
+		/* fragments are sized for the negotiated history, MPPC-8K can not address it */
+		if ((level == bulk_level_index(PACKET_COMPR_TYPE_8K)) &&
+		    (negotiated > bulk_level_index(PACKET_COMPR_TYPE_8K)))
+			continue;
+
+		if (overBudget && (bulk->Estimates[level].Cost >= estimate->Cost))
+			continue;
+
+		cost = bulk->Estimates[level].Cost + bulk->Estimates[level].Ratio * link;
+
+		if ((bestCost < 0.0) || (cost < bestCost))
+		{
+			best = level;
+			bestCost = cost;
+		}
+	}
+
+	if (best != bulk->SendLevel)
+		bulk_set_send_level(bulk, best);
+}
+
+static UINT32 bulk_send_level(rdpBulk* bulk)
+{
+	UINT32 negotiated = bulk_level_index(bulk->CompressionLevel);
+
+	if (!bulk->context->settings->CompressionAdaptive)
+		return negotiated;
+
+	if (bulk->SendLevel > negotiated)
+		bulk_set_send_level(bulk, negotiated);
+
+	if (++bulk->AdaptPackets >= BULK_ADAPT_INTERVAL)
+		bulk_adapt(bulk, negotiated);
+
+	return bulk->SendLevel;
+}
+
+int bulk_compress(rdpBulk* bulk, BYTE updateCode, BYTE* pSrcData, UINT32 SrcSize,
+                  BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
 {
 	int status = -1;
+	UINT32 level;
+	UINT64 time;
 	rdpMetrics* metrics;
 	UINT32 CompressedBytes;
 	UINT32 UncompressedBytes;
@@ -191,22 +459,33 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 		return 0;
 	}
 
-	*ppDstData = bulk->OutputBuffer;
-	*pDstSize = sizeof(bulk->OutputBuffer);
 	bulk_compression_level(bulk);
 	bulk_compression_max_size(bulk);
+	level = bulk_send_level(bulk);
 
-	if ((bulk->CompressionLevel == PACKET_COMPR_TYPE_8K) ||
-			(bulk->CompressionLevel == PACKET_COMPR_TYPE_64K))
+	if ((level == 0) || bulk_skip_payload(bulk, updateCode, pSrcData, SrcSize))
 	{
-		mppc_set_compression_level(bulk->mppcSend, bulk->CompressionLevel);
+		metrics_write_compression(metrics, 0, SrcSize, SrcSize, 0);
+		*ppDstData = pSrcData;
+		*pDstSize = SrcSize;
+		return 0;
+	}
+
+	*ppDstData = bulk->OutputBuffer;
+	*pDstSize = sizeof(bulk->OutputBuffer);
+	time = bulk_time();
+
+	if ((level == bulk_level_index(PACKET_COMPR_TYPE_8K)) ||
+			(level == bulk_level_index(PACKET_COMPR_TYPE_64K)))
+	{
+		mppc_set_compression_level(bulk->mppcSend, level - 1);
 		status = mppc_compress(bulk->mppcSend, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
 	}
-	else if (bulk->CompressionLevel == PACKET_COMPR_TYPE_RDP6)
+	else if (level == bulk_level_index(PACKET_COMPR_TYPE_RDP6))
 	{
 		status = ncrush_compress(bulk->ncrushSend, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
 	}
-	else if (bulk->CompressionLevel == PACKET_COMPR_TYPE_RDP61)
+	else if (level == bulk_level_index(PACKET_COMPR_TYPE_RDP61))
 	{
 		status = xcrush_compress(bulk->xcrushSend, pSrcData, SrcSize, ppDstData, pDstSize, pFlags);
 	}
@@ -215,15 +494,20 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 		status = -1;
 	}
 
+	time = bulk_time() - time;
+
 	if (status >= 0)
 	{
-		CompressedBytes = *pDstSize;
+		CompressedBytes = (*pFlags & PACKET_COMPRESSED) ? *pDstSize : SrcSize;
 		UncompressedBytes = SrcSize;
 		CompressionRatio = metrics_write_bytes(metrics, UncompressedBytes, CompressedBytes);
+		metrics_write_compression(metrics, level, UncompressedBytes, CompressedBytes, time);
+		bulk_update_type(bulk, updateCode, UncompressedBytes, CompressedBytes);
+		bulk_update_estimate(bulk, level, UncompressedBytes, CompressedBytes, time);
 #ifdef WITH_BULK_DEBUG
 		{
 			WLog_DBG(TAG, "Compress Type: %d Flags: %s (0x%04X) Compression Ratio: %f (%d / %d), Total: %f (%u / %u)",
-					 bulk->CompressionLevel, bulk_get_compression_flags_string(*pFlags), *pFlags,
+					 level - 1, bulk_get_compression_flags_string(*pFlags), *pFlags,
 					 CompressionRatio, CompressedBytes, UncompressedBytes,
 					 metrics->TotalCompressionRatio, (UINT32) metrics->TotalCompressedBytes,
 					 (UINT32) metrics->TotalUncompressedBytes);
@@ -240,6 +524,16 @@ int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstDat
 	return status;
 }
 
+static void bulk_reset_adaptation(rdpBulk* bulk)
+{
+	bulk->SendLevel = bulk_level_index(bulk_compression_level(bulk));
+	bulk->AdaptPackets = 0;
+	bulk->AdaptStart = bulk_time();
+	bulk->AdaptTime = 0;
+	CopyMemory(bulk->Estimates, BULK_LEVEL_PRIORS, sizeof(bulk->Estimates));
+	ZeroMemory(bulk->UpdateTypes, sizeof(bulk->UpdateTypes));
+}
+
 void bulk_reset(rdpBulk* bulk)
 {
 	mppc_context_reset(bulk->mppcSend, FALSE);
@@ -248,6 +542,7 @@ void bulk_reset(rdpBulk* bulk)
 	ncrush_context_reset(bulk->ncrushSend, FALSE);
 	xcrush_context_reset(bulk->xcrushRecv, FALSE);
 	xcrush_context_reset(bulk->xcrushSend, FALSE);
+	bulk_reset_adaptation(bulk);
 }
 
 rdpBulk* bulk_new(rdpContext* context)
@@ -265,6 +560,7 @@ rdpBulk* bulk_new(rdpContext* context)
 		bulk->xcrushRecv = xcrush_context_new(FALSE);
 		bulk->xcrushSend = xcrush_context_new(TRUE);
 		bulk->CompressionLevel = context->settings->CompressionLevel;
+		bulk_reset_adaptation(bulk);
 	}
 
 	return bulk;
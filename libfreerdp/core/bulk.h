@@ -25,15 +25,38 @@ typedef struct rdp_bulk rdpBulk;
 #include "rdp.h"
 
 #include <freerdp/api.h>
+#include <freerdp/metrics.h>
 #include <freerdp/codec/mppc.h>
 #include <freerdp/codec/ncrush.h>
 #include <freerdp/codec/xcrush.h>
 
+#define BULK_UPDATE_TYPES	16
+
+struct _BULK_LEVEL_ESTIMATE
+{
+	double Ratio;
+	double Cost; /* microseconds per uncompressed byte */
+};
+typedef struct _BULK_LEVEL_ESTIMATE BULK_LEVEL_ESTIMATE;
+
+struct _BULK_UPDATE_TYPE
+{
+	UINT32 Failures;
+	UINT32 Skip;
+};
+typedef struct _BULK_UPDATE_TYPE BULK_UPDATE_TYPE;
+
 struct rdp_bulk
 {
 	rdpContext* context;
 	UINT32 CompressionLevel;
 	UINT32 CompressionMaxSize;
+	UINT32 SendLevel;
+	UINT32 AdaptPackets;
+	UINT64 AdaptStart;
+	UINT64 AdaptTime;
+	BULK_LEVEL_ESTIMATE Estimates[METRICS_COMPRESSION_LEVELS];
+	BULK_UPDATE_TYPE UpdateTypes[BULK_UPDATE_TYPES];
 	MPPC_CONTEXT* mppcSend;
 	MPPC_CONTEXT* mppcRecv;
 	NCRUSH_CONTEXT* ncrushRecv;
@@ -51,8 +74,8 @@ FREERDP_LOCAL UINT32 bulk_compression_max_size(rdpBulk* bulk);
 
 FREERDP_LOCAL int bulk_decompress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize,
                                   BYTE** ppDstData, UINT32* pDstSize, UINT32 flags);
-FREERDP_LOCAL int bulk_compress(rdpBulk* bulk, BYTE* pSrcData, UINT32 SrcSize,
-                                BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags);
+FREERDP_LOCAL int bulk_compress(rdpBulk* bulk, BYTE updateCode, BYTE* pSrcData,
+                                UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags);
 
 FREERDP_LOCAL void bulk_reset(rdpBulk* bulk);
 
@@ -76,13 +76,15 @@ BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, BYTE* data, int size)
 
 	flags = CHANNEL_FLAG_FIRST;
 	left = size;
+	/* all chunks of the message leave in as few TLS records as possible */
+	transport_begin_write_batch(rdp->transport);
 
 	while (left > 0)
 	{
 		s = rdp_send_stream_init(rdp);
 
 		if (!s)
-			return FALSE;
+			goto fail;
 
 		if (left > (int) rdp->settings->VirtualChannelChunkSize)
 		{
@@ -105,7 +107,7 @@ BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, BYTE* data, int size)
 		if (!Stream_EnsureCapacity(s, chunkSize))
 		{
 			Stream_Release(s);
-			return FALSE;
+			goto fail;
 		}
 
 		Stream_Write(s, data, chunkSize);
@@ -113,7 +115,7 @@ BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, BYTE* data, int size)
 		if (!rdp_send(rdp, s, channelId))
 		{
 			Stream_Release(s);
-			return FALSE;
+			goto fail;
 		}
 
 		data += chunkSize;
@@ -121,7 +123,10 @@ BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, BYTE* data, int size)
 		flags = 0;
 	}
 
-	return TRUE;
+	return transport_end_write_batch(rdp->transport);
+fail:
+	transport_end_write_batch(rdp->transport);
+	return FALSE;
 }
 
 BOOL freerdp_channel_process(freerdp* instance, wStream* s, UINT16 channelId)
@@ -348,6 +348,9 @@ static int freerdp_channels_process_sync(rdpChannels* channels,
 	rdpMcsChannel* channel;
 	CHANNEL_OPEN_EVENT* item;
 	CHANNEL_OPEN_DATA* pChannelOpenData;
+	rdpTransport* transport = instance->context->rdp->transport;
+	/* everything queued by the channels goes out in one write batch */
+	transport_begin_write_batch(transport);
 
 	while (MessageQueue_Peek(channels->queue, &message, TRUE))
 	{
@@ -387,6 +390,9 @@ static int freerdp_channels_process_sync(rdpChannels* channels,
 		}
 	}
 
+	if (!transport_end_write_batch(transport))
+		status = FALSE;
+
 	return status;
 }
 
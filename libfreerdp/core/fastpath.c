@@ -916,9 +916,7 @@ wStream* fastpath_update_pdu_init(rdpFastPath* fastpath)
 
 wStream* fastpath_update_pdu_init_new(rdpFastPath* fastpath)
 {
-	wStream* s;
-	s = Stream_New(NULL, FASTPATH_MAX_PACKET_SIZE);
-	return s;
+	return transport_send_stream_init(fastpath->rdp->transport, FASTPATH_MAX_PACKET_SIZE);
 }
 
 BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s, BOOL skipCompression)
@@ -975,6 +973,9 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			rdp->sec_flags |= SEC_SECURE_CHECKSUM;
 	}
 
+	/* fragments are gathered and written out together */
+	transport_begin_write_batch(rdp->transport);
+
 	for (fragment = 0; (totalLength > 0) || (fragment == 0); fragment++)
 	{
 		BYTE* pSrcData;
@@ -1003,7 +1004,8 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 
 		if (settings->CompressionEnabled && !skipCompression)
 		{
-			if (bulk_compress(rdp->bulk, pSrcData, SrcSize, &pDstData, &DstSize, &compressionFlags) >= 0)
+			if (bulk_compress(rdp->bulk, updateCode, pSrcData, SrcSize, &pDstData, &DstSize,
+			                  &compressionFlags) >= 0)
 			{
 				if (compressionFlags)
 				{
@@ -1054,6 +1056,22 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		Stream_SetPosition(fs, 0);
 		fastpath_write_update_pdu_header(fs, &fpUpdatePduHeader, rdp);
 		fastpath_write_update_header(fs, &fpUpdateHeader);
+
+		if (!(rdp->sec_flags & SEC_ENCRYPT))
+		{
+			/* only the headers are copied, the payload is written from where it is */
+			Stream_SealLength(fs);
+
+			if (transport_write_gather(rdp->transport, fs, pDstData, DstSize) < 0)
+			{
+				status = FALSE;
+				break;
+			}
+
+			Stream_Seek(s, SrcSize);
+			continue;
+		}
+
 		Stream_Write(fs, pDstData, DstSize);
 
 		if (pad)
@@ -1067,7 +1085,11 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 			if (rdp->settings->EncryptionMethods == ENCRYPTION_METHOD_FIPS)
 			{
 				if (!security_hmac_signature(data, dataSize - pad, pSignature, rdp))
-					return FALSE;
+				{
+					status = FALSE;
+					break;
+				}
+
 				security_fips_encrypt(data, dataSize, rdp);
 			}
 			else
@@ -1078,7 +1100,10 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 					status = security_mac_signature(rdp, data, dataSize, pSignature);
 
 				if (!status || !security_encrypt(data, dataSize, rdp))
-					return FALSE;
+				{
+					status = FALSE;
+					break;
+				}
 			}
 		}
 
@@ -1093,6 +1118,9 @@ BOOL fastpath_send_update_pdu(rdpFastPath* fastpath, BYTE updateCode, wStream* s
 		Stream_Seek(s, SrcSize);
 	}
 
+	if (!transport_end_write_batch(rdp->transport))
+		status = FALSE;
+
 	rdp->sec_flags = 0;
 
 	return status;
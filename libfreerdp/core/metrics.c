@@ -38,6 +38,25 @@ double metrics_write_bytes(rdpMetrics* metrics, UINT32 UncompressedBytes, UINT32
 	return CompressionRatio;
 }
 
+/**
+ * Accounts a payload sent by the bulk compressor, level 0 counts the
+ * payloads sent uncompressed, level n the ones compressed with type n - 1.
+ */
+void metrics_write_compression(rdpMetrics* metrics, UINT32 level,
+		UINT32 UncompressedBytes, UINT32 CompressedBytes, UINT64 CompressionTime)
+{
+	METRICS_COMPRESSION_LEVEL* stats;
+
+	if (level >= METRICS_COMPRESSION_LEVELS)
+		return;
+
+	stats = &metrics->CompressionLevels[level];
+	stats->Packets++;
+	stats->UncompressedBytes += UncompressedBytes;
+	stats->CompressedBytes += CompressedBytes;
+	stats->CompressionTime += CompressionTime;
+}
+
 rdpMetrics* metrics_new(rdpContext* context)
 {
 	rdpMetrics* metrics;
@@ -29,6 +29,7 @@
 #include "certificate.h"
 
 #include <freerdp/log.h>
+#include <freerdp/channels/wtsvc.h>
 
 #include "peer.h"
 
@@ -265,7 +266,20 @@ static BOOL freerdp_peer_check_fds(freerdp_peer* peer)
 {
 	int status;
 	rdpRdp* rdp;
+	BOOL rc = TRUE;
 	rdp = peer->context->rdp;
+	status = transport_flush_output_queue(rdp->transport);
+
+	if (status < 0)
+		return FALSE;
+
+	/* the queue made room again, let the server resume its updates */
+	if (status > 0)
+		IFCALLRET(peer->OutputQueueDrained, rc, peer);
+
+	if (!rc)
+		return FALSE;
+
 	status = rdp_check_fds(rdp);
 
 	if (status < 0)
@@ -699,6 +713,18 @@ static BOOL freerdp_peer_has_more_to_read(freerdp_peer* peer)
 	return peer->context->rdp->transport->haveMoreBytesToRead;
 }
 
+static size_t freerdp_peer_get_output_queue_size(freerdp_peer* peer)
+{
+	rdpTransport* transport = peer->context->rdp->transport;
+	return transport_get_output_queue_size(transport);
+}
+
+static BOOL freerdp_peer_is_output_queue_full(freerdp_peer* peer)
+{
+	rdpTransport* transport = peer->context->rdp->transport;
+	return transport_is_output_queue_full(transport);
+}
+
 BOOL freerdp_peer_context_new(freerdp_peer* client)
 {
 	rdpRdp* rdp;
@@ -752,6 +778,8 @@ BOOL freerdp_peer_context_new(freerdp_peer* client)
 	client->IsWriteBlocked = freerdp_peer_is_write_blocked;
 	client->DrainOutputBuffer = freerdp_peer_drain_output_buffer;
 	client->HasMoreToRead = freerdp_peer_has_more_to_read;
+	client->GetOutputQueueSize = freerdp_peer_get_output_queue_size;
+	client->IsOutputQueueFull = freerdp_peer_is_output_queue_full;
 	IFCALLRET(client->ContextNew, ret, client, client->context);
 
 	if (ret)
@@ -818,6 +846,8 @@ freerdp_peer* freerdp_peer_new(int sockfd)
 		client->IsWriteBlocked = freerdp_peer_is_write_blocked;
 		client->DrainOutputBuffer = freerdp_peer_drain_output_buffer;
 		client->HasMoreToRead = freerdp_peer_has_more_to_read;
+		client->GetOutputQueueSize = freerdp_peer_get_output_queue_size;
+		client->IsOutputQueueFull = freerdp_peer_is_output_queue_full;
 		client->VirtualChannelOpen = freerdp_peer_virtual_channel_open;
 		client->VirtualChannelClose = freerdp_peer_virtual_channel_close;
 		client->VirtualChannelWrite = freerdp_peer_virtual_channel_write;
@@ -836,3 +866,102 @@ void freerdp_peer_free(freerdp_peer* client)
 
 	free(client);
 }
+
+struct rdp_peer_reactor_context
+{
+	freerdp_peer* client;
+	HANDLE vcm;
+	pReactorClose close;
+};
+typedef struct rdp_peer_reactor_context rdpPeerReactorContext;
+
+static BOOL freerdp_peer_reactor_dispatch(void* arg)
+{
+	rdpPeerReactorContext* context = (rdpPeerReactorContext*) arg;
+	freerdp_peer* client = context->client;
+
+	if (client->CheckFileDescriptor(client) != TRUE)
+		return FALSE;
+
+	if (context->vcm && (WTSVirtualChannelManagerCheckFileDescriptor(context->vcm) != TRUE))
+		return FALSE;
+
+	return TRUE;
+}
+
+/* the socket write event is only among the handles while output is queued */
+static DWORD freerdp_peer_reactor_get_handles(void* arg, HANDLE* handles, DWORD count)
+{
+	DWORD nCount;
+	rdpPeerReactorContext* context = (rdpPeerReactorContext*) arg;
+	freerdp_peer* client = context->client;
+
+	if (count < 2)
+		return 0;
+
+	nCount = client->GetEventHandles(client, handles, count - 1);
+
+	if (nCount == 0)
+		return 0;
+
+	if (context->vcm)
+		handles[nCount++] = WTSVirtualChannelManagerGetEventHandle(context->vcm);
+
+	return nCount;
+}
+
+static void freerdp_peer_reactor_close(void* arg)
+{
+	rdpPeerReactorContext* context = (rdpPeerReactorContext*) arg;
+
+	if (context->close)
+		context->close(context->client);
+
+	free(context);
+}
+
+/**
+ * Serves an initialized peer from a reactor instead of a thread of its own.
+ * Whenever its transport or virtual channel manager (optional) is signaled
+ * the peer and channels are checked, on failure the peer is removed and
+ * close is called with the peer as argument to disconnect and free it.
+ * The handles are fetched again after each dispatch, so that the reactor
+ * waits for the socket to become writable while a peer with an output
+ * queue limit has output queued.
+ */
+rdpReactorSource* freerdp_peer_reactor_add(freerdp_peer* client, rdpReactor* reactor,
+        HANDLE hVirtualChannelManager, pReactorClose close)
+{
+	DWORD count;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	rdpReactorSource* source;
+	rdpPeerReactorContext* context;
+
+	if (!client || !reactor)
+		return NULL;
+
+	context = (rdpPeerReactorContext*) calloc(1, sizeof(rdpPeerReactorContext));
+
+	if (!context)
+		return NULL;
+
+	context->client = client;
+	context->vcm = hVirtualChannelManager;
+	context->close = close;
+	count = freerdp_peer_reactor_get_handles(context, handles, ARRAYSIZE(handles) - 1);
+
+	if (count == 0)
+	{
+		WLog_ERR(TAG, "Failed to get the peer event handles");
+		free(context);
+		return NULL;
+	}
+
+	source = freerdp_reactor_add_ex(reactor, handles, count, freerdp_peer_reactor_dispatch,
+	                                freerdp_peer_reactor_get_handles, freerdp_peer_reactor_close, context);
+
+	if (!source)
+		free(context);
+
+	return source;
+}
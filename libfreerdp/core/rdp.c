@@ -1708,6 +1708,7 @@ void rdp_free(rdpRdp* rdp)
 		heartbeat_free(rdp->heartbeat);
 		multitransport_free(rdp->multitransport);
 		bulk_free(rdp->bulk);
+		persistent_cache_free(rdp->persistent);
 		free(rdp);
 	}
 }
@@ -49,6 +49,7 @@
 #include <freerdp/freerdp.h>
 #include <freerdp/settings.h>
 #include <freerdp/log.h>
+#include <freerdp/cache/persistent.h>
 #include <freerdp/api.h>
 
 #include <winpr/stream.h>
@@ -149,6 +150,7 @@ struct rdp_rdp
 	rdpAutoDetect* autodetect;
 	rdpHeartbeat* heartbeat;
 	rdpMultitransport* multitransport;
+	rdpPersistentCache* persistent;
 	WINPR_RC4_CTX* rc4_decrypt_key;
 	int decrypt_use_count;
 	int decrypt_checksum_use_count;
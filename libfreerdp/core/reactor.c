@@ -0,0 +1,669 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Event Reactor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/collections.h>
+
+#include <freerdp/log.h>
+#include <freerdp/reactor.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
+
+#define TAG FREERDP_TAG("core.reactor")
+
+#define REACTOR_MAX_EVENTS	64
+
+/**
+ * A reactor multiplexes the event handles of many sources (typically one
+ * per connected peer) on a small, fixed set of threads. Each source is
+ * owned by one thread for its whole lifetime, so its dispatch callback is
+ * never run concurrently, just like with a dedicated thread per peer.
+ *
+ * With epoll each reactor thread waits on the file descriptors behind the
+ * WinPR handles of its sources. Elsewhere every source falls back to a
+ * thread of its own waiting with WaitForMultipleObjects.
+ */
+
+typedef struct rdp_reactor_thread REACTOR_THREAD;
+
+struct rdp_reactor_source
+{
+	REACTOR_THREAD* owner;
+	rdpReactorSource* next;
+	DWORD count;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	pReactorDispatch dispatch;
+	pReactorGetHandles getHandles;
+	pReactorClose close;
+	void* context;
+	BOOL removed;
+#ifdef HAVE_SYS_EPOLL_H
+	UINT64 iteration;
+#else
+	HANDLE stopEvent;
+#endif
+};
+
+struct rdp_reactor_thread
+{
+	rdpReactor* reactor;
+	HANDLE thread;
+	CRITICAL_SECTION lock;
+	wArrayList* sources;
+#ifdef HAVE_SYS_EPOLL_H
+	int epfd;
+	HANDLE wakeup;
+	BOOL pendingRemoval;
+	UINT64 iteration;
+#endif
+};
+
+struct rdp_reactor
+{
+	DWORD count;
+	REACTOR_THREAD* threads;
+	BOOL stop;
+};
+
+static void reactor_source_close(rdpReactorSource* source)
+{
+	if (source->close)
+		source->close(source->context);
+
+#ifndef HAVE_SYS_EPOLL_H
+	CloseHandle(source->stopEvent);
+#endif
+	free(source);
+}
+
+/* unlinks the removed sources, the caller closes them without holding the lock */
+static rdpReactorSource* reactor_thread_unlink_removed(REACTOR_THREAD* rt, BOOL all)
+{
+	int index;
+	rdpReactorSource* source;
+	rdpReactorSource* removed = NULL;
+
+	for (index = ArrayList_Count(rt->sources) - 1; index >= 0; index--)
+	{
+		source = (rdpReactorSource*) ArrayList_GetItem(rt->sources, index);
+
+		if (!all && !source->removed)
+			continue;
+
+		ArrayList_RemoveAt(rt->sources, index);
+		source->next = removed;
+		removed = source;
+	}
+
+	return removed;
+}
+
+static BOOL reactor_source_update(rdpReactorSource* source, const HANDLE* handles, DWORD count);
+
+/* fetches the handles of a source again after a dispatch, if they can change */
+static BOOL reactor_source_refresh(rdpReactorSource* source)
+{
+	DWORD count;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+
+	if (!source->getHandles)
+		return TRUE;
+
+	count = source->getHandles(source->context, handles, MAXIMUM_WAIT_OBJECTS - 1);
+
+	if ((count == 0) || (count >= MAXIMUM_WAIT_OBJECTS))
+	{
+		WLog_ERR(TAG, "failed to get the handles of a source");
+		return FALSE;
+	}
+
+	if ((count == source->count) &&
+	    (memcmp(handles, source->handles, count * sizeof(HANDLE)) == 0))
+		return TRUE;
+
+	return reactor_source_update(source, handles, count);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+static void reactor_source_unregister(rdpReactorSource* source, DWORD count)
+{
+	DWORD index;
+	int fd;
+
+	for (index = 0; index < count; index++)
+	{
+		fd = GetEventFileDescriptor(source->handles[index]);
+
+		if (fd >= 0)
+			epoll_ctl(source->owner->epfd, EPOLL_CTL_DEL, fd, NULL);
+	}
+}
+
+/* all handles of a source on the same descriptor share one registration */
+static UINT32 reactor_source_epoll_events(rdpReactorSource* source, int fd)
+{
+	DWORD index;
+	ULONG mode = 0;
+	UINT32 events = 0;
+
+	for (index = 0; index < source->count; index++)
+	{
+		if (GetEventFileDescriptor(source->handles[index]) == fd)
+			mode |= GetEventFileDescriptorMode(source->handles[index]);
+	}
+
+	if (mode & WINPR_FD_WRITE)
+		events |= EPOLLOUT;
+
+	if ((mode & WINPR_FD_READ) || !events)
+		events |= EPOLLIN;
+
+	return events;
+}
+
+static BOOL reactor_source_register(rdpReactorSource* source)
+{
+	DWORD index;
+	int fd;
+	struct epoll_event event;
+
+	for (index = 0; index < source->count; index++)
+	{
+		fd = GetEventFileDescriptor(source->handles[index]);
+
+		if (fd < 0)
+		{
+			WLog_ERR(TAG, "handle %u has no file descriptor", index);
+			goto fail;
+		}
+
+		ZeroMemory(&event, sizeof(event));
+		event.events = reactor_source_epoll_events(source, fd);
+		event.data.ptr = source;
+
+		/* a source may list the same descriptor twice */
+		if ((epoll_ctl(source->owner->epfd, EPOLL_CTL_ADD, fd, &event) < 0) && (errno != EEXIST))
+		{
+			WLog_ERR(TAG, "epoll_ctl failed: %s", strerror(errno));
+			goto fail;
+		}
+	}
+
+	return TRUE;
+fail:
+	reactor_source_unregister(source, index);
+	return FALSE;
+}
+
+static BOOL reactor_source_start(rdpReactorSource* source)
+{
+	return TRUE;
+}
+
+static BOOL reactor_source_update(rdpReactorSource* source, const HANDLE* handles, DWORD count)
+{
+	reactor_source_unregister(source, source->count);
+	source->count = count;
+	CopyMemory(source->handles, handles, count * sizeof(HANDLE));
+	return reactor_source_register(source);
+}
+
+static void reactor_thread_reap(REACTOR_THREAD* rt)
+{
+	rdpReactorSource* source;
+	rdpReactorSource* removed;
+	EnterCriticalSection(&rt->lock);
+	rt->pendingRemoval = FALSE;
+	removed = reactor_thread_unlink_removed(rt, FALSE);
+	LeaveCriticalSection(&rt->lock);
+
+	while (removed)
+	{
+		source = removed;
+		removed = source->next;
+		reactor_source_unregister(source, source->count);
+		reactor_source_close(source);
+	}
+}
+
+static DWORD WINAPI reactor_thread_proc(LPVOID arg)
+{
+	int index;
+	int status;
+	BOOL reap;
+	rdpReactorSource* source;
+	REACTOR_THREAD* rt = (REACTOR_THREAD*) arg;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while (!rt->reactor->stop)
+	{
+		status = epoll_wait(rt->epfd, events, REACTOR_MAX_EVENTS, -1);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_ERR(TAG, "epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		reap = FALSE;
+		rt->iteration++;
+
+		for (index = 0; index < status; index++)
+		{
+			source = (rdpReactorSource*) events[index].data.ptr;
+
+			if (!source)
+			{
+				ResetEvent(rt->wakeup);
+				reap = TRUE;
+				continue;
+			}
+
+			/* several handles of a source may be ready at once */
+			if (source->removed || (source->iteration == rt->iteration))
+				continue;
+
+			source->iteration = rt->iteration;
+
+			if (!source->dispatch(source->context) || !reactor_source_refresh(source))
+			{
+				EnterCriticalSection(&rt->lock);
+				source->removed = TRUE;
+				LeaveCriticalSection(&rt->lock);
+				reap = TRUE;
+			}
+		}
+
+		if (reap || rt->pendingRemoval)
+			reactor_thread_reap(rt);
+	}
+
+	return 0;
+}
+
+static BOOL reactor_thread_init(REACTOR_THREAD* rt)
+{
+	int fd;
+	struct epoll_event event;
+	rt->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (rt->epfd < 0)
+	{
+		WLog_ERR(TAG, "epoll_create1 failed: %s", strerror(errno));
+		return FALSE;
+	}
+
+	rt->wakeup = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!rt->wakeup)
+		return FALSE;
+
+	fd = GetEventFileDescriptor(rt->wakeup);
+	ZeroMemory(&event, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if ((fd < 0) || (epoll_ctl(rt->epfd, EPOLL_CTL_ADD, fd, &event) < 0))
+		return FALSE;
+
+	if (!(rt->thread = CreateThread(NULL, 0, reactor_thread_proc, rt, 0, NULL)))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void reactor_thread_wakeup(REACTOR_THREAD* rt)
+{
+	if (rt->wakeup)
+		SetEvent(rt->wakeup);
+}
+
+static void reactor_thread_uninit(REACTOR_THREAD* rt)
+{
+	if (rt->wakeup)
+		CloseHandle(rt->wakeup);
+
+	if (rt->epfd >= 0)
+		close(rt->epfd);
+}
+
+#else
+
+static DWORD WINAPI reactor_source_thread_proc(LPVOID arg)
+{
+	DWORD status;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	rdpReactorSource* source = (rdpReactorSource*) arg;
+	REACTOR_THREAD* rt = source->owner;
+
+	while (TRUE)
+	{
+		CopyMemory(handles, source->handles, source->count * sizeof(HANDLE));
+		handles[source->count] = source->stopEvent;
+		status = WaitForMultipleObjects(source->count + 1, handles, FALSE, INFINITE);
+
+		if (status == WAIT_FAILED)
+			break;
+
+		if (WaitForSingleObject(source->stopEvent, 0) == WAIT_OBJECT_0)
+			break;
+
+		if (!source->dispatch(source->context) || !reactor_source_refresh(source))
+			break;
+	}
+
+	EnterCriticalSection(&rt->lock);
+	ArrayList_Remove(rt->sources, source);
+	LeaveCriticalSection(&rt->lock);
+	reactor_source_close(source);
+	return 0;
+}
+
+static BOOL reactor_source_register(rdpReactorSource* source)
+{
+	if (!(source->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void reactor_source_unregister(rdpReactorSource* source, DWORD count)
+{
+	CloseHandle(source->stopEvent);
+}
+
+static BOOL reactor_source_update(rdpReactorSource* source, const HANDLE* handles, DWORD count)
+{
+	/* only the source thread waits on them, it picks them up next round */
+	source->count = count;
+	CopyMemory(source->handles, handles, count * sizeof(HANDLE));
+	return TRUE;
+}
+
+static BOOL reactor_source_start(rdpReactorSource* source)
+{
+	HANDLE thread;
+
+	if (!(thread = CreateThread(NULL, 0, reactor_source_thread_proc, source, 0, NULL)))
+		return FALSE;
+
+	CloseHandle(thread);
+	return TRUE;
+}
+
+static BOOL reactor_thread_init(REACTOR_THREAD* rt)
+{
+	return TRUE;
+}
+
+static void reactor_thread_wakeup(REACTOR_THREAD* rt)
+{
+	int index;
+	rdpReactorSource* source;
+	EnterCriticalSection(&rt->lock);
+
+	for (index = 0; index < ArrayList_Count(rt->sources); index++)
+	{
+		source = (rdpReactorSource*) ArrayList_GetItem(rt->sources, index);
+		SetEvent(source->stopEvent);
+	}
+
+	LeaveCriticalSection(&rt->lock);
+}
+
+static void reactor_thread_uninit(REACTOR_THREAD* rt)
+{
+	/* the source threads detach themselves from the list when they are done */
+	while (ArrayList_Count(rt->sources) > 0)
+		Sleep(10);
+}
+
+#endif
+
+rdpReactor* freerdp_reactor_new(DWORD threads)
+{
+	DWORD index;
+	SYSTEM_INFO sysinfo;
+	rdpReactor* reactor;
+
+	if (threads == 0)
+	{
+		GetNativeSystemInfo(&sysinfo);
+		threads = sysinfo.dwNumberOfProcessors;
+	}
+
+#ifndef HAVE_SYS_EPOLL_H
+	/* every source runs on its own thread, a single list is enough */
+	threads = 1;
+#endif
+	reactor = (rdpReactor*) calloc(1, sizeof(rdpReactor));
+
+	if (!reactor)
+		return NULL;
+
+	reactor->threads = (REACTOR_THREAD*) calloc(threads, sizeof(REACTOR_THREAD));
+
+	if (!reactor->threads)
+	{
+		free(reactor);
+		return NULL;
+	}
+
+	for (index = 0; index < threads; index++)
+	{
+		REACTOR_THREAD* rt = &reactor->threads[index];
+		rt->reactor = reactor;
+#ifdef HAVE_SYS_EPOLL_H
+		rt->epfd = -1;
+#endif
+
+		if (!InitializeCriticalSectionAndSpinCount(&rt->lock, 4000))
+			goto fail;
+
+		reactor->count++;
+
+		if (!(rt->sources = ArrayList_New(FALSE)))
+			goto fail;
+
+		if (!reactor_thread_init(rt))
+			goto fail;
+	}
+
+	return reactor;
+fail:
+	freerdp_reactor_free(reactor);
+	return NULL;
+}
+
+void freerdp_reactor_free(rdpReactor* reactor)
+{
+	DWORD index;
+	rdpReactorSource* source;
+	rdpReactorSource* removed;
+
+	if (!reactor)
+		return;
+
+	reactor->stop = TRUE;
+
+	for (index = 0; index < reactor->count; index++)
+		reactor_thread_wakeup(&reactor->threads[index]);
+
+	for (index = 0; index < reactor->count; index++)
+	{
+		REACTOR_THREAD* rt = &reactor->threads[index];
+
+		if (rt->thread)
+		{
+			WaitForSingleObject(rt->thread, INFINITE);
+			CloseHandle(rt->thread);
+		}
+
+		if (rt->sources)
+		{
+			reactor_thread_uninit(rt);
+			removed = reactor_thread_unlink_removed(rt, TRUE);
+
+			while (removed)
+			{
+				source = removed;
+				removed = source->next;
+				reactor_source_close(source);
+			}
+
+			ArrayList_Free(rt->sources);
+		}
+
+		DeleteCriticalSection(&rt->lock);
+	}
+
+	free(reactor->threads);
+	free(reactor);
+}
+
+/**
+ * Adds a source with less than MAXIMUM_WAIT_OBJECTS handles. The handles
+ * must stay valid until the close callback of the source has been called.
+ */
+rdpReactorSource* freerdp_reactor_add(rdpReactor* reactor, const HANDLE* handles,
+                                      DWORD count, pReactorDispatch dispatch, pReactorClose close, void* context)
+{
+	return freerdp_reactor_add_ex(reactor, handles, count, dispatch, NULL, close, context);
+}
+
+/**
+ * Like freerdp_reactor_add(), for a source whose handles change. After each
+ * dispatch getHandles (optional) is asked for the current handles and the
+ * reactor waits on those from then on.
+ */
+rdpReactorSource* freerdp_reactor_add_ex(rdpReactor* reactor, const HANDLE* handles,
+        DWORD count, pReactorDispatch dispatch, pReactorGetHandles getHandles,
+        pReactorClose close, void* context)
+{
+	DWORD index;
+	REACTOR_THREAD* rt;
+	rdpReactorSource* source;
+
+	if (!reactor || !handles || !dispatch || (count == 0) || (count >= MAXIMUM_WAIT_OBJECTS))
+		return NULL;
+
+	/* the least loaded thread takes the new source */
+	rt = &reactor->threads[0];
+
+	for (index = 1; index < reactor->count; index++)
+	{
+		if (ArrayList_Count(reactor->threads[index].sources) < ArrayList_Count(rt->sources))
+			rt = &reactor->threads[index];
+	}
+
+	source = (rdpReactorSource*) calloc(1, sizeof(rdpReactorSource));
+
+	if (!source)
+		return NULL;
+
+	source->owner = rt;
+	source->count = count;
+	CopyMemory(source->handles, handles, count * sizeof(HANDLE));
+	source->dispatch = dispatch;
+	source->getHandles = getHandles;
+	source->close = close;
+	source->context = context;
+	EnterCriticalSection(&rt->lock);
+
+	if (!reactor_source_register(source))
+	{
+		LeaveCriticalSection(&rt->lock);
+		free(source);
+		return NULL;
+	}
+
+	if (ArrayList_Add(rt->sources, source) < 0)
+		goto fail;
+
+	if (!reactor_source_start(source))
+	{
+		ArrayList_Remove(rt->sources, source);
+		goto fail;
+	}
+
+	LeaveCriticalSection(&rt->lock);
+	return source;
+fail:
+	reactor_source_unregister(source, source->count);
+	LeaveCriticalSection(&rt->lock);
+	free(source);
+	return NULL;
+}
+
+/**
+ * Removes a source. The close callback is called asynchronously on the
+ * thread owning the source, after any running dispatch has returned.
+ * A source whose dispatch returned FALSE is already gone.
+ */
+void freerdp_reactor_remove(rdpReactor* reactor, rdpReactorSource* source)
+{
+	REACTOR_THREAD* rt;
+
+	if (!reactor || !source)
+		return;
+
+	rt = source->owner;
+	EnterCriticalSection(&rt->lock);
+	source->removed = TRUE;
+#ifdef HAVE_SYS_EPOLL_H
+	rt->pendingRemoval = TRUE;
+	SetEvent(rt->wakeup);
+#else
+	SetEvent(source->stopEvent);
+#endif
+	LeaveCriticalSection(&rt->lock);
+}
+
+DWORD freerdp_reactor_get_source_count(rdpReactor* reactor)
+{
+	DWORD index;
+	DWORD count = 0;
+
+	if (!reactor)
+		return 0;
+
+	for (index = 0; index < reactor->count; index++)
+	{
+		REACTOR_THREAD* rt = &reactor->threads[index];
+		EnterCriticalSection(&rt->lock);
+		count += ArrayList_Count(rt->sources);
+		LeaveCriticalSection(&rt->lock);
+	}
+
+	return count;
+}
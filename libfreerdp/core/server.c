@@ -484,6 +484,9 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptor(HANDLE hServer)
 		}
 	}
 
+	/* everything queued by the channels goes out in one write batch */
+	transport_begin_write_batch(vcm->rdp->transport);
+
 	while (MessageQueue_Peek(vcm->queue, &message, TRUE))
 	{
 		BYTE* buffer;
@@ -505,6 +508,9 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptor(HANDLE hServer)
 			break;
 	}
 
+	if (!transport_end_write_batch(vcm->rdp->transport))
+		status = FALSE;
+
 	return status;
 }
 
@@ -289,6 +289,7 @@ rdpSettings* freerdp_settings_new(DWORD flags)
 	settings->ExtSecurity = FALSE;
 	settings->NlaSecurity = TRUE;
 	settings->TlsSecurity = TRUE;
+	settings->TlsSessionResumption = TRUE;
 	settings->RdpSecurity = TRUE;
 	settings->NegotiateSecurityLayer = TRUE;
 	settings->RestrictedAdminModeRequired = FALSE;
@@ -646,6 +647,7 @@ rdpSettings* freerdp_settings_clone(rdpSettings* settings)
 		CHECKED_STRDUP(AuthenticationServiceClass); /* 1098 */
 		CHECKED_STRDUP(AllowedTlsCiphers); /* 1101 */
 		CHECKED_STRDUP(NtlmSamFile); /* 1103 */
+		CHECKED_STRDUP(TlsSessionCacheFile); /* 1106 */
 		CHECKED_STRDUP(PreconnectionBlob); /* 1155 */
 		CHECKED_STRDUP(KerberosKdc); /* 1344 */
 		CHECKED_STRDUP(KerberosRealm); /* 1345 */
@@ -676,6 +678,7 @@ rdpSettings* freerdp_settings_clone(rdpSettings* settings)
 		CHECKED_STRDUP(RemoteApplicationFile); /* 2116 */
 		CHECKED_STRDUP(RemoteApplicationGuid); /* 2117 */
 		CHECKED_STRDUP(RemoteApplicationCmdLine); /* 2118 */
+		CHECKED_STRDUP(BitmapCachePersistFile); /* 2503 */
 		CHECKED_STRDUP(ImeFileName); /* 2628 */
 		CHECKED_STRDUP(DrivesToRedirect); /* 4290 */
 		/**
@@ -1018,6 +1021,7 @@ void freerdp_settings_free(rdpSettings* settings)
 	free(settings->ClientDir);
 	free(settings->AllowedTlsCiphers);
 	free(settings->NtlmSamFile);
+	free(settings->TlsSessionCacheFile);
 	free(settings->CertificateFile);
 	free(settings->PrivateKeyFile);
 	free(settings->ConnectionFile);
@@ -1074,6 +1078,7 @@ void freerdp_settings_free(rdpSettings* settings)
 	free(settings->RemoteApplicationFile);
 	free(settings->RemoteApplicationGuid);
 	free(settings->RemoteApplicationCmdLine);
+	free(settings->BitmapCachePersistFile);
 	free(settings->ImeFileName);
 	free(settings->DrivesToRedirect);
 	free(settings->WindowTitle);
@@ -0,0 +1,312 @@
+
+#include <stdio.h>
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/reactor.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#define TEST_SOURCES	8
+
+typedef struct
+{
+	HANDLE event;
+	HANDLE dispatched;
+	HANDLE closed;
+	LONG calls;
+	LONG maxCalls;
+} TEST_SOURCE;
+
+static BOOL test_dispatch(void* context)
+{
+	TEST_SOURCE* test = (TEST_SOURCE*) context;
+	LONG calls = InterlockedIncrement(&test->calls);
+	ResetEvent(test->event);
+	SetEvent(test->dispatched);
+	return calls < test->maxCalls;
+}
+
+static void test_close(void* context)
+{
+	TEST_SOURCE* test = (TEST_SOURCE*) context;
+	SetEvent(test->closed);
+}
+
+static BOOL test_signal(TEST_SOURCE* test, LONG calls)
+{
+	ResetEvent(test->dispatched);
+	SetEvent(test->event);
+
+	if (WaitForSingleObject(test->dispatched, 5000) != WAIT_OBJECT_0)
+		return FALSE;
+
+	return test->calls == calls;
+}
+
+#ifndef _WIN32
+
+#define TEST_QUEUE_LIMIT	(64 * 1024)
+#define TEST_QUEUE_OUTPUT	(1024 * 1024)
+
+/**
+ * A peer with an output queue limit: the socket is non-blocking, output the
+ * socket does not take stays queued and the write event is only among the
+ * handles while something is queued, like the transport does it.
+ */
+typedef struct
+{
+	int fd;
+	HANDLE readEvent;
+	HANDLE writeEvent;
+	HANDLE drained;
+	HANDLE closed;
+	size_t queued;
+	size_t sent;
+	BOOL full;
+} TEST_QUEUE_PEER;
+
+static BOOL test_queue_dispatch(void* context)
+{
+	BYTE data[4096];
+	ssize_t status;
+	TEST_QUEUE_PEER* peer = (TEST_QUEUE_PEER*) context;
+
+	/* every request byte asks for more output than the limit */
+	while ((status = recv(peer->fd, data, sizeof(data), 0)) > 0)
+		peer->queued += status * TEST_QUEUE_OUTPUT;
+
+	ZeroMemory(data, sizeof(data));
+
+	while (peer->queued > 0)
+	{
+		status = send(peer->fd, data, MIN(peer->queued, sizeof(data)), 0);
+
+		if (status < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			return FALSE;
+		}
+
+		peer->queued -= status;
+		peer->sent += status;
+	}
+
+	if (peer->queued >= TEST_QUEUE_LIMIT)
+		peer->full = TRUE;
+
+	if (peer->full && (peer->queued <= TEST_QUEUE_LIMIT / 2))
+	{
+		peer->full = FALSE;
+		SetEvent(peer->drained);
+	}
+
+	return TRUE;
+}
+
+static DWORD test_queue_get_handles(void* context, HANDLE* handles, DWORD count)
+{
+	DWORD nCount = 0;
+	TEST_QUEUE_PEER* peer = (TEST_QUEUE_PEER*) context;
+
+	if (count < 2)
+		return 0;
+
+	handles[nCount++] = peer->readEvent;
+
+	if (peer->queued > 0)
+		handles[nCount++] = peer->writeEvent;
+
+	return nCount;
+}
+
+static void test_queue_close(void* context)
+{
+	TEST_QUEUE_PEER* peer = (TEST_QUEUE_PEER*) context;
+	SetEvent(peer->closed);
+}
+
+/**
+ * Output queued by a dispatch goes out once the socket is writable again,
+ * without any further input from the client.
+ */
+static BOOL test_output_queue(rdpReactor* reactor)
+{
+	int fds[2];
+	BYTE data[4096];
+	ssize_t status;
+	size_t received = 0;
+	BOOL rc = FALSE;
+	DWORD start;
+	TEST_QUEUE_PEER peer = { 0 };
+	rdpReactorSource* source = NULL;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return FALSE;
+
+	peer.fd = fds[0];
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	peer.readEvent = CreateFileDescriptorEvent(NULL, TRUE, FALSE, fds[0], WINPR_FD_READ);
+	peer.writeEvent = CreateFileDescriptorEvent(NULL, TRUE, FALSE, fds[0], WINPR_FD_WRITE);
+	peer.drained = CreateEvent(NULL, TRUE, FALSE, NULL);
+	peer.closed = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	if (!peer.readEvent || !peer.writeEvent || !peer.drained || !peer.closed)
+		goto fail;
+
+	source = freerdp_reactor_add_ex(reactor, &peer.readEvent, 1, test_queue_dispatch,
+	                                test_queue_get_handles, test_queue_close, &peer);
+
+	if (!source)
+		goto fail;
+
+	data[0] = 1;
+
+	if (send(fds[1], data, 1, 0) != 1)
+		goto fail;
+
+	start = GetTickCount();
+
+	while (received < TEST_QUEUE_OUTPUT)
+	{
+		if (GetTickCount() - start > 5000)
+		{
+			fprintf(stderr, "queued output stalled after %lu bytes\n", (unsigned long) received);
+			goto fail;
+		}
+
+		status = recv(fds[1], data, sizeof(data), 0);
+
+		if (status > 0)
+			received += status;
+		else
+			Sleep(1);
+	}
+
+	if (WaitForSingleObject(peer.drained, 5000) != WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "output queue did not report drained\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	if (source)
+	{
+		freerdp_reactor_remove(reactor, source);
+
+		if (WaitForSingleObject(peer.closed, 5000) != WAIT_OBJECT_0)
+			rc = FALSE;
+	}
+
+	CloseHandle(peer.readEvent);
+	CloseHandle(peer.writeEvent);
+	CloseHandle(peer.drained);
+	CloseHandle(peer.closed);
+	close(fds[0]);
+	close(fds[1]);
+	return rc;
+}
+
+#endif
+
+int TestReactor(int argc, char* argv[])
+{
+	int rc = -1;
+	DWORD index;
+	rdpReactor* reactor;
+	rdpReactorSource* sources[TEST_SOURCES] = { 0 };
+	TEST_SOURCE tests[TEST_SOURCES] = { 0 };
+	reactor = freerdp_reactor_new(2);
+
+	if (!reactor)
+		return -1;
+
+	for (index = 0; index < TEST_SOURCES; index++)
+	{
+		tests[index].event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		tests[index].dispatched = CreateEvent(NULL, TRUE, FALSE, NULL);
+		tests[index].closed = CreateEvent(NULL, TRUE, FALSE, NULL);
+		tests[index].maxCalls = (index == 0) ? 2 : 100;
+
+		if (!tests[index].event || !tests[index].dispatched || !tests[index].closed)
+			goto fail;
+
+		sources[index] = freerdp_reactor_add(reactor, &tests[index].event, 1, test_dispatch,
+		                                     test_close, &tests[index]);
+
+		if (!sources[index])
+			goto fail;
+	}
+
+	if (freerdp_reactor_get_source_count(reactor) != TEST_SOURCES)
+		goto fail;
+
+	/* every source is dispatched on its own signal */
+	for (index = 0; index < TEST_SOURCES; index++)
+	{
+		if (!test_signal(&tests[index], 1))
+		{
+			fprintf(stderr, "source %u was not dispatched\n", index);
+			goto fail;
+		}
+	}
+
+	/* a dispatch returning FALSE closes the source */
+	if (!test_signal(&tests[0], 2) ||
+	    (WaitForSingleObject(tests[0].closed, 5000) != WAIT_OBJECT_0))
+	{
+		fprintf(stderr, "failing source was not closed\n");
+		goto fail;
+	}
+
+	/* explicit removal */
+	freerdp_reactor_remove(reactor, sources[1]);
+
+	if (WaitForSingleObject(tests[1].closed, 5000) != WAIT_OBJECT_0)
+	{
+		fprintf(stderr, "removed source was not closed\n");
+		goto fail;
+	}
+
+	SetEvent(tests[1].event);
+	Sleep(50);
+
+	if ((tests[1].calls != 1) || (freerdp_reactor_get_source_count(reactor) != TEST_SOURCES - 2))
+		goto fail;
+
+#ifndef _WIN32
+
+	if (!test_output_queue(reactor))
+		goto fail;
+
+#endif
+
+	rc = 0;
+fail:
+	freerdp_reactor_free(reactor);
+
+	for (index = 0; index < TEST_SOURCES; index++)
+	{
+		/* the reactor closes the remaining sources */
+		if ((rc == 0) && (WaitForSingleObject(tests[index].closed, 0) != WAIT_OBJECT_0))
+			rc = -1;
+
+		CloseHandle(tests[index].event);
+		CloseHandle(tests[index].dispatched);
+		CloseHandle(tests[index].closed);
+	}
+
+	return rc;
+}
@@ -56,7 +56,14 @@
 
 #define BUFFER_SIZE 16384
 
+/* room for the largest TPKT or TSRequest PDU plus what follows it */
+#define RECEIVE_RING_SIZE (2 * 0x10000)
+
+/* four maximal TLS records, flushed as soon as the next PDU would not fit */
+#define WRITE_BATCH_SIZE (4 * BUFFER_SIZE)
+
 static void* transport_client_thread(void* arg);
+static int transport_write_batch_flush(rdpTransport* transport);
 
 
 static void transport_ssl_cb(SSL* ssl, int where, int ret)
@@ -76,7 +83,7 @@ wStream* transport_send_stream_init(rdpTransport* transport, int size)
 {
 	wStream* s;
 
-	if (!(s = StreamPool_Take(transport->ReceivePool, size)))
+	if (!(s = StreamPool_Take(transport->SendPool, size)))
 		return NULL;
 
 	if (!Stream_EnsureCapacity(s, size))
@@ -106,6 +113,13 @@ BOOL transport_attach(rdpTransport* transport, int sockfd)
 
 	bufferedBio = BIO_push(bufferedBio, socketBio);
 	transport->frontBio = bufferedBio;
+
+	if (transport->WriteEvent)
+		CloseHandle(transport->WriteEvent);
+
+	/* signaled while the socket can take more data, see transport_get_event_handles */
+	transport->WriteEvent = CreateFileDescriptorEvent(NULL, TRUE, FALSE, sockfd, WINPR_FD_WRITE);
+	transport->OutputQueueFull = FALSE;
 	return TRUE;
 }
 
@@ -418,9 +432,15 @@ static void transport_bio_error_log(LPCSTR tag, LPCSTR biofunc, BIO* bio,
 	}
 }
 
-int transport_read_layer(rdpTransport* transport, BYTE* data, int bytes)
+/**
+ * @brief Reads whatever the transport layer has available, up to bytes
+ *
+ * In blocking mode the call waits until at least one byte could be read.
+ *
+ * @return < 0 on error; 0 if no data is available (non blocking mode); > 0 number of bytes read
+ */
+static int transport_read_layer(rdpTransport* transport, BYTE* data, int bytes)
 {
-	int read = 0;
 	int status = -1;
 
 	if (!transport->frontBio)
@@ -429,121 +449,177 @@ int transport_read_layer(rdpTransport* transport, BYTE* data, int bytes)
 		return -1;
 	}
 
-	while (read < bytes)
+	while (1)
 	{
-		status = BIO_read(transport->frontBio, data + read, bytes - read);
+		status = BIO_read(transport->frontBio, data, bytes);
 
-		if (status <= 0)
+		if (status > 0)
+			break;
+
+		if (!transport->frontBio || !BIO_should_retry(transport->frontBio))
 		{
-			if (!transport->frontBio || !BIO_should_retry(transport->frontBio))
+			/* something unexpected happened, let's close */
+			if (!transport->frontBio)
 			{
-				/* something unexpected happened, let's close */
-				if (!transport->frontBio)
-				{
-					WLog_ERR(TAG, "BIO_read: transport->frontBio null");
-					return -1;
-				}
-
-				WLog_ERR_BIO(TAG, "BIO_read", transport->frontBio);
-				transport->layer = TRANSPORT_LAYER_CLOSED;
+				WLog_ERR(TAG, "BIO_read: transport->frontBio null");
 				return -1;
 			}
 
-			/* non blocking will survive a partial read */
-			if (!transport->blocking)
-				return read;
+			WLog_ERR_BIO(TAG, "BIO_read", transport->frontBio);
+			transport->layer = TRANSPORT_LAYER_CLOSED;
+			return -1;
+		}
 
-			/* blocking means that we can't continue until we have read the number of requested bytes */
-			if (BIO_wait_read(transport->frontBio, 100) < 0)
-			{
-				WLog_ERR_BIO(TAG, "BIO_wait_read", transport->frontBio);
-				return -1;
-			}
+		/* non blocking will survive a partial read */
+		if (!transport->blocking)
+			return 0;
 
-			continue;
+		/* blocking means that we can't continue until we have read something */
+		if (BIO_wait_read(transport->frontBio, 100) < 0)
+		{
+			WLog_ERR_BIO(TAG, "BIO_wait_read", transport->frontBio);
+			return -1;
 		}
+	}
 
 #ifdef HAVE_VALGRIND_MEMCHECK_H
-		VALGRIND_MAKE_MEM_DEFINED(data + read, bytes - read);
+	VALGRIND_MAKE_MEM_DEFINED(data, status);
 #endif
-		read += status;
-	}
+	return status;
+}
+
+/**
+ * Received data is kept in a ring buffer. Bytes at the read head that
+ * belong to PDUs already handed out are tracked in ReceiveConsumed, they
+ * are only given back to the ring once no stream view references them
+ * anymore. The ring never grows, so views stay valid until released.
+ */
 
-	return read;
+static void transport_recv_reset(rdpTransport* transport)
+{
+	RingBuffer* ring = &transport->ReceiveRing;
+	ring->readPtr = ring->writePtr = 0;
+	ring->freeSize = ring->size;
+	transport->ReceiveConsumed = 0;
 }
 
+static size_t transport_recv_available(rdpTransport* transport)
+{
+	return ringbuffer_used(&transport->ReceiveRing) - transport->ReceiveConsumed;
+}
 
 /**
- * @brief Tries to read toRead bytes from the specified transport
- *
- * Try to read toRead bytes from the transport to the stream.
- * In case it was not possible to read toRead bytes 0 is returned. The stream is always advanced by the
- * number of bytes read.
- *
- * The function assumes that the stream has enough capacity to hold the data.
- *
- * @param[in] transport rdpTransport
- * @param[in] s wStream
- * @param[in] toRead number of bytes to read
- * @return < 0 on error; 0 if not enough data is available (non blocking mode); 1 toRead bytes read
+ * Reading ahead is only safe once the connection has settled on its
+ * final security layer, the plaintext negotiation must not swallow the
+ * first bytes of a TLS handshake.
  */
-static int transport_read_layer_bytes(rdpTransport* transport, wStream* s,
-                                      unsigned int toRead)
+static BOOL transport_recv_read_ahead(rdpTransport* transport)
 {
-	int status;
-	status = transport_read_layer(transport, Stream_Pointer(s), toRead);
+	return (transport->layer == TRANSPORT_LAYER_TLS) ||
+	       (transport->layer == TRANSPORT_LAYER_TSG_TLS);
+}
 
-	if (status <= 0)
-		return status;
+static int transport_recv_peek(rdpTransport* transport, size_t length,
+                               DataChunk chunks[2])
+{
+	size_t start;
+	size_t linear;
+	RingBuffer* ring = &transport->ReceiveRing;
+	start = (ring->readPtr + transport->ReceiveConsumed) % ring->size;
+	linear = MIN(length, ring->size - start);
+	chunks[0].data = ring->buffer + start;
+	chunks[0].size = linear;
+
+	if (linear == length)
+		return 1;
+
+	chunks[1].data = ring->buffer;
+	chunks[1].size = length - linear;
+	return 2;
+}
+
+static void transport_recv_copy(rdpTransport* transport, BYTE* data, size_t length)
+{
+	int index;
+	int count;
+	DataChunk chunks[2];
+	count = transport_recv_peek(transport, length, chunks);
 
-	Stream_Seek(s, status);
-	return status == toRead ? 1 : 0;
+	for (index = 0; index < count; index++)
+	{
+		CopyMemory(data, chunks[index].data, chunks[index].size);
+		data += chunks[index].size;
+	}
 }
 
 /**
- * @brief Try to read a complete PDU (NLA, fast-path or tpkt) from the underlying transport.
+ * @brief Makes sure at least needed unconsumed bytes are buffered
  *
- * If possible a complete PDU is read, in case of non blocking transport this might not succeed.
- * Except in case of an error the passed stream will point to the last byte read (correct
- * position). When the pdu read is completed the stream is sealed and the pointer set to 0
+ * Once the security layer allows it every read asks for all the linear
+ * space left in the ring, so a single call drains as much as TLS has
+ * decrypted and following PDUs are served without touching the BIO.
  *
- * @param[in] transport rdpTransport
- * @param[in] s wStream
- * @return < 0 on error; 0 if not enough data is available (non blocking mode); > 0 number of
- * bytes of the *complete* pdu read
+ * @return < 0 on error; 0 if not enough data is available (non blocking mode); 1 on success
  */
-int transport_read_pdu(rdpTransport* transport, wStream* s)
+static int transport_recv_fill(rdpTransport* transport, size_t needed)
 {
 	int status;
-	int position;
-	int pduLength;
-	BYTE* header;
-	position = 0;
-	pduLength = 0;
+	size_t available;
+	size_t linear;
+	RingBuffer* ring = &transport->ReceiveRing;
 
-	if (!transport)
-		return -1;
+	while ((available = transport_recv_available(transport)) < needed)
+	{
+		if (ringbuffer_used(ring) == 0)
+			ring->readPtr = ring->writePtr = 0;
 
-	if (!s)
-		return -1;
+		if (ring->freeSize == 0)
+			linear = 0;
+		else if (ring->writePtr >= ring->readPtr)
+			linear = ring->size - ring->writePtr;
+		else
+			linear = ring->readPtr - ring->writePtr;
 
-	position = Stream_GetPosition(s);
+		if (linear == 0)
+		{
+			WLog_ERR(TAG, "receive ring exhausted (%d bytes pending)",
+			         (int) ringbuffer_used(ring));
+			return -1;
+		}
 
-	/* Make sure there is enough space for the longest header within the stream */
-	if (!Stream_EnsureCapacity(s, 4))
-		return -1;
+		if (!transport_recv_read_ahead(transport))
+			linear = MIN(linear, needed - available);
+
+		status = transport_read_layer(transport, ring->buffer + ring->writePtr, (int) linear);
+
+		if (status <= 0)
+			return status;
+
+		ringbuffer_commit_written_bytes(ring, status);
+	}
 
-	/* Make sure at least two bytes are read for further processing */
-	if (position < 2
-	    && (status = transport_read_layer_bytes(transport, s, 2 - position)) != 1)
+	return 1;
+}
+
+/**
+ * @brief Determines the length of the PDU (NLA, fast-path or tpkt) at the read head
+ *
+ * @return < 0 on error; 0 if length holds the number of header bytes still required;
+ * 1 if length holds the length of the complete PDU
+ */
+static int transport_recv_pdu_length(rdpTransport* transport, size_t* length)
+{
+	int pduLength = 0;
+	BYTE header[4] = { 0 };
+	size_t available = transport_recv_available(transport);
+
+	if (available < 2)
 	{
-		/* No data available at the moment */
-		return status;
+		*length = 2;
+		return 0;
 	}
 
-	/* update position value for further checks */
-	position = Stream_GetPosition(s);
-	header = Stream_Buffer(s);
+	transport_recv_copy(transport, header, MIN(available, sizeof(header)));
 
 	if (transport->NlaMode)
 	{
@@ -560,20 +636,22 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 			{
 				if ((header[1] & ~(0x80)) == 1)
 				{
-					/* check for header bytes already was readed in previous calls */
-					if (position < 3
-					    && (status = transport_read_layer_bytes(transport, s, 3 - position)) != 1)
-						return status;
+					if (available < 3)
+					{
+						*length = 3;
+						return 0;
+					}
 
 					pduLength = header[2];
 					pduLength += 3;
 				}
 				else if ((header[1] & ~(0x80)) == 2)
 				{
-					/* check for header bytes already was readed in previous calls */
-					if (position < 4
-					    && (status = transport_read_layer_bytes(transport, s, 4 - position)) != 1)
-						return status;
+					if (available < 4)
+					{
+						*length = 4;
+						return 0;
+					}
 
 					pduLength = (header[2] << 8) | header[3];
 					pduLength += 4;
@@ -596,10 +674,11 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 		if (header[0] == 0x03)
 		{
 			/* TPKT header */
-			/* check for header bytes already was readed in previous calls */
-			if (position < 4
-			    && (status = transport_read_layer_bytes(transport, s, 4 - position)) != 1)
-				return status;
+			if (available < 4)
+			{
+				*length = 4;
+				return 0;
+			}
 
 			pduLength = (header[2] << 8) | header[3];
 
@@ -615,10 +694,11 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 			/* Fast-Path Header */
 			if (header[1] & 0x80)
 			{
-				/* check for header bytes already was readed in previous calls */
-				if (position < 3
-				    && (status = transport_read_layer_bytes(transport, s, 3 - position)) != 1)
-					return status;
+				if (available < 3)
+				{
+					*length = 3;
+					return 0;
+				}
 
 				pduLength = ((header[1] & 0x7F) << 8) | header[2];
 			}
@@ -638,53 +718,163 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 		}
 	}
 
-	if (!Stream_EnsureCapacity(s, Stream_GetPosition(s) + pduLength))
+	if (pduLength < 2)
+	{
+		WLog_ERR(TAG, "invalid pduLength: %d", pduLength);
 		return -1;
+	}
+
+	*length = pduLength;
+	return 1;
+}
+
+/**
+ * @brief Slices the next complete PDU out of the receive ring
+ *
+ * The PDU is returned as one chunk, or two if it wraps around the end of
+ * the ring, and stays in place until transport_recv_release() is called.
+ *
+ * @return < 0 on error; 0 if not enough data is available (non blocking mode); > 0 number of
+ * chunks
+ */
+static int transport_recv_pdu(rdpTransport* transport, DataChunk chunks[2])
+{
+	int index;
+	int count;
+	int status;
+	size_t length = 2;
+
+	while (1)
+	{
+		status = transport_recv_fill(transport, length);
+
+		if (status <= 0)
+			return status;
+
+		status = transport_recv_pdu_length(transport, &length);
+
+		if (status < 0)
+			return -1;
 
-	status = transport_read_layer_bytes(transport, s,
-	                                    pduLength - Stream_GetPosition(s));
+		if (status > 0)
+			break;
+	}
 
-	if (status != 1)
+	status = transport_recv_fill(transport, length);
+
+	if (status <= 0)
 		return status;
 
-	if (Stream_GetPosition(s) >= pduLength)
-		WLog_Packet(WLog_Get(TAG), WLOG_TRACE, Stream_Buffer(s), pduLength,
-		            WLOG_PACKET_INBOUND);
+	count = transport_recv_peek(transport, length, chunks);
+	transport->ReceiveConsumed += length;
 
-	Stream_SealLength(s);
-	Stream_SetPosition(s, 0);
-	return Stream_Length(s);
+	for (index = 0; index < count; index++)
+		WLog_Packet(WLog_Get(TAG), WLOG_TRACE, (BYTE*) chunks[index].data,
+		            chunks[index].size, WLOG_PACKET_INBOUND);
+
+	return count;
 }
 
-int transport_write(rdpTransport* transport, wStream* s)
+static void transport_recv_release(rdpTransport* transport)
 {
-	int length;
-	int status = -1;
-	int writtenlength = 0;
+	if (transport->ReceiveViews > 0)
+		return;
+
+	ringbuffer_commit_read_bytes(&transport->ReceiveRing, transport->ReceiveConsumed);
+	transport->ReceiveConsumed = 0;
+}
+
+/**
+ * @brief Try to read a complete PDU (NLA, fast-path or tpkt) from the underlying transport.
+ *
+ * If possible a complete PDU is read, in case of non blocking transport this might not succeed.
+ * Incomplete PDUs are kept in the receive ring of the transport, the passed stream is only
+ * written once the PDU is complete. The stream is then sealed and the pointer set to 0
+ *
+ * @param[in] transport rdpTransport
+ * @param[in] s wStream
+ * @return < 0 on error; 0 if not enough data is available (non blocking mode); > 0 number of
+ * bytes of the *complete* pdu read
+ */
+int transport_read_pdu(rdpTransport* transport, wStream* s)
+{
+	int index;
+	int count;
+	int status;
+	DataChunk chunks[2];
 
 	if (!transport)
 		return -1;
 
-	if (!transport->frontBio)
+	if (!s)
+		return -1;
+
+	/* the peer can't answer PDUs still sitting in the write batch */
+	EnterCriticalSection(&(transport->WriteLock));
+	status = transport_write_batch_flush(transport);
+	LeaveCriticalSection(&(transport->WriteLock));
+
+	if (status < 0)
+		return -1;
+
+	count = transport_recv_pdu(transport, chunks);
+
+	if (count <= 0)
+		return count;
+
+	Stream_SetPosition(s, 0);
+
+	if (!Stream_EnsureCapacity(s, chunks[0].size + ((count > 1) ? chunks[1].size : 0)))
 	{
-		transport->layer = TRANSPORT_LAYER_CLOSED;
+		transport_recv_release(transport);
 		return -1;
 	}
 
-	EnterCriticalSection(&(transport->WriteLock));
-	length = Stream_GetPosition(s);
-	writtenlength = length;
+	for (index = 0; index < count; index++)
+		Stream_Write(s, chunks[index].data, chunks[index].size);
+
+	transport_recv_release(transport);
+	Stream_SealLength(s);
 	Stream_SetPosition(s, 0);
+	return Stream_Length(s);
+}
 
-	if (length > 0)
+/**
+ * With an output queue limit configured, writes no longer wait for the
+ * buffered BIO to drain. What the socket does not take right away stays
+ * queued and is sent from transport_flush_output_queue() once the write
+ * event is signaled. As soon as the limit is reached the queue reports
+ * full, callers are expected to hold back output they can produce again
+ * later (screen updates) until it has drained to half of the limit.
+ * The queue never drops data on its own, protocol PDUs can not be lost.
+ */
+static BOOL transport_output_queue_enabled(rdpTransport* transport)
+{
+	return transport->WriteEvent && (transport->settings->OutputQueueLimit > 0);
+}
+
+static void transport_output_queue_update(rdpTransport* transport)
+{
+	if (!transport_output_queue_enabled(transport))
+		return;
+
+	if (transport_get_output_queue_size(transport) >= transport->settings->OutputQueueLimit)
+		transport->OutputQueueFull = TRUE;
+}
+
+static int transport_write_layer(rdpTransport* transport, const BYTE* data, int length)
+{
+	int status = -1;
+
+	if (!transport->frontBio)
 	{
-		WLog_Packet(WLog_Get(TAG), WLOG_TRACE, Stream_Buffer(s), length,
-		            WLOG_PACKET_OUTBOUND);
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+		return -1;
 	}
 
 	while (length > 0)
 	{
-		status = BIO_write(transport->frontBio, Stream_Pointer(s), length);
+		status = BIO_write(transport->frontBio, data, length);
 
 		if (status <= 0)
 		{
@@ -715,7 +905,8 @@ int transport_write(rdpTransport* transport, wStream* s)
 			continue;
 		}
 
-		if (transport->blocking || transport->settings->WaitForOutputBufferFlush)
+		if (transport->blocking || (transport->settings->WaitForOutputBufferFlush &&
+		                            !transport_output_queue_enabled(transport)))
 		{
 			while (BIO_write_blocked(transport->frontBio))
 			{
@@ -736,10 +927,9 @@ int transport_write(rdpTransport* transport, wStream* s)
 		}
 
 		length -= status;
-		Stream_Seek(s, status);
+		data += status;
 	}
 
-	transport->written += writtenlength;
 out_cleanup:
 
 	if (status < 0)
@@ -747,6 +937,132 @@ out_cleanup:
 		/* A write error indicates that the peer has dropped the connection */
 		transport->layer = TRANSPORT_LAYER_CLOSED;
 	}
+	else
+		transport_output_queue_update(transport);
+
+	return status;
+}
+
+/**
+ * Writes out the PDUs gathered in the write batch with a single BIO_write, the
+ * TLS layer turns them into as few maximal-size records as possible.
+ * The caller must hold the write lock.
+ */
+static int transport_write_batch_flush(rdpTransport* transport)
+{
+	int status;
+	size_t length = Stream_GetPosition(transport->WriteBatch);
+
+	if (length == 0)
+		return 1;
+
+	Stream_SetPosition(transport->WriteBatch, 0);
+	status = transport_write_layer(transport, Stream_Buffer(transport->WriteBatch), (int) length);
+	return (status < 0) ? -1 : 1;
+}
+
+/**
+ * Starts gathering outgoing PDUs instead of writing each of them out. Batches
+ * nest, the PDUs are flushed when the outermost batch ends, when the batch
+ * buffer is full or before the transport blocks to read a PDU.
+ */
+void transport_begin_write_batch(rdpTransport* transport)
+{
+	if (!transport)
+		return;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	transport->WriteBatchDepth++;
+	LeaveCriticalSection(&(transport->WriteLock));
+}
+
+BOOL transport_end_write_batch(rdpTransport* transport)
+{
+	int status = 1;
+
+	if (!transport)
+		return FALSE;
+
+	EnterCriticalSection(&(transport->WriteLock));
+
+	if (transport->WriteBatchDepth > 0)
+		transport->WriteBatchDepth--;
+
+	if (transport->WriteBatchDepth == 0)
+		status = transport_write_batch_flush(transport);
+
+	LeaveCriticalSection(&(transport->WriteLock));
+	return (status < 0) ? FALSE : TRUE;
+}
+
+/* The caller must hold the write lock. */
+static int transport_write_buffer(rdpTransport* transport, const BYTE* data, int length)
+{
+	int status = length;
+
+	if (length > 0)
+	{
+		WLog_Packet(WLog_Get(TAG), WLOG_TRACE, data, length,
+		            WLOG_PACKET_OUTBOUND);
+	}
+
+	if ((transport->WriteBatchDepth > 0) && (length < WRITE_BATCH_SIZE))
+	{
+		if ((Stream_Capacity(transport->WriteBatch) -
+		     Stream_GetPosition(transport->WriteBatch)) < (size_t) length)
+			status = transport_write_batch_flush(transport);
+
+		if (status >= 0)
+			Stream_Write(transport->WriteBatch, data, length);
+	}
+	else
+	{
+		/* keep the PDUs in order, an oversized one goes right after the batch */
+		status = transport_write_batch_flush(transport);
+
+		if ((status >= 0) && (length > 0))
+			status = transport_write_layer(transport, data, length);
+	}
+
+	return status;
+}
+
+int transport_write(rdpTransport* transport, wStream* s)
+{
+	return transport_write_gather(transport, s, NULL, 0);
+}
+
+/**
+ * Writes the content of the stream followed by length bytes of data, the
+ * data is not copied into a stream of its own first. The stream reference
+ * is consumed, the data only needs to stay valid during the call.
+ */
+int transport_write_gather(rdpTransport* transport, wStream* s, const BYTE* data, size_t length)
+{
+	int status = -1;
+	size_t position;
+	size_t writtenlength;
+
+	if (!transport)
+		return -1;
+
+	if (!transport->frontBio)
+	{
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+		return -1;
+	}
+
+	EnterCriticalSection(&(transport->WriteLock));
+	position = Stream_GetPosition(s);
+	writtenlength = position + length;
+	Stream_SetPosition(s, 0);
+	status = transport_write_buffer(transport, Stream_Buffer(s), (int) position);
+
+	if ((status >= 0) && (length > 0))
+		status = transport_write_buffer(transport, data, (int) length);
+
+	if (status >= 0)
+		transport->written += writtenlength;
 
 	Stream_Release(s);
 	LeaveCriticalSection(&(transport->WriteLock));
@@ -789,6 +1105,25 @@ DWORD transport_get_event_handles(rdpTransport* transport, HANDLE* events,
 				return 0;
 			}
 		}
+
+		/* only wait for the socket to become writable while output is queued */
+		if (transport_output_queue_enabled(transport) &&
+		    (transport_get_output_queue_size(transport) > 0))
+		{
+			nCount++;
+
+			if (events)
+			{
+				if (nCount > count)
+				{
+					WLog_ERR(TAG, "%s: provided handles array is too small (count=%d nCount=%d)",
+					         __FUNCTION__, count, nCount);
+					return 0;
+				}
+
+				events[2] = transport->WriteEvent;
+			}
+		}
 	}
 	else
 	{
@@ -851,11 +1186,82 @@ int transport_drain_output_buffer(rdpTransport* transport)
 	return status;
 }
 
+size_t transport_get_output_queue_size(rdpTransport* transport)
+{
+	long pending;
+
+	if (!transport || !transport->frontBio)
+		return 0;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	pending = BIO_wpending(transport->frontBio);
+	LeaveCriticalSection(&(transport->WriteLock));
+	return (pending > 0) ? (size_t) pending : 0;
+}
+
+BOOL transport_is_output_queue_full(rdpTransport* transport)
+{
+	BOOL full;
+
+	if (!transport)
+		return FALSE;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	full = transport->OutputQueueFull;
+	LeaveCriticalSection(&(transport->WriteLock));
+	return full;
+}
+
+/**
+ * Hands as much of the output queue to the socket as it takes without blocking.
+ *
+ * @return < 0 on error; 1 if the queue was full and has drained below half of
+ * the limit; 0 otherwise
+ */
+int transport_flush_output_queue(rdpTransport* transport)
+{
+	int status = 0;
+	size_t queued;
+
+	if (!transport || !transport->frontBio)
+		return -1;
+
+	if (!transport_output_queue_enabled(transport))
+		return 0;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	queued = transport_get_output_queue_size(transport);
+
+	if ((queued > 0) && (BIO_flush(transport->frontBio) < 1))
+	{
+		WLog_ERR(TAG, "error when flushing the output queue");
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+		LeaveCriticalSection(&(transport->WriteLock));
+		return -1;
+	}
+
+	if (transport->OutputQueueFull)
+	{
+		queued = transport_get_output_queue_size(transport);
+
+		if (queued <= transport->settings->OutputQueueLimit / 2)
+		{
+			transport->OutputQueueFull = FALSE;
+			status = 1;
+		}
+	}
+
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status;
+}
+
 int transport_check_fds(rdpTransport* transport)
 {
+	int count;
 	int status;
 	int recv_status;
 	wStream* received;
+	DataChunk chunks[2];
 	DWORD now = GetTickCount();
 	DWORD dueDate = now + transport->settings->MaxTimeInCheckLoop;
 
@@ -871,26 +1277,65 @@ int transport_check_fds(rdpTransport* transport)
 	while (!freerdp_shall_disconnect(transport->context->instance) && (now < dueDate))
 	{
 		/**
-		 * Note: transport_read_pdu tries to read one PDU from
-		 * the transport layer.
-		 * The ReceiveBuffer might have a position > 0 in case of a non blocking
-		 * transport. If transport_read_pdu returns 0 the pdu couldn't be read at
-		 * this point.
-		 * Note that transport->ReceiveBuffer is replaced after each iteration
-		 * of this loop with a fresh stream instance from a pool.
+		 * Note: transport_recv_pdu tries to slice one PDU out of the
+		 * receive ring, reading from the transport layer if required.
+		 * If it returns 0 the pdu couldn't be read at this point, the
+		 * partial data stays in the ring.
 		 */
-		if ((status = transport_read_pdu(transport, transport->ReceiveBuffer)) <= 0)
+		if ((status = transport_recv_pdu(transport, chunks)) <= 0)
 		{
 			if (status < 0)
-				WLog_DBG(TAG, "transport_check_fds: transport_read_pdu() - %i", status);
+				WLog_DBG(TAG, "transport_check_fds: transport_recv_pdu() - %i", status);
 
 			return status;
 		}
 
-		received = transport->ReceiveBuffer;
+		count = status;
 
-		if (!(transport->ReceiveBuffer = StreamPool_Take(transport->ReceivePool, 0)))
-			return -1;
+		/**
+		 * A PDU in one piece is passed as a view into the ring. Only a PDU
+		 * wrapping around the end of the ring is copied, into
+		 * transport->ReceiveBuffer which is then replaced with a fresh
+		 * stream instance from a pool.
+		 * With AsyncUpdate the update thread keeps bitmap data referenced
+		 * through the pool (see message.c) after this returns, the ring is
+		 * reused by then, so every PDU is copied into a pooled stream.
+		 */
+		if ((count == 1) && !transport->settings->AsyncUpdate)
+		{
+			received = &transport->ReceiveView;
+			received->buffer = received->pointer = (BYTE*) chunks[0].data;
+			received->length = received->capacity = chunks[0].size;
+			received->count = 1;
+			received->pool = NULL;
+			transport->ReceiveViews++;
+		}
+		else
+		{
+			int index;
+			received = transport->ReceiveBuffer;
+			Stream_SetPosition(received, 0);
+
+			if (!Stream_EnsureCapacity(received, chunks[0].size +
+			                           ((count > 1) ? chunks[1].size : 0)))
+			{
+				transport_recv_release(transport);
+				return -1;
+			}
+
+			for (index = 0; index < count; index++)
+				Stream_Write(received, chunks[index].data, chunks[index].size);
+
+			Stream_SealLength(received);
+			Stream_SetPosition(received, 0);
+			transport_recv_release(transport);
+
+			if (!(transport->ReceiveBuffer = StreamPool_Take(transport->ReceivePool, 0)))
+			{
+				Stream_Release(received);
+				return -1;
+			}
+		}
 
 		/**
 		 * status:
@@ -900,11 +1345,25 @@ int transport_check_fds(rdpTransport* transport)
 		 */
 		recv_status = transport->ReceiveCallback(transport, received,
 		              transport->ReceiveExtra);
-		Stream_Release(received);
+
+		if (received == &transport->ReceiveView)
+		{
+			transport->ReceiveViews--;
+			transport_recv_release(transport);
+		}
+		else
+			Stream_Release(received);
 
 		/* session redirection or activation */
 		if (recv_status == 1 || recv_status == 2)
 		{
+			/* PDUs already buffered would not signal the transport events again */
+			if (transport_recv_available(transport) > 0)
+			{
+				SetEvent(transport->rereadEvent);
+				transport->haveMoreBytesToRead = TRUE;
+			}
+
 			return recv_status;
 		}
 
@@ -995,8 +1454,17 @@ BOOL transport_disconnect(rdpTransport* transport)
 		transport->rdg = NULL;
 	}
 
+	if (transport->WriteEvent)
+	{
+		CloseHandle(transport->WriteEvent);
+		transport->WriteEvent = NULL;
+	}
+
 	transport->frontBio = NULL;
 	transport->layer = TRANSPORT_LAYER_TCP;
+	transport->OutputQueueFull = FALSE;
+	transport_recv_reset(transport);
+	Stream_SetPosition(transport->WriteBatch, 0);
 	return status;
 }
 
@@ -1100,17 +1568,31 @@ rdpTransport* transport_new(rdpContext* context)
 	if (!transport->ReceivePool)
 		goto out_free_transport;
 
+	/* PDUs are built in streams of their own pool, senders do not contend with the receiver */
+	transport->SendPool = StreamPool_New(TRUE, BUFFER_SIZE);
+
+	if (!transport->SendPool)
+		goto out_free_receivepool;
+
 	/* receive buffer for non-blocking read. */
 	transport->ReceiveBuffer = StreamPool_Take(transport->ReceivePool, 0);
 
 	if (!transport->ReceiveBuffer)
-		goto out_free_receivepool;
+		goto out_free_sendpool;
+
+	if (!ringbuffer_init(&transport->ReceiveRing, RECEIVE_RING_SIZE))
+		goto out_free_receivebuffer;
+
+	transport->WriteBatch = Stream_New(NULL, WRITE_BATCH_SIZE);
+
+	if (!transport->WriteBatch)
+		goto out_free_receivering;
 
 	transport->connectedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
 	if (!transport->connectedEvent
 	    || transport->connectedEvent == INVALID_HANDLE_VALUE)
-		goto out_free_receivebuffer;
+		goto out_free_writebatch;
 
 	transport->rereadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 
@@ -1135,8 +1617,14 @@ out_free_rereadEvent:
 	CloseHandle(transport->rereadEvent);
 out_free_connectedEvent:
 	CloseHandle(transport->connectedEvent);
+out_free_writebatch:
+	Stream_Free(transport->WriteBatch, TRUE);
+out_free_receivering:
+	ringbuffer_destroy(&transport->ReceiveRing);
 out_free_receivebuffer:
 	StreamPool_Return(transport->ReceivePool, transport->ReceiveBuffer);
+out_free_sendpool:
+	StreamPool_Free(transport->SendPool);
 out_free_receivepool:
 	StreamPool_Free(transport->ReceivePool);
 out_free_transport:
@@ -1154,6 +1642,9 @@ void transport_free(rdpTransport* transport)
 	if (transport->ReceiveBuffer)
 		Stream_Release(transport->ReceiveBuffer);
 
+	ringbuffer_destroy(&transport->ReceiveRing);
+	Stream_Free(transport->WriteBatch, TRUE);
+	StreamPool_Free(transport->SendPool);
 	StreamPool_Free(transport->ReceivePool);
 	CloseHandle(transport->connectedEvent);
 	CloseHandle(transport->rereadEvent);
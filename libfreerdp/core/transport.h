@@ -46,6 +46,7 @@ typedef struct rdp_transport rdpTransport;
 
 #include <freerdp/api.h>
 #include <freerdp/crypto/tls.h>
+#include <freerdp/utils/ringbuffer.h>
 
 #include <time.h>
 #include <freerdp/types.h>
@@ -67,8 +68,13 @@ struct rdp_transport
 	rdpSettings* settings;
 	void* ReceiveExtra;
 	wStream* ReceiveBuffer;
+	RingBuffer ReceiveRing;
+	size_t ReceiveConsumed;
+	int ReceiveViews;
+	wStream ReceiveView;
 	TransportRecv ReceiveCallback;
 	wStreamPool* ReceivePool;
+	wStreamPool* SendPool;
 	HANDLE connectedEvent;
 	HANDLE stopEvent;
 	HANDLE thread;
@@ -78,6 +84,10 @@ struct rdp_transport
 	BOOL GatewayEnabled;
 	CRITICAL_SECTION ReadLock;
 	CRITICAL_SECTION WriteLock;
+	wStream* WriteBatch;
+	int WriteBatchDepth;
+	HANDLE WriteEvent;
+	BOOL OutputQueueFull;
 	ULONG written;
 	HANDLE rereadEvent;
 	BOOL haveMoreBytesToRead;
@@ -98,6 +108,10 @@ FREERDP_LOCAL BOOL transport_accept_nla(rdpTransport* transport);
 FREERDP_LOCAL void transport_stop(rdpTransport* transport);
 FREERDP_LOCAL int transport_read_pdu(rdpTransport* transport, wStream* s);
 FREERDP_LOCAL int transport_write(rdpTransport* transport, wStream* s);
+FREERDP_LOCAL int transport_write_gather(rdpTransport* transport, wStream* s,
+        const BYTE* data, size_t length);
+FREERDP_LOCAL void transport_begin_write_batch(rdpTransport* transport);
+FREERDP_LOCAL BOOL transport_end_write_batch(rdpTransport* transport);
 
 FREERDP_LOCAL void transport_get_fds(rdpTransport* transport, void** rfds,
                                      int* rcount);
@@ -114,6 +128,9 @@ FREERDP_LOCAL void transport_set_nla_mode(rdpTransport* transport,
         BOOL NlaMode);
 FREERDP_LOCAL BOOL transport_is_write_blocked(rdpTransport* transport);
 FREERDP_LOCAL int transport_drain_output_buffer(rdpTransport* transport);
+FREERDP_LOCAL size_t transport_get_output_queue_size(rdpTransport* transport);
+FREERDP_LOCAL BOOL transport_is_output_queue_full(rdpTransport* transport);
+FREERDP_LOCAL int transport_flush_output_queue(rdpTransport* transport);
 
 FREERDP_LOCAL wStream* transport_receive_pool_take(rdpTransport* transport);
 FREERDP_LOCAL int transport_receive_pool_return(rdpTransport* transport,
@@ -680,7 +680,7 @@ static BOOL update_end_paint(rdpContext* context)
 	update->combineUpdates = FALSE;
 	update->numberOrders = 0;
 	update->us = NULL;
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return TRUE;
 }
 
@@ -23,19 +23,31 @@
 
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 
 #include <winpr/crt.h>
 #include <winpr/sspi.h>
 #include <winpr/ssl.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
 
 #include <winpr/stream.h>
 #include <freerdp/utils/ringbuffer.h>
 
 #include <freerdp/log.h>
 #include <freerdp/crypto/tls.h>
+#include <freerdp/crypto/crypto.h>
 #include "../core/tcp.h"
 #include "opensslcompat.h"
 
+#include <openssl/rand.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
 #ifdef HAVE_POLL_H
 #include <poll.h>
 #endif
@@ -44,6 +56,24 @@
 #include <valgrind/memcheck.h>
 #endif
 
+#if defined(HAVE_LINUX_TLS_H) && (OPENSSL_VERSION_NUMBER >= 0x10101000L) && \
+	!defined(LIBRESSL_VERSION_NUMBER)
+#define TLS_KERNEL_OFFLOAD
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <openssl/kdf.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS		282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP		31
+#endif
+#endif
+
 #define TAG FREERDP_TAG("crypto")
 
 
@@ -74,6 +104,8 @@ struct _BIO_RDP_TLS
 {
 	SSL* ssl;
 	CRITICAL_SECTION lock;
+	BOOL kernelSend;
+	BOOL kernelRecv;
 };
 typedef struct _BIO_RDP_TLS BIO_RDP_TLS;
 
@@ -93,6 +125,15 @@ static int bio_rdp_tls_write(BIO* bio, const char* buf, int size)
 		return 0;
 
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE | BIO_FLAGS_READ | BIO_FLAGS_IO_SPECIAL);
+
+	if (tls->kernelSend)
+	{
+		/* the kernel encrypts, plaintext goes straight to the socket */
+		status = BIO_write(BIO_next(bio), buf, size);
+		BIO_copy_next_retry(bio);
+		return status;
+	}
+
 	EnterCriticalSection(&tls->lock);
 	status = SSL_write(tls->ssl, buf, size);
 	error = SSL_get_error(tls->ssl, status);
@@ -147,6 +188,14 @@ static int bio_rdp_tls_read(BIO* bio, char* buf, int size)
 		return 0;
 
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE | BIO_FLAGS_READ | BIO_FLAGS_IO_SPECIAL);
+
+	if (tls->kernelRecv)
+	{
+		status = BIO_read(BIO_next(bio), buf, size);
+		BIO_copy_next_retry(bio);
+		return status;
+	}
+
 	EnterCriticalSection(&tls->lock);
 	status = SSL_read(tls->ssl, buf, size);
 	error = SSL_get_error(tls->ssl, status);
@@ -248,7 +297,9 @@ static long bio_rdp_tls_ctrl(BIO* bio, int cmd, long num, void* ptr)
 	switch (cmd)
 	{
 		case BIO_CTRL_RESET:
-			SSL_shutdown(tls->ssl);
+			/* a close notify from OpenSSL would not match the kernel's record state */
+			if (!tls->kernelSend)
+				SSL_shutdown(tls->ssl);
 
 			if (SSL_in_connect_init(tls->ssl))
 				SSL_set_connect_state(tls->ssl);
@@ -466,7 +517,9 @@ static int bio_rdp_tls_free(BIO* bio)
 	{
 		if (BIO_get_init(bio) && tls->ssl)
 		{
-			SSL_shutdown(tls->ssl);
+			if (!tls->kernelSend)
+				SSL_shutdown(tls->ssl);
+
 			SSL_free(tls->ssl);
 		}
 		BIO_set_init(bio, 0);
@@ -637,6 +690,398 @@ out_free:
 	return NULL;
 }
 
+/**
+ * Session resumption
+ *
+ * Clients keep the most recent session of every server (host:port) in a
+ * process wide cache, auto-reconnects and repeated connections offer it
+ * and skip the full handshake when the server accepts. New sessions are
+ * picked up through the session callback, which also sees TLS 1.3 tickets
+ * arriving after the handshake. With TlsSessionCacheFile set the cache is
+ * loaded from and written back to that file.
+ *
+ * Servers create a SSL_CTX per connection, stateless session tickets
+ * therefore use process wide ticket keys, rotated every
+ * TLS_TICKET_KEY_LIFETIME.
+ */
+
+#define TLS_SESSION_CACHE_SIZE		64
+#define TLS_SESSION_LINE_LENGTH		16384
+#define TLS_TICKET_KEY_LIFETIME		(12 * 60 * 60 * 1000)
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define TLS_TICKET_KEY_LENGTH		80
+#else
+#define TLS_TICKET_KEY_LENGTH		48
+#endif
+
+struct _TLS_SESSION_CACHE_ENTRY
+{
+	char* key;
+	SSL_SESSION* session;
+	UINT64 used;
+};
+typedef struct _TLS_SESSION_CACHE_ENTRY TLS_SESSION_CACHE_ENTRY;
+
+static INIT_ONCE tls_session_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION tls_session_lock;
+static int tls_session_ex_index = -1;
+static TLS_SESSION_CACHE_ENTRY tls_session_cache[TLS_SESSION_CACHE_SIZE];
+static char* tls_session_cache_file = NULL;
+static BYTE tls_ticket_keys[TLS_TICKET_KEY_LENGTH];
+static UINT64 tls_ticket_keys_time = 0;
+static TLS_SESSION_STATISTICS tls_session_statistics;
+
+static BOOL CALLBACK tls_session_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	/* the application data of the SSL belongs to the transport */
+	tls_session_ex_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+
+	if (tls_session_ex_index < 0)
+		return FALSE;
+
+	return InitializeCriticalSectionAndSpinCount(&tls_session_lock, 4000);
+}
+
+static BOOL tls_session_lock_acquire(void)
+{
+	if (!InitOnceExecuteOnce(&tls_session_once, tls_session_init, NULL, NULL))
+		return FALSE;
+
+	EnterCriticalSection(&tls_session_lock);
+	return TRUE;
+}
+
+static char* tls_session_key(rdpTls* tls)
+{
+	int length;
+	char* key;
+
+	if (!tls->hostname)
+		return NULL;
+
+	length = _snprintf(NULL, 0, "%s:%d", tls->hostname, tls->port);
+
+	if (length < 0)
+		return NULL;
+
+	key = (char*) malloc(length + 1);
+
+	if (!key)
+		return NULL;
+
+	if (_snprintf(key, length + 1, "%s:%d", tls->hostname, tls->port) != length)
+	{
+		free(key);
+		return NULL;
+	}
+
+	return key;
+}
+
+static BOOL tls_session_is_valid(SSL_SESSION* session)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+
+	if (!SSL_SESSION_is_resumable(session))
+		return FALSE;
+
+#endif
+	return (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session)) > time(NULL);
+}
+
+static void tls_session_cache_remove(TLS_SESSION_CACHE_ENTRY* entry)
+{
+	free(entry->key);
+	SSL_SESSION_free(entry->session);
+	ZeroMemory(entry, sizeof(TLS_SESSION_CACHE_ENTRY));
+}
+
+static TLS_SESSION_CACHE_ENTRY* tls_session_cache_find(const char* key)
+{
+	int index;
+
+	for (index = 0; index < TLS_SESSION_CACHE_SIZE; index++)
+	{
+		if (tls_session_cache[index].key && (strcmp(tls_session_cache[index].key, key) == 0))
+			return &tls_session_cache[index];
+	}
+
+	return NULL;
+}
+
+/* takes ownership of the session on success */
+static BOOL tls_session_cache_put(const char* key, SSL_SESSION* session)
+{
+	int index;
+	char* entryKey;
+	TLS_SESSION_CACHE_ENTRY* entry;
+	entry = tls_session_cache_find(key);
+
+	if (!entry)
+	{
+		entry = &tls_session_cache[0];
+
+		for (index = 0; index < TLS_SESSION_CACHE_SIZE; index++)
+		{
+			if (!tls_session_cache[index].key)
+			{
+				entry = &tls_session_cache[index];
+				break;
+			}
+
+			if (tls_session_cache[index].used < entry->used)
+				entry = &tls_session_cache[index];
+		}
+	}
+
+	if (!(entryKey = _strdup(key)))
+		return FALSE;
+
+	if (entry->key)
+		tls_session_cache_remove(entry);
+
+	entry->key = entryKey;
+	entry->session = session;
+	entry->used = GetTickCount64();
+	return TRUE;
+}
+
+static void tls_session_cache_load(const char* file)
+{
+	FILE* fp;
+	char* line;
+	char* value;
+	BYTE* data;
+	int length;
+	const unsigned char* ptr;
+	SSL_SESSION* session;
+
+	if (tls_session_cache_file && (strcmp(tls_session_cache_file, file) == 0))
+		return;
+
+	free(tls_session_cache_file);
+
+	if (!(tls_session_cache_file = _strdup(file)))
+		return;
+
+	if (!(fp = fopen(file, "r")))
+		return;
+
+	if (!(line = (char*) malloc(TLS_SESSION_LINE_LENGTH)))
+	{
+		fclose(fp);
+		return;
+	}
+
+	while (fgets(line, TLS_SESSION_LINE_LENGTH, fp))
+	{
+		if (!(value = strchr(line, ' ')))
+			continue;
+
+		*value++ = '\0';
+		value[strcspn(value, "\r\n")] = '\0';
+		data = NULL;
+		length = 0;
+		crypto_base64_decode(value, (int) strlen(value), &data, &length);
+
+		if (!data)
+			continue;
+
+		ptr = data;
+		session = d2i_SSL_SESSION(NULL, &ptr, length);
+		free(data);
+
+		if (!session)
+			continue;
+
+		if (!tls_session_is_valid(session) || !tls_session_cache_put(line, session))
+			SSL_SESSION_free(session);
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+static void tls_session_cache_save(void)
+{
+	int index;
+	int length;
+	FILE* fp;
+	BYTE* data;
+	BYTE* ptr;
+	char* value;
+#ifndef _WIN32
+	int fd;
+	fd = open(tls_session_cache_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+	if (fd < 0)
+		return;
+
+	if (!(fp = fdopen(fd, "w")))
+	{
+		close(fd);
+		return;
+	}
+
+#else
+
+	if (!(fp = fopen(tls_session_cache_file, "w")))
+		return;
+
+#endif
+
+	for (index = 0; index < TLS_SESSION_CACHE_SIZE; index++)
+	{
+		if (!tls_session_cache[index].key)
+			continue;
+
+		length = i2d_SSL_SESSION(tls_session_cache[index].session, NULL);
+
+		if ((length <= 0) || !(data = (BYTE*) malloc(length)))
+			continue;
+
+		ptr = data;
+		i2d_SSL_SESSION(tls_session_cache[index].session, &ptr);
+		value = crypto_base64_encode(data, length);
+		free(data);
+
+		if (value)
+			fprintf(fp, "%s %s\n", tls_session_cache[index].key, value);
+
+		free(value);
+	}
+
+	fclose(fp);
+}
+
+static int tls_session_new_callback(SSL* ssl, SSL_SESSION* session)
+{
+	int status = 0;
+	char* key;
+	rdpTls* tls = (rdpTls*) SSL_get_ex_data(ssl, tls_session_ex_index);
+
+	if (!tls || !(key = tls_session_key(tls)))
+		return 0;
+
+	if (tls_session_lock_acquire())
+	{
+		if (tls_session_cache_put(key, session))
+		{
+			status = 1;
+
+			if (tls_session_cache_file)
+				tls_session_cache_save();
+		}
+
+		LeaveCriticalSection(&tls_session_lock);
+	}
+
+	free(key);
+	return status;
+}
+
+static void tls_session_restore(rdpTls* tls)
+{
+	char* key;
+	TLS_SESSION_CACHE_ENTRY* entry;
+	rdpSettings* settings = tls->settings;
+
+	if (!(key = tls_session_key(tls)))
+		return;
+
+	if (!tls_session_lock_acquire())
+	{
+		free(key);
+		return;
+	}
+
+	if (settings->TlsSessionCacheFile)
+		tls_session_cache_load(settings->TlsSessionCacheFile);
+
+	if ((entry = tls_session_cache_find(key)))
+	{
+		if (!tls_session_is_valid(entry->session))
+		{
+			tls_session_cache_remove(entry);
+		}
+		else if (SSL_set_session(tls->ssl, entry->session))
+		{
+			entry->used = GetTickCount64();
+			tls_session_statistics.ClientOffered++;
+		}
+	}
+
+	LeaveCriticalSection(&tls_session_lock);
+	free(key);
+}
+
+static BOOL tls_session_set_ticket_keys(SSL_CTX* ctx)
+{
+	BOOL rc = TRUE;
+	UINT64 now = GetTickCount64();
+
+	if (!tls_session_lock_acquire())
+		return FALSE;
+
+	if (!tls_ticket_keys_time || ((now - tls_ticket_keys_time) > TLS_TICKET_KEY_LIFETIME))
+	{
+		if (RAND_bytes(tls_ticket_keys, sizeof(tls_ticket_keys)) == 1)
+			tls_ticket_keys_time = now;
+		else
+			rc = FALSE;
+	}
+
+	if (rc && (SSL_CTX_set_tlsext_ticket_keys(ctx, tls_ticket_keys, sizeof(tls_ticket_keys)) != 1))
+		rc = FALSE;
+
+	LeaveCriticalSection(&tls_session_lock);
+	return rc;
+}
+
+static void tls_session_update_statistics(rdpTls* tls, BOOL clientMode)
+{
+	BOOL reused = SSL_session_reused(tls->ssl) ? TRUE : FALSE;
+
+	if (!tls_session_lock_acquire())
+		return;
+
+	if (clientMode)
+	{
+		tls_session_statistics.ClientHandshakes++;
+
+		if (reused)
+			tls_session_statistics.ClientResumed++;
+	}
+	else
+	{
+		tls_session_statistics.ServerHandshakes++;
+
+		if (reused)
+			tls_session_statistics.ServerResumed++;
+	}
+
+	LeaveCriticalSection(&tls_session_lock);
+
+	if (reused)
+		WLog_DBG(TAG, "TLS session resumed");
+}
+
+void tls_get_session_statistics(TLS_SESSION_STATISTICS* statistics)
+{
+	if (!statistics)
+		return;
+
+	if (!tls_session_lock_acquire())
+	{
+		ZeroMemory(statistics, sizeof(TLS_SESSION_STATISTICS));
+		return;
+	}
+
+	*statistics = tls_session_statistics;
+	LeaveCriticalSection(&tls_session_lock);
+}
+
 #if OPENSSL_VERSION_NUMBER >= 0x010000000L
 static BOOL tls_prepare(rdpTls* tls, BIO* underlying, const SSL_METHOD* method,
                         int options, BOOL clientMode)
@@ -659,6 +1104,32 @@ static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method,
 	SSL_CTX_set_options(tls->ctx, options);
 	SSL_CTX_set_read_ahead(tls->ctx, 1);
 
+	if (settings->TlsSessionResumption && !clientMode)
+	{
+		SSL_CTX_set_session_id_context(tls->ctx, (const unsigned char*) "FreeRDP", 7);
+
+		if (!tls_session_set_ticket_keys(tls->ctx))
+			WLog_WARN(TAG, "unable to set TLS session ticket keys");
+	}
+	else if (settings->TlsSessionResumption)
+	{
+		SSL_CTX_set_session_cache_mode(tls->ctx,
+		                               SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(tls->ctx, tls_session_new_callback);
+	}
+#ifdef TLS_KERNEL_OFFLOAD
+
+	if (settings->TlsKernelOffload && !tls->isGatewayTransport)
+	{
+		/* only TLS 1.2 record keys are handed to the kernel, see tls_kernel_offload() */
+		SSL_CTX_set_max_proto_version(tls->ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_NO_RENEGOTIATION
+		SSL_CTX_set_options(tls->ctx, SSL_OP_NO_RENEGOTIATION);
+#endif
+	}
+
+#endif
+
 	if (settings->AllowedTlsCiphers)
 	{
 		if (!SSL_CTX_set_cipher_list(tls->ctx, settings->AllowedTlsCiphers))
@@ -676,11 +1147,185 @@ static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method,
 		return FALSE;
 	}
 
+	if (settings->TlsSessionResumption && clientMode)
+	{
+		if (!InitOnceExecuteOnce(&tls_session_once, tls_session_init, NULL, NULL) ||
+		    !SSL_set_ex_data(tls->ssl, tls_session_ex_index, tls))
+			WLog_WARN(TAG, "unable to attach the TLS session cache");
+	}
+
 	BIO_push(tls->bio, underlying);
 	tls->underlying = underlying;
 	return TRUE;
 }
 
+#ifdef TLS_KERNEL_OFFLOAD
+static BOOL tls_kernel_derive_key_block(SSL* ssl, BYTE* keyBlock, size_t length)
+{
+	BOOL rc = FALSE;
+	size_t masterKeyLength;
+	BYTE masterKey[SSL_MAX_MASTER_KEY_LENGTH];
+	BYTE seed[2 * SSL3_RANDOM_SIZE];
+	static const char label[] = "key expansion";
+	const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+	const EVP_MD* md = cipher ? SSL_CIPHER_get_handshake_digest(cipher) : NULL;
+	EVP_PKEY_CTX* pctx;
+
+	if (!md)
+		return FALSE;
+
+	masterKeyLength = SSL_SESSION_get_master_key(SSL_get_session(ssl), masterKey,
+	                  sizeof(masterKey));
+	/* the key block is seeded with server_random + client_random (RFC 5246 6.3) */
+	SSL_get_server_random(ssl, seed, SSL3_RANDOM_SIZE);
+	SSL_get_client_random(ssl, &seed[SSL3_RANDOM_SIZE], SSL3_RANDOM_SIZE);
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, NULL);
+
+	if (!pctx)
+		goto out;
+
+	if ((EVP_PKEY_derive_init(pctx) <= 0) ||
+	    (EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) <= 0) ||
+	    (EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, masterKey, masterKeyLength) <= 0) ||
+	    (EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, (const BYTE*) label, sizeof(label) - 1) <= 0) ||
+	    (EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, seed, sizeof(seed)) <= 0) ||
+	    (EVP_PKEY_derive(pctx, keyBlock, &length) <= 0))
+		goto out;
+
+	rc = TRUE;
+out:
+	EVP_PKEY_CTX_free(pctx);
+	OPENSSL_cleanse(masterKey, sizeof(masterKey));
+	return rc;
+}
+
+union tls_kernel_crypto_info
+{
+	struct tls_crypto_info info;
+	struct tls12_crypto_info_aes_gcm_128 gcm128;
+	struct tls12_crypto_info_aes_gcm_256 gcm256;
+};
+
+static void tls_kernel_fill_crypto_info(union tls_kernel_crypto_info* crypto,
+                                        int nid, const BYTE* key, const BYTE* salt)
+{
+	/* no application data record has been exchanged yet, Finished was record 0 */
+	static const BYTE sequence[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	ZeroMemory(crypto, sizeof(union tls_kernel_crypto_info));
+	crypto->info.version = TLS_1_2_VERSION;
+
+	if (nid == NID_aes_128_gcm)
+	{
+		crypto->gcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		CopyMemory(crypto->gcm128.key, key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+		CopyMemory(crypto->gcm128.salt, salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+		CopyMemory(crypto->gcm128.iv, sequence, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+		CopyMemory(crypto->gcm128.rec_seq, sequence, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	}
+	else
+	{
+		crypto->gcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		CopyMemory(crypto->gcm256.key, key, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+		CopyMemory(crypto->gcm256.salt, salt, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+		CopyMemory(crypto->gcm256.iv, sequence, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+		CopyMemory(crypto->gcm256.rec_seq, sequence, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+	}
+}
+
+/**
+ * Moves the record encryption of an established TLS 1.2 AES-GCM session into
+ * the kernel (Linux kTLS). The rdp tls BIO then passes plaintext straight to
+ * the socket BIO. Receiving is only offloaded if OpenSSL has not read ahead
+ * past the handshake. Any failure leaves the session in OpenSSL.
+ */
+static void tls_kernel_offload(rdpTls* tls, BOOL clientMode)
+{
+	int fd;
+	int nid;
+	size_t keyLength;
+	socklen_t cryptoLength;
+	BYTE keyBlock[2 * 32 + 2 * 4];
+	const BYTE* clientKey;
+	const BYTE* serverKey;
+	union tls_kernel_crypto_info tx;
+	union tls_kernel_crypto_info rx;
+	BIO_RDP_TLS* data = (BIO_RDP_TLS*) BIO_get_data(tls->bio);
+	const SSL_CIPHER* cipher = SSL_get_current_cipher(tls->ssl);
+
+	if (!tls->settings->TlsKernelOffload || tls->isGatewayTransport || !data || !cipher)
+		return;
+
+	/* TSG and other tunnels don't end in a plain socket */
+	if (BIO_method_type(tls->underlying) != BIO_TYPE_BUFFERED)
+		return;
+
+	nid = SSL_CIPHER_get_cipher_nid(cipher);
+
+	if ((SSL_version(tls->ssl) != TLS1_2_VERSION) ||
+	    ((nid != NID_aes_128_gcm) && (nid != NID_aes_256_gcm)))
+	{
+		WLog_INFO(TAG, "kernel TLS offload not available for %s %s",
+		          SSL_get_version(tls->ssl), SSL_CIPHER_get_name(cipher));
+		return;
+	}
+
+	/* ciphertext still queued in the buffered BIO must not be encrypted again */
+	if ((BIO_flush(tls->underlying) < 1) || BIO_write_blocked(tls->underlying))
+		return;
+
+	fd = BIO_get_fd(tls->bio, NULL);
+
+	if (fd < 0)
+		return;
+
+	keyLength = (nid == NID_aes_128_gcm) ? 16 : 32;
+
+	if (!tls_kernel_derive_key_block(tls->ssl, keyBlock, 2 * keyLength + 2 * 4))
+	{
+		WLog_WARN(TAG, "unable to derive the TLS key block, kernel offload disabled");
+		return;
+	}
+
+	/* client_write_key, server_write_key, client_write_IV, server_write_IV */
+	clientKey = keyBlock;
+	serverKey = &keyBlock[keyLength];
+	tls_kernel_fill_crypto_info(&tx, nid, clientMode ? clientKey : serverKey,
+	                            &keyBlock[2 * keyLength + (clientMode ? 0 : 4)]);
+	tls_kernel_fill_crypto_info(&rx, nid, clientMode ? serverKey : clientKey,
+	                            &keyBlock[2 * keyLength + (clientMode ? 4 : 0)]);
+	OPENSSL_cleanse(keyBlock, sizeof(keyBlock));
+	cryptoLength = (nid == NID_aes_128_gcm) ? sizeof(tx.gcm128) : sizeof(tx.gcm256);
+
+	if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0)
+	{
+		WLog_INFO(TAG, "kernel TLS not available (%s), staying in user space",
+		          strerror(errno));
+		goto out;
+	}
+
+	if (setsockopt(fd, SOL_TLS, TLS_TX, &tx, cryptoLength) < 0)
+	{
+		WLog_WARN(TAG, "kernel TLS transmit offload failed: %s", strerror(errno));
+		goto out;
+	}
+
+	data->kernelSend = TRUE;
+
+	if (SSL_has_pending(tls->ssl))
+		WLog_DBG(TAG, "TLS records already buffered, receive offload skipped");
+	else if (setsockopt(fd, SOL_TLS, TLS_RX, &rx, cryptoLength) < 0)
+		WLog_WARN(TAG, "kernel TLS receive offload failed: %s", strerror(errno));
+	else
+		data->kernelRecv = TRUE;
+
+	WLog_INFO(TAG, "kernel TLS offload enabled (%s, transmit%s)",
+	          SSL_CIPHER_get_name(cipher), data->kernelRecv ? " and receive" : " only");
+out:
+	OPENSSL_cleanse(&tx, sizeof(tx));
+	OPENSSL_cleanse(&rx, sizeof(rx));
+}
+#endif
+
 int tls_do_handshake(rdpTls* tls, BOOL clientMode)
 {
 	CryptoCert cert;
@@ -770,6 +1415,7 @@ int tls_do_handshake(rdpTls* tls, BOOL clientMode)
 	}
 	while (TRUE);
 
+	tls_session_update_statistics(tls, clientMode);
 	cert = tls_get_certificate(tls, clientMode);
 
 	if (!cert)
@@ -812,6 +1458,12 @@ int tls_do_handshake(rdpTls* tls, BOOL clientMode)
 
 out:
 	tls_free_certificate(cert);
+#ifdef TLS_KERNEL_OFFLOAD
+
+	if (verify_status > 0)
+		tls_kernel_offload(tls, clientMode);
+
+#endif
 	return verify_status;
 }
 
@@ -856,6 +1508,10 @@ int tls_connect(rdpTls* tls, BIO* underlying)
 #ifndef OPENSSL_NO_TLSEXT
 	SSL_set_tlsext_host_name(tls->ssl, tls->hostname);
 #endif
+
+	if (tls->settings->TlsSessionResumption)
+		tls_session_restore(tls);
+
 	return tls_do_handshake(tls, TRUE);
 }
 
@@ -884,6 +884,7 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 	const RECTANGLE_16* rect;
 	gdiGfxSurface* surface;
 	gdiGfxCacheEntry* cacheEntry;
+	gdiGfxCacheEntry* oldEntry;
 	rect = &(surfaceToCache->rectSrc);
 	surface = (gdiGfxSurface*) context->GetSurfaceData(context,
 	          surfaceToCache->surfaceId);
@@ -911,6 +912,16 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 	freerdp_image_copy(cacheEntry->data, cacheEntry->format, cacheEntry->scanline,
 	                   0, 0, cacheEntry->width, cacheEntry->height, surface->data,
 	                   surface->format, surface->scanline, rect->left, rect->top, NULL, FREERDP_FLIP_NONE);
+	/* the slot may still hold an entry imported from the persistent cache */
+	oldEntry = (gdiGfxCacheEntry*) context->GetCacheSlotData(context,
+	           surfaceToCache->cacheSlot);
+
+	if (oldEntry)
+	{
+		free(oldEntry->data);
+		free(oldEntry);
+	}
+
 	context->SetCacheSlotData(context, surfaceToCache->cacheSlot,
 	                          (void*) cacheEntry);
 	return CHANNEL_RC_OK;
@@ -973,6 +984,73 @@ static UINT gdi_CacheImportReply(RdpgfxClientContext* context,
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_CacheImportEntry(RdpgfxClientContext* context, UINT16 cacheSlot,
+                                 const PERSISTENT_CACHE_ENTRY* importCacheEntry)
+{
+	gdiGfxCacheEntry* cacheEntry;
+	const UINT32 scanline = gfx_align_scanline(importCacheEntry->width * 4, 16);
+
+	/* entries are exported with the scanline padding of the cache entry */
+	if (importCacheEntry->size != scanline * importCacheEntry->height)
+		return CHANNEL_RC_OK;
+
+	cacheEntry = (gdiGfxCacheEntry*) context->GetCacheSlotData(context, cacheSlot);
+
+	if (cacheEntry)
+	{
+		free(cacheEntry->data);
+		free(cacheEntry);
+		context->SetCacheSlotData(context, cacheSlot, NULL);
+	}
+
+	cacheEntry = (gdiGfxCacheEntry*) calloc(1, sizeof(gdiGfxCacheEntry));
+
+	if (!cacheEntry)
+		return ERROR_INTERNAL_ERROR;
+
+	cacheEntry->width = importCacheEntry->width;
+	cacheEntry->height = importCacheEntry->height;
+	cacheEntry->format = importCacheEntry->format;
+	cacheEntry->scanline = scanline;
+	cacheEntry->data = (BYTE*) malloc(importCacheEntry->size);
+
+	if (!cacheEntry->data)
+	{
+		free(cacheEntry);
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	CopyMemory(cacheEntry->data, importCacheEntry->data, importCacheEntry->size);
+	return context->SetCacheSlotData(context, cacheSlot, (void*) cacheEntry);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_ExportCacheEntry(RdpgfxClientContext* context, UINT16 cacheSlot,
+                                 PERSISTENT_CACHE_ENTRY* exportCacheEntry)
+{
+	gdiGfxCacheEntry* cacheEntry;
+	cacheEntry = (gdiGfxCacheEntry*) context->GetCacheSlotData(context, cacheSlot);
+
+	if (!cacheEntry)
+		return ERROR_NOT_FOUND;
+
+	exportCacheEntry->width = cacheEntry->width;
+	exportCacheEntry->height = cacheEntry->height;
+	exportCacheEntry->format = cacheEntry->format;
+	exportCacheEntry->size = cacheEntry->scanline * cacheEntry->height;
+	exportCacheEntry->data = cacheEntry->data;
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  *
@@ -1048,6 +1126,8 @@ void gdi_graphics_pipeline_init(rdpGdi* gdi, RdpgfxClientContext* gfx)
 	gfx->MapSurfaceToOutput = gdi_MapSurfaceToOutput;
 	gfx->MapSurfaceToWindow = gdi_MapSurfaceToWindow;
 	gfx->UpdateSurfaces = gdi_UpdateSurfaces;
+	gfx->CacheImportEntry = gdi_CacheImportEntry;
+	gfx->ExportCacheEntry = gdi_ExportCacheEntry;
 }
 
 void gdi_graphics_pipeline_uninit(rdpGdi* gdi, RdpgfxClientContext* gfx)
@@ -53,6 +53,7 @@
 
 static char* test_pcap_file = NULL;
 static BOOL test_dump_rfx_realtime = TRUE;
+static rdpReactor* test_reactor = NULL;
 
 BOOL test_peer_context_new(freerdp_peer* client, testPeerContext* context)
 {
@@ -747,19 +748,23 @@ static BOOL tf_peer_suppress_output(rdpContext* context, BYTE allow,
 	return TRUE;
 }
 
-static void* test_peer_mainloop(void* arg)
+static void test_peer_closed(void* arg)
 {
-	HANDLE handles[32];
-	DWORD count;
-	DWORD status;
-	testPeerContext* context;
 	freerdp_peer* client = (freerdp_peer*) arg;
+	WLog_INFO(TAG, "Client %s disconnected.",
+	          client->local ? "(local)" : client->hostname);
+	client->Disconnect(client);
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+}
+
+static BOOL test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
+{
+	testPeerContext* context;
 
+	/* the listener frees the peer if it is not accepted */
 	if (!test_peer_init(client))
-	{
-		freerdp_peer_free(client);
-		return NULL;
-	}
+		return FALSE;
 
 	/* Initialize the real server settings here */
 	client->settings->CertificateFile = _strdup("server.crt");
@@ -770,8 +775,8 @@ static void* test_peer_mainloop(void* arg)
 	    || !client->settings->RdpKeyFile)
 	{
 		WLog_ERR(TAG, "Memory allocation failed (strdup)");
-		freerdp_peer_free(client);
-		return NULL;
+		freerdp_peer_context_free(client);
+		return FALSE;
 	}
 
 	client->settings->RdpSecurity = TRUE;
@@ -800,53 +805,13 @@ static void* test_peer_mainloop(void* arg)
 	WLog_INFO(TAG, "We've got a client %s",
 	          client->local ? "(local)" : client->hostname);
 
-	while (1)
+	/* The peer is served by the reactor threads from now on, no thread of its own is needed. */
+	if (!freerdp_peer_reactor_add(client, test_reactor, context->vcm, test_peer_closed))
 	{
-		count = 0;
-		{
-			DWORD tmp = client->GetEventHandles(client, &handles[count], 32 - count);
-
-			if (tmp == 0)
-			{
-				WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
-				break;
-			}
-
-			count += tmp;
-		}
-		handles[count++] = WTSVirtualChannelManagerGetEventHandle(context->vcm);
-		status = WaitForMultipleObjects(count, handles, FALSE, INFINITE);
-
-		if (status == WAIT_FAILED)
-		{
-			WLog_ERR(TAG, "WaitForMultipleObjects failed (errno: %d)", errno);
-			break;
-		}
-
-		if (client->CheckFileDescriptor(client) != TRUE)
-			break;
-
-		if (WTSVirtualChannelManagerCheckFileDescriptor(context->vcm) != TRUE)
-			break;
-	}
-
-	WLog_INFO(TAG, "Client %s disconnected.",
-	          client->local ? "(local)" : client->hostname);
-	client->Disconnect(client);
-	freerdp_peer_context_free(client);
-	freerdp_peer_free(client);
-	return NULL;
-}
-
-static BOOL test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
-{
-	HANDLE hThread;
-
-	if (!(hThread = CreateThread(NULL, 0,
-	                             (LPTHREAD_START_ROUTINE) test_peer_mainloop, (void*) client, 0, NULL)))
+		freerdp_peer_context_free(client);
 		return FALSE;
+	}
 
-	CloseHandle(hThread);
 	return TRUE;
 }
 
@@ -918,16 +883,25 @@ int main(int argc, char* argv[])
 	}
 
 	WTSRegisterWtsApiFunctionTable(FreeRDP_InitWtsApi());
+	test_reactor = freerdp_reactor_new(0);
+
+	if (!test_reactor)
+		return -1;
+
 	instance = freerdp_listener_new();
 
 	if (!instance)
+	{
+		freerdp_reactor_free(test_reactor);
 		return -1;
+	}
 
 	instance->PeerAccepted = test_peer_accepted;
 
 	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
 	{
 		freerdp_listener_free(instance);
+		freerdp_reactor_free(test_reactor);
 		return -1;
 	}
 
@@ -938,6 +912,7 @@ int main(int argc, char* argv[])
 	if (!file)
 	{
 		freerdp_listener_free(instance);
+		freerdp_reactor_free(test_reactor);
 		WSACleanup();
 		return -1;
 	}
@@ -951,6 +926,7 @@ int main(int argc, char* argv[])
 
 	free(file);
 	freerdp_listener_free(instance);
+	freerdp_reactor_free(test_reactor);
 	WSACleanup();
 	return 0;
 }
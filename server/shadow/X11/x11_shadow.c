@@ -535,6 +535,19 @@ static int x11_shadow_handle_xevent(x11ShadowSubsystem* subsystem,
 		x11_shadow_query_cursor(subsystem, TRUE);
 	}
 
+#endif
+#ifdef WITH_XDAMAGE
+	else if (subsystem->use_xdamage && (xevent->type == subsystem->xdamage_notify_event))
+	{
+		RECTANGLE_16 rect;
+		XDamageNotifyEvent* notify = (XDamageNotifyEvent*) xevent;
+		rect.left = notify->area.x;
+		rect.top = notify->area.y;
+		rect.right = notify->area.x + notify->area.width;
+		rect.bottom = notify->area.y + notify->area.height;
+		region16_union_rect(&(subsystem->damageRegion), &(subsystem->damageRegion), &rect);
+	}
+
 #endif
 	else
 	{
@@ -543,25 +556,67 @@ static int x11_shadow_handle_xevent(x11ShadowSubsystem* subsystem,
 	return 1;
 }
 
-static void x11_shadow_validate_region(x11ShadowSubsystem* subsystem, int x,
-                                       int y,
-                                       int width, int height)
+static void x11_shadow_invalidate_screen(x11ShadowSubsystem* subsystem)
 {
-	XRectangle region;
-
-	if (!subsystem->use_xfixes || !subsystem->use_xdamage)
-		return;
+	RECTANGLE_16 screenRect;
+	screenRect.left = 0;
+	screenRect.top = 0;
+	screenRect.right = subsystem->width;
+	screenRect.bottom = subsystem->height;
+	region16_clear(&(subsystem->damageRegion));
+	region16_union_rect(&(subsystem->damageRegion), &(subsystem->damageRegion), &screenRect);
+}
 
-	region.x = x;
-	region.y = y;
-	region.width = width;
-	region.height = height;
-#ifdef WITH_XFIXES
+/**
+ * Moves the damage reported so far into region, in surface coordinates.
+ * Pending events are processed first and the damage object is emptied so
+ * that the server reports any later drawing again, even to areas that are
+ * about to be grabbed.
+ */
+static BOOL x11_shadow_take_damage(x11ShadowSubsystem* subsystem,
+                                   rdpShadowSurface* surface, REGION16* region)
+{
+#ifdef WITH_XDAMAGE
+	UINT32 index;
+	UINT32 numRects;
+	XEvent xevent;
+	RECTANGLE_16 rect;
+	const RECTANGLE_16* rects;
 	XLockDisplay(subsystem->display);
-	XFixesSetRegion(subsystem->display, subsystem->xdamage_region, &region, 1);
-	XDamageSubtract(subsystem->display, subsystem->xdamage,
-	                subsystem->xdamage_region, None);
+
+	while (XPending(subsystem->display) > 0)
+	{
+		XNextEvent(subsystem->display, &xevent);
+		x11_shadow_handle_xevent(subsystem, &xevent);
+	}
+
+	XDamageSubtract(subsystem->display, subsystem->xdamage, None, None);
 	XUnlockDisplay(subsystem->display);
+	rects = region16_rects(&(subsystem->damageRegion), &numRects);
+
+	for (index = 0; index < numRects; index++)
+	{
+		INT32 left = MAX(rects[index].left - surface->x, 0);
+		INT32 top = MAX(rects[index].top - surface->y, 0);
+		INT32 right = MIN(rects[index].right - surface->x, surface->width);
+		INT32 bottom = MIN(rects[index].bottom - surface->y, surface->height);
+
+		if ((left >= right) || (top >= bottom))
+			continue;
+
+		rect.left = (UINT16) left;
+		rect.top = (UINT16) top;
+		rect.right = (UINT16) right;
+		rect.bottom = (UINT16) bottom;
+
+		if (!region16_union_rect(region, region, &rect))
+			return FALSE;
+	}
+
+	region16_clear(&(subsystem->damageRegion));
+	return TRUE;
+#else
+	return FALSE;
 #endif
 }
 
@@ -694,6 +749,7 @@ static BOOL x11_shadow_check_resize(x11ShadowSubsystem* subsystem)
 		virtualScreen->right = subsystem->width;
 		virtualScreen->bottom = subsystem->height;
 		virtualScreen->flags = 1;
+		x11_shadow_invalidate_screen(subsystem);
 		return TRUE;
 	}
 
@@ -717,31 +773,216 @@ static int x11_shadow_error_handler_for_capture(Display* display,
 	return 0;
 }
 
+/* smallest changed area searched for scrolled content */
+#define X11_SHADOW_MOVE_MIN_SIZE	64
+
+/**
+ * Adds rect to the region without the part covered by hole, which is
+ * updated on the clients by a move instead.
+ */
+static BOOL x11_shadow_invalidate_outside(REGION16* region, const RECTANGLE_16* rect,
+        const RECTANGLE_16* hole)
+{
+	RECTANGLE_16 part;
+
+	if (!rectangles_intersects(rect, hole))
+		return region16_union_rect(region, region, rect);
+
+	part = *rect;
+
+	if (rect->top < hole->top)
+	{
+		part.bottom = hole->top;
+
+		if (!region16_union_rect(region, region, &part))
+			return FALSE;
+	}
+
+	if (hole->bottom < rect->bottom)
+	{
+		part.top = hole->bottom;
+		part.bottom = rect->bottom;
+
+		if (!region16_union_rect(region, region, &part))
+			return FALSE;
+	}
+
+	part.top = MAX(rect->top, hole->top);
+	part.bottom = MIN(rect->bottom, hole->bottom);
+
+	if (rect->left < hole->left)
+	{
+		part.left = rect->left;
+		part.right = hole->left;
+
+		if (!region16_union_rect(region, region, &part))
+			return FALSE;
+	}
+
+	if (hole->right < rect->right)
+	{
+		part.left = hole->right;
+		part.right = rect->right;
+
+		if (!region16_union_rect(region, region, &part))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Looks for content that moved within the changed part of a grabbed area,
+ * the surface still has to hold the previous frame.
+ */
+static void x11_shadow_detect_move(rdpShadowSurface* surface, const RECTANGLE_16* rect,
+                                   BYTE* pSrcData, int nSrcStep, REGION16* changed)
+{
+	int left, top;
+	SHADOW_SURFACE_MOVE move;
+	const RECTANGLE_16* extents = region16_extents(changed);
+
+	if (((extents->right - extents->left) < X11_SHADOW_MOVE_MIN_SIZE) ||
+	    ((extents->bottom - extents->top) < X11_SHADOW_MOVE_MIN_SIZE))
+		return;
+
+	left = rect->left + extents->left;
+	top = rect->top + extents->top;
+
+	if (!shadow_capture_detect_move(&surface->data[(top * surface->scanline) + (left * 4)],
+	                                surface->scanline, extents->right - extents->left,
+	                                extents->bottom - extents->top,
+	                                &pSrcData[(extents->top * nSrcStep) + (extents->left * 4)],
+	                                nSrcStep, &move))
+		return;
+
+	move.rect.left += left;
+	move.rect.top += top;
+	move.rect.right += left;
+	move.rect.bottom += top;
+	surface->move = move;
+	surface->moved = TRUE;
+}
+
+/**
+ * Compares one grabbed area with the surface and copies the tiles that
+ * really changed, pSrcData points at the top left pixel of rect.
+ */
+static BOOL x11_shadow_grab_rect(rdpShadowSurface* surface, const RECTANGLE_16* rect,
+                                 BYTE* pSrcData, int nSrcStep)
+{
+	BOOL rc = FALSE;
+	UINT32 index;
+	UINT32 numRects;
+	REGION16 changed;
+	RECTANGLE_16 invalidRect;
+	const RECTANGLE_16* rects;
+	region16_init(&changed);
+
+	if (shadow_capture_compare_region(
+	        &surface->data[(rect->top * surface->scanline) + (rect->left * 4)],
+	        surface->scanline, rect->right - rect->left, rect->bottom - rect->top,
+	        pSrcData, nSrcStep, &changed) < 0)
+		goto fail;
+
+	rects = region16_rects(&changed, &numRects);
+
+	/* one move per frame, damage rectangles do not overlap */
+	if ((numRects > 0) && !surface->moved)
+		x11_shadow_detect_move(surface, rect, pSrcData, nSrcStep, &changed);
+
+	for (index = 0; index < numRects; index++)
+	{
+		invalidRect.left = rect->left + rects[index].left;
+		invalidRect.top = rect->top + rects[index].top;
+		invalidRect.right = rect->left + rects[index].right;
+		invalidRect.bottom = rect->top + rects[index].bottom;
+
+		if (!freerdp_image_copy(surface->data, surface->format, surface->scanline,
+		                        invalidRect.left, invalidRect.top,
+		                        invalidRect.right - invalidRect.left,
+		                        invalidRect.bottom - invalidRect.top,
+		                        pSrcData, PIXEL_FORMAT_BGRX32, nSrcStep,
+		                        rects[index].left, rects[index].top, NULL, FREERDP_FLIP_NONE))
+			goto fail;
+
+		if (surface->moved)
+		{
+			if (!x11_shadow_invalidate_outside(&(surface->invalidRegion), &invalidRect,
+			                                   &(surface->move.rect)))
+				goto fail;
+		}
+		else if (!region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+		                              &invalidRect))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	region16_uninit(&changed);
+	return rc;
+}
+
 static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 {
+	int fps;
 	int count;
-	int status;
-	int x, y;
-	int width, height;
+	int status = 1;
+	int bytesPerLine;
 	XImage* image;
-	rdpShadowScreen* screen;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
+	UINT32 index;
+	UINT32 numRects;
+	REGION16 grabRegion;
+	const RECTANGLE_16* rects;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
 	server = subsystem->server;
 	surface = server->surface;
-	screen = server->screen;
 	count = ArrayList_Count(server->clients);
 
 	if (count < 1)
+	{
+		/* the surface is not kept up to date without viewers */
+		x11_shadow_invalidate_screen(subsystem);
 		return 1;
+	}
 
 	surfaceRect.left = 0;
 	surfaceRect.top = 0;
 	surfaceRect.right = surface->width;
 	surfaceRect.bottom = surface->height;
+	region16_init(&grabRegion);
+
+	if (subsystem->use_xdamage)
+	{
+		if (!x11_shadow_take_damage(subsystem, surface, &grabRegion))
+		{
+			status = -1;
+			goto out;
+		}
+
+		/* nothing was drawn since the last grab */
+		if (region16_is_empty(&grabRegion))
+			goto out;
+	}
+	else
+	{
+		region16_union_rect(&grabRegion, &grabRegion, &surfaceRect);
+	}
+
+	if (subsystem->use_xshm)
+	{
+		/* the shared pixmap keeps the size the screen had at startup */
+		RECTANGLE_16 fbRect;
+		fbRect.left = 0;
+		fbRect.top = 0;
+		fbRect.right = (UINT16) MAX(subsystem->fb_image->width - surface->x, 0);
+		fbRect.bottom = (UINT16) MAX(subsystem->fb_image->height - surface->y, 0);
+		region16_intersect_rect(&grabRegion, &grabRegion, &fbRect);
+	}
+
+	rects = region16_rects(&grabRegion, &numRects);
 	XLockDisplay(subsystem->display);
 	/*
 	 * Ignore BadMatch error during image capture. The screen size may be
@@ -752,79 +993,103 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	if (subsystem->use_xshm)
 	{
 		image = subsystem->fb_image;
-		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
-		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) & (image->data[surface->width * 4]), image->bytes_per_line,
-		                                &invalidRect);
+		bytesPerLine = image->bytes_per_line;
+
+		for (index = 0; index < numRects; index++)
+		{
+			XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
+			          subsystem->xshm_gc, surface->x + rects[index].left,
+			          surface->y + rects[index].top,
+			          rects[index].right - rects[index].left,
+			          rects[index].bottom - rects[index].top,
+			          surface->x + rects[index].left, surface->y + rects[index].top);
+		}
+
+		XSync(subsystem->display, False);
+
+		for (index = 0; index < numRects; index++)
+		{
+			BYTE* pSrcData = (BYTE*) &image->data[((surface->y + rects[index].top) * bytesPerLine) +
+			                                      ((surface->x + rects[index].left) * 4)];
+
+			if (!x11_shadow_grab_rect(surface, &rects[index], pSrcData, bytesPerLine))
+			{
+				status = -1;
+				break;
+			}
+		}
 	}
 	else
 	{
-		image = XGetImage(subsystem->display, subsystem->root_window,
-		                  surface->x, surface->y, surface->width, surface->height, AllPlanes, ZPixmap);
-
-		if (!image)
+		for (index = 0; index < numRects; index++)
 		{
-			/*
-			 * BadMatch error happened. The size may have been changed again.
-			 * Give up this frame and we will resize again in next frame
-			 */
-			goto fail_capture;
-		}
+			image = XGetImage(subsystem->display, subsystem->root_window,
+			                  surface->x + rects[index].left, surface->y + rects[index].top,
+			                  rects[index].right - rects[index].left,
+			                  rects[index].bottom - rects[index].top, AllPlanes, ZPixmap);
+
+			if (!image)
+			{
+				/*
+				 * BadMatch error happened. The size may have been changed again.
+				 * Give up this frame and we will resize again in next frame
+				 */
+				status = 0;
+				break;
+			}
+
+			if (!x11_shadow_grab_rect(surface, &rects[index], (BYTE*) image->data,
+			                          image->bytes_per_line))
+				status = -1;
+
+			XDestroyImage(image);
 
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) image->data, image->bytes_per_line, &invalidRect);
+			if (status != 1)
+				break;
+		}
 	}
 
 	/* Restore the default error handler */
 	XSetErrorHandler(NULL);
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-	                    &invalidRect);
+
+	/* the damage is consumed, grab everything again next time */
+	if (status != 1)
+		x11_shadow_invalidate_screen(subsystem);
+
 	region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion),
 	                        &surfaceRect);
 
-	if (!region16_is_empty(&(surface->invalidRegion)))
-	{
-		extents = region16_extents(&(surface->invalidRegion));
-		x = extents->left;
-		y = extents->top;
-		width = extents->right - extents->left;
-		height = extents->bottom - extents->top;
-		freerdp_image_copy(surface->data, surface->format,
-		                   surface->scanline, x, y, width, height,
-		                   (BYTE*) image->data, PIXEL_FORMAT_BGRX32,
-		                   image->bytes_per_line, x, y, NULL, FREERDP_FLIP_NONE);
+	if (!region16_is_empty(&(surface->invalidRegion)) || surface->moved)
+	{
 		//x11_shadow_blend_cursor(subsystem);
-		count = ArrayList_Count(server->clients);
 		shadow_subsystem_frame_update((rdpShadowSubsystem*)subsystem);
+		/* each client paces itself, capture as fast as the fastest one takes frames */
+		ArrayList_Lock(server->clients);
+		count = ArrayList_Count(server->clients);
 
-		if (count == 1)
+		for (index = 0, fps = 0; (int) index < count; index++)
 		{
 			rdpShadowClient* client;
-			client = (rdpShadowClient*) ArrayList_GetItem(server->clients, 0);
+			client = (rdpShadowClient*) ArrayList_GetItem(server->clients, index);
 
 			if (client)
-			{
-				subsystem->captureFrameRate = shadow_encoder_preferred_fps(client->encoder);
-			}
+				fps = MAX(fps, shadow_encoder_preferred_fps(client->encoder));
 		}
 
+		ArrayList_Unlock(server->clients);
+
+		if (fps > 0)
+			subsystem->captureFrameRate = fps;
+
 		region16_clear(&(surface->invalidRegion));
+		surface->moved = FALSE;
 	}
 
-	if (!subsystem->use_xshm)
-		XDestroyImage(image);
-
-	return 1;
-fail_capture:
-	XSetErrorHandler(NULL);
-	XSync(subsystem->display, False);
-	XUnlockDisplay(subsystem->display);
-	return 0;
+out:
+	region16_uninit(&grabRegion);
+	return status;
 }
 
 static int x11_shadow_subsystem_process_message(x11ShadowSubsystem* subsystem,
@@ -974,7 +1239,7 @@ static int x11_shadow_xinerama_init(x11ShadowSubsystem* subsystem)
 	                            &xinerama_error))
 		return -1;
 
-	if (!XDamageQueryVersion(subsystem->display, &major, &minor))
+	if (!XineramaQueryVersion(subsystem->display, &major, &minor))
 		return -1;
 
 	if (!XineramaIsActive(subsystem->display))
@@ -1012,13 +1277,8 @@ static int x11_shadow_xdamage_init(x11ShadowSubsystem* subsystem)
 	if (!subsystem->xdamage)
 		return -1;
 
-#ifdef WITH_XFIXES
-	subsystem->xdamage_region = XFixesCreateRegion(subsystem->display, NULL, 0);
-
-	if (!subsystem->xdamage_region)
-		return -1;
-
-#endif
+	/* the first grab takes the whole screen */
+	x11_shadow_invalidate_screen(subsystem);
 	return 1;
 #else
 	return -1;
@@ -1203,9 +1463,6 @@ static int x11_shadow_subsystem_init(x11ShadowSubsystem* subsystem)
 
 	XFreeExtensionList(extensions);
 
-	if (subsystem->composite)
-		subsystem->use_xdamage = FALSE;
-
 	pfs = XListPixmapFormats(subsystem->display, &pf_count);
 
 	if (!pfs)
@@ -1310,6 +1567,41 @@ static int x11_shadow_subsystem_uninit(x11ShadowSubsystem* subsystem)
 
 	if (subsystem->display)
 	{
+#ifdef WITH_XDAMAGE
+		if (subsystem->xdamage)
+		{
+			XDamageDestroy(subsystem->display, subsystem->xdamage);
+			subsystem->xdamage = 0;
+		}
+
+#endif
+
+		if (subsystem->xshm_gc)
+		{
+			XFreeGC(subsystem->display, subsystem->xshm_gc);
+			subsystem->xshm_gc = NULL;
+		}
+
+		if (subsystem->fb_pixmap)
+		{
+			XFreePixmap(subsystem->display, subsystem->fb_pixmap);
+			subsystem->fb_pixmap = 0;
+		}
+
+		if (subsystem->fb_image)
+		{
+			if (subsystem->fb_shm_info.shmaddr != ((char*) - 1))
+			{
+				XShmDetach(subsystem->display, &(subsystem->fb_shm_info));
+				shmdt(subsystem->fb_shm_info.shmaddr);
+			}
+
+			/* the image data is the shared memory segment */
+			subsystem->fb_image->data = NULL;
+			XDestroyImage(subsystem->fb_image);
+			subsystem->fb_image = NULL;
+		}
+
 		XCloseDisplay(subsystem->display);
 		subsystem->display = NULL;
 	}
@@ -1383,10 +1675,11 @@ static x11ShadowSubsystem* x11_shadow_subsystem_new(void)
 	subsystem->ExtendedMouseEvent = (pfnShadowExtendedMouseEvent)
 	x11_shadow_input_extended_mouse_event;
 	subsystem->composite = FALSE;
-	subsystem->use_xshm = FALSE; /* temporarily disabled */
+	subsystem->use_xshm = TRUE;
 	subsystem->use_xfixes = TRUE;
-	subsystem->use_xdamage = FALSE;
+	subsystem->use_xdamage = TRUE;
 	subsystem->use_xinerama = TRUE;
+	region16_init(&(subsystem->damageRegion));
 	return subsystem;
 }
 
@@ -1396,6 +1689,7 @@ static void x11_shadow_subsystem_free(x11ShadowSubsystem* subsystem)
 		return;
 
 	x11_shadow_subsystem_uninit(subsystem);
+	region16_uninit(&(subsystem->damageRegion));
 	free(subsystem);
 }
 
@@ -31,6 +31,8 @@ typedef struct x11_shadow_subsystem x11ShadowSubsystem;
 
 #include <X11/Xlib.h>
 
+#include <freerdp/codec/region.h>
+
 #ifdef WITH_XSHM
 #include <X11/extensions/XShm.h>
 #endif
@@ -79,6 +81,10 @@ struct x11_shadow_subsystem
 	Pixmap fb_pixmap;
 	Window root_window;
 	XShmSegmentInfo fb_shm_info;
+	GC xshm_gc;
+
+	/* root window area drawn to since the last grab */
+	REGION16 damageRegion;
 
 	int cursorHotX;
 	int cursorHotY;
@@ -91,10 +97,8 @@ struct x11_shadow_subsystem
 	rdpShadowClient* lastMouseClient;
 
 #ifdef WITH_XDAMAGE
-	GC xshm_gc;
 	Damage xdamage;
 	int xdamage_notify_event;
-	XserverRegion xdamage_region;
 #endif
 
 #ifdef WITH_XFIXES
@@ -25,8 +25,11 @@
 #include "shadow_input.h"
 #include "shadow_screen.h"
 #include "shadow_surface.h"
+#include "shadow_rate.h"
 #include "shadow_encoder.h"
 #include "shadow_capture.h"
+#include "shadow_share.h"
+#include "shadow_cache.h"
 #include "shadow_channels.h"
 #include "shadow_subsystem.h"
 #include "shadow_lobby.h"
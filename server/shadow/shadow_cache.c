@@ -0,0 +1,149 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+
+#include <freerdp/log.h>
+
+#include "shadow.h"
+
+#include "shadow_cache.h"
+
+#define TAG SERVER_TAG("shadow.cache")
+
+/* cache sizes clients have to support, [MS-RDPEGFX] 2.2.3.1 */
+#define SHADOW_CACHE_MAX_SIZE	(100 * 1024 * 1024)
+#define SHADOW_CACHE_SMALL_MAX_SIZE	(16 * 1024 * 1024)
+
+#define SHADOW_CACHE_PRIME1	0x9E3779B185EBCA87ULL
+#define SHADOW_CACHE_PRIME2	0xC2B2AE3D27D4EB4FULL
+
+static INLINE UINT64 shadow_cache_mix(UINT64 hash, UINT64 value)
+{
+	hash ^= value * SHADOW_CACHE_PRIME2;
+	hash = (hash << 31) | (hash >> 33);
+	return hash * SHADOW_CACHE_PRIME1;
+}
+
+/**
+ * Returns the cache key of a block of 32bpp pixels. The key only depends
+ * on the content, so it stays valid across connections and can match the
+ * keys a client offers from its persistent cache. 0 is never returned.
+ */
+UINT64 shadow_cache_key(const BYTE* pData, int nStep, int nWidth, int nHeight)
+{
+	int x, y;
+	UINT32 v32;
+	UINT64 v64;
+	const BYTE* pLine;
+	UINT64 hash = shadow_cache_mix(SHADOW_CACHE_PRIME1,
+	                               ((UINT64) nWidth << 32) | (UINT32) nHeight);
+
+	for (y = 0; y < nHeight; y++)
+	{
+		pLine = &pData[y * nStep];
+
+		for (x = 0; (x + 2) <= nWidth; x += 2)
+		{
+			CopyMemory(&v64, &pLine[x * 4], 8);
+			hash = shadow_cache_mix(hash, v64);
+		}
+
+		if (x < nWidth)
+		{
+			CopyMemory(&v32, &pLine[x * 4], 4);
+			hash = shadow_cache_mix(hash, v32);
+		}
+	}
+
+	hash ^= hash >> 33;
+	hash *= SHADOW_CACHE_PRIME2;
+	hash ^= hash >> 29;
+	return hash ? hash : 1;
+}
+
+/**
+ * Picks the slot for a new tile, slots drawn from since they were last
+ * passed get a second chance. Tiles that were never drawn from, including
+ * the entries imported from the persistent cache of the client, are given
+ * up first.
+ */
+UINT16 shadow_cache_get_slot(rdpShadowCache* cache)
+{
+	UINT16 cacheSlot;
+
+	while (cache->referenced[cache->hand])
+	{
+		cache->referenced[cache->hand] = 0;
+		cache->hand = (cache->hand + 1 < cache->numSlots) ? cache->hand + 1 : 1;
+	}
+
+	cacheSlot = cache->hand;
+	cache->hand = (cache->hand + 1 < cache->numSlots) ? cache->hand + 1 : 1;
+	return cacheSlot;
+}
+
+void shadow_cache_touch_slot(rdpShadowCache* cache, UINT16 cacheSlot)
+{
+	if (cacheSlot < cache->numSlots)
+		cache->referenced[cacheSlot] = 1;
+}
+
+/**
+ * maxSlots is the slot count of the client, slot 0 is not used. The cache
+ * is further limited to as many tiles as the client has to keep in memory.
+ */
+rdpShadowCache* shadow_cache_new(UINT16 maxSlots, BOOL smallCache)
+{
+	UINT32 numSlots;
+	rdpShadowCache* cache;
+	numSlots = (smallCache ? SHADOW_CACHE_SMALL_MAX_SIZE : SHADOW_CACHE_MAX_SIZE) /
+	           (SHADOW_CACHE_TILE_SIZE * SHADOW_CACHE_TILE_SIZE * 4);
+	numSlots = MIN(numSlots, maxSlots);
+
+	if (numSlots < 2)
+		return NULL;
+
+	cache = (rdpShadowCache*) calloc(1, sizeof(rdpShadowCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->numSlots = (UINT16) numSlots;
+	cache->hand = 1;
+
+	if (!(cache->referenced = (BYTE*) calloc(numSlots, sizeof(BYTE))))
+	{
+		free(cache);
+		return NULL;
+	}
+
+	WLog_DBG(TAG, "%lu cache slots", (unsigned long) numSlots);
+	return cache;
+}
+
+void shadow_cache_free(rdpShadowCache* cache)
+{
+	if (!cache)
+		return;
+
+	free(cache->referenced);
+	free(cache);
+}
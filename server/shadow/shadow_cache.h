@@ -0,0 +1,57 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_CACHE_H
+#define FREERDP_SHADOW_SERVER_CACHE_H
+
+#include <freerdp/server/shadow.h>
+
+#include <winpr/crt.h>
+
+/* the surface is cached in tiles of this size, aligned to the surface */
+#define SHADOW_CACHE_TILE_SIZE	64
+
+typedef struct rdp_shadow_cache rdpShadowCache;
+
+/**
+ * Slots of the graphics pipeline bitmap cache of one client. The keys the
+ * client holds are tracked by the rdpgfx server, this only decides which
+ * slot is given up for a new tile.
+ */
+struct rdp_shadow_cache
+{
+	UINT16 numSlots;
+	UINT16 hand;
+	BYTE* referenced;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+UINT64 shadow_cache_key(const BYTE* pData, int nStep, int nWidth, int nHeight);
+
+UINT16 shadow_cache_get_slot(rdpShadowCache* cache);
+void shadow_cache_touch_slot(rdpShadowCache* cache, UINT16 cacheSlot);
+
+rdpShadowCache* shadow_cache_new(UINT16 maxSlots, BOOL smallCache);
+void shadow_cache_free(rdpShadowCache* cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_CACHE_H */
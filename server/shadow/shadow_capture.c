@@ -22,6 +22,14 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
+#include <winpr/pool.h>
+
+#if defined(WITH_SSE2)
+#include <emmintrin.h>
+#elif defined(WITH_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <freerdp/log.h>
 
@@ -80,142 +88,595 @@ int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 	return 1;
 }
 
-int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BYTE* pData2, int nStep2, RECTANGLE_16* rect)
+/**
+ * Frames are compared in tiles of 16x16 pixels. The dirty tiles are turned
+ * into a region, runs of dirty tiles in a tile row become one rectangle and
+ * tile rows with the same runs are merged into one band. Tall frames are
+ * split into stripes of tile rows compared on the thread pool.
+ */
+
+#define SHADOW_CAPTURE_TILE_SIZE	16
+#define SHADOW_CAPTURE_STRIPE_ROWS	16
+#define SHADOW_CAPTURE_MAX_STRIPES	16
+
+typedef struct
 {
-	BOOL equal;
-	BOOL allEqual;
-	int tw, th;
-	int tx, ty, k;
-	int nrow, ncol;
-	int l, t, r, b;
-	BYTE *p1, *p2;
-	BOOL rows[1024];
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	BOOL cols[1024];
-#endif
+	const BYTE* pData1;
+	int nStep1;
+	const BYTE* pData2;
+	int nStep2;
+	int nWidth;
+	int nHeight;
+	int ncol;
+	int firstRow;
+	int lastRow;
+	BYTE* tiles;
+	BOOL changed;
+} SHADOW_CAPTURE_STRIPE;
+
+static INLINE BOOL shadow_capture_tile_row_equal(const BYTE* p1, const BYTE* p2)
+{
+#if defined(WITH_SSE2)
+	__m128i c0 = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) p1),
+	                             _mm_loadu_si128((const __m128i*) p2));
+	__m128i c1 = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) &p1[16]),
+	                             _mm_loadu_si128((const __m128i*) &p2[16]));
+	__m128i c2 = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) &p1[32]),
+	                             _mm_loadu_si128((const __m128i*) &p2[32]));
+	__m128i c3 = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) &p1[48]),
+	                             _mm_loadu_si128((const __m128i*) &p2[48]));
+	c0 = _mm_and_si128(_mm_and_si128(c0, c1), _mm_and_si128(c2, c3));
+	return (_mm_movemask_epi8(c0) == 0xFFFF) ? TRUE : FALSE;
+#elif defined(WITH_NEON)
+	uint32x4_t d0 = veorq_u32(vld1q_u32((const uint32_t*) p1), vld1q_u32((const uint32_t*) p2));
+	uint32x4_t d1 = veorq_u32(vld1q_u32((const uint32_t*) &p1[16]),
+	                          vld1q_u32((const uint32_t*) &p2[16]));
+	uint32x4_t d2 = veorq_u32(vld1q_u32((const uint32_t*) &p1[32]),
+	                          vld1q_u32((const uint32_t*) &p2[32]));
+	uint32x4_t d3 = veorq_u32(vld1q_u32((const uint32_t*) &p1[48]),
+	                          vld1q_u32((const uint32_t*) &p2[48]));
+	uint64x2_t d = vreinterpretq_u64_u32(vorrq_u32(vorrq_u32(d0, d1), vorrq_u32(d2, d3)));
+	return ((vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1)) == 0) ? TRUE : FALSE;
+#else
+	int k;
+	UINT64 v1, v2;
+	UINT64 diff = 0;
+
+	for (k = 0; k < 64; k += 8)
+	{
+		CopyMemory(&v1, &p1[k], 8);
+		CopyMemory(&v2, &p2[k], 8);
+		diff |= v1 ^ v2;
+	}
 
-	allEqual = TRUE;
-	ZeroMemory(rect, sizeof(RECTANGLE_16));
-	FillMemory(rows, sizeof(rows), 0xFF);
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	FillMemory(cols, sizeof(cols), 0xFF);
+	return (diff == 0) ? TRUE : FALSE;
 #endif
+}
+
+static BOOL shadow_capture_tile_equal(const BYTE* p1, int nStep1, const BYTE* p2, int nStep2,
+                                      int tw, int th)
+{
+	int k;
 
-	nrow = (nHeight + 15) / 16;
-	ncol = (nWidth + 15) / 16;
+	if (tw == SHADOW_CAPTURE_TILE_SIZE)
+	{
+		for (k = 0; k < th; k++)
+		{
+			if (!shadow_capture_tile_row_equal(p1, p2))
+				return FALSE;
 
-	l = ncol + 1;
-	r = -1;
+			p1 += nStep1;
+			p2 += nStep2;
+		}
 
-	t = nrow + 1;
-	b = -1;
+		return TRUE;
+	}
 
-	for (ty = 0; ty < nrow; ty++)
+	for (k = 0; k < th; k++)
 	{
-		th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
+		if (memcmp(p1, p2, tw * 4) != 0)
+			return FALSE;
 
-		if (!th)
-			th = 16;
+		p1 += nStep1;
+		p2 += nStep2;
+	}
+
+	return TRUE;
+}
+
+static void shadow_capture_compare_stripe(SHADOW_CAPTURE_STRIPE* stripe)
+{
+	int tx, ty;
+	int tw, th;
+	BYTE* tiles;
+	const BYTE* p1;
+	const BYTE* p2;
+
+	for (ty = stripe->firstRow; ty < stripe->lastRow; ty++)
+	{
+		th = stripe->nHeight - (ty * SHADOW_CAPTURE_TILE_SIZE);
+
+		if (th > SHADOW_CAPTURE_TILE_SIZE)
+			th = SHADOW_CAPTURE_TILE_SIZE;
+
+		tiles = &stripe->tiles[ty * stripe->ncol];
+		p1 = &stripe->pData1[ty * SHADOW_CAPTURE_TILE_SIZE * stripe->nStep1];
+		p2 = &stripe->pData2[ty * SHADOW_CAPTURE_TILE_SIZE * stripe->nStep2];
+
+		for (tx = 0; tx < stripe->ncol; tx++)
+		{
+			tw = stripe->nWidth - (tx * SHADOW_CAPTURE_TILE_SIZE);
+
+			if (tw > SHADOW_CAPTURE_TILE_SIZE)
+				tw = SHADOW_CAPTURE_TILE_SIZE;
+
+			tiles[tx] = shadow_capture_tile_equal(&p1[tx * SHADOW_CAPTURE_TILE_SIZE * 4], stripe->nStep1,
+			                                      &p2[tx * SHADOW_CAPTURE_TILE_SIZE * 4], stripe->nStep2,
+			                                      tw, th) ? 0 : 1;
+
+			if (tiles[tx])
+				stripe->changed = TRUE;
+		}
+	}
+}
+
+static void CALLBACK shadow_capture_compare_work_callback(PTP_CALLBACK_INSTANCE instance,
+        void* context, PTP_WORK work)
+{
+	shadow_capture_compare_stripe((SHADOW_CAPTURE_STRIPE*) context);
+}
+
+static int shadow_capture_get_stripe_count(int nrow)
+{
+	SYSTEM_INFO sysinfo;
+	int count = nrow / SHADOW_CAPTURE_STRIPE_ROWS;
+	GetNativeSystemInfo(&sysinfo);
+
+	if (count > (int) sysinfo.dwNumberOfProcessors)
+		count = (int) sysinfo.dwNumberOfProcessors;
+
+	if (count > SHADOW_CAPTURE_MAX_STRIPES)
+		count = SHADOW_CAPTURE_MAX_STRIPES;
+
+	return (count < 1) ? 1 : count;
+}
+
+static BOOL shadow_capture_tiles_to_region(const BYTE* tiles, int ncol, int nrow,
+        int nWidth, int nHeight, REGION16* region)
+{
+	int tx, ty;
+	int band;
+	int start;
+	RECTANGLE_16 rect;
+
+	for (band = 0; band < nrow; band = ty)
+	{
+		/* rows with the same dirty tiles share one band */
+		for (ty = band + 1; ty < nrow; ty++)
+		{
+			if (memcmp(&tiles[band * ncol], &tiles[ty * ncol], ncol) != 0)
+				break;
+		}
+
+		rect.top = band * SHADOW_CAPTURE_TILE_SIZE;
+		rect.bottom = MIN(ty * SHADOW_CAPTURE_TILE_SIZE, nHeight);
 
 		for (tx = 0; tx < ncol; tx++)
 		{
-			equal = TRUE;
+			if (!tiles[band * ncol + tx])
+				continue;
+
+			start = tx;
+
+			while ((tx < ncol) && tiles[band * ncol + tx])
+				tx++;
+
+			rect.left = start * SHADOW_CAPTURE_TILE_SIZE;
+			rect.right = MIN(tx * SHADOW_CAPTURE_TILE_SIZE, nWidth);
+
+			if (!region16_union_rect(region, region, &rect))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Compares two frames and sets region to the tiles that differ.
+ *
+ * @return 1 if the frames differ, 0 if they are equal, -1 on failure
+ */
+int shadow_capture_compare_region(BYTE* pData1, int nStep1, int nWidth, int nHeight,
+                                  BYTE* pData2, int nStep2, REGION16* region)
+{
+	int index;
+	int count;
+	int status = -1;
+	int nrow, ncol;
+	BYTE* tiles;
+	BOOL changed = FALSE;
+	PTP_WORK work[SHADOW_CAPTURE_MAX_STRIPES] = { 0 };
+	SHADOW_CAPTURE_STRIPE stripes[SHADOW_CAPTURE_MAX_STRIPES];
+
+	if (!pData1 || !pData2 || !region || (nWidth < 0) || (nHeight < 0))
+		return -1;
+
+	region16_clear(region);
+	nrow = (nHeight + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	ncol = (nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+
+	if (!nrow || !ncol)
+		return 0;
+
+	tiles = (BYTE*) malloc(nrow * ncol);
+
+	if (!tiles)
+		return -1;
+
+	count = shadow_capture_get_stripe_count(nrow);
+
+	for (index = 0; index < count; index++)
+	{
+		stripes[index].pData1 = pData1;
+		stripes[index].nStep1 = nStep1;
+		stripes[index].pData2 = pData2;
+		stripes[index].nStep2 = nStep2;
+		stripes[index].nWidth = nWidth;
+		stripes[index].nHeight = nHeight;
+		stripes[index].ncol = ncol;
+		stripes[index].firstRow = (nrow * index) / count;
+		stripes[index].lastRow = (nrow * (index + 1)) / count;
+		stripes[index].tiles = tiles;
+		stripes[index].changed = FALSE;
+
+		/* the first stripe is compared on the calling thread */
+		if (index > 0)
+		{
+			work[index] = CreateThreadpoolWork(
+			                  (PTP_WORK_CALLBACK) shadow_capture_compare_work_callback,
+			                  &stripes[index], NULL);
+
+			if (work[index])
+				SubmitThreadpoolWork(work[index]);
+			else
+				shadow_capture_compare_stripe(&stripes[index]);
+		}
+	}
+
+	shadow_capture_compare_stripe(&stripes[0]);
+
+	for (index = 0; index < count; index++)
+	{
+		if (work[index])
+		{
+			WaitForThreadpoolWorkCallbacks(work[index], FALSE);
+			CloseThreadpoolWork(work[index]);
+		}
 
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
+		if (stripes[index].changed)
+			changed = TRUE;
+	}
 
-			if (!tw)
-				tw = 16;
+	if (!changed)
+	{
+		status = 0;
+		goto out;
+	}
 
-			p1 = &pData1[(ty * 16 * nStep1) + (tx * 16 * 4)];
-			p2 = &pData2[(ty * 16 * nStep2) + (tx * 16 * 4)];
+#ifdef WITH_DEBUG_SHADOW_CAPTURE
+	{
+		int ty;
+		char* row_str = calloc(ncol + 1, sizeof(char));
 
-			for (k = 0; k < th; k++)
+		if (row_str)
+		{
+			for (ty = 0; ty < nrow; ty++)
 			{
-				if (memcmp(p1, p2, tw * 4) != 0)
-				{
-					equal = FALSE;
-					break;
-				}
-
-				p1 += nStep1;
-				p2 += nStep2;
+				for (index = 0; index < ncol; index++)
+					row_str[index] = tiles[ty * ncol + index] ? 'X' : 'O';
+
+				WLog_INFO(TAG, "|%s|", row_str);
 			}
 
-			if (!equal)
-			{
-				rows[ty] = FALSE;
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-				cols[tx] = FALSE;
+			free(row_str);
+		}
+	}
 #endif
 
-				if (l > tx)
-					l = tx;
+	if (shadow_capture_tiles_to_region(tiles, ncol, nrow, nWidth, nHeight, region))
+		status = 1;
 
-				if (r < tx)
-					r = tx;
-			}
+out:
+	free(tiles);
+	return status;
+}
+
+int shadow_capture_compare(BYTE* pData1, int nStep1, int nWidth, int nHeight, BYTE* pData2, int nStep2, RECTANGLE_16* rect)
+{
+	int status;
+	REGION16 region;
+	ZeroMemory(rect, sizeof(RECTANGLE_16));
+	region16_init(&region);
+	status = shadow_capture_compare_region(pData1, nStep1, nWidth, nHeight, pData2, nStep2,
+	                                       &region);
+
+	if (status > 0)
+		*rect = *region16_extents(&region);
+
+	region16_uninit(&region);
+	return (status < 0) ? 0 : status;
+}
+
+/**
+ * Move detection: every line (row or column) of both frames is reduced to
+ * a hash. Changed lines of the new frame look up equal lines of the old
+ * frame and vote for their distance, the winning distance is then grown
+ * into the longest band of lines that are equal at that distance. Runs of
+ * identical lines, such as plain backgrounds, carry no position and do not
+ * vote. The band is verified pixel by pixel before it is reported.
+ */
+
+#define SHADOW_CAPTURE_MOVE_MIN_LINES	32
+#define SHADOW_CAPTURE_MOVE_MIN_VOTES	4
+#define SHADOW_CAPTURE_MOVE_MAX_CANDIDATES	4
+
+static void shadow_capture_hash_rows(const BYTE* pData, int nStep, int nWidth, int nHeight,
+                                     UINT64* hashes)
+{
+	int x, y;
+	UINT32 pixel;
+	UINT64 hash;
+	const BYTE* pLine;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		hash = 0xCBF29CE484222325ULL;
+		pLine = &pData[y * nStep];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			CopyMemory(&pixel, &pLine[x * 4], 4);
+			hash = (hash ^ pixel) * 0x100000001B3ULL;
 		}
 
-		if (!rows[ty])
+		hashes[y] = hash;
+	}
+}
+
+static void shadow_capture_hash_columns(const BYTE* pData, int nStep, int nWidth, int nHeight,
+                                        UINT64* hashes)
+{
+	int x, y;
+	UINT32 pixel;
+	const BYTE* pLine;
+
+	/* accumulated row by row to walk the frame in memory order */
+	for (x = 0; x < nWidth; x++)
+		hashes[x] = 0xCBF29CE484222325ULL;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		pLine = &pData[y * nStep];
+
+		for (x = 0; x < nWidth; x++)
 		{
-			allEqual = FALSE;
+			CopyMemory(&pixel, &pLine[x * 4], 4);
+			hashes[x] = (hashes[x] ^ pixel) * 0x100000001B3ULL;
+		}
+	}
+}
+
+/**
+ * Returns the distance most changed lines of hashes2 moved by from
+ * hashes1, or 0 if there is no clear one.
+ */
+static int shadow_capture_find_shift(const UINT64* hashes1, const UINT64* hashes2, int count)
+{
+	int i, j, k;
+	int size;
+	int shift = 0;
+	int candidates;
+	UINT32 best = 0;
+	int* table;
+	UINT32* votes;
+
+	size = 64;
 
-			if (t > ty)
-				t = ty;
+	while (size < (count * 2))
+		size <<= 1;
 
-			if (b < ty)
-				b = ty;
+	/* open addressing, slots hold the line index + 1 */
+	table = (int*) calloc(size, sizeof(int));
+	votes = (UINT32*) calloc(count * 2, sizeof(UINT32));
+
+	if (!table || !votes)
+		goto out;
+
+	for (i = 0; i < count; i++)
+	{
+		if ((i > 0) && (hashes1[i] == hashes1[i - 1]))
+			continue;
+
+		k = (int) (hashes1[i] & (size - 1));
+
+		while (table[k])
+			k = (k + 1) & (size - 1);
+
+		table[k] = i + 1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if ((hashes2[i] == hashes1[i]) || ((i > 0) && (hashes2[i] == hashes2[i - 1])))
+			continue;
+
+		k = (int) (hashes2[i] & (size - 1));
+		candidates = 0;
+
+		while (table[k] && (candidates < SHADOW_CAPTURE_MOVE_MAX_CANDIDATES))
+		{
+			j = table[k] - 1;
+
+			if (hashes1[j] == hashes2[i])
+			{
+				votes[i - j + count]++;
+				candidates++;
+			}
+
+			k = (k + 1) & (size - 1);
 		}
 	}
 
-	if (allEqual)
-		return 0;
+	for (k = 0; k < (count * 2); k++)
+	{
+		if ((k != count) && (votes[k] > best))
+		{
+			best = votes[k];
+			shift = k - count;
+		}
+	}
+
+	if (best < SHADOW_CAPTURE_MOVE_MIN_VOTES)
+		shift = 0;
+
+out:
+	free(table);
+	free(votes);
+	return shift;
+}
 
-	rect->left = l * 16;
-	rect->top = t * 16;
-	rect->right = (r + 1) * 16;
-	rect->bottom = (b + 1) * 16;
+/**
+ * Finds the band of lines equal to the lines shift before them in the old
+ * frame that saves the most changed lines.
+ */
+static BOOL shadow_capture_find_band(const UINT64* hashes1, const UINT64* hashes2, int count,
+                                     int shift, int* first, int* last)
+{
+	int i;
+	int start = -1;
+	int gain = 0;
+	int bestGain = 0;
+	int begin = MAX(0, shift);
+	int end = MIN(count, count + shift);
+
+	for (i = begin; i <= end; i++)
+	{
+		if ((i < end) && (hashes2[i] == hashes1[i - shift]))
+		{
+			if (start < 0)
+			{
+				start = i;
+				gain = 0;
+			}
 
-	if (rect->right > nWidth)
-		rect->right = nWidth;
+			if (hashes2[i] != hashes1[i])
+				gain++;
 
-	if (rect->bottom > nHeight)
-		rect->bottom = nHeight;
+			continue;
+		}
 
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	char *col_str = calloc(ncol + 1, sizeof(char));
-	if (!col_str)
+		if ((start >= 0) && (gain > bestGain) &&
+		    ((i - start) >= SHADOW_CAPTURE_MOVE_MIN_LINES))
+		{
+			bestGain = gain;
+			*first = start;
+			*last = i;
+		}
+
+		start = -1;
+	}
+
+	return (bestGain >= (SHADOW_CAPTURE_MOVE_MIN_LINES / 2)) ? TRUE : FALSE;
+}
+
+static BOOL shadow_capture_verify_move(const BYTE* pData1, int nStep1, const BYTE* pData2,
+                                       int nStep2, const SHADOW_SURFACE_MOVE* move)
+{
+	int y;
+	const BYTE* p1;
+	const BYTE* p2;
+	int width = (move->rect.right - move->rect.left) * 4;
+
+	for (y = move->rect.top; y < move->rect.bottom; y++)
 	{
-		WLog_ERR(TAG, "calloc failed!");
-		return 1;
+		p1 = &pData1[(y - move->dy) * nStep1 + (move->rect.left - move->dx) * 4];
+		p2 = &pData2[y * nStep2 + move->rect.left * 4];
+
+		if (memcmp(p1, p2, width) != 0)
+			return FALSE;
 	}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf(&col_str[tx], "-");
-	WLog_INFO(TAG, "%s", col_str);
+	return TRUE;
+}
+
+/**
+ * Looks for a vertical or horizontal shift of a block of the old frame
+ * pData1 in the new frame pData2, as left behind by scrolling or by moving
+ * a window. The frames should be cut down to the changed area, lines that
+ * do not take part in the move keep it from being found.
+ *
+ * @return TRUE if move was set to a block that is exactly equal to the
+ * old frame shifted by (dx, dy)
+ */
+BOOL shadow_capture_detect_move(BYTE* pData1, int nStep1, int nWidth, int nHeight,
+                                BYTE* pData2, int nStep2, SHADOW_SURFACE_MOVE* move)
+{
+	int shift;
+	int first = 0;
+	int last = 0;
+	BOOL found = FALSE;
+	UINT64* hashes;
+
+	if (!pData1 || !pData2 || !move)
+		return FALSE;
+
+	if ((nWidth < SHADOW_CAPTURE_MOVE_MIN_LINES) || (nHeight < SHADOW_CAPTURE_MOVE_MIN_LINES))
+		return FALSE;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf(&col_str[tx], "%c", cols[tx] ? 'O' : 'X');
-	WLog_INFO(TAG, "%s", col_str);
+	hashes = (UINT64*) calloc(MAX(nWidth, nHeight) * 2, sizeof(UINT64));
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf(&col_str[tx], "-");
-	WLog_INFO(TAG, "%s", col_str);
+	if (!hashes)
+		return FALSE;
 
-	for (ty = 0; ty < nrow; ty++)
+	/* vertical scrolling first, it is by far the most common */
+	shadow_capture_hash_rows(pData1, nStep1, nWidth, nHeight, hashes);
+	shadow_capture_hash_rows(pData2, nStep2, nWidth, nHeight, &hashes[nHeight]);
+	shift = shadow_capture_find_shift(hashes, &hashes[nHeight], nHeight);
+
+	if (shift && shadow_capture_find_band(hashes, &hashes[nHeight], nHeight, shift,
+	                                      &first, &last))
 	{
-		for (tx = 0; tx < ncol; tx++)
-			sprintf(&col_str[tx], "%c", cols[tx] ? 'O' : 'X');
-		WLog_INFO(TAG, "%s", col_str);
-		WLog_INFO(TAG, "|%s|", rows[ty] ? "O" : "X");
+		move->rect.left = 0;
+		move->rect.top = first;
+		move->rect.right = nWidth;
+		move->rect.bottom = last;
+		move->dx = 0;
+		move->dy = shift;
+		found = shadow_capture_verify_move(pData1, nStep1, pData2, nStep2, move);
 	}
 
-	WLog_INFO(TAG, "left: %d top: %d right: %d bottom: %d ncol: %d nrow: %d",
-			l, t, r, b, ncol, nrow);
-	free(col_str);
-#endif
+	if (!found)
+	{
+		shadow_capture_hash_columns(pData1, nStep1, nWidth, nHeight, hashes);
+		shadow_capture_hash_columns(pData2, nStep2, nWidth, nHeight, &hashes[nWidth]);
+		shift = shadow_capture_find_shift(hashes, &hashes[nWidth], nWidth);
 
-	return 1;
+		if (shift && shadow_capture_find_band(hashes, &hashes[nWidth], nWidth, shift,
+		                                      &first, &last))
+		{
+			move->rect.left = first;
+			move->rect.top = 0;
+			move->rect.right = last;
+			move->rect.bottom = nHeight;
+			move->dx = shift;
+			move->dy = 0;
+			found = shadow_capture_verify_move(pData1, nStep1, pData2, nStep2, move);
+		}
+	}
+
+	free(hashes);
+	return found;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
@@ -34,13 +34,58 @@
 
 #define TAG CLIENT_TAG("shadow")
 
+#define SHADOW_CLIENT_MAX_UPDATE_RECTS	64
+
+/* H.264 updates changing more of the desktop are encoded as a full frame */
+#define SHADOW_CLIENT_H264_SCENE_CHANGE_PERCENT	50
+
 struct _SHADOW_GFX_STATUS
 {
 	BOOL gfxOpened;
 	BOOL gfxSurfaceCreated;
+	rdpShadowCache* gfxCache;
 };
 typedef struct _SHADOW_GFX_STATUS SHADOW_GFX_STATUS;
 
+/* a tile completely covered by an update, found in or added to the cache */
+struct _SHADOW_GFX_TILE
+{
+	RECTANGLE_16 rect;
+	UINT64 cacheKey;
+	UINT16 cacheSlot;
+	BOOL cached;
+};
+typedef struct _SHADOW_GFX_TILE SHADOW_GFX_TILE;
+
+/* a part of an update made of a single colour, x8r8g8b8 */
+struct _SHADOW_SOLID_RECT
+{
+	RECTANGLE_16 rect;
+	UINT32 color;
+};
+typedef struct _SHADOW_SOLID_RECT SHADOW_SOLID_RECT;
+
+/* the parts of one graphics pipeline frame, in the order they are drawn */
+struct _SHADOW_GFX_UPDATE
+{
+	const SHADOW_SURFACE_MOVE* move;
+
+	SHADOW_SOLID_RECT* solidRects;
+	UINT32 numSolidRects;
+
+	rdpShadowCache* cache;
+	SHADOW_GFX_TILE* tiles;
+	UINT32 numTiles;
+
+	/* encoded with H.264, NULL for the whole frame */
+	const RECTANGLE_16* regionRects;
+	UINT32 numRegionRects;
+
+	RECTANGLE_16* planarRects;
+	UINT32 numPlanarRects;
+};
+typedef struct _SHADOW_GFX_UPDATE SHADOW_GFX_UPDATE;
+
 static INLINE BOOL shadow_client_rdpgfx_new_surface(rdpShadowClient* client)
 {
 	UINT error = CHANNEL_RC_OK;
@@ -146,6 +191,7 @@ static BOOL shadow_client_context_new(freerdp_peer* peer,
 	settings->DrawAllowColorSubsampling = TRUE;
 	settings->DrawAllowDynamicColorFidelity = TRUE;
 	settings->CompressionLevel = PACKET_COMPR_TYPE_RDP6;
+	settings->NetworkAutoDetect = TRUE;
 
 	if (!(settings->CertificateFile = _strdup(server->CertificateFile)))
 		goto fail_cert_file;
@@ -426,6 +472,17 @@ static BOOL shadow_client_refresh_request(rdpShadowClient* client)
 	return MessageQueue_Dispatch(MsgPipe->In, &message);
 }
 
+/**
+ * Screen updates skipped while the output queue was full only left their
+ * damage in the invalid region. Once the queue has room again a frame is
+ * requested so that region is sent even if the screen does not change.
+ */
+static BOOL shadow_client_output_queue_drained(freerdp_peer* peer)
+{
+	rdpShadowClient* client = (rdpShadowClient*) peer->context;
+	return shadow_client_refresh_request(client);
+}
+
 static BOOL shadow_client_refresh_rect(rdpShadowClient* client, BYTE count,
                                        RECTANGLE_16* areas)
 {
@@ -588,6 +645,7 @@ static INLINE void shadow_client_common_frame_acknowledge(
 	 * a latest acknowledged frame id.
 	 */
 	client->encoder->lastAckframeId = frameId;
+	shadow_rate_frame_acked(client->encoder->rate, frameId);
 }
 
 static BOOL shadow_client_surface_frame_acknowledge(rdpShadowClient* client,
@@ -600,18 +658,59 @@ static BOOL shadow_client_surface_frame_acknowledge(rdpShadowClient* client,
 static UINT shadow_client_rdpgfx_frame_acknowledge(RdpgfxServerContext* context,
         RDPGFX_FRAME_ACKNOWLEDGE_PDU* frameAcknowledge)
 {
-	shadow_client_common_frame_acknowledge((rdpShadowClient*)context->custom,
-	                                       frameAcknowledge->frameId);
+	rdpShadowClient* client = (rdpShadowClient*) context->custom;
+	shadow_rate_set_client_queue(client->encoder->rate, frameAcknowledge->queueDepth);
+	shadow_client_common_frame_acknowledge(client, frameAcknowledge->frameId);
 	return CHANNEL_RC_OK;
 }
 static UINT shadow_client_rdpgfx_qoe_frame_acknowledge(RdpgfxServerContext*
         context, RDPGFX_QOE_FRAME_ACKNOWLEDGE_PDU* qoeFrameAcknowledge)
 {
-	shadow_client_common_frame_acknowledge((rdpShadowClient*)context->custom,
-	                                       qoeFrameAcknowledge->frameId);
+	rdpShadowClient* client = (rdpShadowClient*) context->custom;
+	/* time from the end of the frame to its decode and render on the client */
+	shadow_rate_set_decode_time(client->encoder->rate, qoeFrameAcknowledge->timeDiffEDR);
+	shadow_client_common_frame_acknowledge(client, qoeFrameAcknowledge->frameId);
 	return CHANNEL_RC_OK;
 }
 
+static BOOL shadow_client_rtt_measure_response(rdpContext* context, UINT16 sequenceNumber)
+{
+	rdpShadowClient* client = (rdpShadowClient*) context;
+	shadow_rate_set_rtt(client->encoder->rate, context->autodetect->netCharAverageRTT);
+	return TRUE;
+}
+
+static BOOL shadow_client_bandwidth_measure_results(rdpContext* context,
+        UINT16 sequenceNumber)
+{
+	rdpShadowClient* client = (rdpShadowClient*) context;
+	shadow_rate_set_bandwidth(client->encoder->rate, context->autodetect->netCharBandwidth);
+	return TRUE;
+}
+
+/**
+ * Continuous network autodetection, [MS-RDPBCGR] 1.3.1.1. Every probe
+ * measures the round trip time, a bandwidth measurement covers the
+ * regular traffic between two probes.
+ */
+static BOOL shadow_client_autodetect_probe(rdpShadowClient* client, UINT16 sequenceNumber)
+{
+	BOOL rc = FALSE;
+	rdpContext* context = (rdpContext*) client;
+	rdpAutoDetect* autodetect = context->autodetect;
+
+	if (sequenceNumber & 1)
+		IFCALLRET(autodetect->BandwidthMeasureStop, rc, context, sequenceNumber);
+	else
+		IFCALLRET(autodetect->BandwidthMeasureStart, rc, context, sequenceNumber);
+
+	if (!rc)
+		return FALSE;
+
+	IFCALLRET(autodetect->RTTMeasureRequest, rc, context, sequenceNumber);
+	return rc;
+}
+
 /**
  * Function description
  *
@@ -696,14 +795,635 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 }
 
 
+/**
+ * Aligns an update to H.264 macroblocks. Returns FALSE for a scene change,
+ * when so much of the desktop changed that the whole frame is encoded.
+ */
+static BOOL shadow_client_h264_region(const RECTANGLE_16* rects, UINT32 numRects,
+                                      UINT32 width, UINT32 height, REGION16* region)
+{
+	UINT32 index;
+	UINT32 numAligned;
+	UINT64 area = 0;
+	RECTANGLE_16 rect;
+	const RECTANGLE_16* aligned;
+
+	for (index = 0; index < numRects; index++)
+	{
+		rect.left = rects[index].left & ~15;
+		rect.top = rects[index].top & ~15;
+		rect.right = MIN((rects[index].right + 15) & ~15, width);
+		rect.bottom = MIN((rects[index].bottom + 15) & ~15, height);
+
+		if ((rect.left >= rect.right) || (rect.top >= rect.bottom))
+			continue;
+
+		if (!region16_union_rect(region, region, &rect))
+			return FALSE;
+	}
+
+	aligned = region16_rects(region, &numAligned);
+
+	if ((numAligned < 1) || (numAligned > SHADOW_CLIENT_MAX_UPDATE_RECTS))
+		return FALSE;
+
+	for (index = 0; index < numAligned; index++)
+	{
+		area += (UINT64)(aligned[index].right - aligned[index].left) *
+		        (aligned[index].bottom - aligned[index].top);
+	}
+
+	return (area * 100) < ((UINT64) width * height * SHADOW_CLIENT_H264_SCENE_CHANGE_PERCENT);
+}
+
+/**
+ * Finds the parts of an update that are filled with a single colour, in
+ * tiles of the encoder grid. Horizontal runs of tiles with the same colour
+ * are merged. Everything else is added to the remaining region.
+ */
+static BOOL shadow_client_split_solid(rdpShadowClient* client, BYTE* pSrcData, int nSrcStep,
+                                      UINT32 width, UINT32 height, const RECTANGLE_16* rects, UINT32 numRects,
+                                      REGION16* remaining, SHADOW_SOLID_RECT** ppSolidRects, UINT32* pNumSolidRects)
+{
+	BOOL rc = FALSE;
+	UINT32 index;
+	UINT32 tx, ty;
+	UINT32 color;
+	UINT32 numParts;
+	UINT32 numSolidRects = 0;
+	UINT32 maxSolidRects = 0;
+	REGION16 update;
+	REGION16 part;
+	RECTANGLE_16 tileRect;
+	SHADOW_SOLID_RECT* solid;
+	SHADOW_SOLID_RECT* solidRects = NULL;
+	SHADOW_SOLID_RECT* newRects;
+	const RECTANGLE_16* extents;
+	const RECTANGLE_16* parts;
+	rdpShadowEncoder* encoder = client->encoder;
+	UINT32 tileWidth = encoder->maxTileWidth;
+	UINT32 tileHeight = encoder->maxTileHeight;
+	region16_init(&update);
+	region16_init(&part);
+
+	for (index = 0; index < numRects; index++)
+	{
+		if (!region16_union_rect(&update, &update, &rects[index]))
+			goto fail;
+	}
+
+	extents = region16_extents(&update);
+
+	for (ty = extents->top / tileHeight; ty * tileHeight < extents->bottom; ty++)
+	{
+		for (tx = extents->left / tileWidth; tx * tileWidth < extents->right; tx++)
+		{
+			tileRect.left = tx * tileWidth;
+			tileRect.top = ty * tileHeight;
+			tileRect.right = MIN(tileRect.left + tileWidth, width);
+			tileRect.bottom = MIN(tileRect.top + tileHeight, height);
+
+			if ((tileRect.left >= tileRect.right) || (tileRect.top >= tileRect.bottom))
+				continue;
+
+			if (!region16_intersect_rect(&part, &update, &tileRect))
+				goto fail;
+
+			parts = region16_rects(&part, &numParts);
+
+			for (index = 0; index < numParts; index++)
+			{
+				if (!shadow_encoder_rect_color(pSrcData, nSrcStep, &parts[index], &color))
+				{
+					if (!region16_union_rect(remaining, remaining, &parts[index]))
+						goto fail;
+
+					continue;
+				}
+
+				solid = numSolidRects ? &solidRects[numSolidRects - 1] : NULL;
+
+				if (solid && (solid->color == color) && (solid->rect.right == parts[index].left) &&
+				    (solid->rect.top == parts[index].top) && (solid->rect.bottom == parts[index].bottom))
+				{
+					solid->rect.right = parts[index].right;
+					continue;
+				}
+
+				if (numSolidRects == maxSolidRects)
+				{
+					maxSolidRects = MAX(maxSolidRects * 2, 32);
+					newRects = (SHADOW_SOLID_RECT*) realloc(solidRects,
+					                                        maxSolidRects * sizeof(SHADOW_SOLID_RECT));
+
+					if (!newRects)
+						goto fail;
+
+					solidRects = newRects;
+				}
+
+				solid = &solidRects[numSolidRects++];
+				solid->rect = parts[index];
+				solid->color = color;
+			}
+		}
+	}
+
+	*ppSolidRects = solidRects;
+	*pNumSolidRects = numSolidRects;
+	solidRects = NULL;
+	rc = TRUE;
+fail:
+	free(solidRects);
+	region16_uninit(&part);
+	region16_uninit(&update);
+	return rc;
+}
+
+static int shadow_client_compare_solid(const void* a, const void* b)
+{
+	const SHADOW_SOLID_RECT* s1 = (const SHADOW_SOLID_RECT*) a;
+	const SHADOW_SOLID_RECT* s2 = (const SHADOW_SOLID_RECT*) b;
+
+	if (s1->color != s2->color)
+		return (s1->color < s2->color) ? -1 : 1;
+
+	if (s1->rect.top != s2->rect.top)
+		return (s1->rect.top < s2->rect.top) ? -1 : 1;
+
+	return (s1->rect.left < s2->rect.left) ? -1 : (s1->rect.left > s2->rect.left);
+}
+
+/**
+ * Sends the single coloured parts of a frame, one SolidFill per colour.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT shadow_client_gfx_send_solid(rdpShadowClient* client,
+        SHADOW_SOLID_RECT* solidRects, UINT32 numSolidRects)
+{
+	UINT32 index;
+	UINT32 count;
+	UINT error = CHANNEL_RC_OK;
+	RECTANGLE_16* fillRects;
+	RDPGFX_SOLID_FILL_PDU solidFill;
+
+	if (!numSolidRects)
+		return CHANNEL_RC_OK;
+
+	if (!(fillRects = (RECTANGLE_16*) calloc(numSolidRects, sizeof(RECTANGLE_16))))
+		return CHANNEL_RC_NO_MEMORY;
+
+	qsort(solidRects, numSolidRects, sizeof(SHADOW_SOLID_RECT), shadow_client_compare_solid);
+	solidFill.surfaceId = 0;
+	solidFill.fillRects = fillRects;
+
+	for (index = 0; !error && (index < numSolidRects); index += count)
+	{
+		solidFill.fillPixel.B = solidRects[index].color & 0xFF;
+		solidFill.fillPixel.G = (solidRects[index].color >> 8) & 0xFF;
+		solidFill.fillPixel.R = (solidRects[index].color >> 16) & 0xFF;
+		solidFill.fillPixel.XA = 0xFF;
+
+		for (count = 0; ((index + count) < numSolidRects) && (count < 0xFFFF) &&
+		     (solidRects[index + count].color == solidRects[index].color); count++)
+			fillRects[count] = solidRects[index + count].rect;
+
+		solidFill.fillRectCount = (UINT16) count;
+		shadow_rate_add_bytes(client->encoder->rate, 16 + (8 * count));
+		IFCALLRET(client->rdpgfx->SolidFill, error, client->rdpgfx, &solidFill);
+	}
+
+	free(fillRects);
+	return error;
+}
+
+/**
+ * Sends the single coloured parts of an update as OpaqueRect orders.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_opaque_rects(rdpShadowClient* client,
+        const SHADOW_SOLID_RECT* solidRects, UINT32 numSolidRects)
+{
+	BOOL ret = TRUE;
+	UINT32 index;
+	UINT32 dstFormat;
+	OPAQUE_RECT_ORDER opaqueRect;
+	rdpContext* context = (rdpContext*) client;
+	rdpUpdate* update = context->update;
+	rdpSettings* settings = context->settings;
+
+	/* the colour is encoded in the colour depth of the session */
+	switch (settings->ColorDepth)
+	{
+		case 32:
+			dstFormat = PIXEL_FORMAT_ABGR32;
+			break;
+
+		case 24:
+			dstFormat = PIXEL_FORMAT_BGR24;
+			break;
+
+		case 16:
+			dstFormat = PIXEL_FORMAT_RGB16;
+			break;
+
+		case 15:
+			dstFormat = PIXEL_FORMAT_RGB15;
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	if (!update->BeginPaint(context))
+		return FALSE;
+
+	for (index = 0; ret && (index < numSolidRects); index++)
+	{
+		opaqueRect.nLeftRect = solidRects[index].rect.left;
+		opaqueRect.nTopRect = solidRects[index].rect.top;
+		opaqueRect.nWidth = solidRects[index].rect.right - solidRects[index].rect.left;
+		opaqueRect.nHeight = solidRects[index].rect.bottom - solidRects[index].rect.top;
+		opaqueRect.color = ConvertColor(solidRects[index].color, PIXEL_FORMAT_BGRX32,
+		                                dstFormat, NULL) & 0x00FFFFFF;
+		ret = update->primary->OpaqueRect(context, &opaqueRect);
+	}
+
+	shadow_rate_add_bytes(client->encoder->rate, 16 * numSolidRects);
+
+	if (!update->EndPaint(context))
+		ret = FALSE;
+
+	if (!ret)
+		WLog_ERR(TAG, "OpaqueRect failed");
+
+	return ret;
+}
+
+/**
+ * Splits the tiles of an update the client holds in its bitmap cache off
+ * the region that has to be encoded. The other tiles covered completely
+ * by the update are returned as well, to be cached once they are drawn.
+ */
+static BOOL shadow_client_gfx_cache_tiles(rdpShadowClient* client, rdpShadowCache* cache,
+        BYTE* pSrcData, int nSrcStep, UINT32 width, UINT32 height,
+        const RECTANGLE_16* rects, UINT32 numRects, REGION16* encodeRegion,
+        SHADOW_GFX_TILE** ppTiles, UINT32* pNumTiles)
+{
+	BOOL rc = FALSE;
+	UINT32 index;
+	UINT32 tx, ty;
+	UINT32 numParts;
+	UINT32 numTiles = 0;
+	UINT32 maxTiles;
+	REGION16 update;
+	REGION16 part;
+	RECTANGLE_16 tileRect;
+	const RECTANGLE_16* extents;
+	const RECTANGLE_16* parts;
+	SHADOW_GFX_TILE* tiles;
+	SHADOW_GFX_TILE* tile;
+	region16_init(&update);
+	region16_init(&part);
+
+	for (index = 0; index < numRects; index++)
+	{
+		if (!region16_union_rect(&update, &update, &rects[index]))
+			goto out;
+	}
+
+	extents = region16_extents(&update);
+	maxTiles = ((extents->right + SHADOW_CACHE_TILE_SIZE - 1) / SHADOW_CACHE_TILE_SIZE -
+	            extents->left / SHADOW_CACHE_TILE_SIZE) *
+	           ((extents->bottom + SHADOW_CACHE_TILE_SIZE - 1) / SHADOW_CACHE_TILE_SIZE -
+	            extents->top / SHADOW_CACHE_TILE_SIZE);
+
+	if (!(tiles = (SHADOW_GFX_TILE*) calloc(MAX(maxTiles, 1), sizeof(SHADOW_GFX_TILE))))
+		goto out;
+
+	for (ty = extents->top / SHADOW_CACHE_TILE_SIZE;
+	     ty * SHADOW_CACHE_TILE_SIZE < extents->bottom; ty++)
+	{
+		for (tx = extents->left / SHADOW_CACHE_TILE_SIZE;
+		     tx * SHADOW_CACHE_TILE_SIZE < extents->right; tx++)
+		{
+			tileRect.left = tx * SHADOW_CACHE_TILE_SIZE;
+			tileRect.top = ty * SHADOW_CACHE_TILE_SIZE;
+			tileRect.right = MIN(tileRect.left + SHADOW_CACHE_TILE_SIZE, width);
+			tileRect.bottom = MIN(tileRect.top + SHADOW_CACHE_TILE_SIZE, height);
+
+			if ((tileRect.left >= tileRect.right) || (tileRect.top >= tileRect.bottom))
+				continue;
+
+			if (!region16_intersect_rect(&part, &update, &tileRect))
+				goto fail;
+
+			parts = region16_rects(&part, &numParts);
+
+			if ((numParts == 1) && (memcmp(parts, &tileRect, sizeof(RECTANGLE_16)) == 0))
+			{
+				tile = &tiles[numTiles++];
+				tile->rect = tileRect;
+				tile->cacheKey = shadow_cache_key(
+				                     &pSrcData[(tileRect.top * nSrcStep) + (tileRect.left * 4)],
+				                     nSrcStep, tileRect.right - tileRect.left,
+				                     tileRect.bottom - tileRect.top);
+				tile->cached = rdpgfx_server_cache_lookup(client->rdpgfx, tile->cacheKey,
+				               &tile->cacheSlot);
+
+				if (tile->cached)
+				{
+					shadow_cache_touch_slot(cache, tile->cacheSlot);
+					continue;
+				}
+			}
+
+			for (index = 0; index < numParts; index++)
+			{
+				if (!region16_union_rect(encodeRegion, encodeRegion, &parts[index]))
+					goto fail;
+			}
+		}
+	}
+
+	*ppTiles = tiles;
+	*pNumTiles = numTiles;
+	rc = TRUE;
+	goto out;
+fail:
+	free(tiles);
+out:
+	region16_uninit(&part);
+	region16_uninit(&update);
+	return rc;
+}
+
+/**
+ * Draws the cached tiles of an update from the bitmap cache or, once the
+ * update is drawn, adds the others to it.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT shadow_client_gfx_send_tiles(rdpShadowClient* client, rdpShadowCache* cache,
+        const SHADOW_GFX_TILE* tiles, UINT32 numTiles, BOOL cached)
+{
+	UINT32 index;
+	UINT error = CHANNEL_RC_OK;
+	RDPGFX_POINT16 destPt;
+	RDPGFX_CACHE_TO_SURFACE_PDU cacheToSurface;
+	RDPGFX_SURFACE_TO_CACHE_PDU surfaceToCache;
+
+	for (index = 0; !error && (index < numTiles); index++)
+	{
+		if (tiles[index].cached != cached)
+			continue;
+
+		if (cached)
+		{
+			destPt.x = tiles[index].rect.left;
+			destPt.y = tiles[index].rect.top;
+			cacheToSurface.cacheSlot = tiles[index].cacheSlot;
+			cacheToSurface.surfaceId = 0;
+			cacheToSurface.destPtsCount = 1;
+			cacheToSurface.destPts = &destPt;
+			IFCALLRET(client->rdpgfx->CacheToSurface, error, client->rdpgfx, &cacheToSurface);
+		}
+		else
+		{
+			/* an equal tile earlier in the update is cached already */
+			if (rdpgfx_server_cache_lookup(client->rdpgfx, tiles[index].cacheKey, NULL))
+				continue;
+
+			surfaceToCache.surfaceId = 0;
+			surfaceToCache.cacheKey = tiles[index].cacheKey;
+			surfaceToCache.cacheSlot = shadow_cache_get_slot(cache);
+			surfaceToCache.rectSrc = tiles[index].rect;
+			IFCALLRET(client->rdpgfx->SurfaceToCache, error, client->rdpgfx, &surfaceToCache);
+		}
+	}
+
+	return error;
+}
+
+/**
+ * Moves the parts of an update that look like text or user interface off
+ * the region encoded with H.264, they are sent with the lossless planar
+ * codec in tiles of the encoder grid instead.
+ */
+static BOOL shadow_client_gfx_split_planar(rdpShadowClient* client, BYTE* pSrcData,
+        int nSrcStep, UINT32 width, UINT32 height, const RECTANGLE_16* rects,
+        UINT32 numRects, REGION16* videoRegion, RECTANGLE_16** ppPlanarRects,
+        UINT32* pNumPlanarRects)
+{
+	BOOL rc = FALSE;
+	UINT32 index;
+	UINT32 tx, ty;
+	UINT32 numParts;
+	UINT32 numPlanarRects = 0;
+	UINT32 maxPlanarRects = 0;
+	REGION16 update;
+	REGION16 part;
+	RECTANGLE_16 tileRect;
+	RECTANGLE_16* planarRects = NULL;
+	RECTANGLE_16* newRects;
+	const RECTANGLE_16* extents;
+	const RECTANGLE_16* parts;
+	rdpShadowEncoder* encoder = client->encoder;
+	UINT32 tileWidth = encoder->maxTileWidth;
+	UINT32 tileHeight = encoder->maxTileHeight;
+	region16_init(&update);
+	region16_init(&part);
+
+	for (index = 0; index < numRects; index++)
+	{
+		if (!region16_union_rect(&update, &update, &rects[index]))
+			goto fail;
+	}
+
+	extents = region16_extents(&update);
+
+	for (ty = extents->top / tileHeight; ty * tileHeight < extents->bottom; ty++)
+	{
+		for (tx = extents->left / tileWidth; tx * tileWidth < extents->right; tx++)
+		{
+			tileRect.left = tx * tileWidth;
+			tileRect.top = ty * tileHeight;
+			tileRect.right = MIN(tileRect.left + tileWidth, width);
+			tileRect.bottom = MIN(tileRect.top + tileHeight, height);
+
+			if ((tileRect.left >= tileRect.right) || (tileRect.top >= tileRect.bottom))
+				continue;
+
+			if (!region16_intersect_rect(&part, &update, &tileRect))
+				goto fail;
+
+			parts = region16_rects(&part, &numParts);
+
+			if (!numParts)
+				continue;
+
+			if (shadow_encoder_classify_tile(encoder, pSrcData, nSrcStep,
+			                                 &tileRect) != SHADOW_TILE_TEXT)
+			{
+				for (index = 0; index < numParts; index++)
+				{
+					if (!region16_union_rect(videoRegion, videoRegion, &parts[index]))
+						goto fail;
+				}
+
+				continue;
+			}
+
+			if ((numPlanarRects + numParts) > maxPlanarRects)
+			{
+				maxPlanarRects = MAX(maxPlanarRects * 2, numPlanarRects + numParts + 16);
+				newRects = (RECTANGLE_16*) realloc(planarRects,
+				                                   maxPlanarRects * sizeof(RECTANGLE_16));
+
+				if (!newRects)
+					goto fail;
+
+				planarRects = newRects;
+			}
+
+			CopyMemory(&planarRects[numPlanarRects], parts, numParts * sizeof(RECTANGLE_16));
+			numPlanarRects += numParts;
+		}
+	}
+
+	*ppPlanarRects = planarRects;
+	*pNumPlanarRects = numPlanarRects;
+	planarRects = NULL;
+	rc = TRUE;
+fail:
+	free(planarRects);
+	region16_uninit(&part);
+	region16_uninit(&update);
+	return rc;
+}
+
+/* rectangles compressed by the encoding jobs, sent in order afterwards */
+struct _SHADOW_PLANAR_PARTS
+{
+	BYTE* pSrcData;
+	int nSrcStep;
+	const RECTANGLE_16* rects;
+	BYTE** buffers;
+	UINT32* sizes;
+};
+typedef struct _SHADOW_PLANAR_PARTS SHADOW_PLANAR_PARTS;
+
+static BOOL shadow_client_gfx_planar_job(SHADOW_ENCODER_JOB* job, void* arg, UINT32 first,
+        UINT32 last)
+{
+	UINT32 index;
+	const RECTANGLE_16* rect;
+	SHADOW_PLANAR_PARTS* parts = (SHADOW_PLANAR_PARTS*) arg;
+
+	for (index = first; index < last; index++)
+	{
+		rect = &parts->rects[index];
+		parts->buffers[index] = freerdp_bitmap_compress_planar(job->planar,
+		                        &parts->pSrcData[(rect->top * parts->nSrcStep) + (rect->left * 4)],
+		                        PIXEL_FORMAT_BGRX32, rect->right - rect->left, rect->bottom - rect->top,
+		                        parts->nSrcStep, NULL, &parts->sizes[index]);
+
+		if (!parts->buffers[index])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * Function description
  *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT shadow_client_gfx_send_planar(rdpShadowClient* client, BYTE* pSrcData,
+        int nSrcStep, const RECTANGLE_16* rects, UINT32 numRects)
+{
+	UINT32 index;
+	UINT32 numJobs;
+	UINT32 pixels = 0;
+	UINT error = CHANNEL_RC_OK;
+	RDPGFX_SURFACE_COMMAND cmd;
+	SHADOW_PLANAR_PARTS parts;
+	rdpShadowEncoder* encoder = client->encoder;
+	cmd.surfaceId = 0;
+	cmd.contextId = 0;
+	cmd.codecId = RDPGFX_CODECID_PLANAR;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.extra = NULL;
+
+	if (!numRects)
+		return CHANNEL_RC_OK;
+
+	parts.pSrcData = pSrcData;
+	parts.nSrcStep = nSrcStep;
+	parts.rects = rects;
+	parts.buffers = (BYTE**) calloc(numRects, sizeof(BYTE*));
+	parts.sizes = (UINT32*) calloc(numRects, sizeof(UINT32));
+
+	if (!parts.buffers || !parts.sizes)
+	{
+		error = CHANNEL_RC_NO_MEMORY;
+		goto out;
+	}
+
+	for (index = 0; index < numRects; index++)
+		pixels += (rects[index].right - rects[index].left) * (rects[index].bottom - rects[index].top);
+
+	numJobs = shadow_encoder_num_jobs(encoder, numRects, pixels);
+
+	if (!shadow_encoder_run_jobs(encoder, FREERDP_CODEC_PLANAR, numJobs, numRects,
+	                             shadow_client_gfx_planar_job, &parts))
+	{
+		WLog_ERR(TAG, "freerdp_bitmap_compress_planar failed");
+		error = ERROR_INTERNAL_ERROR;
+		goto out;
+	}
+
+	for (index = 0; !error && (index < numRects); index++)
+	{
+		cmd.left = rects[index].left;
+		cmd.top = rects[index].top;
+		cmd.right = rects[index].right;
+		cmd.bottom = rects[index].bottom;
+		cmd.width = cmd.right - cmd.left;
+		cmd.height = cmd.bottom - cmd.top;
+		cmd.data = parts.buffers[index];
+		cmd.length = parts.sizes[index];
+		shadow_rate_add_bytes(encoder->rate, cmd.length);
+		IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, &cmd);
+	}
+
+out:
+
+	if (parts.buffers)
+	{
+		for (index = 0; index < numRects; index++)
+			free(parts.buffers[index]);
+	}
+
+	free(parts.buffers);
+	free(parts.sizes);
+	return error;
+}
+
+/**
+ * Sends a graphics pipeline frame. Without regionRects the whole frame is
+ * encoded with H.264, otherwise only the listed areas, which may be none.
+ *
  * @return TRUE on success
  */
 static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
-        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight,
+        const SHADOW_GFX_UPDATE* gfxUpdate)
 {
+	UINT32 index;
 	UINT error = CHANNEL_RC_OK;
 	rdpUpdate* update;
 	rdpContext* context;
@@ -714,6 +1434,9 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 	RDPGFX_START_FRAME_PDU cmdstart;
 	RDPGFX_END_FRAME_PDU cmdend;
 	SYSTEMTIME sTime;
+	const SHADOW_SURFACE_MOVE* move = gfxUpdate->move;
+	const RECTANGLE_16* regionRects = gfxUpdate->regionRects;
+	UINT32 numRegionRects = gfxUpdate->numRegionRects;
 	context = (rdpContext*) client;
 	update = context->update;
 	settings = context->settings;
@@ -734,44 +1457,236 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 	cmd.width = nWidth;
 	cmd.height = nHeight;
 
-	if (settings->GfxH264)
+	if (settings->GfxH264)
+	{
+		RDPGFX_AVC420_BITMAP_STREAM avc420;
+		RECTANGLE_16 regionRect;
+		RDPGFX_H264_QUANT_QUALITY* quantQualityVals = NULL;
+		BOOL encode = !regionRects || (numRegionRects > 0);
+		BOOL single = encode && !move && !gfxUpdate->numTiles && !gfxUpdate->numPlanarRects &&
+		              !gfxUpdate->numSolidRects;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420 | FREERDP_CODEC_PLANAR) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC420");
+			return FALSE;
+		}
+
+		if (!regionRects)
+		{
+			regionRect.left = cmd.left;
+			regionRect.top = cmd.top;
+			regionRect.right = cmd.right;
+			regionRect.bottom = cmd.bottom;
+			regionRects = &regionRect;
+			numRegionRects = 1;
+		}
+
+		if (encode)
+		{
+			if (avc420_compress_region(encoder->h264, pSrcData, cmd.format, nSrcStep,
+			                           nWidth, nHeight, regionRects, numRegionRects,
+			                           &avc420.data, &avc420.length) < 0)
+			{
+				WLog_ERR(TAG, "avc420_compress_region failed");
+				return FALSE;
+			}
+
+			shadow_rate_add_bytes(encoder->rate, avc420.length);
+
+			if (!(quantQualityVals = (RDPGFX_H264_QUANT_QUALITY*) calloc(numRegionRects,
+			                         sizeof(RDPGFX_H264_QUANT_QUALITY))))
+				return FALSE;
+
+			for (index = 0; index < numRegionRects; index++)
+			{
+				quantQualityVals[index].qp = encoder->h264->QP;
+				quantQualityVals[index].r = 0;
+				quantQualityVals[index].p = 0;
+				quantQualityVals[index].qualityVal = 100 - quantQualityVals[index].qp;
+			}
+
+			cmd.codecId = RDPGFX_CODECID_AVC420;
+			cmd.extra = (void*)&avc420;
+			/* the client only refreshes the areas listed in the metablock */
+			avc420.meta.numRegionRects = numRegionRects;
+			avc420.meta.regionRects = (RECTANGLE_16*) regionRects;
+			avc420.meta.quantQualityVals = quantQualityVals;
+		}
+
+		if (single)
+		{
+			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
+			          &cmdstart, &cmdend);
+		}
+		else
+		{
+			IFCALLRET(client->rdpgfx->StartFrame, error, client->rdpgfx, &cmdstart);
+
+			if (!error && move)
+			{
+				/* the moved block is copied on the client before the new pixels are drawn */
+				RDPGFX_POINT16 destPt;
+				RDPGFX_SURFACE_TO_SURFACE_PDU surfaceToSurface;
+				destPt.x = move->rect.left;
+				destPt.y = move->rect.top;
+				surfaceToSurface.surfaceIdSrc = 0;
+				surfaceToSurface.surfaceIdDest = 0;
+				surfaceToSurface.rectSrc.left = move->rect.left - move->dx;
+				surfaceToSurface.rectSrc.top = move->rect.top - move->dy;
+				surfaceToSurface.rectSrc.right = move->rect.right - move->dx;
+				surfaceToSurface.rectSrc.bottom = move->rect.bottom - move->dy;
+				surfaceToSurface.destPtsCount = 1;
+				surfaceToSurface.destPts = &destPt;
+				IFCALLRET(client->rdpgfx->SurfaceToSurface, error, client->rdpgfx,
+				          &surfaceToSurface);
+			}
+
+			if (!error)
+				error = shadow_client_gfx_send_solid(client, gfxUpdate->solidRects,
+				                                     gfxUpdate->numSolidRects);
+
+			if (!error)
+				error = shadow_client_gfx_send_tiles(client, gfxUpdate->cache, gfxUpdate->tiles,
+				                                     gfxUpdate->numTiles, TRUE);
+
+			if (!error && encode)
+				IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, &cmd);
+
+			if (!error)
+				error = shadow_client_gfx_send_planar(client, pSrcData, nSrcStep,
+				                                      gfxUpdate->planarRects,
+				                                      gfxUpdate->numPlanarRects);
+
+			if (!error)
+				error = shadow_client_gfx_send_tiles(client, gfxUpdate->cache, gfxUpdate->tiles,
+				                                     gfxUpdate->numTiles, FALSE);
+
+			if (!error)
+				IFCALLRET(client->rdpgfx->EndFrame, error, client->rdpgfx, &cmdend);
+		}
+
+		free(quantQualityVals);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "Sending the surface frame failed with error %u", error);
+			return FALSE;
+		}
+
+		shadow_rate_frame_sent(encoder->rate, cmdstart.frameId);
+	}
+
+	return TRUE;
+}
+
+/**
+ * NSCodec rectangles, split into bands so that large updates are encoded
+ * by several jobs. Each job appends its messages to its own stream.
+ */
+struct _SHADOW_NSC_PARTS
+{
+	BYTE* pSrcData;
+	int nSrcStep;
+	RECTANGLE_16* rects;
+	UINT32 numRects;
+	UINT32* jobs;
+	size_t* offsets;
+	size_t* lengths;
+};
+typedef struct _SHADOW_NSC_PARTS SHADOW_NSC_PARTS;
+
+static void shadow_client_nsc_parts_free(SHADOW_NSC_PARTS* parts)
+{
+	free(parts->rects);
+	free(parts->jobs);
+	free(parts->offsets);
+	free(parts->lengths);
+}
+
+static BOOL shadow_client_nsc_job(SHADOW_ENCODER_JOB* job, void* arg, UINT32 first,
+                                  UINT32 last)
+{
+	UINT32 index;
+	const RECTANGLE_16* rect;
+	SHADOW_NSC_PARTS* parts = (SHADOW_NSC_PARTS*) arg;
+
+	for (index = first; index < last; index++)
 	{
-		RDPGFX_AVC420_BITMAP_STREAM avc420;
-		RECTANGLE_16 regionRect;
-		RDPGFX_H264_QUANT_QUALITY quantQualityVal;
+		rect = &parts->rects[index];
+		parts->jobs[index] = job->index;
+		parts->offsets[index] = Stream_GetPosition(job->bs);
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420) < 0)
-		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC420");
+		if (!nsc_compose_message(job->nsc, job->bs,
+		                         &parts->pSrcData[(rect->top * parts->nSrcStep) + (rect->left * 4)],
+		                         rect->right - rect->left, rect->bottom - rect->top, parts->nSrcStep))
 			return FALSE;
-		}
 
-		avc420_compress(encoder->h264, pSrcData, cmd.format, nSrcStep,
-		                nWidth, nHeight, &avc420.data, &avc420.length);
-		cmd.codecId = RDPGFX_CODECID_AVC420;
-		cmd.extra = (void*)&avc420;
-		regionRect.left = cmd.left;
-		regionRect.top = cmd.top;
-		regionRect.right = cmd.right;
-		regionRect.bottom = cmd.bottom;
-		quantQualityVal.qp = encoder->h264->QP;
-		quantQualityVal.r = 0;
-		quantQualityVal.p = 0;
-		quantQualityVal.qualityVal = 100 - quantQualityVal.qp;
-		avc420.meta.numRegionRects = 1;
-		avc420.meta.regionRects = &regionRect;
-		avc420.meta.quantQualityVals = &quantQualityVal;
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
-		          &cmdstart, &cmdend);
+		parts->lengths[index] = Stream_GetPosition(job->bs) - parts->offsets[index];
+	}
 
-		if (error)
+	return TRUE;
+}
+
+static BOOL shadow_client_nsc_split(rdpShadowClient* client, BYTE* pSrcData, int nSrcStep,
+                                    const RECTANGLE_16* rects, UINT32 numRects, SHADOW_NSC_PARTS* parts)
+{
+	UINT32 index;
+	UINT32 numJobs;
+	UINT32 pixels = 0;
+	UINT32 maxParts = 0;
+	UINT32 bandHeight;
+	UINT16 top;
+	rdpShadowEncoder* encoder = client->encoder;
+	ZeroMemory(parts, sizeof(SHADOW_NSC_PARTS));
+	parts->pSrcData = pSrcData;
+	parts->nSrcStep = nSrcStep;
+	/* one band per rectangle unless there are threads to share the work */
+	bandHeight = (encoder->maxJobs > 1) ? encoder->maxTileHeight : 0xFFFF;
+
+	for (index = 0; index < numRects; index++)
+	{
+		maxParts += ((rects[index].bottom - rects[index].top) + bandHeight - 1) / bandHeight;
+		pixels += (rects[index].right - rects[index].left) * (rects[index].bottom - rects[index].top);
+	}
+
+	if (!maxParts)
+		return TRUE;
+
+	parts->rects = (RECTANGLE_16*) calloc(maxParts, sizeof(RECTANGLE_16));
+	parts->jobs = (UINT32*) calloc(maxParts, sizeof(UINT32));
+	parts->offsets = (size_t*) calloc(maxParts, sizeof(size_t));
+	parts->lengths = (size_t*) calloc(maxParts, sizeof(size_t));
+
+	if (!parts->rects || !parts->jobs || !parts->offsets || !parts->lengths)
+		goto fail;
+
+	for (index = 0; index < numRects; index++)
+	{
+		for (top = rects[index].top; top < rects[index].bottom;
+		     top = parts->rects[parts->numRects - 1].bottom)
 		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %u", error);
-			return FALSE;
+			RECTANGLE_16* band = &parts->rects[parts->numRects++];
+			band->left = rects[index].left;
+			band->right = rects[index].right;
+			band->top = top;
+			band->bottom = (UINT16) MIN((UINT32) top + bandHeight, rects[index].bottom);
 		}
 	}
 
+	numJobs = shadow_encoder_num_jobs(encoder, parts->numRects, pixels);
+
+	if (!shadow_encoder_run_jobs(encoder, FREERDP_CODEC_NSCODEC, numJobs, parts->numRects,
+	                             shadow_client_nsc_job, parts))
+	{
+		WLog_ERR(TAG, "nsc_compose_message failed");
+		goto fail;
+	}
+
 	return TRUE;
+fail:
+	shadow_client_nsc_parts_free(parts);
+	return FALSE;
 }
 
 /**
@@ -780,10 +1695,11 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
  * @return TRUE on success
  */
 static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
-        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+        BYTE* pSrcData, int nSrcStep, const RECTANGLE_16* rects, UINT32 numRects)
 {
 	BOOL ret = TRUE;
 	int i;
+	UINT32 index;
 	BOOL first;
 	BOOL last;
 	wStream* s;
@@ -795,6 +1711,7 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 	rdpShadowServer* server;
 	rdpShadowEncoder* encoder;
 	SURFACE_BITS_COMMAND cmd;
+	SHADOW_NSC_PARTS nscParts;
 	context = (rdpContext*) client;
 	update = context->update;
 	settings = context->settings;
@@ -806,9 +1723,10 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 
 	if (settings->RemoteFxCodec)
 	{
-		RFX_RECT rect;
+		RFX_RECT* rfxRects;
 		RFX_MESSAGE* messages;
 		RFX_RECT* messageRects = NULL;
+		rdpShadowShareFrame* frame = NULL;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
@@ -817,14 +1735,43 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 		}
 
 		s = encoder->bs;
-		rect.x = nXSrc;
-		rect.y = nYSrc;
-		rect.width = nWidth;
-		rect.height = nHeight;
-
-		if (!(messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
-		                                     settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
-		                                     settings->MultifragMaxRequestSize)))
+
+		if (!(rfxRects = (RFX_RECT*) calloc(numRects, sizeof(RFX_RECT))))
+			return FALSE;
+
+		for (index = 0; index < numRects; index++)
+		{
+			rfxRects[index].x = rects[index].left;
+			rfxRects[index].y = rects[index].top;
+			rfxRects[index].width = rects[index].right - rects[index].left;
+			rfxRects[index].height = rects[index].bottom - rects[index].top;
+		}
+
+		/**
+		 * Viewers of the desktop share the encoded tiles, only the
+		 * serialization below runs per client.
+		 */
+		if (!client->inLobby)
+			frame = shadow_share_encode_rfx(server->share, encoder->rfx->mode, encoder->rfxQuality,
+			                                pSrcData, nSrcStep, settings->DesktopWidth,
+			                                settings->DesktopHeight, rfxRects, numRects,
+			                                settings->MultifragMaxRequestSize);
+
+		if (frame)
+		{
+			messages = frame->messages;
+			numMessages = frame->numMessages;
+		}
+		else
+		{
+			messages = rfx_encode_messages(encoder->rfx, rfxRects, numRects, pSrcData,
+			                               settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
+			                               settings->MultifragMaxRequestSize);
+		}
+
+		free(rfxRects);
+
+		if (!messages)
 		{
 			WLog_ERR(TAG, "rfx_encode_messages failed");
 			return FALSE;
@@ -840,28 +1787,20 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 		cmd.height = settings->DesktopHeight;
 		cmd.skipCompression = TRUE;
 
-		if (numMessages > 0)
-			messageRects = messages[0].rects;
-
 		for (i = 0; i < numMessages; i++)
 		{
 			Stream_SetPosition(s, 0);
 
 			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
 			{
-				while (i < numMessages)
-				{
-					rfx_message_free(encoder->rfx, &messages[i++]);
-				}
-
 				WLog_ERR(TAG, "rfx_write_message failed");
 				ret = FALSE;
 				break;
 			}
 
-			rfx_message_free(encoder->rfx, &messages[i]);
 			cmd.bitmapDataLength = Stream_GetPosition(s);
 			cmd.bitmapData = Stream_Buffer(s);
+			shadow_rate_add_bytes(encoder->rate, cmd.bitmapDataLength);
 			first = (i == 0) ? TRUE : FALSE;
 			last = ((i + 1) == numMessages) ? TRUE : FALSE;
 
@@ -878,8 +1817,21 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 			}
 		}
 
-		free(messageRects);
-		free(messages);
+		if (frame)
+		{
+			shadow_share_frame_release(frame);
+		}
+		else
+		{
+			if (numMessages > 0)
+				messageRects = messages[0].rects;
+
+			for (i = 0; i < numMessages; i++)
+				rfx_message_free(encoder->rfx, &messages[i]);
+
+			free(messageRects);
+			free(messages);
+		}
 	}
 	else if (settings->NSCodec)
 	{
@@ -889,38 +1841,110 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 			return FALSE;
 		}
 
-		s = encoder->bs;
-		Stream_SetPosition(s, 0);
-		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
-		cmd.bpp = 32;
-		cmd.codecID = settings->NSCodecId;
-		cmd.destLeft = nXSrc;
-		cmd.destTop = nYSrc;
-		cmd.destRight = cmd.destLeft + nWidth;
-		cmd.destBottom = cmd.destTop + nHeight;
-		cmd.width = nWidth;
-		cmd.height = nHeight;
-		cmd.bitmapDataLength = Stream_GetPosition(s);
-		cmd.bitmapData = Stream_Buffer(s);
-		first = TRUE;
-		last = TRUE;
-
-		if (!encoder->frameAck)
-			IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
-		else
-			IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
-			          frameId);
+		if (!shadow_client_nsc_split(client, pSrcData, nSrcStep, rects, numRects, &nscParts))
+			return FALSE;
 
-		if (!ret)
+		rects = nscParts.rects;
+		numRects = nscParts.numRects;
+
+		for (index = 0; index < numRects; index++)
 		{
-			WLog_ERR(TAG, "Send surface bits(NSCodec) failed");
+			const RECTANGLE_16* rect = &rects[index];
+			s = encoder->jobs[nscParts.jobs[index]].bs;
+			cmd.bpp = 32;
+			cmd.codecID = settings->NSCodecId;
+			cmd.destLeft = rect->left;
+			cmd.destTop = rect->top;
+			cmd.destRight = rect->right;
+			cmd.destBottom = rect->bottom;
+			cmd.width = rect->right - rect->left;
+			cmd.height = rect->bottom - rect->top;
+			cmd.bitmapDataLength = nscParts.lengths[index];
+			cmd.bitmapData = Stream_Buffer(s) + nscParts.offsets[index];
+			shadow_rate_add_bytes(encoder->rate, cmd.bitmapDataLength);
+			first = (index == 0) ? TRUE : FALSE;
+			last = ((index + 1) == numRects) ? TRUE : FALSE;
+
+			if (!encoder->frameAck)
+				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
+			else
+				IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
+				          frameId);
+
+			if (!ret)
+			{
+				WLog_ERR(TAG, "Send surface bits(NSCodec) failed");
+				break;
+			}
 		}
+
+		shadow_client_nsc_parts_free(&nscParts);
 	}
 
+	if (ret)
+		shadow_rate_frame_sent(encoder->rate, frameId);
+
 	return ret;
 }
 
+/* tiles of a bitmap update, compressed by the encoding jobs */
+struct _SHADOW_BITMAP_TILES
+{
+	BITMAP_DATA* bitmaps;
+	BYTE** grid;
+	BYTE* pSrcData;
+	int nSrcStep;
+	UINT32 bitsPerPixel;
+};
+typedef struct _SHADOW_BITMAP_TILES SHADOW_BITMAP_TILES;
+
+static BOOL shadow_client_bitmap_job(SHADOW_ENCODER_JOB* job, void* arg, UINT32 first,
+                                     UINT32 last)
+{
+	UINT32 index;
+	UINT32 dstSize;
+	UINT32 bytesPerPixel;
+	BYTE* buffer;
+	BITMAP_DATA* bitmap;
+	SHADOW_BITMAP_TILES* tiles = (SHADOW_BITMAP_TILES*) arg;
+	bytesPerPixel = (tiles->bitsPerPixel + 7) / 8;
+
+	for (index = first; index < last; index++)
+	{
+		bitmap = &tiles->bitmaps[index];
+		buffer = tiles->grid[index];
+		dstSize = 64 * 64 * 4;
+
+		if (tiles->bitsPerPixel < 32)
+		{
+			if (!interleaved_compress(job->interleaved, buffer, &dstSize, bitmap->width,
+			                          bitmap->height, tiles->pSrcData, PIXEL_FORMAT_BGRX32, tiles->nSrcStep,
+			                          bitmap->destLeft, bitmap->destTop, NULL, tiles->bitsPerPixel))
+				return FALSE;
+		}
+		else
+		{
+			buffer = freerdp_bitmap_compress_planar(job->planar,
+			                                        &tiles->pSrcData[(bitmap->destTop * tiles->nSrcStep) + (bitmap->destLeft * 4)],
+			                                        PIXEL_FORMAT_BGRX32, bitmap->width, bitmap->height, tiles->nSrcStep,
+			                                        buffer, &dstSize);
+
+			if (!buffer)
+				return FALSE;
+		}
+
+		bitmap->bitmapDataStream = buffer;
+		bitmap->bitmapLength = dstSize;
+		bitmap->bitsPerPixel = tiles->bitsPerPixel;
+		bitmap->cbScanWidth = bitmap->width * bytesPerPixel;
+		bitmap->cbUncompressedSize = bitmap->width * bitmap->height * bytesPerPixel;
+		bitmap->cbCompFirstRowSize = 0;
+		bitmap->cbCompMainBodySize = bitmap->bitmapLength;
+	}
+
+	return TRUE;
+}
+
 /**
  * Function description
  *
@@ -930,13 +1954,11 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
         BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
 {
 	BOOL ret = TRUE;
-	BYTE* data;
-	BYTE* buffer;
 	int yIdx, xIdx, k;
 	int rows, cols;
-	UINT32 DstSize;
-	UINT32 SrcFormat;
+	UINT32 numJobs;
 	BITMAP_DATA* bitmap;
+	SHADOW_BITMAP_TILES tiles;
 	rdpUpdate* update;
 	rdpContext* context;
 	rdpSettings* settings;
@@ -971,8 +1993,6 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 		}
 	}
 
-	SrcFormat = PIXEL_FORMAT_BGRX32;
-
 	if ((nXSrc % 4) != 0)
 	{
 		nWidth += (nXSrc % 4);
@@ -1030,44 +2050,32 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 			if ((bitmap->width < 4) || (bitmap->height < 4))
 				continue;
 
-			if (settings->ColorDepth < 32)
-			{
-				int bitsPerPixel = settings->ColorDepth;
-				int bytesPerPixel = (bitsPerPixel + 7) / 8;
-				DstSize = 64 * 64 * 4;
-				buffer = encoder->grid[k];
-				interleaved_compress(encoder->interleaved, buffer, &DstSize, bitmap->width,
-				                     bitmap->height,
-				                     pSrcData, SrcFormat, nSrcStep, bitmap->destLeft, bitmap->destTop, NULL,
-				                     bitsPerPixel);
-				bitmap->bitmapDataStream = buffer;
-				bitmap->bitmapLength = DstSize;
-				bitmap->bitsPerPixel = bitsPerPixel;
-				bitmap->cbScanWidth = bitmap->width * bytesPerPixel;
-				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * bytesPerPixel;
-			}
-			else
-			{
-				UINT32 dstSize;
-				buffer = encoder->grid[k];
-				data = &pSrcData[(bitmap->destTop * nSrcStep) + (bitmap->destLeft * 4)];
-				buffer = freerdp_bitmap_compress_planar(encoder->planar, data, SrcFormat,
-				                                        bitmap->width, bitmap->height, nSrcStep, buffer, &dstSize);
-				bitmap->bitmapDataStream = buffer;
-				bitmap->bitmapLength = dstSize;
-				bitmap->bitsPerPixel = 32;
-				bitmap->cbScanWidth = bitmap->width * 4;
-				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * 4;
-			}
-
-			bitmap->cbCompFirstRowSize = 0;
-			bitmap->cbCompMainBodySize = bitmap->bitmapLength;
-			totalBitmapSize += bitmap->bitmapLength;
 			k++;
 		}
 	}
 
+	/* tiles are compressed by the encoding jobs into the grid buffers */
+	tiles.bitmaps = bitmapData;
+	tiles.grid = encoder->grid;
+	tiles.pSrcData = pSrcData;
+	tiles.nSrcStep = nSrcStep;
+	tiles.bitsPerPixel = (settings->ColorDepth < 32) ? settings->ColorDepth : 32;
+	numJobs = shadow_encoder_num_jobs(encoder, k, k * 64 * 64);
+
+	if (!shadow_encoder_run_jobs(encoder, (settings->ColorDepth < 32) ?
+	                             FREERDP_CODEC_INTERLEAVED : FREERDP_CODEC_PLANAR, numJobs, k,
+	                             shadow_client_bitmap_job, &tiles))
+	{
+		WLog_ERR(TAG, "Failed to compress bitmap tiles");
+		ret = FALSE;
+		goto out;
+	}
+
+	for (yIdx = 0; yIdx < k; yIdx++)
+		totalBitmapSize += bitmapData[yIdx].bitmapLength;
+
 	bitmapUpdate.count = bitmapUpdate.number = k;
+	shadow_rate_add_bytes(encoder->rate, totalBitmapSize);
 	updateSizeEstimate = totalBitmapSize + (k * bitmapUpdate.count) + 16;
 
 	if (updateSizeEstimate > maxUpdateSize)
@@ -1139,6 +2147,88 @@ out:
 	return ret;
 }
 
+/**
+ * Checks whether the move of the surface can be sent to this client and
+ * translates it into client coordinates. The source must be up to date on
+ * the client, areas it has not received yet are pending.
+ */
+static BOOL shadow_client_prepare_move(rdpShadowClient* client, BOOL gfx,
+                                       SHADOW_GFX_STATUS* pStatus, const REGION16* pending,
+                                       SHADOW_SURFACE_MOVE* move)
+{
+	RECTANGLE_16 source;
+	rdpSettings* settings = ((rdpContext*) client)->settings;
+	rdpShadowServer* server = client->server;
+	const RECTANGLE_16* subRect = &(server->subRect);
+
+	if (gfx)
+	{
+		/* a full frame encode would overwrite it anyway */
+		if (!pStatus->gfxSurfaceCreated || !server->h264Region)
+			return FALSE;
+	}
+	else if (!settings->OrderSupport[NEG_SCRBLT_INDEX])
+		return FALSE;
+
+	source.left = move->rect.left - move->dx;
+	source.top = move->rect.top - move->dy;
+	source.right = move->rect.right - move->dx;
+	source.bottom = move->rect.bottom - move->dy;
+
+	if (region16_intersects_rect(pending, &source))
+		return FALSE;
+
+	if (server->shareSubRect)
+	{
+		if ((MIN(source.left, move->rect.left) < subRect->left) ||
+		    (MIN(source.top, move->rect.top) < subRect->top) ||
+		    (MAX(source.right, move->rect.right) > subRect->right) ||
+		    (MAX(source.bottom, move->rect.bottom) > subRect->bottom))
+			return FALSE;
+
+		move->rect.left -= subRect->left;
+		move->rect.top -= subRect->top;
+		move->rect.right -= subRect->left;
+		move->rect.bottom -= subRect->top;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_scrblt(rdpShadowClient* client,
+                                      const SHADOW_SURFACE_MOVE* move)
+{
+	BOOL ret;
+	SCRBLT_ORDER scrblt;
+	rdpContext* context = (rdpContext*) client;
+	rdpUpdate* update = context->update;
+	scrblt.nLeftRect = move->rect.left;
+	scrblt.nTopRect = move->rect.top;
+	scrblt.nWidth = move->rect.right - move->rect.left;
+	scrblt.nHeight = move->rect.bottom - move->rect.top;
+	scrblt.bRop = 0xCC; /* SRCCOPY */
+	scrblt.nXSrc = move->rect.left - move->dx;
+	scrblt.nYSrc = move->rect.top - move->dy;
+
+	if (!update->BeginPaint(context))
+		return FALSE;
+
+	ret = update->primary->ScrBlt(context, &scrblt);
+
+	if (!update->EndPaint(context))
+		ret = FALSE;
+
+	if (!ret)
+		WLog_ERR(TAG, "ScrBlt failed");
+
+	return ret;
+}
+
 /**
  * Function description
  *
@@ -1148,7 +2238,6 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
         SHADOW_GFX_STATUS* pStatus)
 {
 	BOOL ret = TRUE;
-	int nXSrc, nYSrc;
 	int nWidth, nHeight;
 	rdpContext* context;
 	rdpSettings* settings;
@@ -1163,16 +2252,30 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 	int index;
 	UINT32 numRects = 0;
 	const RECTANGLE_16* rects;
+	RECTANGLE_16* updateRects = NULL;
+	SHADOW_SURFACE_MOVE move;
+	BOOL moved = FALSE;
+	BOOL gfx;
 	context = (rdpContext*) client;
 	settings = context->settings;
 	server = client->server;
 	encoder = client->encoder;
 	surface = client->inLobby ? server->lobby : server->surface;
+	gfx = settings->SupportGraphicsPipeline && settings->GfxH264 && pStatus->gfxOpened;
 	EnterCriticalSection(&(client->lock));
 	region16_init(&invalidRegion);
 	region16_copy(&invalidRegion, &(client->invalidRegion));
 	region16_clear(&(client->invalidRegion));
 	LeaveCriticalSection(&(client->lock));
+
+	if (!client->inLobby && surface->moved)
+	{
+		move = surface->move;
+
+		if (!(moved = shadow_client_prepare_move(client, gfx, pStatus, &invalidRegion, &move)))
+			region16_union_rect(&invalidRegion, &invalidRegion, &(surface->move.rect));
+	}
+
 	rects = region16_rects(&(surface->invalidRegion), &numRects);
 
 	for (index = 0; index < numRects; index++)
@@ -1191,39 +2294,78 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 		region16_intersect_rect(&invalidRegion, &invalidRegion, &(server->subRect));
 	}
 
+	if (moved && !gfx)
+	{
+		if (!(ret = shadow_client_send_scrblt(client, &move)))
+			goto out;
+	}
+	else if (moved && region16_is_empty(&invalidRegion))
+	{
+		/* a graphics frame always carries new pixels, send the block as such */
+		region16_union_rect(&invalidRegion, &invalidRegion, &(surface->move.rect));
+		moved = FALSE;
+	}
+
 	if (region16_is_empty(&invalidRegion))
 	{
 		/* No image region need to be updated. Success */
 		goto out;
 	}
 
-	extents = region16_extents(&invalidRegion);
-	nXSrc = extents->left;
-	nYSrc = extents->top;
-	nWidth = extents->right - extents->left;
-	nHeight = extents->bottom - extents->top;
+	rects = region16_rects(&invalidRegion, &numRects);
+
+	/* a region made of many small rectangles is sent as its extents */
+	if (numRects > SHADOW_CLIENT_MAX_UPDATE_RECTS)
+	{
+		extents = region16_extents(&invalidRegion);
+		rects = extents;
+		numRects = 1;
+	}
+
+	if (!(updateRects = (RECTANGLE_16*) calloc(numRects, sizeof(RECTANGLE_16))))
+	{
+		ret = FALSE;
+		goto out;
+	}
+
+	CopyMemory(updateRects, rects, numRects * sizeof(RECTANGLE_16));
 	pSrcData = surface->data;
 	nSrcStep = surface->scanline;
 
-	/* Move to new pSrcData / nXSrc / nYSrc according to sub rect */
+	/* Move to new pSrcData / rectangles according to sub rect */
 	if (server->shareSubRect)
 	{
 		int subX, subY;
 		subX = server->subRect.left;
 		subY = server->subRect.top;
-		nXSrc -= subX;
-		nYSrc -= subY;
+
+		for (index = 0; index < numRects; index++)
+		{
+			updateRects[index].left -= subX;
+			updateRects[index].top -= subY;
+			updateRects[index].right -= subX;
+			updateRects[index].bottom -= subY;
+		}
+
 		pSrcData = &pSrcData[(subY * nSrcStep) + (subX * 4)];
 	}
 
 	//WLog_INFO(TAG, "shadow_client_send_surface_update: x: %d y: %d width: %d height: %d right: %d bottom: %d",
 	//	nXSrc, nYSrc, nWidth, nHeight, nXSrc + nWidth, nYSrc + nHeight);
 
-	if (settings->SupportGraphicsPipeline &&
-	    settings->GfxH264 &&
-	    pStatus->gfxOpened)
+	if (gfx)
 	{
-		/* GFX/h264 always full screen encoded */
+		UINT32 count;
+		REGION16 h264Region;
+		REGION16 solidRegion;
+		REGION16 encodeRegion;
+		REGION16 videoRegion;
+		const RECTANGLE_16* encodeRects = updateRects;
+		UINT32 numEncodeRects = numRects;
+		SHADOW_GFX_UPDATE gfxUpdate = { 0 };
+		BOOL fullFrame = !server->h264Region;
+
+		/* the frame covers the whole surface, the region tells what changed */
 		nWidth = settings->DesktopWidth;
 		nHeight = settings->DesktopHeight;
 
@@ -1238,23 +2380,152 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 				goto out;
 
 			pStatus->gfxSurfaceCreated = TRUE;
+			fullFrame = TRUE;
+		}
+
+		/* the capabilities sizing the bitmap cache are confirmed by now */
+		if (!pStatus->gfxCache)
+			pStatus->gfxCache = shadow_cache_new(rdpgfx_server_cache_max_slots(client->rdpgfx),
+			                                     settings->GfxSmallCache || settings->GfxThinClient);
+
+		shadow_encoder_update_history(encoder, updateRects, numRects);
+		region16_init(&h264Region);
+		region16_init(&solidRegion);
+		region16_init(&encodeRegion);
+		region16_init(&videoRegion);
+
+		/* single coloured tiles cost a rectangle in a SolidFill */
+		if (!fullFrame)
+		{
+			ret = shadow_client_split_solid(client, pSrcData, nSrcStep, nWidth, nHeight,
+			                                updateRects, numRects, &solidRegion,
+			                                &gfxUpdate.solidRects, &gfxUpdate.numSolidRects);
+			encodeRects = region16_rects(&solidRegion, &numEncodeRects);
 		}
 
-		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
-		                                     nHeight);
+		if (ret && !fullFrame && pStatus->gfxCache && numEncodeRects)
+		{
+			ret = shadow_client_gfx_cache_tiles(client, pStatus->gfxCache, pSrcData, nSrcStep,
+			                                    nWidth, nHeight, encodeRects, numEncodeRects,
+			                                    &encodeRegion, &gfxUpdate.tiles, &gfxUpdate.numTiles);
+			encodeRects = region16_rects(&encodeRegion, &numEncodeRects);
+		}
+
+		if (ret && !fullFrame && numEncodeRects)
+		{
+			ret = shadow_client_gfx_split_planar(client, pSrcData, nSrcStep, nWidth, nHeight,
+			                                     encodeRects, numEncodeRects, &videoRegion,
+			                                     &gfxUpdate.planarRects, &gfxUpdate.numPlanarRects);
+			encodeRects = region16_rects(&videoRegion, &numEncodeRects);
+		}
+
+		if (ret)
+		{
+			if (!fullFrame && !numEncodeRects)
+			{
+				/* nothing is left for H.264 */
+				gfxUpdate.regionRects = updateRects;
+			}
+			else if (!fullFrame && shadow_client_h264_region(encodeRects, numEncodeRects,
+			         nWidth, nHeight, &h264Region))
+			{
+				gfxUpdate.regionRects = region16_rects(&h264Region, &gfxUpdate.numRegionRects);
+			}
+			else
+			{
+				/* a full frame draws the cached and the planar tiles as well */
+				for (index = 0, count = 0; index < (int) gfxUpdate.numTiles; index++)
+				{
+					if (!gfxUpdate.tiles[index].cached)
+						gfxUpdate.tiles[count++] = gfxUpdate.tiles[index];
+				}
+
+				gfxUpdate.numTiles = count;
+				gfxUpdate.numPlanarRects = 0;
+				gfxUpdate.numSolidRects = 0;
+			}
+
+			gfxUpdate.move = (moved && gfxUpdate.regionRects) ? &move : NULL;
+			gfxUpdate.cache = pStatus->gfxCache;
+			ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
+			                                     nHeight, &gfxUpdate);
+		}
+
+		free(gfxUpdate.tiles);
+		free(gfxUpdate.planarRects);
+		free(gfxUpdate.solidRects);
+		region16_uninit(&videoRegion);
+		region16_uninit(&encodeRegion);
+		region16_uninit(&solidRegion);
+		region16_uninit(&h264Region);
+		goto out;
+	}
+
+	/* without the graphics pipeline single coloured tiles are sent as orders */
+	if (settings->OrderSupport[NEG_OPAQUE_RECT_INDEX] && (settings->ColorDepth >= 15))
+	{
+		REGION16 solidRegion;
+		RECTANGLE_16* solidUpdateRects;
+		SHADOW_SOLID_RECT* solidRects = NULL;
+		UINT32 numSolidRects = 0;
+		region16_init(&solidRegion);
+		ret = shadow_client_split_solid(client, pSrcData, nSrcStep, settings->DesktopWidth,
+		                                settings->DesktopHeight, updateRects, numRects, &solidRegion,
+		                                &solidRects, &numSolidRects);
+
+		if (ret && numSolidRects)
+			ret = shadow_client_send_opaque_rects(client, solidRects, numSolidRects);
+
+		if (ret)
+		{
+			rects = region16_rects(&solidRegion, &numRects);
+			solidUpdateRects = (RECTANGLE_16*) realloc(updateRects,
+			                   MAX(numRects, 1) * sizeof(RECTANGLE_16));
+
+			if (solidUpdateRects)
+			{
+				updateRects = solidUpdateRects;
+				CopyMemory(updateRects, rects, numRects * sizeof(RECTANGLE_16));
+			}
+			else
+				ret = FALSE;
+		}
+
+		free(solidRects);
+		region16_uninit(&solidRegion);
+
+		if (!ret)
+			goto out;
+
+		if (!numRects)
+		{
+			/* orders are not acknowledged */
+			shadow_rate_frame_sent(encoder->rate, 0);
+			goto out;
+		}
 	}
-	else if (settings->RemoteFxCodec || settings->NSCodec)
+
+	if (settings->RemoteFxCodec || settings->NSCodec)
 	{
-		ret = shadow_client_send_surface_bits(client, pSrcData, nSrcStep, nXSrc, nYSrc,
-		                                      nWidth, nHeight);
+		ret = shadow_client_send_surface_bits(client, pSrcData, nSrcStep, updateRects, numRects);
 	}
 	else
 	{
-		ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep, nXSrc, nYSrc,
-		                                       nWidth, nHeight);
+		for (index = 0; ret && (index < numRects); index++)
+		{
+			ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep,
+			                                       updateRects[index].left, updateRects[index].top,
+			                                       updateRects[index].right - updateRects[index].left,
+			                                       updateRects[index].bottom - updateRects[index].top);
+		}
+
+		/* bitmap updates are not acknowledged */
+		if (ret)
+			shadow_rate_frame_sent(encoder->rate, 0);
 	}
 
 out:
+	free(updateRects);
 	region16_uninit(&invalidRegion);
 	return ret;
 }
@@ -1338,6 +2609,11 @@ static INLINE BOOL shadow_client_no_surface_update(rdpShadowClient* client,
 	rdpShadowSurface* surface;
 	server = client->server;
 	surface = client->inLobby ? server->lobby : server->surface;
+
+	/* the move is not replayed later, its destination is sent as pixels */
+	if (!client->inLobby && surface->moved)
+		shadow_client_mark_invalid(client, 1, &(surface->move.rect));
+
 	return shadow_client_surface_update(client, &(surface->invalidRegion));
 }
 
@@ -1447,8 +2723,15 @@ static int shadow_client_subsystem_process_message(rdpShadowClient* client,
 
 static void* shadow_client_thread(rdpShadowClient* client)
 {
+	BOOL send;
+	UINT64 now;
 	DWORD status;
 	DWORD nCount;
+	DWORD dwTimeout;
+	UINT32 rateTimeout = 0;
+	UINT64 refreshTime = 0;
+	UINT64 probeTime = 0;
+	UINT16 probeSequence = 0;
 	wMessage message;
 	wMessage pointerPositionMsg;
 	wMessage pointerAlphaMsg;
@@ -1469,6 +2752,7 @@ static void* shadow_client_thread(rdpShadowClient* client)
 	SHADOW_GFX_STATUS gfxstatus;
 	gfxstatus.gfxOpened = FALSE;
 	gfxstatus.gfxSurfaceCreated = FALSE;
+	gfxstatus.gfxCache = NULL;
 	server = client->server;
 	screen = server->screen;
 	encoder = client->encoder;
@@ -1480,12 +2764,15 @@ static void* shadow_client_thread(rdpShadowClient* client)
 	peer->PostConnect = shadow_client_post_connect;
 	peer->Activate = shadow_client_activate;
 	peer->Logon = shadow_client_logon;
+	peer->OutputQueueDrained = shadow_client_output_queue_drained;
 	shadow_input_register_callbacks(peer->input);
 	peer->Initialize(peer);
 	peer->update->RefreshRect = (pRefreshRect)shadow_client_refresh_rect;
 	peer->update->SuppressOutput = (pSuppressOutput)shadow_client_suppress_output;
 	peer->update->SurfaceFrameAcknowledge = (pSurfaceFrameAcknowledge)
 	                                        shadow_client_surface_frame_acknowledge;
+	context->autodetect->RTTMeasureResponse = shadow_client_rtt_measure_response;
+	context->autodetect->BandwidthMeasureResults = shadow_client_bandwidth_measure_results;
 
 	if ((!client->vcm) || (!subsystem->updateEvent))
 		goto out;
@@ -1515,7 +2802,34 @@ static void* shadow_client_thread(rdpShadowClient* client)
 		}
 		events[nCount++] = ChannelEvent;
 		events[nCount++] = MessageQueue_Event(MsgQueue);
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		/* wake up for a frame held back by the rate control and for the next probe */
+		dwTimeout = INFINITE;
+		now = GetTickCount64();
+
+		if (refreshTime)
+			dwTimeout = (refreshTime > now) ? (DWORD) (refreshTime - now) : 0;
+
+		if (client->activated && settings->NetworkAutoDetect)
+			dwTimeout = MIN(dwTimeout, (probeTime > now) ? (DWORD) (probeTime - now) : 0);
+
+		status = WaitForMultipleObjects(nCount, events, FALSE, dwTimeout);
+		now = GetTickCount64();
+
+		if (refreshTime && (now >= refreshTime))
+		{
+			refreshTime = 0;
+
+			if (!shadow_client_refresh_request(client))
+				WLog_WARN(TAG, "Failed to request a frame held back by the rate control");
+		}
+
+		if (client->activated && settings->NetworkAutoDetect && (now >= probeTime))
+		{
+			probeTime = now + SHADOW_RATE_PROBE_INTERVAL;
+
+			if (!shadow_client_autodetect_probe(client, probeSequence++))
+				WLog_WARN(TAG, "Failed to send network autodetect requests");
+		}
 
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
@@ -1526,8 +2840,26 @@ static void* shadow_client_thread(rdpShadowClient* client)
 			 * (at shadow_multiclient_consume). As best practice, subsystem
 			 * implementation should invoke shadow_subsystem_frame_update which
 			 * triggers the event and then wait for completion */
-			if (client->activated && !client->suppressOutput)
+			/* A client that does not keep up with its output merges the
+			 * skipped frames into its invalid region instead of stalling
+			 * the subsystem, which waits for every client to consume. */
+			send = client->activated && !client->suppressOutput &&
+			       !peer->IsOutputQueueFull(peer);
+
+			/* Frames the rate control holds back are merged as well and
+			 * requested again once it lets the next one through. */
+			if (send && !shadow_rate_may_send(encoder->rate, &rateTimeout))
+			{
+				send = FALSE;
+
+				if (!refreshTime)
+					refreshTime = GetTickCount64() + rateTimeout;
+			}
+
+			if (send)
 			{
+				refreshTime = 0;
+
 				/* Send screen update or resize to this client */
 
 				/* Check resize */
@@ -1704,6 +3036,8 @@ static void* shadow_client_thread(rdpShadowClient* client)
 		(void)client->rdpgfx->Close(client->rdpgfx);
 	}
 
+	shadow_cache_free(gfxstatus.gfxCache);
+
 	shadow_client_channels_free(client);
 
 	if (UpdateSubscriber)
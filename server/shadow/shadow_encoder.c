@@ -20,14 +20,32 @@
 #include "config.h"
 #endif
 
+#include <winpr/interlocked.h>
+
+#if defined(WITH_SSE2)
+#include <emmintrin.h>
+#elif defined(WITH_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <freerdp/log.h>
+
 #include "shadow.h"
 
 #include "shadow_encoder.h"
 
+#define TAG SERVER_TAG("shadow.encoder")
+
+/* H.264 quantization parameter added per quality level */
+#define SHADOW_ENCODER_QP_STEP	4
+
+/* pixels per job, smaller updates are not worth handing to another thread */
+#define SHADOW_ENCODER_JOB_PIXELS	(256 * 256)
+
 int shadow_encoder_preferred_fps(rdpShadowEncoder* encoder)
 {
-	/* Return preferred fps calculated according to the last
-	 * sent frame id and last client-acknowledged frame id.
+	/* Return preferred fps calculated by the rate control from
+	 * frame acknowledgements, round trip time and bandwidth.
 	 */
 	return encoder->fps;
 }
@@ -44,32 +62,450 @@ UINT32 shadow_encoder_inflight_frames(rdpShadowEncoder* encoder)
 
 UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder)
 {
-	UINT32 frameId;
-	int inFlightFrames;
-	inFlightFrames = shadow_encoder_inflight_frames(encoder);
-
 	/*
-	 * Calculate preferred fps according to how much frames are
-	 * in-progress. Note that it only works when subsytem implementation
-	 * calls shadow_encoder_preferred_fps and takes the suggestion.
+	 * Frames in progress are limited by shadow_rate_may_send, which
+	 * also sets the preferred fps from the frame acknowledgements.
 	 */
-	if (inFlightFrames > 1)
+	return ++encoder->frameId;
+}
+
+/**
+ * Applies the quality level and targets of the rate control to the codecs.
+ * RemoteFX only gets new quantization values when the level changed, the
+ * other codecs take theirs per frame.
+ */
+static void shadow_encoder_apply_rate(rdpShadowEncoder* encoder)
+{
+	UINT32 quality;
+	rdpShadowRate* rate = encoder->rate;
+	rdpShadowServer* server = encoder->server;
+	rdpContext* context = (rdpContext*) encoder->client;
+	rdpSettings* settings = context->settings;
+	quality = rate->quality;
+	encoder->fps = rate->fps;
+
+	if (encoder->rfx && (encoder->rfxQuality != quality))
+	{
+		if (shadow_rate_set_rfx_quality(encoder->rfx, quality))
+			encoder->rfxQuality = quality;
+	}
+
+	if (encoder->nsc)
+		encoder->nsc->ColorLossLevel = MIN(settings->NSCodecColorLossLevel + quality, 7);
+
+	if (encoder->h264)
+	{
+		encoder->h264->FrameRate = rate->fps;
+		encoder->h264->BitRate = MIN(server->h264BitRate, rate->bitRate);
+		encoder->h264->QP = MIN(server->h264QP + quality * SHADOW_ENCODER_QP_STEP, 51);
+	}
+}
+
+/**
+ * Tiles are classified by how often they changed in the last eight frames
+ * sent, by the number of distinct colours and by the share of pixels equal
+ * to their left neighbour. Text and user interface elements use few colours
+ * or consist mostly of flat runs even when anti-aliased, photos do neither.
+ */
+
+#define SHADOW_ENCODER_VIDEO_FRAMES	6
+#define SHADOW_ENCODER_TEXT_COLORS	64
+#define SHADOW_ENCODER_TEXT_FLAT_PERCENT	60
+
+void shadow_encoder_update_history(rdpShadowEncoder* encoder, const RECTANGLE_16* rects,
+                                   UINT32 numRects)
+{
+	int tx, ty;
+	UINT32 index;
+	int count = encoder->gridWidth * encoder->gridHeight;
+
+	if (!encoder->gridHistory)
+		return;
+
+	for (tx = 0; tx < count; tx++)
+		encoder->gridHistory[tx] <<= 1;
+
+	for (index = 0; index < numRects; index++)
+	{
+		if ((rects[index].right <= rects[index].left) ||
+		    (rects[index].bottom <= rects[index].top))
+			continue;
+
+		for (ty = rects[index].top / encoder->maxTileHeight;
+		     (ty <= (rects[index].bottom - 1) / encoder->maxTileHeight) &&
+		     (ty < encoder->gridHeight); ty++)
+		{
+			for (tx = rects[index].left / encoder->maxTileWidth;
+			     (tx <= (rects[index].right - 1) / encoder->maxTileWidth) &&
+			     (tx < encoder->gridWidth); tx++)
+				encoder->gridHistory[(ty * encoder->gridWidth) + tx] |= 1;
+		}
+	}
+}
+
+SHADOW_TILE_CLASS shadow_encoder_classify_tile(rdpShadowEncoder* encoder,
+        const BYTE* pSrcData, int nSrcStep, const RECTANGLE_16* tile)
+{
+	int x, y;
+	int tx, ty;
+	BYTE history;
+	UINT32 pixel;
+	UINT32 previous;
+	UINT32 slot;
+	UINT32 flat = 0;
+	UINT32 pixels;
+	UINT32 numColors = 0;
+	UINT32 colors[SHADOW_ENCODER_TEXT_COLORS * 2];
+	BYTE used[SHADOW_ENCODER_TEXT_COLORS * 2] = { 0 };
+	const BYTE* pLine;
+	tx = tile->left / encoder->maxTileWidth;
+	ty = tile->top / encoder->maxTileHeight;
+
+	if (encoder->gridHistory && (tx < encoder->gridWidth) && (ty < encoder->gridHeight))
+	{
+		history = encoder->gridHistory[(ty * encoder->gridWidth) + tx];
+
+		for (x = 0; history; history >>= 1)
+			x += history & 1;
+
+		if (x >= SHADOW_ENCODER_VIDEO_FRAMES)
+			return SHADOW_TILE_VIDEO;
+	}
+
+	pixels = (tile->right - tile->left) * (tile->bottom - tile->top);
+
+	for (y = tile->top; y < tile->bottom; y++)
+	{
+		pLine = &pSrcData[(y * nSrcStep) + (tile->left * 4)];
+		CopyMemory(&previous, pLine, 4);
+		previous = ~previous;
+
+		for (x = 0; x < (tile->right - tile->left); x++)
+		{
+			CopyMemory(&pixel, &pLine[x * 4], 4);
+			pixel &= 0x00FFFFFF;
+
+			if (pixel == previous)
+			{
+				flat++;
+				continue;
+			}
+
+			previous = pixel;
+
+			if (numColors > SHADOW_ENCODER_TEXT_COLORS)
+				continue;
+
+			/* open addressing, the table is never more than half full */
+			slot = (pixel * 0x9E3779B1) >> 25;
+
+			while (used[slot] && (colors[slot] != pixel))
+				slot = (slot + 1) & ((SHADOW_ENCODER_TEXT_COLORS * 2) - 1);
+
+			if (!used[slot])
+			{
+				used[slot] = 1;
+				colors[slot] = pixel;
+				numColors++;
+			}
+		}
+	}
+
+	if ((numColors <= SHADOW_ENCODER_TEXT_COLORS) ||
+	    ((flat * 100) >= (pixels * SHADOW_ENCODER_TEXT_FLAT_PERCENT)))
+		return SHADOW_TILE_TEXT;
+
+	return SHADOW_TILE_IMAGE;
+}
+
+static INLINE BOOL shadow_encoder_row_color(const BYTE* pLine, UINT32 width, UINT32 color)
+{
+	UINT32 x = 0;
+	UINT32 pixel;
+#if defined(WITH_SSE2)
+	const __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i fill = _mm_set1_epi32((int) color);
+	__m128i eq = _mm_set1_epi32(-1);
+
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*) &pLine[x * 4]), mask);
+		eq = _mm_and_si128(eq, _mm_cmpeq_epi32(v, fill));
+	}
+
+	if (_mm_movemask_epi8(eq) != 0xFFFF)
+		return FALSE;
+
+#elif defined(WITH_NEON)
+	const uint32x4_t mask = vdupq_n_u32(0x00FFFFFF);
+	const uint32x4_t fill = vdupq_n_u32(color);
+	uint32x4_t diff = vdupq_n_u32(0);
+
+	for (; x + 4 <= width; x += 4)
+	{
+		uint32x4_t v = vandq_u32(vld1q_u32((const uint32_t*) &pLine[x * 4]), mask);
+		diff = vorrq_u32(diff, veorq_u32(v, fill));
+	}
+
+	if ((vgetq_lane_u64(vreinterpretq_u64_u32(diff), 0) |
+	     vgetq_lane_u64(vreinterpretq_u64_u32(diff), 1)) != 0)
+		return FALSE;
+
+#endif
+
+	for (; x < width; x++)
 	{
-		encoder->fps = (100 / (inFlightFrames + 1) * encoder->maxFps) / 100;
+		CopyMemory(&pixel, &pLine[x * 4], 4);
+
+		if ((pixel & 0x00FFFFFF) != color)
+			return FALSE;
 	}
-	else
+
+	return TRUE;
+}
+
+/**
+ * Checks whether all pixels of the rectangle have the same colour, the
+ * alpha channel is ignored. Returns the colour in pColor.
+ */
+BOOL shadow_encoder_rect_color(const BYTE* pSrcData, int nSrcStep, const RECTANGLE_16* rect,
+                               UINT32* pColor)
+{
+	int y;
+	UINT32 color;
+	UINT32 width = rect->right - rect->left;
+	const BYTE* pLine = &pSrcData[(rect->top * nSrcStep) + (rect->left * 4)];
+
+	if ((rect->right <= rect->left) || (rect->bottom <= rect->top))
+		return FALSE;
+
+	CopyMemory(&color, pLine, 4);
+	color &= 0x00FFFFFF;
+
+	for (y = rect->top; y < rect->bottom; y++)
 	{
-		encoder->fps += 2;
+		if (!shadow_encoder_row_color(pLine, width, color))
+			return FALSE;
 
-		if (encoder->fps > encoder->maxFps)
-			encoder->fps = encoder->maxFps;
+		pLine += nSrcStep;
 	}
 
-	if (encoder->fps < 1)
-		encoder->fps = 1;
+	*pColor = color;
+	return TRUE;
+}
 
-	frameId = ++encoder->frameId;
-	return frameId;
+static DWORD shadow_encoder_planar_flags(rdpShadowEncoder* encoder)
+{
+	DWORD planarFlags = 0;
+	rdpContext* context = (rdpContext*) encoder->client;
+	rdpSettings* settings = context->settings;
+
+	if (settings->DrawAllowSkipAlpha)
+		planarFlags |= PLANAR_FORMAT_HEADER_NA;
+
+	planarFlags |= PLANAR_FORMAT_HEADER_RLE;
+	return planarFlags;
+}
+
+static void CALLBACK shadow_encoder_job_work(PTP_CALLBACK_INSTANCE instance, void* context,
+        PTP_WORK work)
+{
+	SHADOW_ENCODER_JOB* job = (SHADOW_ENCODER_JOB*) context;
+	rdpShadowServer* server = job->encoder->server;
+	job->status = job->fn(job, job->arg, job->first, job->last);
+	InterlockedDecrement(&server->encodeJobs);
+}
+
+/**
+ * Creates the codec contexts a worker job needs for the given codecs and
+ * copies the parameters of the encoder, which the rate control changes
+ * from frame to frame.
+ */
+static BOOL shadow_encoder_prepare_job(rdpShadowEncoder* encoder, SHADOW_ENCODER_JOB* job,
+                                       UINT32 codecs)
+{
+	if (!job->work)
+	{
+		if (!(job->work = CreateThreadpoolWork(shadow_encoder_job_work, (void*) job,
+		                                       &encoder->server->encodeEnv)))
+			return FALSE;
+	}
+
+	if (codecs & FREERDP_CODEC_NSCODEC)
+	{
+		if (!job->nsc && !(job->nsc = nsc_context_new()))
+			return FALSE;
+
+		if (!nsc_context_reset(job->nsc, encoder->width, encoder->height))
+			return FALSE;
+
+		job->nsc->ColorLossLevel = encoder->nsc->ColorLossLevel;
+		job->nsc->ChromaSubsamplingLevel = encoder->nsc->ChromaSubsamplingLevel;
+		job->nsc->DynamicColorFidelity = encoder->nsc->DynamicColorFidelity;
+		nsc_context_set_pixel_format(job->nsc, PIXEL_FORMAT_BGRX32);
+	}
+
+	if ((codecs & FREERDP_CODEC_PLANAR) && !job->planar)
+	{
+		if (!(job->planar = freerdp_bitmap_planar_context_new(shadow_encoder_planar_flags(encoder),
+		                    encoder->maxTileWidth, encoder->maxTileHeight)))
+			return FALSE;
+	}
+
+	if ((codecs & FREERDP_CODEC_INTERLEAVED) && !job->interleaved)
+	{
+		if (!(job->interleaved = bitmap_interleaved_context_new(TRUE)))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Number of jobs to split numItems items covering the given number of
+ * pixels into. Small updates stay on the client thread.
+ */
+UINT32 shadow_encoder_num_jobs(rdpShadowEncoder* encoder, UINT32 numItems, UINT32 pixels)
+{
+	UINT32 numJobs = pixels / SHADOW_ENCODER_JOB_PIXELS;
+	numJobs = MIN(numJobs, encoder->maxJobs);
+	numJobs = MIN(numJobs, numItems);
+	return MAX(numJobs, 1);
+}
+
+/**
+ * Splits items [0, numItems) into numJobs contiguous ranges and runs fn on
+ * each. Job 0 runs on the calling thread, the others on the encoding pool
+ * of the server while it has idle workers. With every worker busy, which
+ * happens when many clients encode at once, the remaining ranges run on
+ * the calling thread as well. Returns when all jobs are done, so clients
+ * send the results in order on their own thread.
+ */
+BOOL shadow_encoder_run_jobs(rdpShadowEncoder* encoder, UINT32 codecs, UINT32 numJobs,
+                             UINT32 numItems, pfnShadowEncoderJob fn, void* arg)
+{
+	UINT32 index;
+	UINT32 submitted;
+	BOOL status = TRUE;
+	SHADOW_ENCODER_JOB* job;
+	rdpShadowServer* server = encoder->server;
+
+	if (!numItems)
+		return TRUE;
+
+	numJobs = MIN(MAX(numJobs, 1), MIN(encoder->maxJobs, numItems));
+
+	for (index = 0; index < numJobs; index++)
+	{
+		job = &encoder->jobs[index];
+		job->fn = fn;
+		job->arg = arg;
+		job->first = (UINT32)(((UINT64) numItems * index) / numJobs);
+		job->last = (UINT32)(((UINT64) numItems * (index + 1)) / numJobs);
+		job->status = FALSE;
+		Stream_SetPosition(job->bs, 0);
+	}
+
+	job = &encoder->jobs[0];
+	job->nsc = encoder->nsc;
+	job->planar = encoder->planar;
+	job->interleaved = encoder->interleaved;
+
+	for (submitted = 1; submitted < numJobs; submitted++)
+	{
+		job = &encoder->jobs[submitted];
+
+		if (InterlockedIncrement(&server->encodeJobs) > (LONG) server->encodeThreads)
+		{
+			InterlockedDecrement(&server->encodeJobs);
+			break;
+		}
+
+		if (!shadow_encoder_prepare_job(encoder, job, codecs))
+		{
+			WLog_WARN(TAG, "failed to prepare encoding job %lu", (unsigned long) submitted);
+			InterlockedDecrement(&server->encodeJobs);
+			break;
+		}
+
+		SubmitThreadpoolWork(job->work);
+	}
+
+	if (!fn(&encoder->jobs[0], arg, encoder->jobs[0].first, encoder->jobs[0].last))
+		status = FALSE;
+
+	for (index = submitted; index < numJobs; index++)
+	{
+		job = &encoder->jobs[index];
+
+		if (!fn(&encoder->jobs[0], arg, job->first, job->last))
+			status = FALSE;
+	}
+
+	for (index = 1; index < submitted; index++)
+	{
+		job = &encoder->jobs[index];
+		WaitForThreadpoolWorkCallbacks(job->work, FALSE);
+
+		if (!job->status)
+			status = FALSE;
+	}
+
+	return status;
+}
+
+static int shadow_encoder_init_jobs(rdpShadowEncoder* encoder)
+{
+	UINT32 index;
+	rdpShadowServer* server = encoder->server;
+	encoder->maxJobs = server->encodePool ? MAX(server->encodeThreads, 1) : 1;
+	encoder->jobs = (SHADOW_ENCODER_JOB*) calloc(encoder->maxJobs, sizeof(SHADOW_ENCODER_JOB));
+
+	if (!encoder->jobs)
+		return -1;
+
+	for (index = 0; index < encoder->maxJobs; index++)
+	{
+		encoder->jobs[index].encoder = encoder;
+		encoder->jobs[index].index = index;
+
+		if (!(encoder->jobs[index].bs = Stream_New(NULL,
+		                                encoder->maxTileWidth * encoder->maxTileHeight * 4)))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void shadow_encoder_uninit_jobs(rdpShadowEncoder* encoder)
+{
+	UINT32 index;
+	SHADOW_ENCODER_JOB* job;
+
+	if (!encoder->jobs)
+		return;
+
+	for (index = 0; index < encoder->maxJobs; index++)
+	{
+		job = &encoder->jobs[index];
+
+		if (job->work)
+			CloseThreadpoolWork(job->work);
+
+		/* the codecs of job 0 belong to the encoder */
+		if (index > 0)
+		{
+			nsc_context_free(job->nsc);
+			freerdp_bitmap_planar_context_free(job->planar);
+			bitmap_interleaved_context_free(job->interleaved);
+		}
+
+		Stream_Free(job->bs, TRUE);
+	}
+
+	free(encoder->jobs);
+	encoder->jobs = NULL;
+	encoder->maxJobs = 0;
 }
 
 static int shadow_encoder_init_grid(rdpShadowEncoder* encoder)
@@ -93,6 +529,11 @@ static int shadow_encoder_init_grid(rdpShadowEncoder* encoder)
 	if (!encoder->grid)
 		return -1;
 
+	encoder->gridHistory = (BYTE*) calloc(tileCount, sizeof(BYTE));
+
+	if (!encoder->gridHistory)
+		return -1;
+
 	for (i = 0; i < encoder->gridHeight; i++)
 	{
 		for (j = 0; j < encoder->gridWidth; j++)
@@ -119,6 +560,9 @@ static int shadow_encoder_uninit_grid(rdpShadowEncoder* encoder)
 		encoder->grid = NULL;
 	}
 
+	free(encoder->gridHistory);
+	encoder->gridHistory = NULL;
+
 	encoder->gridWidth = 0;
 	encoder->gridHeight = 0;
 	return 0;
@@ -126,8 +570,10 @@ static int shadow_encoder_uninit_grid(rdpShadowEncoder* encoder)
 
 static int shadow_encoder_init_rfx(rdpShadowEncoder* encoder)
 {
+	/* tile work of RemoteFX runs on the pool shared by all clients */
 	if (!encoder->rfx)
-		encoder->rfx = rfx_context_new(TRUE);
+		encoder->rfx = rfx_context_new_ex(TRUE,
+		                                  encoder->server->encodePool ? &encoder->server->encodeEnv : NULL);
 
 	if (!encoder->rfx)
 		goto fail;
@@ -136,6 +582,7 @@ static int shadow_encoder_init_rfx(rdpShadowEncoder* encoder)
 		goto fail;
 
 	encoder->rfx->mode = encoder->server->rfxMode;
+	encoder->rfxQuality = 0;
 	rfx_context_set_pixel_format(encoder->rfx, PIXEL_FORMAT_BGRX32);
 	encoder->codecs |= FREERDP_CODEC_REMOTEFX;
 	return 1;
@@ -172,14 +619,7 @@ fail:
 
 static int shadow_encoder_init_planar(rdpShadowEncoder* encoder)
 {
-	DWORD planarFlags = 0;
-	rdpContext* context = (rdpContext*) encoder->client;
-	rdpSettings* settings = context->settings;
-
-	if (settings->DrawAllowSkipAlpha)
-		planarFlags |= PLANAR_FORMAT_HEADER_NA;
-
-	planarFlags |= PLANAR_FORMAT_HEADER_RLE;
+	DWORD planarFlags = shadow_encoder_planar_flags(encoder);
 
 	if (!encoder->planar)
 	{
@@ -235,6 +675,8 @@ static int shadow_encoder_init_h264(rdpShadowEncoder* encoder)
 	encoder->h264->BitRate = encoder->server->h264BitRate;
 	encoder->h264->FrameRate = encoder->server->h264FrameRate;
 	encoder->h264->QP = encoder->server->h264QP;
+	/* one slice per thread of the encoding pool */
+	encoder->h264->NumberOfThreads = encoder->maxJobs;
 	encoder->codecs |= FREERDP_CODEC_AVC420;
 	return 1;
 fail:
@@ -257,6 +699,9 @@ static int shadow_encoder_init(rdpShadowEncoder* encoder)
 	if (!encoder->bs)
 		return -1;
 
+	if (!encoder->jobs && (shadow_encoder_init_jobs(encoder) < 0))
+		return -1;
+
 	return 1;
 }
 
@@ -322,6 +767,7 @@ static int shadow_encoder_uninit_h264(rdpShadowEncoder* encoder)
 
 static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 {
+	shadow_encoder_uninit_jobs(encoder);
 	shadow_encoder_uninit_grid(encoder);
 
 	if (encoder->bs)
@@ -384,6 +830,7 @@ int shadow_encoder_reset(rdpShadowEncoder* encoder)
 	encoder->frameId = 0;
 	encoder->lastAckframeId = 0;
 	encoder->frameAck = settings->SurfaceFrameMarkerEnabled;
+	shadow_rate_reset(encoder->rate, encoder->maxFps);
 	return 1;
 }
 
@@ -436,6 +883,7 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
+	shadow_encoder_apply_rate(encoder);
 	return 1;
 }
 
@@ -453,8 +901,16 @@ rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client)
 	encoder->fps = 16;
 	encoder->maxFps = 32;
 
+	if (!(encoder->rate = shadow_rate_new(encoder->maxFps)))
+	{
+		free(encoder);
+		return NULL;
+	}
+
 	if (shadow_encoder_init(encoder) < 0)
 	{
+		shadow_encoder_uninit(encoder);
+		shadow_rate_free(encoder->rate);
 		free(encoder);
 		return NULL;
 	}
@@ -468,5 +924,6 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 		return;
 
 	shadow_encoder_uninit(encoder);
+	shadow_rate_free(encoder->rate);
 	free(encoder);
 }
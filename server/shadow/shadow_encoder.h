@@ -27,6 +27,46 @@
 
 #include <freerdp/server/shadow.h>
 
+#include "shadow_rate.h"
+
+/* content of a tile, decides the codec it is sent with */
+enum _SHADOW_TILE_CLASS
+{
+	SHADOW_TILE_TEXT,	/* few colours or flat areas, text and user interface */
+	SHADOW_TILE_IMAGE,	/* many colours, photos and gradients */
+	SHADOW_TILE_VIDEO	/* changed in most of the recent frames */
+};
+typedef enum _SHADOW_TILE_CLASS SHADOW_TILE_CLASS;
+
+typedef struct _SHADOW_ENCODER_JOB SHADOW_ENCODER_JOB;
+
+/* encodes items [first, last) of a frame with the codecs of the job */
+typedef BOOL (*pfnShadowEncoderJob)(SHADOW_ENCODER_JOB* job, void* arg, UINT32 first,
+                                    UINT32 last);
+
+/**
+ * A part of a frame encoded on a worker of the server pool. Job 0 runs on
+ * the client thread with the codecs of the encoder, the others have codec
+ * contexts of their own so that they never share state.
+ */
+struct _SHADOW_ENCODER_JOB
+{
+	rdpShadowEncoder* encoder;
+	PTP_WORK work;
+	UINT32 index;
+
+	pfnShadowEncoderJob fn;
+	void* arg;
+	UINT32 first;
+	UINT32 last;
+	BOOL status;
+
+	wStream* bs;
+	NSC_CONTEXT* nsc;
+	BITMAP_PLANAR_CONTEXT* planar;
+	BITMAP_INTERLEAVED_CONTEXT* interleaved;
+};
+
 struct rdp_shadow_encoder
 {
 	rdpShadowClient* client;
@@ -40,6 +80,7 @@ struct rdp_shadow_encoder
 	int gridWidth;
 	int gridHeight;
 	BYTE* gridBuffer;
+	BYTE* gridHistory;
 	int maxTileWidth;
 	int maxTileHeight;
 
@@ -56,6 +97,12 @@ struct rdp_shadow_encoder
 	BOOL frameAck;
 	UINT32 frameId;
 	UINT32 lastAckframeId;
+
+	rdpShadowRate* rate;
+	UINT32 rfxQuality;
+
+	SHADOW_ENCODER_JOB* jobs;
+	UINT32 maxJobs;
 };
 
 #ifdef __cplusplus
@@ -66,6 +113,17 @@ int shadow_encoder_reset(rdpShadowEncoder* encoder);
 int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs);
 UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder);
 
+UINT32 shadow_encoder_num_jobs(rdpShadowEncoder* encoder, UINT32 numItems, UINT32 pixels);
+BOOL shadow_encoder_run_jobs(rdpShadowEncoder* encoder, UINT32 codecs, UINT32 numJobs,
+                             UINT32 numItems, pfnShadowEncoderJob fn, void* arg);
+
+void shadow_encoder_update_history(rdpShadowEncoder* encoder, const RECTANGLE_16* rects,
+                                   UINT32 numRects);
+BOOL shadow_encoder_rect_color(const BYTE* pSrcData, int nSrcStep, const RECTANGLE_16* rect,
+                               UINT32* pColor);
+SHADOW_TILE_CLASS shadow_encoder_classify_tile(rdpShadowEncoder* encoder,
+        const BYTE* pSrcData, int nSrcStep, const RECTANGLE_16* tile);
+
 rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client);
 void shadow_encoder_free(rdpShadowEncoder* encoder);
 
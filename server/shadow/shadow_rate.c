@@ -0,0 +1,438 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+#include <freerdp/channels/rdpgfx.h>
+
+#include "shadow.h"
+
+#include "shadow_rate.h"
+
+#define TAG SERVER_TAG("shadow.rate")
+
+/* bits per second */
+#define SHADOW_RATE_MIN_BITRATE	(128 * 1000)
+#define SHADOW_RATE_MAX_BITRATE	(100 * 1000 * 1000)
+
+/* queueing delay tolerated on top of the lowest delay seen, in ms */
+#define SHADOW_RATE_QUEUE_DELAY	50
+/* the lowest delay is forgotten after this many ms, routes change */
+#define SHADOW_RATE_BASE_WINDOW	10000
+/* acknowledged bytes are turned into a delivery rate over this many ms */
+#define SHADOW_RATE_SAMPLE_INTERVAL	250
+/* the target is changed at most once per round trip, but not more often than this */
+#define SHADOW_RATE_MIN_INTERVAL	200
+/* frames not acknowledged after this many ms and two round trips are not waited for */
+#define SHADOW_RATE_ACK_TIMEOUT	2000
+/* frames queued in the client decoder before it counts as congested */
+#define SHADOW_RATE_MAX_CLIENT_QUEUE	2
+/* quality is lowered before the frame rate drops below this */
+#define SHADOW_RATE_QUALITY_FPS	8
+
+/* default RemoteFX quantization, LL3 LH3 HL3 HH3 LH2 HL2 HH2 LH1 HL1 HH1 */
+static const UINT32 shadow_rate_rfx_quant[10] =
+{
+	6, 6, 6, 6, 7, 7, 8, 8, 8, 9
+};
+
+static INLINE UINT32 shadow_rate_average(UINT32 average, UINT32 sample)
+{
+	if (!average)
+		return sample;
+
+	return (UINT32) ((((UINT64) average) * 7 + sample) / 8);
+}
+
+static BOOL shadow_rate_congested(rdpShadowRate* rate)
+{
+	UINT32 delay = MAX(rate->queueDelay, rate->rttDelay);
+
+	if (delay > (SHADOW_RATE_QUEUE_DELAY + (rate->baseDelay / 4)))
+		return TRUE;
+
+	return !rate->ackSuspended && (rate->clientQueue > SHADOW_RATE_MAX_CLIENT_QUEUE);
+}
+
+/**
+ * Adjusts the target bit rate like TCP does with its window: it grows
+ * while frames arrive without queueing and drops below the rate the link
+ * was seen to deliver once they queue up. The frame rate follows from the
+ * target and the average frame size, when it would get too low the
+ * quality is lowered first. Called with the lock held.
+ */
+static void shadow_rate_update(rdpShadowRate* rate, UINT64 now)
+{
+	UINT64 bitRate;
+	UINT64 limit;
+	UINT32 budget;
+	UINT32 fps;
+	BOOL congested;
+
+	if ((now - rate->lastChange) < MAX(rate->rtt, SHADOW_RATE_MIN_INTERVAL))
+		return;
+
+	rate->lastChange = now;
+	bitRate = rate->bitRate;
+	congested = shadow_rate_congested(rate);
+
+	if (congested)
+	{
+		/* both only see what got through, the larger one is closer to the capacity */
+		limit = ((UINT64) MAX(rate->deliveryRate, rate->bandwidth)) * 1000;
+
+		if (limit && (limit < bitRate))
+			bitRate = limit * 85 / 100;
+		else
+			bitRate = bitRate * 85 / 100;
+	}
+	else
+	{
+		bitRate += bitRate / 8;
+	}
+
+	if (bitRate < SHADOW_RATE_MIN_BITRATE)
+		bitRate = SHADOW_RATE_MIN_BITRATE;
+
+	if (bitRate > rate->maxBitRate)
+		bitRate = rate->maxBitRate;
+
+	rate->bitRate = (UINT32) bitRate;
+	budget = rate->maxFps;
+
+	if (rate->frameBytes)
+		budget = (UINT32) MIN(bitRate / (((UINT64) rate->frameBytes) * 8), rate->maxFps);
+
+	/* only a link limited target lowers the quality, large updates alone do not */
+	if ((budget < SHADOW_RATE_QUALITY_FPS) && (rate->bitRate < rate->maxBitRate) &&
+	    (rate->quality < SHADOW_RATE_MAX_QUALITY))
+	{
+		rate->quality++;
+		rate->frameBytes = rate->frameBytes * 3 / 4;
+	}
+	else if (!congested && (rate->quality > 0) && (budget >= rate->maxFps))
+	{
+		rate->quality--;
+		rate->frameBytes = rate->frameBytes * 4 / 3;
+	}
+
+	fps = MAX(budget, 1);
+
+	/* a client that decodes slower than we send only queues the frames */
+	if (rate->decodeTime)
+		fps = MIN(fps, MAX(1000 / rate->decodeTime, 1));
+
+	if ((fps != rate->fps) && congested)
+		WLog_DBG(TAG, "congested: %lu kbit/s, %lu fps, quality %lu (rtt %lu ms, delay %lu ms)",
+		         (unsigned long) (rate->bitRate / 1000), (unsigned long) fps,
+		         (unsigned long) rate->quality, (unsigned long) rate->rtt,
+		         (unsigned long) MAX(rate->queueDelay, rate->rttDelay));
+
+	rate->fps = fps;
+}
+
+/**
+ * Counts the frames still on the way. Frames some clients never
+ * acknowledge, for example while minimized, are given up after a while.
+ */
+static UINT32 shadow_rate_inflight(rdpShadowRate* rate, UINT64 now)
+{
+	UINT32 index;
+	UINT32 inflight = 0;
+	UINT64 timeout = SHADOW_RATE_ACK_TIMEOUT + ((UINT64) rate->rtt) * 2;
+	SHADOW_RATE_FRAME* frame;
+
+	for (index = 0; index < SHADOW_RATE_HISTORY; index++)
+	{
+		frame = &rate->history[index];
+
+		if (frame->acked)
+			continue;
+
+		if ((now - frame->sentTime) > timeout)
+			frame->acked = TRUE;
+		else
+			inflight++;
+	}
+
+	return inflight;
+}
+
+/**
+ * Adds encoded bytes to the frame being sent. Only the client thread
+ * calls this, the lock is taken when the frame is complete.
+ */
+void shadow_rate_add_bytes(rdpShadowRate* rate, UINT32 bytes)
+{
+	rate->pendingBytes += bytes;
+}
+
+/**
+ * Records a sent frame. frameId is 0 for frames the client does not
+ * acknowledge.
+ */
+void shadow_rate_frame_sent(rdpShadowRate* rate, UINT32 frameId)
+{
+	UINT64 now = GetTickCount64();
+	SHADOW_RATE_FRAME* frame;
+	EnterCriticalSection(&rate->lock);
+	frame = &rate->history[rate->historyIndex];
+	rate->historyIndex = (rate->historyIndex + 1) % SHADOW_RATE_HISTORY;
+	frame->frameId = frameId;
+	frame->bytes = rate->pendingBytes;
+	frame->sentTime = now;
+	frame->acked = (frameId == 0);
+	rate->frameBytes = shadow_rate_average(rate->frameBytes, rate->pendingBytes);
+	rate->pendingBytes = 0;
+	rate->nextFrameTime = now + (1000 / rate->fps);
+	shadow_rate_update(rate, now);
+	LeaveCriticalSection(&rate->lock);
+}
+
+/**
+ * Acknowledges frameId and the frames sent before it. The time the frame
+ * took compared to the fastest recent one is the delay it spent queued.
+ */
+void shadow_rate_frame_acked(rdpShadowRate* rate, UINT32 frameId)
+{
+	UINT32 index;
+	UINT32 delay = 0;
+	UINT32 sample;
+	BOOL found = FALSE;
+	UINT64 now = GetTickCount64();
+	SHADOW_RATE_FRAME* frame;
+	EnterCriticalSection(&rate->lock);
+
+	for (index = 0; index < SHADOW_RATE_HISTORY; index++)
+	{
+		frame = &rate->history[index];
+
+		if (frame->acked || ((INT32) (frameId - frame->frameId) < 0))
+			continue;
+
+		frame->acked = TRUE;
+		rate->deliveredBytes += frame->bytes;
+
+		if (frame->frameId == frameId)
+		{
+			delay = (UINT32) (now - frame->sentTime);
+			found = TRUE;
+		}
+	}
+
+	if (found)
+	{
+		if (!rate->baseDelayTime || (delay <= rate->baseDelay) ||
+		    ((now - rate->baseDelayTime) > SHADOW_RATE_BASE_WINDOW))
+		{
+			rate->baseDelay = delay;
+			rate->baseDelayTime = now;
+		}
+
+		rate->queueDelay = delay - rate->baseDelay;
+	}
+
+	if (!rate->deliveredTime)
+	{
+		rate->deliveredTime = now;
+		rate->deliveredBytes = 0;
+	}
+	else if ((now - rate->deliveredTime) >= SHADOW_RATE_SAMPLE_INTERVAL)
+	{
+		sample = (UINT32) ((rate->deliveredBytes * 8) / (now - rate->deliveredTime));
+		rate->deliveryRate = rate->deliveryRate ? ((rate->deliveryRate * 3 + sample) / 4) : sample;
+		rate->deliveredTime = now;
+		rate->deliveredBytes = 0;
+	}
+
+	shadow_rate_update(rate, now);
+	LeaveCriticalSection(&rate->lock);
+}
+
+/**
+ * Frames waiting in the decoder of a graphics pipeline client. The
+ * client may stop acknowledging frames altogether.
+ */
+void shadow_rate_set_client_queue(rdpShadowRate* rate, UINT32 queueDepth)
+{
+	EnterCriticalSection(&rate->lock);
+
+	if (queueDepth == SUSPEND_FRAME_ACKNOWLEDGEMENT)
+	{
+		rate->ackSuspended = TRUE;
+		rate->clientQueue = 0;
+	}
+	else
+	{
+		rate->ackSuspended = FALSE;
+		rate->clientQueue = queueDepth;
+	}
+
+	LeaveCriticalSection(&rate->lock);
+}
+
+void shadow_rate_set_decode_time(rdpShadowRate* rate, UINT32 decodeTime)
+{
+	EnterCriticalSection(&rate->lock);
+	rate->decodeTime = shadow_rate_average(rate->decodeTime, MAX(decodeTime, 1));
+	LeaveCriticalSection(&rate->lock);
+}
+
+/**
+ * A round trip time measurement. The response is queued behind the frames
+ * sent before the request, so it also shows queueing for clients that do
+ * not acknowledge frames.
+ */
+void shadow_rate_set_rtt(rdpShadowRate* rate, UINT32 rtt)
+{
+	UINT64 now = GetTickCount64();
+	EnterCriticalSection(&rate->lock);
+
+	if (!rate->baseRttTime || (rtt <= rate->baseRtt) ||
+	    ((now - rate->baseRttTime) > SHADOW_RATE_BASE_WINDOW))
+	{
+		rate->baseRtt = rtt;
+		rate->baseRttTime = now;
+	}
+
+	rate->rttDelay = rtt - rate->baseRtt;
+	rate->rtt = shadow_rate_average(rate->rtt, MAX(rtt, 1));
+	shadow_rate_update(rate, now);
+	LeaveCriticalSection(&rate->lock);
+}
+
+/**
+ * A continuous bandwidth measurement in kbit/s. Like the delivery rate it
+ * counts what was sent in the interval, so it is only used to back off.
+ */
+void shadow_rate_set_bandwidth(rdpShadowRate* rate, UINT32 bandwidth)
+{
+	EnterCriticalSection(&rate->lock);
+	rate->bandwidth = bandwidth;
+	LeaveCriticalSection(&rate->lock);
+}
+
+/**
+ * Checks whether the next frame may be sent now. If not, pTimeout is set
+ * to the number of ms after which to ask again.
+ */
+BOOL shadow_rate_may_send(rdpShadowRate* rate, UINT32* pTimeout)
+{
+	BOOL status = TRUE;
+	UINT32 maxInflight;
+	UINT64 now = GetTickCount64();
+	EnterCriticalSection(&rate->lock);
+
+	if (now < rate->nextFrameTime)
+	{
+		*pTimeout = (UINT32) (rate->nextFrameTime - now);
+		status = FALSE;
+	}
+	else if (!rate->ackSuspended)
+	{
+		/* the frames of one round trip are on the way anyway, more only queue up */
+		maxInflight = 2 + (rate->rtt * rate->fps) / 1000;
+
+		if (shadow_rate_inflight(rate, now) > maxInflight)
+		{
+			*pTimeout = 1000 / rate->fps;
+			status = FALSE;
+		}
+	}
+
+	LeaveCriticalSection(&rate->lock);
+	return status;
+}
+
+/**
+ * Sets the quantization of an encoder context for a quality level, each
+ * level quantizes all subbands one step coarser.
+ */
+BOOL shadow_rate_set_rfx_quality(RFX_CONTEXT* rfx, UINT32 quality)
+{
+	size_t index;
+	UINT32* quants;
+
+	if (!rfx)
+		return FALSE;
+
+	if (!(quants = (UINT32*) calloc(ARRAYSIZE(shadow_rate_rfx_quant), sizeof(UINT32))))
+		return FALSE;
+
+	for (index = 0; index < ARRAYSIZE(shadow_rate_rfx_quant); index++)
+		quants[index] = MIN(shadow_rate_rfx_quant[index] + quality, 15);
+
+	free(rfx->quants);
+	rfx->quants = quants;
+	rfx->numQuant = 1;
+	rfx->quantIdxY = 0;
+	rfx->quantIdxCb = 0;
+	rfx->quantIdxCr = 0;
+	return TRUE;
+}
+
+/**
+ * Forgets the frames of a previous encoder configuration, the link
+ * measurements stay valid.
+ */
+void shadow_rate_reset(rdpShadowRate* rate, UINT32 maxFps)
+{
+	EnterCriticalSection(&rate->lock);
+	ZeroMemory(rate->history, sizeof(rate->history));
+	rate->historyIndex = 0;
+	rate->pendingBytes = 0;
+	rate->frameBytes = 0;
+	rate->nextFrameTime = 0;
+	rate->maxFps = maxFps;
+	rate->fps = MIN(MAX(rate->fps, 1), maxFps);
+	LeaveCriticalSection(&rate->lock);
+}
+
+rdpShadowRate* shadow_rate_new(UINT32 maxFps)
+{
+	rdpShadowRate* rate;
+	rate = (rdpShadowRate*) calloc(1, sizeof(rdpShadowRate));
+
+	if (!rate)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&rate->lock, 4000))
+	{
+		free(rate);
+		return NULL;
+	}
+
+	rate->maxFps = maxFps;
+	rate->fps = maxFps;
+	rate->maxBitRate = SHADOW_RATE_MAX_BITRATE;
+	rate->bitRate = rate->maxBitRate;
+	return rate;
+}
+
+void shadow_rate_free(rdpShadowRate* rate)
+{
+	if (!rate)
+		return;
+
+	DeleteCriticalSection(&rate->lock);
+	free(rate);
+}
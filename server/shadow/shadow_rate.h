@@ -0,0 +1,114 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_RATE_H
+#define FREERDP_SHADOW_SERVER_RATE_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/codec/rfx.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+/* quality levels, 0 is the codec default and each level is coarser */
+#define SHADOW_RATE_MAX_QUALITY	4
+
+/* interval of the continuous round trip and bandwidth measurements */
+#define SHADOW_RATE_PROBE_INTERVAL	1000
+
+/* frames remembered until they are acknowledged */
+#define SHADOW_RATE_HISTORY	64
+
+typedef struct rdp_shadow_rate rdpShadowRate;
+
+struct _SHADOW_RATE_FRAME
+{
+	UINT32 frameId;
+	UINT32 bytes;
+	UINT64 sentTime;
+	BOOL acked;
+};
+typedef struct _SHADOW_RATE_FRAME SHADOW_RATE_FRAME;
+
+/**
+ * Rate control of one client. Frame acknowledgements tell how long frames
+ * take to arrive and how fast the link delivers them, the continuous
+ * autodetect adds round trip time and bandwidth and the graphics pipeline
+ * quality of experience reports add the decode time of the client.
+ * From those it derives a target bit rate, the frame rate and a quality
+ * level the encoder applies to its codecs.
+ */
+struct rdp_shadow_rate
+{
+	UINT32 maxFps;
+	UINT32 maxBitRate;
+
+	/* results */
+	UINT32 fps;
+	UINT32 quality;
+	UINT32 bitRate;
+
+	/* measurements, times in milliseconds and rates in kbit/s */
+	UINT32 rtt;
+	UINT32 bandwidth;
+	UINT32 deliveryRate;
+	UINT32 decodeTime;
+	UINT32 frameBytes;
+	UINT32 baseDelay;
+	UINT64 baseDelayTime;
+	UINT32 queueDelay;
+	UINT32 baseRtt;
+	UINT64 baseRttTime;
+	UINT32 rttDelay;
+	UINT32 clientQueue;
+	BOOL ackSuspended;
+
+	UINT32 pendingBytes;
+	SHADOW_RATE_FRAME history[SHADOW_RATE_HISTORY];
+	UINT32 historyIndex;
+	UINT64 deliveredBytes;
+	UINT64 deliveredTime;
+
+	UINT64 lastChange;
+	UINT64 nextFrameTime;
+
+	CRITICAL_SECTION lock;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void shadow_rate_add_bytes(rdpShadowRate* rate, UINT32 bytes);
+void shadow_rate_frame_sent(rdpShadowRate* rate, UINT32 frameId);
+void shadow_rate_frame_acked(rdpShadowRate* rate, UINT32 frameId);
+void shadow_rate_set_client_queue(rdpShadowRate* rate, UINT32 queueDepth);
+void shadow_rate_set_decode_time(rdpShadowRate* rate, UINT32 decodeTime);
+void shadow_rate_set_rtt(rdpShadowRate* rate, UINT32 rtt);
+void shadow_rate_set_bandwidth(rdpShadowRate* rate, UINT32 bandwidth);
+BOOL shadow_rate_may_send(rdpShadowRate* rate, UINT32* pTimeout);
+
+BOOL shadow_rate_set_rfx_quality(RFX_CONTEXT* rfx, UINT32 quality);
+
+void shadow_rate_reset(rdpShadowRate* rate, UINT32 maxFps);
+rdpShadowRate* shadow_rate_new(UINT32 maxFps);
+void shadow_rate_free(rdpShadowRate* rate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_RATE_H */
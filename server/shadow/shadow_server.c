@@ -24,11 +24,13 @@
 #include <winpr/ssl.h>
 #include <winpr/wnd.h>
 #include <winpr/path.h>
+#include <winpr/sysinfo.h>
 #include <winpr/cmdline.h>
 #include <winpr/winsock.h>
 
 #include <freerdp/log.h>
 #include <freerdp/version.h>
+#include <freerdp/primitives.h>
 
 #include <winpr/tools/makecert.h>
 
@@ -41,6 +43,9 @@
 
 #define TAG SERVER_TAG("shadow")
 
+/* bytes queued for a client before its screen updates are held back */
+#define SHADOW_OUTPUT_QUEUE_LIMIT	(4 * 1024 * 1024)
+
 static COMMAND_LINE_ARGUMENT_A shadow_args[] =
 {
 	{ "port", COMMAND_LINE_VALUE_REQUIRED, "<number>", NULL, NULL, -1, NULL, "Server port" },
@@ -56,6 +61,10 @@ static COMMAND_LINE_ARGUMENT_A shadow_args[] =
 	{ "sec-nla", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "nla protocol security" },
 	{ "sec-ext", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "nla extended protocol security" },
 	{ "sam-file", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "NTLM SAM file for NLA authentication" },
+	{ "output-queue-limit", COMMAND_LINE_VALUE_REQUIRED, "<bytes>", NULL, NULL, -1, NULL, "Output queued per client before updates are skipped (0 to wait for each write)" },
+	{ "compression-adaptive", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Pick the bulk compression level from link speed and CPU cost" },
+	{ "h264-region", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Encode only the changed areas of the desktop with H.264" },
+	{ "kernel-tls", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Offload TLS 1.2 record encryption to the kernel" },
 	{ "version", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_VERSION, NULL, NULL, NULL, -1, NULL, "Print version" },
 	{ "help", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_HELP, NULL, NULL, NULL, -1, "?", "Print help" },
 	{ NULL, 0, NULL, NULL, NULL, -1, NULL, NULL }
@@ -316,6 +325,23 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		{
 			freerdp_set_param_string(settings, FreeRDP_NtlmSamFile, arg->Value);
 		}
+		CommandLineSwitchCase(arg, "output-queue-limit")
+		{
+			freerdp_set_param_uint32(settings, FreeRDP_OutputQueueLimit,
+			                         (UINT32) strtoul(arg->Value, NULL, 0));
+		}
+		CommandLineSwitchCase(arg, "compression-adaptive")
+		{
+			freerdp_set_param_bool(settings, FreeRDP_CompressionAdaptive, arg->Value ? TRUE : FALSE);
+		}
+		CommandLineSwitchCase(arg, "h264-region")
+		{
+			server->h264Region = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "kernel-tls")
+		{
+			freerdp_set_param_bool(settings, FreeRDP_TlsKernelOffload, arg->Value ? TRUE : FALSE);
+		}
 		CommandLineSwitchDefault(arg)
 		{
 
@@ -460,6 +486,11 @@ int shadow_server_start(rdpShadowServer* server)
 	if (!server->capture)
 		return -1;
 
+	server->share = shadow_share_new(server);
+
+	if (!server->share)
+		return -1;
+
 	if (!server->ipcSocket)
 		status = server->listener->Open(server->listener, NULL, (UINT16) server->port);
 	else
@@ -501,6 +532,12 @@ int shadow_server_stop(rdpShadowServer* server)
 		server->capture = NULL;
 	}
 
+	if (server->share)
+	{
+		shadow_share_free(server->share);
+		server->share = NULL;
+	}
+
 	return 0;
 }
 
@@ -653,6 +690,46 @@ out_fail:
 	return ret;
 }
 
+static void shadow_server_uninit_encode_pool(rdpShadowServer* server)
+{
+	if (!server->encodePool)
+		return;
+
+	DestroyThreadpoolEnvironment(&server->encodeEnv);
+	CloseThreadpool(server->encodePool);
+	server->encodePool = NULL;
+}
+
+/**
+ * One pool of worker threads, one per processor, runs the encoding jobs
+ * of all clients. A few busy sessions use every core while many light
+ * ones encode on their own threads without adding threads of their own.
+ */
+static int shadow_server_init_encode_pool(rdpShadowServer* server)
+{
+	SYSTEM_INFO sysinfo;
+	GetNativeSystemInfo(&sysinfo);
+	server->encodeThreads = MAX(sysinfo.dwNumberOfProcessors, 1);
+	server->encodeJobs = 0;
+	/* initialize the primitives before codecs use them from several threads */
+	primitives_get();
+
+	if (!(server->encodePool = CreateThreadpool(NULL)))
+		return -1;
+
+	InitializeThreadpoolEnvironment(&server->encodeEnv);
+	SetThreadpoolCallbackPool(&server->encodeEnv, server->encodePool);
+
+	if (!SetThreadpoolThreadMinimum(server->encodePool, server->encodeThreads))
+	{
+		shadow_server_uninit_encode_pool(server);
+		return -1;
+	}
+
+	SetThreadpoolThreadMaximum(server->encodePool, server->encodeThreads);
+	return 1;
+}
+
 int shadow_server_init(rdpShadowServer* server)
 {
 	int status;
@@ -670,6 +747,9 @@ int shadow_server_init(rdpShadowServer* server)
 	if (!InitializeCriticalSectionAndSpinCount(&(server->lock), 4000))
 		goto fail_server_lock;
 
+	if (shadow_server_init_encode_pool(server) < 0)
+		goto fail_encode_pool;
+
 	status = shadow_server_init_config_path(server);
 
 	if (status < 0)
@@ -711,6 +791,8 @@ fail_certificate:
 	free(server->ConfigPath);
 	server->ConfigPath = NULL;
 fail_config_path:
+	shadow_server_uninit_encode_pool(server);
+fail_encode_pool:
 	DeleteCriticalSection(&(server->lock));
 fail_server_lock:
 	CloseHandle(server->StopEvent);
@@ -745,6 +827,8 @@ int shadow_server_uninit(rdpShadowServer* server)
 	free(server->ConfigPath);
 	server->ConfigPath = NULL;
 
+	shadow_server_uninit_encode_pool(server);
+
 	DeleteCriticalSection(&(server->lock));
 
 	CloseHandle(server->StopEvent);
@@ -774,6 +858,7 @@ rdpShadowServer* shadow_server_new()
 	server->h264BitRate = 1000000;
 	server->h264FrameRate = 30;
 	server->h264QP = 0;
+	server->h264Region = TRUE;
 
 	server->authentication = FALSE;
 
@@ -782,6 +867,9 @@ rdpShadowServer* shadow_server_new()
 	if (!server)
 		return NULL;
 
+	if (server->settings)
+		server->settings->OutputQueueLimit = SHADOW_OUTPUT_QUEUE_LIMIT;
+
 	return server;
 }
 
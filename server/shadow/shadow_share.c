@@ -0,0 +1,378 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/log.h>
+
+#include "shadow.h"
+
+#include "shadow_share.h"
+
+#define TAG SERVER_TAG("shadow.share")
+
+/* encoders not used for this many frames are released */
+#define SHADOW_SHARE_IDLE_FRAMES	256
+
+/**
+ * One encoder per distinct configuration. Clients that negotiated the
+ * same codec parameters for the same surface end up on the same encoder,
+ * so the encoding cost follows the number of configurations rather than
+ * the number of viewers.
+ */
+struct rdp_shadow_share_encoder
+{
+	RLGR_MODE mode;
+	UINT32 quality;
+	UINT32 format;
+	BYTE* pSrcData;
+	int nSrcStep;
+	UINT32 width;
+	UINT32 height;
+	UINT32 maxDataSize;
+
+	RFX_CONTEXT* rfx;
+	UINT64 lastUsed;
+	volatile LONG refCount;
+
+	CRITICAL_SECTION lock;
+};
+
+static void shadow_share_encoder_free(rdpShadowShareEncoder* encoder)
+{
+	if (!encoder)
+		return;
+
+	rfx_context_free(encoder->rfx);
+	DeleteCriticalSection(&encoder->lock);
+	free(encoder);
+}
+
+static rdpShadowShareEncoder* shadow_share_encoder_new(rdpShadowServer* server,
+        RLGR_MODE mode, UINT32 quality, BYTE* pSrcData, int nSrcStep, UINT32 width,
+        UINT32 height, UINT32 maxDataSize)
+{
+	rdpShadowShareEncoder* encoder;
+	encoder = (rdpShadowShareEncoder*) calloc(1, sizeof(rdpShadowShareEncoder));
+
+	if (!encoder)
+		return NULL;
+
+	encoder->mode = mode;
+	encoder->quality = quality;
+	encoder->format = PIXEL_FORMAT_BGRX32;
+	encoder->pSrcData = pSrcData;
+	encoder->nSrcStep = nSrcStep;
+	encoder->width = width;
+	encoder->height = height;
+	encoder->maxDataSize = maxDataSize;
+
+	if (!InitializeCriticalSectionAndSpinCount(&encoder->lock, 4000))
+	{
+		free(encoder);
+		return NULL;
+	}
+
+	if (!(encoder->rfx = rfx_context_new_ex(TRUE,
+	                     server->encodePool ? &server->encodeEnv : NULL)))
+		goto fail;
+
+	if (!rfx_context_reset(encoder->rfx, width, height))
+		goto fail;
+
+	if (!shadow_rate_set_rfx_quality(encoder->rfx, quality))
+		goto fail;
+
+	encoder->rfx->mode = mode;
+	rfx_context_set_pixel_format(encoder->rfx, encoder->format);
+	return encoder;
+fail:
+	shadow_share_encoder_free(encoder);
+	return NULL;
+}
+
+static rdpShadowShareEncoder* shadow_share_get_encoder(rdpShadowShare* share,
+        RLGR_MODE mode, UINT32 quality, BYTE* pSrcData, int nSrcStep, UINT32 width, UINT32 height,
+        UINT32 maxDataSize)
+{
+	int index;
+	int count;
+	rdpShadowShareEncoder* encoder;
+	count = ArrayList_Count(share->encoders);
+
+	for (index = 0; index < count; index++)
+	{
+		encoder = (rdpShadowShareEncoder*) ArrayList_GetItem(share->encoders, index);
+
+		if ((encoder->mode == mode) && (encoder->quality == quality) &&
+		    (encoder->pSrcData == pSrcData) &&
+		    (encoder->nSrcStep == nSrcStep) && (encoder->width == width) &&
+		    (encoder->height == height) && (encoder->maxDataSize == maxDataSize))
+			return encoder;
+	}
+
+	encoder = shadow_share_encoder_new(share->server, mode, quality, pSrcData, nSrcStep,
+	                                   width, height, maxDataSize);
+
+	if (!encoder)
+		return NULL;
+
+	if (ArrayList_Add(share->encoders, encoder) < 0)
+	{
+		shadow_share_encoder_free(encoder);
+		return NULL;
+	}
+
+	WLog_DBG(TAG, "new shared encoder %lux%lu mode %d quality %lu (%d configurations)",
+	         (unsigned long) width, (unsigned long) height, (int) mode, (unsigned long) quality,
+	         ArrayList_Count(share->encoders));
+	return encoder;
+}
+
+static void shadow_share_frame_free(rdpShadowShareFrame* frame)
+{
+	int i;
+	RFX_RECT* messageRects = NULL;
+	rdpShadowShareEncoder* encoder = frame->encoder;
+
+	if (frame->messages)
+	{
+		if (frame->numMessages > 0)
+			messageRects = frame->messages[0].rects;
+
+		EnterCriticalSection(&encoder->lock);
+
+		for (i = 0; i < frame->numMessages; i++)
+			rfx_message_free(encoder->rfx, &frame->messages[i]);
+
+		LeaveCriticalSection(&encoder->lock);
+		free(messageRects);
+		free(frame->messages);
+	}
+
+	if (frame->event)
+		CloseHandle(frame->event);
+
+	free(frame->rects);
+	free(frame);
+	/* last, the encoder may be pruned as soon as this drops to zero */
+	InterlockedDecrement(&encoder->refCount);
+}
+
+void shadow_share_frame_release(rdpShadowShareFrame* frame)
+{
+	if (!frame)
+		return;
+
+	if (InterlockedDecrement(&frame->refCount) == 0)
+		shadow_share_frame_free(frame);
+}
+
+static rdpShadowShareFrame* shadow_share_find_frame(rdpShadowShare* share,
+        rdpShadowShareEncoder* encoder, const RFX_RECT* rects, UINT32 numRects)
+{
+	rdpShadowShareFrame* frame;
+
+	for (frame = share->frames; frame; frame = frame->next)
+	{
+		if ((frame->encoder == encoder) && (frame->numRects == numRects) &&
+		    (memcmp(frame->rects, rects, numRects * sizeof(RFX_RECT)) == 0))
+			return frame;
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns the RemoteFX messages for the given rectangles of a surface.
+ * The first caller of a frame encodes it, concurrent and later callers
+ * with the same configuration wait for and reuse that result until
+ * shadow_share_next_frame() is called. The messages carry no per
+ * connection state: callers serialize them with their own context so
+ * that codec headers and frame acknowledgement stay per client.
+ * Clients the rate control put on different quality levels do not share.
+ * The returned frame must be released with shadow_share_frame_release().
+ */
+rdpShadowShareFrame* shadow_share_encode_rfx(rdpShadowShare* share, RLGR_MODE mode,
+        UINT32 quality, BYTE* pSrcData, int nSrcStep, UINT32 width, UINT32 height,
+        const RFX_RECT* rects, UINT32 numRects, UINT32 maxDataSize)
+{
+	rdpShadowShareFrame* frame;
+	rdpShadowShareEncoder* encoder;
+
+	if (!share || !pSrcData || !rects || !numRects)
+		return NULL;
+
+	EnterCriticalSection(&share->lock);
+	encoder = shadow_share_get_encoder(share, mode, quality, pSrcData, nSrcStep, width,
+	                                   height, maxDataSize);
+
+	if (!encoder)
+	{
+		LeaveCriticalSection(&share->lock);
+		return NULL;
+	}
+
+	encoder->lastUsed = share->generation;
+	frame = shadow_share_find_frame(share, encoder, rects, numRects);
+
+	if (frame)
+	{
+		InterlockedIncrement(&frame->refCount);
+		share->framesShared++;
+		LeaveCriticalSection(&share->lock);
+		WaitForSingleObject(frame->event, INFINITE);
+
+		if (!frame->messages)
+		{
+			shadow_share_frame_release(frame);
+			return NULL;
+		}
+
+		return frame;
+	}
+
+	frame = (rdpShadowShareFrame*) calloc(1, sizeof(rdpShadowShareFrame));
+
+	if (!frame)
+		goto fail;
+
+	frame->encoder = encoder;
+	InterlockedIncrement(&encoder->refCount);
+	frame->numRects = numRects;
+
+	if (!(frame->rects = (RFX_RECT*) calloc(numRects, sizeof(RFX_RECT))))
+		goto fail;
+
+	CopyMemory(frame->rects, rects, numRects * sizeof(RFX_RECT));
+
+	if (!(frame->event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto fail;
+
+	/* one reference for the frame list, one for the caller */
+	frame->refCount = 2;
+	frame->next = share->frames;
+	share->frames = frame;
+	share->framesEncoded++;
+	LeaveCriticalSection(&share->lock);
+	EnterCriticalSection(&encoder->lock);
+	frame->messages = rfx_encode_messages(encoder->rfx, rects, numRects, pSrcData,
+	                                      width, height, nSrcStep, &frame->numMessages, maxDataSize);
+	LeaveCriticalSection(&encoder->lock);
+	SetEvent(frame->event);
+
+	if (!frame->messages)
+	{
+		WLog_ERR(TAG, "rfx_encode_messages failed");
+		shadow_share_frame_release(frame);
+		return NULL;
+	}
+
+	return frame;
+fail:
+	LeaveCriticalSection(&share->lock);
+
+	if (frame)
+		shadow_share_frame_free(frame);
+
+	return NULL;
+}
+
+/**
+ * Called by the subsystem before it publishes a new frame. Results of the
+ * previous frame are no longer handed out, clients still sending them
+ * keep their own reference.
+ */
+void shadow_share_next_frame(rdpShadowShare* share)
+{
+	int index;
+	rdpShadowShareFrame* frame;
+	rdpShadowShareFrame* frames;
+	rdpShadowShareEncoder* encoder;
+
+	if (!share)
+		return;
+
+	EnterCriticalSection(&share->lock);
+	frames = share->frames;
+	share->frames = NULL;
+	share->generation++;
+
+	for (index = ArrayList_Count(share->encoders) - 1; index >= 0; index--)
+	{
+		encoder = (rdpShadowShareEncoder*) ArrayList_GetItem(share->encoders, index);
+
+		if ((encoder->refCount == 0) &&
+		    ((share->generation - encoder->lastUsed) > SHADOW_SHARE_IDLE_FRAMES))
+			ArrayList_RemoveAt(share->encoders, index);
+	}
+
+	LeaveCriticalSection(&share->lock);
+
+	while (frames)
+	{
+		frame = frames;
+		frames = frame->next;
+		shadow_share_frame_release(frame);
+	}
+}
+
+rdpShadowShare* shadow_share_new(rdpShadowServer* server)
+{
+	rdpShadowShare* share;
+	share = (rdpShadowShare*) calloc(1, sizeof(rdpShadowShare));
+
+	if (!share)
+		return NULL;
+
+	share->server = server;
+
+	if (!InitializeCriticalSectionAndSpinCount(&share->lock, 4000))
+	{
+		free(share);
+		return NULL;
+	}
+
+	if (!(share->encoders = ArrayList_New(FALSE)))
+	{
+		DeleteCriticalSection(&share->lock);
+		free(share);
+		return NULL;
+	}
+
+	ArrayList_Object(share->encoders)->fnObjectFree =
+	    (OBJECT_FREE_FN) shadow_share_encoder_free;
+	return share;
+}
+
+void shadow_share_free(rdpShadowShare* share)
+{
+	if (!share)
+		return;
+
+	shadow_share_next_frame(share);
+	WLog_DBG(TAG, "encoded %lu frames, shared %lu",
+	         (unsigned long) share->framesEncoded, (unsigned long) share->framesShared);
+	ArrayList_Free(share->encoders);
+	DeleteCriticalSection(&share->lock);
+	free(share);
+}
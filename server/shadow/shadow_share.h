@@ -0,0 +1,81 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SHADOW_SERVER_SHARE_H
+#define FREERDP_SHADOW_SERVER_SHARE_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/codec/rfx.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/collections.h>
+
+typedef struct rdp_shadow_share_encoder rdpShadowShareEncoder;
+typedef struct rdp_shadow_share_frame rdpShadowShareFrame;
+
+/**
+ * Encoded output of one update, shared by every client that sends the
+ * same rectangles of the same surface with the same configuration.
+ * The messages are owned by the frame and must not be freed by clients.
+ */
+struct rdp_shadow_share_frame
+{
+	rdpShadowShareEncoder* encoder;
+	rdpShadowShareFrame* next;
+	volatile LONG refCount;
+	HANDLE event;
+
+	RFX_RECT* rects;
+	UINT32 numRects;
+
+	RFX_MESSAGE* messages;
+	int numMessages;
+};
+
+struct rdp_shadow_share
+{
+	rdpShadowServer* server;
+
+	UINT64 generation;
+	wArrayList* encoders;
+	rdpShadowShareFrame* frames;
+
+	UINT64 framesEncoded;
+	UINT64 framesShared;
+
+	CRITICAL_SECTION lock;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+rdpShadowShareFrame* shadow_share_encode_rfx(rdpShadowShare* share, RLGR_MODE mode,
+        UINT32 quality, BYTE* pSrcData, int nSrcStep, UINT32 width, UINT32 height,
+        const RFX_RECT* rects, UINT32 numRects, UINT32 maxDataSize);
+void shadow_share_frame_release(rdpShadowShareFrame* frame);
+
+void shadow_share_next_frame(rdpShadowShare* share);
+
+rdpShadowShare* shadow_share_new(rdpShadowServer* server);
+void shadow_share_free(rdpShadowShare* share);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SHADOW_SERVER_SHARE_H */
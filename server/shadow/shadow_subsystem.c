@@ -269,5 +269,8 @@ int shadow_subsystem_pointer_convert_alpha_pointer_data(BYTE* pixels, BOOL premu
 
 void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem)
 {
+	if (subsystem->server)
+		shadow_share_next_frame(subsystem->server->share);
+
 	shadow_multiclient_publish_and_wait(subsystem->updateEvent);
 }
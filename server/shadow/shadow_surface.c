@@ -99,6 +99,7 @@ BOOL shadow_surface_resize(rdpShadowSurface* surface, int x, int y, int width,
 		surface->height = height;
 		surface->scanline = scanline;
 		surface->data = buffer;
+		surface->moved = FALSE;
 		return TRUE;
 	}
 
@@ -41,6 +41,8 @@ struct _wStream
 
 	DWORD count;
 	wStreamPool* pool;
+	size_t poolIndex;
+	struct _wStream* poolNext;
 };
 typedef struct _wStream wStream;
 
@@ -325,11 +327,12 @@ static INLINE BOOL Stream_SafeSeek(wStream* s, size_t size) {
 
 /* StreamPool */
 
+#define STREAM_POOL_SIZE_CLASSES	31
+
 struct _wStreamPool
 {
 	int aSize;
-	int aCapacity;
-	wStream** aArray;
+	wStream* aClasses[STREAM_POOL_SIZE_CLASSES];
 
 	int uSize;
 	int uCapacity;
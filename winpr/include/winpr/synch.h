@@ -378,6 +378,7 @@ WINPR_API HANDLE CreateWaitObjectEvent(LPSECURITY_ATTRIBUTES lpEventAttributes,
 
 WINPR_API int GetEventFileDescriptor(HANDLE hEvent);
 WINPR_API int SetEventFileDescriptor(HANDLE hEvent, int FileDescriptor, ULONG mode);
+WINPR_API ULONG GetEventFileDescriptorMode(HANDLE hEvent);
 
 WINPR_API void* GetEventWaitObject(HANDLE hEvent);
 
@@ -24,6 +24,9 @@
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/library.h>
+#include <winpr/interlocked.h>
+
+#include <errno.h>
 
 #include "pool.h"
 
@@ -50,48 +53,197 @@ static BOOL CALLBACK init_module(PINIT_ONCE once, PVOID param, PVOID *context)
 }
 #endif
 
-static TP_POOL DEFAULT_POOL =
+/* set up by InitializeThreadpool on first use */
+static TP_POOL DEFAULT_POOL;
+
+static BOOL thread_pool_park_init(PTP_POOL pool)
 {
-	0,    /* DWORD Minimum */
-	500,  /* DWORD Maximum */
-	NULL, /* wArrayList* Threads */
-	NULL, /* wQueue* PendingQueue */
-	NULL, /* HANDLE TerminateEvent */
-	NULL, /* wCountdownEvent* WorkComplete */
-};
+#if defined(_WIN32)
+	pool->Park = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	return (pool->Park != NULL);
+#elif defined(__APPLE__)
+	return (semaphore_create(mach_task_self(), &pool->Park, SYNC_POLICY_FIFO, 0) == KERN_SUCCESS);
+#else
+	return (sem_init(&pool->Park, 0, 0) == 0);
+#endif
+}
 
-static void* thread_pool_work_func(void* arg)
+static void thread_pool_park_uninit(PTP_POOL pool)
 {
-	DWORD status;
-	PTP_POOL pool;
-	PTP_WORK work;
-	HANDLE events[2];
-	PTP_CALLBACK_INSTANCE callbackInstance;
+#if defined(_WIN32)
+	CloseHandle(pool->Park);
+	pool->Park = NULL;
+#elif defined(__APPLE__)
+	semaphore_destroy(mach_task_self(), pool->Park);
+#else
+	sem_destroy(&pool->Park);
+#endif
+}
 
-	pool = (PTP_POOL) arg;
+static void thread_pool_park_wait(PTP_POOL pool)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(pool->Park, INFINITE);
+#elif defined(__APPLE__)
+	semaphore_wait(pool->Park);
+#else
+	while ((sem_wait(&pool->Park) != 0) && (errno == EINTR));
+#endif
+}
 
-	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+static void thread_pool_park_post(PTP_POOL pool, int count)
+{
+	while (count-- > 0)
+	{
+#if defined(_WIN32)
+		ReleaseSemaphore(pool->Park, 1, NULL);
+#elif defined(__APPLE__)
+		semaphore_signal(pool->Park);
+#else
+		sem_post(&pool->Park);
+#endif
+	}
+}
 
-	while (1)
+static BOOL thread_pool_queue_push(TP_WORK_QUEUE* queue, PTP_WORK work)
+{
+	DWORD index;
+	DWORD capacity;
+	PTP_WORK* items;
+
+	EnterCriticalSection(&queue->Lock);
+
+	if ((DWORD) queue->Count == queue->Capacity)
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		capacity = queue->Capacity ? queue->Capacity * 2 : 64;
 
-		if (status == WAIT_OBJECT_0)
-			break;
+		if (!(items = (PTP_WORK*) calloc(capacity, sizeof(PTP_WORK))))
+		{
+			LeaveCriticalSection(&queue->Lock);
+			return FALSE;
+		}
+
+		for (index = 0; index < (DWORD) queue->Count; index++)
+			items[index] = queue->Items[(queue->Head + index) & (queue->Capacity - 1)];
+
+		free(queue->Items);
+		queue->Items = items;
+		queue->Capacity = capacity;
+		queue->Head = 0;
+	}
+
+	queue->Items[(queue->Head + queue->Count) & (queue->Capacity - 1)] = work;
+	queue->Count++;
+	LeaveCriticalSection(&queue->Lock);
+	return TRUE;
+}
+
+static PTP_WORK thread_pool_queue_pop(TP_WORK_QUEUE* queue)
+{
+	PTP_WORK work = NULL;
+
+	/* unlocked peek, the caller looks again before it sleeps */
+	if (queue->Count < 1)
+		return NULL;
 
-		if (status != (WAIT_OBJECT_0 + 1))
+	EnterCriticalSection(&queue->Lock);
+
+	if (queue->Count > 0)
+	{
+		work = queue->Items[queue->Head];
+		queue->Head = (queue->Head + 1) & (queue->Capacity - 1);
+		queue->Count--;
+	}
+
+	LeaveCriticalSection(&queue->Lock);
+	return work;
+}
+
+/**
+ * Takes work from the own queue first, then steals from the others.
+ */
+static PTP_WORK thread_pool_next_work(PTP_POOL pool, LONG home)
+{
+	LONG index;
+	LONG numQueues;
+	PTP_WORK work;
+	numQueues = pool->NumQueues;
+
+	for (index = 0; index < numQueues; index++)
+	{
+		if ((work = thread_pool_queue_pop(&pool->Queues[(home + index) % numQueues])))
+		{
+			InterlockedDecrement(&pool->Pending);
+			return work;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Wakes one sleeping worker, if any. A worker is claimed by taking it off
+ * the Sleeping count, so each claim is matched by exactly one post and
+ * submitting to a busy pool costs no system call.
+ */
+static void thread_pool_wake(PTP_POOL pool)
+{
+	LONG sleeping;
+
+	while ((sleeping = InterlockedCompareExchange(&pool->Sleeping, 0, 0)) > 0)
+	{
+		if (InterlockedCompareExchange(&pool->Sleeping, sleeping - 1, sleeping) == sleeping)
+		{
+			thread_pool_park_post(pool, 1);
 			break;
+		}
+	}
+}
+
+static void thread_pool_park(PTP_POOL pool)
+{
+	LONG sleeping;
+	InterlockedIncrement(&pool->Sleeping);
+
+	/* either a submitter sees this worker sleeping or it sees the work */
+	if ((InterlockedCompareExchange(&pool->Pending, 0, 0) == 0) && !pool->Terminate)
+	{
+		thread_pool_park_wait(pool);
+		return;
+	}
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE) Queue_Dequeue(pool->PendingQueue);
+	while ((sleeping = InterlockedCompareExchange(&pool->Sleeping, 0, 0)) > 0)
+	{
+		if (InterlockedCompareExchange(&pool->Sleeping, sleeping - 1, sleeping) == sleeping)
+			return;
+	}
+
+	/* a submitter claimed this worker already, consume its post */
+	thread_pool_park_wait(pool);
+}
+
+static void* thread_pool_work_func(void* arg)
+{
+	LONG home;
+	PTP_POOL pool;
+	PTP_WORK work;
+	TP_CALLBACK_INSTANCE callbackInstance;
 
-		if (callbackInstance)
+	pool = (PTP_POOL) arg;
+	home = (InterlockedIncrement(&pool->NextWorker) - 1) % TP_POOL_MAX_QUEUES;
+
+	while (!pool->Terminate)
+	{
+		if (!(work = thread_pool_next_work(pool, home)))
 		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+			thread_pool_park(pool);
+			continue;
 		}
+
+		callbackInstance.Work = work;
+		work->WorkCallback(&callbackInstance, work->CallbackParameter, work);
+		/* last access to the work, its owner may close it once signaled */
+		CountdownEvent_Signal(work->WorkComplete, 1);
 	}
 
 	ExitThread(0);
@@ -104,62 +256,116 @@ static void threads_close(void *thread)
 	CloseHandle(thread);
 }
 
+/**
+ * Starts one more worker. Each worker gets a queue of its own up to
+ * TP_POOL_MAX_QUEUES, the queue is published once the worker runs.
+ */
+static BOOL thread_pool_add_thread(PTP_POOL pool)
+{
+	HANDLE thread;
+	TP_WORK_QUEUE* queue = NULL;
+
+	if (pool->NumQueues < TP_POOL_MAX_QUEUES)
+	{
+		queue = &pool->Queues[pool->NumQueues];
+		ZeroMemory(queue, sizeof(TP_WORK_QUEUE));
+
+		if (!InitializeCriticalSectionAndSpinCount(&queue->Lock, 4000))
+			return FALSE;
+	}
+
+	if (!(thread = CreateThread(NULL, 0,
+				(LPTHREAD_START_ROUTINE) thread_pool_work_func,
+				(void*) pool, 0, NULL)))
+	{
+		if (queue)
+			DeleteCriticalSection(&queue->Lock);
+
+		return FALSE;
+	}
+
+	if (queue)
+		InterlockedIncrement(&pool->NumQueues);
+
+	if (ArrayList_Add(pool->Threads, thread) < 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static void thread_pool_stop(PTP_POOL pool)
+{
+	LONG index;
+	InterlockedExchange(&pool->Terminate, TRUE);
+	thread_pool_park_post(pool, ArrayList_Count(pool->Threads));
+	ArrayList_Free(pool->Threads);
+	pool->Threads = NULL;
+
+	for (index = 0; index < pool->NumQueues; index++)
+	{
+		DeleteCriticalSection(&pool->Queues[index].Lock);
+		free(pool->Queues[index].Items);
+	}
+
+	pool->NumQueues = 0;
+	thread_pool_park_uninit(pool);
+}
+
 static BOOL InitializeThreadpool(PTP_POOL pool)
 {
 	int index;
-	HANDLE thread;
 
 	if (pool->Threads)
 		return TRUE;
 
 	pool->Minimum = 0;
 	pool->Maximum = 500;
+	pool->NumQueues = 0;
+	pool->NextQueue = 0;
+	pool->NextWorker = 0;
+	pool->Pending = 0;
+	pool->Sleeping = 0;
+	pool->Terminate = FALSE;
 
-	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
-		goto fail_queue_new;
-
-	if (!(pool->WorkComplete = CountdownEvent_New(0)))
-		goto fail_countdown_event;
-
-	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
-		goto fail_terminate_event;
+	if (!thread_pool_park_init(pool))
+		return FALSE;
 
 	if (!(pool->Threads = ArrayList_New(TRUE)))
-		goto fail_thread_array;
+	{
+		thread_pool_park_uninit(pool);
+		return FALSE;
+	}
 
 	pool->Threads->object.fnObjectFree = threads_close;
 
 	for (index = 0; index < 4; index++)
 	{
-		if (!(thread = CreateThread(NULL, 0,
-					(LPTHREAD_START_ROUTINE) thread_pool_work_func,
-					(void*) pool, 0, NULL)))
+		if (!thread_pool_add_thread(pool))
 		{
-			goto fail_create_threads;
+			thread_pool_stop(pool);
+			return FALSE;
 		}
-
-		if (ArrayList_Add(pool->Threads, thread) < 0)
-			goto fail_create_threads;
 	}
 
 	return TRUE;
+}
 
-fail_create_threads:
-	SetEvent(pool->TerminateEvent);
-	ArrayList_Free(pool->Threads);
-	pool->Threads = NULL;
-fail_thread_array:
-	CloseHandle(pool->TerminateEvent);
-	pool->TerminateEvent = NULL;
-fail_terminate_event:
-	CountdownEvent_Free(pool->WorkComplete);
-	pool->WorkComplete = NULL;
-fail_countdown_event:
-	Queue_Free(pool->PendingQueue);
-	pool->WorkComplete = NULL;
-fail_queue_new:
-
-	return FALSE;
+/**
+ * Queues work on the pool. Submitters spread the work round robin over the
+ * worker queues and wake a worker only if one sleeps, so a burst of work
+ * items neither serializes on one lock nor signals per item.
+ */
+BOOL EnqueueThreadpoolWork(PTP_POOL pool, PTP_WORK work)
+{
+	DWORD index;
+	index = ((DWORD) InterlockedIncrement(&pool->NextQueue)) % (DWORD) pool->NumQueues;
+
+	if (!thread_pool_queue_push(&pool->Queues[index], work))
+		return FALSE;
+
+	InterlockedIncrement(&pool->Pending);
+	thread_pool_wake(pool);
+	return TRUE;
 }
 
 PTP_POOL GetDefaultThreadpool()
@@ -204,29 +410,14 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
-
-	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
-	CountdownEvent_Free(ptpp->WorkComplete);
-	CloseHandle(ptpp->TerminateEvent);
+	thread_pool_stop(ptpp);
 
-	if (ptpp == &DEFAULT_POOL)
-	{
-		ptpp->Threads = NULL;
-		ptpp->PendingQueue = NULL;
-		ptpp->WorkComplete = NULL;
-		ptpp->TerminateEvent = NULL;
-	}
-	else
-	{
+	if (ptpp != &DEFAULT_POOL)
 		free(ptpp);
-	}
 }
 
 BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 {
-	HANDLE thread;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSetThreadpoolThreadMinimum)
@@ -236,14 +427,7 @@ BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 
 	while (ArrayList_Count(ptpp->Threads) < ptpp->Minimum)
 	{
-		if (!(thread = CreateThread(NULL, 0,
-				(LPTHREAD_START_ROUTINE) thread_pool_work_func,
-				(void*) ptpp, 0, NULL)))
-		{
-			return FALSE;
-		}
-
-		if (ArrayList_Add(ptpp->Threads, thread) < 0)
+		if (!thread_pool_add_thread(ptpp))
 			return FALSE;
 	}
 
@@ -25,19 +25,49 @@
 #include <winpr/thread.h>
 #include <winpr/collections.h>
 
+#ifndef _WIN32
+#include "../synch/synch.h"
+#endif
+
+/* number of work queues, workers beyond that share queues */
+#define TP_POOL_MAX_QUEUES	64
+
 struct _TP_CALLBACK_INSTANCE
 {
 	PTP_WORK Work;
 };
 
+/**
+ * Work queue of one worker thread. Idle workers steal from the queues of
+ * the others, so that workers only meet on the same lock when stealing.
+ */
+struct _TP_WORK_QUEUE
+{
+	CRITICAL_SECTION Lock;
+	PTP_WORK* Items;
+	DWORD Capacity;
+	DWORD Head;
+	volatile LONG Count;
+};
+typedef struct _TP_WORK_QUEUE TP_WORK_QUEUE;
+
 struct _TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
 	wArrayList* Threads;
-	wQueue* PendingQueue;
-	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	TP_WORK_QUEUE Queues[TP_POOL_MAX_QUEUES];
+	volatile LONG NumQueues;
+	volatile LONG NextQueue;
+	volatile LONG NextWorker;
+	volatile LONG Pending;
+	volatile LONG Sleeping;
+	volatile LONG Terminate;
+#ifdef _WIN32
+	HANDLE Park;
+#else
+	winpr_sem_t Park;
+#endif
 };
 
 struct _TP_WORK
@@ -45,6 +75,7 @@ struct _TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	wCountdownEvent* WorkComplete;
 };
 
 struct _TP_TIMER
@@ -68,6 +99,7 @@ struct _TP_CLEANUP_GROUP
 };
 
 PTP_POOL GetDefaultThreadpool();
+BOOL EnqueueThreadpoolWork(PTP_POOL pool, PTP_WORK work);
 
 #endif /* WINPR_POOL_PRIVATE_H */
 
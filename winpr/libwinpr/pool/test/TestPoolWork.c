@@ -27,6 +27,169 @@ void CALLBACK test_WorkCallback(PTP_CALLBACK_INSTANCE instance, void* context, P
 	}
 }
 
+void CALLBACK test_BlockingCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	WaitForSingleObject((HANDLE) context, INFINITE);
+}
+
+/**
+ * WaitForThreadpoolWorkCallbacks only waits for the callbacks of the given
+ * work object, not for other work running on the same pool.
+ */
+static BOOL test_WorkWaitIsPerWork(void)
+{
+	BOOL rc = FALSE;
+	HANDLE event;
+	PTP_WORK blocking = NULL;
+	PTP_WORK work = NULL;
+
+	if (!(event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	blocking = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_BlockingCallback, event, NULL);
+	work = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_WorkCallback, "wait", NULL);
+
+	if (!blocking || !work)
+	{
+		printf("CreateThreadpoolWork failure\n");
+		goto fail;
+	}
+
+	SubmitThreadpoolWork(blocking);
+	SubmitThreadpoolWork(work);
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+
+	if (WaitForSingleObject(event, 0) == WAIT_OBJECT_0)
+	{
+		printf("WaitForThreadpoolWorkCallbacks waited for other work\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	SetEvent(event);
+
+	if (blocking)
+	{
+		WaitForThreadpoolWorkCallbacks(blocking, FALSE);
+		CloseThreadpoolWork(blocking);
+	}
+
+	if (work)
+		CloseThreadpoolWork(work);
+
+	CloseHandle(event);
+	return rc;
+}
+
+#define TEST_MANY_WORK	2048
+
+void CALLBACK test_CountCallback(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	InterlockedIncrement((LONG*) context);
+}
+
+/**
+ * Submits one work item per 64x64 tile of a 4K frame, each waited for on
+ * its own, and one work object many times, as the codecs do.
+ */
+static BOOL test_ManyWork(PTP_CALLBACK_ENVIRON environment)
+{
+	int index;
+	BOOL rc = FALSE;
+	LONG counts[TEST_MANY_WORK];
+	LONG repeated = 0;
+	PTP_WORK work[TEST_MANY_WORK];
+
+	ZeroMemory(counts, sizeof(counts));
+	ZeroMemory(work, sizeof(work));
+
+	for (index = 0; index < TEST_MANY_WORK; index++)
+	{
+		if (!(work[index] = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_CountCallback,
+		                    &counts[index], environment)))
+		{
+			printf("CreateThreadpoolWork failure\n");
+			goto fail;
+		}
+	}
+
+	for (index = 0; index < TEST_MANY_WORK; index++)
+		SubmitThreadpoolWork(work[index]);
+
+	for (index = 0; index < TEST_MANY_WORK; index++)
+	{
+		WaitForThreadpoolWorkCallbacks(work[index], FALSE);
+
+		if (counts[index] != 1)
+		{
+			printf("work %d ran %d times\n", index, (int) counts[index]);
+			goto fail;
+		}
+	}
+
+	CloseThreadpoolWork(work[0]);
+
+	if (!(work[0] = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_CountCallback,
+	                &repeated, environment)))
+	{
+		printf("CreateThreadpoolWork failure\n");
+		goto fail;
+	}
+
+	for (index = 0; index < TEST_MANY_WORK; index++)
+		SubmitThreadpoolWork(work[0]);
+
+	WaitForThreadpoolWorkCallbacks(work[0], FALSE);
+
+	if (repeated != TEST_MANY_WORK)
+	{
+		printf("repeated work ran %d times\n", (int) repeated);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < TEST_MANY_WORK; index++)
+	{
+		if (work[index])
+			CloseThreadpoolWork(work[index]);
+	}
+
+	return rc;
+}
+
+/**
+ * Closing a work object with callbacks still queued waits for them.
+ */
+static BOOL test_CloseWaitsForCallbacks(void)
+{
+	int index;
+	LONG calls = 0;
+	PTP_WORK work;
+
+	if (!(work = CreateThreadpoolWork((PTP_WORK_CALLBACK) test_CountCallback, &calls, NULL)))
+	{
+		printf("CreateThreadpoolWork failure\n");
+		return FALSE;
+	}
+
+	for (index = 0; index < TEST_MANY_WORK; index++)
+		SubmitThreadpoolWork(work);
+
+	CloseThreadpoolWork(work);
+
+	if (calls != TEST_MANY_WORK)
+	{
+		printf("CloseThreadpoolWork returned after %d of %d callbacks\n", (int) calls,
+		       TEST_MANY_WORK);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 int TestPoolWork(int argc, char* argv[])
 {
 	int index;
@@ -56,6 +219,15 @@ int TestPoolWork(int argc, char* argv[])
 	WaitForThreadpoolWorkCallbacks(work, FALSE);
 	CloseThreadpoolWork(work);
 
+	if (!test_WorkWaitIsPerWork())
+		return -1;
+
+	if (!test_ManyWork(NULL))
+		return -1;
+
+	if (!test_CloseWaitsForCallbacks())
+		return -1;
+
 	printf("Private Thread Pool\n");
 
 	if (!(pool = CreateThreadpool(NULL)))
@@ -75,6 +247,9 @@ int TestPoolWork(int argc, char* argv[])
 	InitializeThreadpoolEnvironment(&environment);
 	SetThreadpoolCallbackPool(&environment, pool);
 
+	if (!test_ManyWork(&environment))
+		return -1;
+
 	cleanupGroup = CreateThreadpoolCleanupGroup();
 
 	if (!cleanupGroup)
@@ -86,6 +86,13 @@ PTP_WORK winpr_CreateThreadpoolWork(PTP_WORK_CALLBACK pfnwk, PVOID pv, PTP_CALLB
 		work->CallbackEnvironment = pcbe;
 		work->WorkCallback = pfnwk;
 		work->CallbackParameter = pv;
+
+		/* callbacks of this work only, the pool may run work of others */
+		if (!(work->WorkComplete = CountdownEvent_New(0)))
+		{
+			free(work);
+			return NULL;
+		}
 	}
 
 	return work;
@@ -101,13 +108,19 @@ VOID winpr_CloseThreadpoolWork(PTP_WORK pwk)
 		return;
 	}
 #endif
+	/* outstanding callbacks still use the work, wait until they are done */
+	if (WaitForSingleObject(CountdownEvent_WaitHandle(pwk->WorkComplete), INFINITE) != WAIT_OBJECT_0)
+		WLog_ERR(TAG, "error waiting on work completion");
+
+	/* the last callback sets the event holding the countdown lock, let it leave */
+	CountdownEvent_AddCount(pwk->WorkComplete, 0);
+	CountdownEvent_Free(pwk->WorkComplete);
 	free(pwk);
 }
 
 VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 {
 	PTP_POOL pool;
-	PTP_CALLBACK_INSTANCE callbackInstance;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSubmitThreadpoolWork)
@@ -117,13 +130,12 @@ VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 	}
 #endif
 	pool = pwk->CallbackEnvironment->Pool;
-	callbackInstance = (PTP_CALLBACK_INSTANCE) malloc(sizeof(TP_CALLBACK_INSTANCE));
+	CountdownEvent_AddCount(pwk->WorkComplete, 1);
 
-	if (callbackInstance)
+	if (!EnqueueThreadpoolWork(pool, pwk))
 	{
-		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		Queue_Enqueue(pool->PendingQueue, callbackInstance);
+		WLog_ERR(TAG, "failed to queue work");
+		CountdownEvent_Signal(pwk->WorkComplete, 1);
 	}
 }
 
@@ -141,7 +153,6 @@ BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_C
 VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallbacks)
 {
 	HANDLE event;
-	PTP_POOL pool;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pWaitForThreadpoolWorkCallbacks)
@@ -150,8 +161,7 @@ VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallb
 		return;
 	}
 #endif
-	pool = pwk->CallbackEnvironment->Pool;
-	event = CountdownEvent_WaitHandle(pool->WorkComplete);
+	event = CountdownEvent_WaitHandle(pwk->WorkComplete);
 
 	if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)
 		WLog_ERR(TAG, "error waiting on work completion");
@@ -348,6 +348,26 @@ int GetEventFileDescriptor(HANDLE hEvent)
 #endif
 }
 
+/*
+ * Returns the WINPR_FD_READ / WINPR_FD_WRITE mode the inner file
+ * descriptor is waited on with, 0 if there is none
+ */
+
+ULONG GetEventFileDescriptorMode(HANDLE hEvent)
+{
+#ifndef _WIN32
+	ULONG Type;
+	WINPR_HANDLE* Object;
+
+	if (!winpr_Handle_GetInfo(hEvent, &Type, &Object))
+		return 0;
+
+	return Object->Mode;
+#else
+	return 0;
+#endif
+}
+
 /*
  * Set inner file descriptor for usage with select()
  * This file descriptor is not usable on Windows
@@ -91,11 +91,12 @@ void CountdownEvent_AddCount(wCountdownEvent* countdown, DWORD signalCount)
 {
 	EnterCriticalSection(&countdown->lock);
 
-	countdown->count += signalCount;
-
-	if (countdown->count > 0)
+	/* the event is set exactly while the count is zero, only touch it on a change */
+	if ((countdown->count == 0) && (signalCount > 0))
 		ResetEvent(countdown->event);
 
+	countdown->count += signalCount;
+
 	LeaveCriticalSection(&countdown->lock);
 }
 
@@ -113,7 +114,7 @@ BOOL CountdownEvent_Signal(wCountdownEvent* countdown, DWORD signalCount)
 
 	EnterCriticalSection(&countdown->lock);
 
-	if (WaitForSingleObject(countdown->event, 0) == WAIT_OBJECT_0)
+	if (countdown->count == 0)
 		oldStatus = TRUE;
 
 	if (signalCount <= countdown->count)
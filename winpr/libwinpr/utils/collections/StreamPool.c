@@ -26,115 +26,56 @@
 #include <winpr/collections.h>
 
 /**
- * Methods
+ * Available streams are kept in free lists by size class, class n holding
+ * the streams with a capacity of at least 2^n bytes. New streams are
+ * allocated with the capacity rounded up to the next class so that they
+ * can serve any request of the same class later on. Streams in use are
+ * tracked in an array, each of them knowing its own position, which makes
+ * taking and returning a stream O(1).
  */
 
-void StreamPool_ShiftUsed(wStreamPool* pool, int index, int count)
+static int StreamPool_SizeClass(size_t size)
 {
-	if (count > 0)
-	{
-		if (pool->uSize + count > pool->uCapacity)
-		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->uCapacity * 2;
-			new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->uCapacity = new_cap;
-			pool->uArray = new_arr;
-		}
+	int sizeClass = 0;
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index], (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += count;
-	}
-	else if (count < 0)
-	{
-		if (pool->uSize - index + count > 0)
-		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index - count],
-					(pool->uSize - index + count) * sizeof(wStream*));
-		}
+	while ((size >>= 1) && (sizeClass < (STREAM_POOL_SIZE_CLASSES - 1)))
+		sizeClass++;
 
-		pool->uSize += count;
-	}
+	return sizeClass;
 }
 
-/**
- * Adds a used stream to the pool.
- */
-
-void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
+static BOOL StreamPool_AddUsed(wStreamPool* pool, wStream* s)
 {
-	if ((pool->uSize + 1) >= pool->uCapacity)
+	if (pool->uSize >= pool->uCapacity)
 	{
 		int new_cap;
-		wStream **new_arr;
-
+		wStream** new_arr;
 		new_cap = pool->uCapacity * 2;
 		new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
+
 		if (!new_arr)
-			return;
+			return FALSE;
+
 		pool->uCapacity = new_cap;
 		pool->uArray = new_arr;
 	}
 
+	s->poolIndex = pool->uSize;
 	pool->uArray[(pool->uSize)++] = s;
+	return TRUE;
 }
 
-/**
- * Removes a used stream from the pool.
- */
-
-void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
+static void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
 {
-	int index;
-	BOOL found = FALSE;
+	wStream* last;
+	size_t index = s->poolIndex;
 
-	for (index = 0; index < pool->uSize; index++)
-	{
-		if (pool->uArray[index] == s)
-		{
-			found = TRUE;
-			break;
-		}
-	}
+	if ((index >= (size_t) pool->uSize) || (pool->uArray[index] != s))
+		return;
 
-	if (found)
-		StreamPool_ShiftUsed(pool, index, -1);
-}
-
-void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
-{
-	if (count > 0)
-	{
-		if (pool->aSize + count > pool->aCapacity)
-		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->aCapacity * 2;
-			new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->aCapacity = new_cap;
-			pool->aArray = new_arr;
-		}
-
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index], (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += count;
-	}
-	else if (count < 0)
-	{
-		if (pool->aSize - index + count > 0)
-		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index - count],
-					(pool->aSize - index + count) * sizeof(wStream*));
-		}
-
-		pool->aSize += count;
-	}
+	last = pool->uArray[--(pool->uSize)];
+	pool->uArray[index] = last;
+	last->poolIndex = index;
 }
 
 /**
@@ -144,7 +85,8 @@ void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
 	int index;
-	int foundIndex;
+	int sizeClass;
+	int lastClass;
 	wStream* s = NULL;
 
 	if (pool->synchronized)
@@ -153,39 +95,59 @@ wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 	if (size == 0)
 		size = pool->defaultSize;
 
-	foundIndex = -1;
+	/* only the head of the class below is looked at, it may be large enough */
+	index = StreamPool_SizeClass(size);
+	sizeClass = index;
+
+	if ((((size_t) 1) << sizeClass) < size)
+		sizeClass++;
+
+	lastClass = sizeClass + 1;
 
-	for (index = 0; index < pool->aSize; index++)
+	if (lastClass >= STREAM_POOL_SIZE_CLASSES)
+		lastClass = STREAM_POOL_SIZE_CLASSES - 1;
+
+	for (; index <= lastClass; index++)
 	{
-		s = pool->aArray[index];
+		s = pool->aClasses[index];
 
-		if (Stream_Capacity(s) >= size)
+		if (s && (Stream_Capacity(s) >= size))
 		{
-			foundIndex = index;
+			pool->aClasses[index] = s->poolNext;
+			pool->aSize--;
 			break;
 		}
+
+		s = NULL;
 	}
 
-	if (foundIndex < 0)
+	if (!s)
 	{
+		if (sizeClass < (STREAM_POOL_SIZE_CLASSES - 1))
+			size = ((size_t) 1) << sizeClass;
+
 		s = Stream_New(NULL, size);
+
 		if (!s)
 			goto out_fail;
 	}
 	else
 	{
 		Stream_SetPosition(s, 0);
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
 	}
 
-	if (s)
+	s->pool = pool;
+	s->count = 1;
+	s->poolNext = NULL;
+
+	if (!StreamPool_AddUsed(pool, s))
 	{
-		s->pool = pool;
-		s->count = 1;
-		StreamPool_AddUsed(pool, s);
+		Stream_Free(s, TRUE);
+		s = NULL;
 	}
 
 out_fail:
+
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 
@@ -198,38 +160,17 @@ out_fail:
 
 void StreamPool_Return(wStreamPool* pool, wStream* s)
 {
+	int sizeClass;
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
-	if ((pool->aSize + 1) >= pool->aCapacity)
-	{
-		int new_cap;
-		wStream **new_arr;
-
-		new_cap = pool->aCapacity * 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
-	else if ((pool->aSize + 1) * 3 < pool->aCapacity)
-	{
-		int new_cap;
-		wStream **new_arr;
-
-		new_cap = pool->aCapacity / 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
-
-	pool->aArray[(pool->aSize)++] = s;
 	StreamPool_RemoveUsed(pool, s);
+	sizeClass = StreamPool_SizeClass(Stream_Capacity(s));
+	s->poolNext = pool->aClasses[sizeClass];
+	pool->aClasses[sizeClass] = s;
+	pool->aSize++;
 
-out_fail:
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 }
@@ -347,15 +288,23 @@ void StreamPool_Release(wStreamPool* pool, BYTE* ptr)
 
 void StreamPool_Clear(wStreamPool* pool)
 {
+	int index;
+	wStream* s;
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
-	while (pool->aSize > 0)
+	for (index = 0; index < STREAM_POOL_SIZE_CLASSES; index++)
 	{
-		(pool->aSize)--;
-		Stream_Free(pool->aArray[pool->aSize], TRUE);
+		while ((s = pool->aClasses[index]))
+		{
+			pool->aClasses[index] = s->poolNext;
+			Stream_Free(s, TRUE);
+		}
 	}
 
+	pool->aSize = 0;
+
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 }
@@ -375,23 +324,12 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 		pool->synchronized = synchronized;
 		pool->defaultSize = defaultSize;
 
-		pool->aSize = 0;
-		pool->aCapacity = 32;
-		pool->aArray = (wStream**) calloc(pool->aCapacity, sizeof(wStream*));
-
-		if (!pool->aArray)
-		{
-			free(pool);
-			return NULL;
-		}
-
 		pool->uSize = 0;
 		pool->uCapacity = 32;
 		pool->uArray = (wStream**) calloc(pool->uCapacity, sizeof(wStream*));
 
 		if (!pool->uArray)
 		{
-			free(pool->aArray);
 			free(pool);
 			return NULL;
 		}
@@ -410,7 +348,6 @@ void StreamPool_Free(wStreamPool* pool)
 
 		DeleteCriticalSection(&pool->lock);
 
-		free(pool->aArray);
 		free(pool->uArray);
 
 		free(pool);
@@ -96,6 +96,8 @@ wStream* Stream_New(BYTE* buffer, size_t size)
 
 	s->pool = NULL;
 	s->count = 0;
+	s->poolIndex = 0;
+	s->poolNext = NULL;
 
 	return s;
 }
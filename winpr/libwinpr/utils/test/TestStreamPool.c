@@ -5,11 +5,69 @@
 
 #define BUFFER_SIZE 16384
 
+static BOOL TestStreamPoolSizeClasses(void)
+{
+	BOOL rc = FALSE;
+	wStream* small;
+	wStream* large;
+	wStream* s;
+	wStreamPool* pool;
+
+	pool = StreamPool_New(FALSE, BUFFER_SIZE);
+
+	if (!pool)
+		return FALSE;
+
+	small = StreamPool_Take(pool, 1000);
+	large = StreamPool_Take(pool, 100000);
+
+	if (!small || !large || (Stream_Capacity(small) < 1000) || (Stream_Capacity(large) < 100000))
+		goto fail;
+
+	Stream_Release(small);
+	Stream_Release(large);
+
+	if ((pool->aSize != 2) || (pool->uSize != 0))
+		goto fail;
+
+	/* a request is served from its own size class */
+	s = StreamPool_Take(pool, 900);
+
+	if (s != small)
+		goto fail;
+
+	Stream_Release(s);
+	s = StreamPool_Take(pool, 70000);
+
+	if (s != large)
+		goto fail;
+
+	Stream_Release(s);
+
+	/* a much larger stream is not handed out for a small request */
+	s = StreamPool_Take(pool, 100);
+
+	if ((s == small) || (s == large) || (pool->aSize != 2))
+		goto fail;
+
+	Stream_Release(s);
+	rc = TRUE;
+fail:
+	StreamPool_Free(pool);
+	return rc;
+}
+
 int TestStreamPool(int argc, char* argv[])
 {
 	wStream* s[5];
 	wStreamPool* pool;
 
+	if (!TestStreamPoolSizeClasses())
+	{
+		printf("StreamPool: size classes failed\n");
+		return -1;
+	}
+
 	pool = StreamPool_New(TRUE, BUFFER_SIZE);
 
 	s[0] = StreamPool_Take(pool, 0);